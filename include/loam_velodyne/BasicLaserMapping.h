@@ -35,11 +35,25 @@
 #include "Twist.h"
 #include "CircularBuffer.h"
 #include "time_utils.h"
+#include "VoxelFeatureMap.h"
+#include "IncrementalVoxelFilter.h"
+#include "CubeSpillStore.h"
+#include "CompactPointCloud.h"
+#include "nanoflann_pcl.h"
+#include "OptimizationReport.h"
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <pcl/filters/voxel_grid.h>
 
+#include <Eigen/Geometry>
+
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 namespace loam
 {
 
@@ -74,13 +88,121 @@ typedef struct IMUState2
    };
 } IMUState2;
 
+/** \brief Run time statistics of the laser mapping stages.
+ *
+ * The map maintenance stages (cube shift, local map, map insertion, cube down sizing and surround
+ * map) are measured on the maintenance thread if the map is maintained asynchronously. The frame
+ * time covers the critical path of process() only.
+ */
+struct MappingStageTimes
+{
+   StageTime cubeShift;          ///< shifting the cube grid along with the sensor
+   StageTime localMap;           ///< selecting the map cubes in view and assembling the local map
+   StageTime stackDownsize;      ///< down sizing the feature stack
+   StageTime optimization;       ///< scan to map pose optimization
+   StageTime mapInsertion;       ///< inserting the feature stack into the map cubes
+   StageTime cubeDownsize;       ///< down sizing the map cubes in view
+   StageTime fullResTransform;   ///< transforming the full resolution cloud to the map
+   StageTime surroundMap;        ///< creating the down sized surround map
+   StageTime frame;              ///< total time of a processed frame
+};
+
+/** \brief Size of the map, in memory and spilled to disk. */
+struct MapSize
+{
+   size_t cubes = 0;    ///< number of non-empty cubes
+   size_t points = 0;   ///< number of corner and surface points
+};
+
+/** \brief Run time and map statistics of the laser mapping.
+ *
+ * All counters accumulate over the whole run, except for the memory section, which describes the map
+ * after the last map update. Differences between two snapshots give the statistics of the frames in between.
+ */
+struct MappingStats
+{
+   MappingStageTimes stages;   ///< accumulated run times of the mapping stages
+
+   struct Memory
+   {
+      size_t memoryBytes = 0;    ///< estimated size of the in memory map cubes
+      size_t memoryCubes = 0;    ///< number of non-empty in memory cubes
+      size_t spilledBytes = 0;   ///< size of the cube files on disk
+      size_t spilledCubes = 0;   ///< number of cubes on disk
+      size_t spillCount = 0;     ///< total number of cubes written to disk
+      size_t reloadCount = 0;    ///< total number of cubes read back from disk
+      size_t failedReloads = 0;  ///< total number of cubes that could not be read back (kept in memory only)
+   } memory;
+
+   struct LocalMap
+   {
+      size_t frames = 0;             ///< number of assembled local maps
+      size_t points = 0;             ///< total number of local map points
+      size_t segments = 0;           ///< total number of point segments referenced by the local maps
+      size_t copiedBytes = 0;        ///< total size of the local map points copied out of the map cubes
+      size_t indexAllocations = 0;   ///< memory blocks requested from the system by the kd-tree index builds
+   } localMap;
+
+   struct SurroundMap
+   {
+      size_t maps = 0;            ///< number of generated surround maps
+      size_t skippedMaps = 0;     ///< number of surround maps skipped for lack of demand
+      size_t filteredCubes = 0;   ///< number of cubes down sized for a surround map
+      size_t reusedCubes = 0;     ///< number of unchanged cubes taken from the cache
+      double filterTime = 0;      ///< total time spent down sizing cubes (in seconds)
+   } surroundMap;
+
+   struct FrameBudget
+   {
+      size_t frames = 0;              ///< number of frames processed with a time budget
+      size_t overruns = 0;            ///< number of frames exceeding the time budget
+      double frameBudget = 0;         ///< total frame time budget (in seconds)
+      double frameTime = 0;           ///< total frame time (in seconds)
+      double optimizationBudget = 0;  ///< total time granted to the pose optimization (in seconds)
+      double optimizationTime = 0;    ///< total time spent in the pose optimization (in seconds)
+      size_t plannedIterations = 0;   ///< total number of iterations planned for the pose optimization
+      size_t iterations = 0;          ///< total number of iterations run
+      size_t features = 0;            ///< total number of stack features used per iteration
+      size_t stackFeatures = 0;       ///< total number of stack features available
+   } frameBudget;
+
+   struct FeatureSelection
+   {
+      size_t frames = 0;              ///< number of optimizations narrowed down to the selected features
+      size_t correspondences = 0;     ///< total number of correspondences found in the first iteration
+      size_t selected = 0;            ///< total number of selected correspondences
+      double weakestInformation = 0;  ///< sum of the weakest eigenvalue of the selection relative to all correspondences
+   } featureSelection;
+};
+
+/** \brief Down sized points of one map cube within the surround map.
+ *
+ * The cloud is never modified once created, so consumers may hold on to it (e.g. on another
+ * thread) while the mapping continues. A changed cube gets a new cloud with a new generation.
+ */
+struct SurroundCube
+{
+   uint64_t generation = 0;                           ///< unique id of the cube content
+   pcl::PointCloud<pcl::PointXYZI>::ConstPtr cloud;   ///< down sized cube points
+};
+
 class BasicLaserMapping
 {
 public:
    explicit BasicLaserMapping(const float& scanPeriod = 0.1, const size_t& maxIterations = 10);
+   ~BasicLaserMapping();
 
-   /** \brief Try to process buffered data. */
+   /** \brief Try to process buffered data.
+    *
+    * @return true, if the frame was processed and lastReport() describes it, false if it was stacked
+    */
    bool process(Time const& laserOdometryTime);
+
+   /** \brief The convergence and quality report of the last processed frame, valid until the next call to process(). */
+   const OptimizationReport& lastReport() const { return _report; }
+
+   /** \brief The reports of the most recent processed frames, oldest first (thread safe). */
+   std::vector<OptimizationReport> recentReports() const { return _reportHistory.reports(); }
    void updateIMU(IMUState2 const& newState);
    void updateOdometry(double pitch, double yaw, double roll, double x, double y, double z);
    void updateOdometry(Twist const& twist);
@@ -94,6 +216,67 @@ public:
    void setDeltaTAbort(float val) { _deltaTAbort = val; }
    void setDeltaRAbort(float val) { _deltaRAbort = val; }
 
+   /** \brief Set the processing time target per frame in seconds (0 to disable).
+    *
+    * If enabled, the pose optimization gets the time left in the frame. Its iterations and the share of
+    * the feature stack used per iteration are planned from the odometry increment, the convergence of the
+    * previous frame and the measured cost per feature, instead of always allowing maxIterations.
+    */
+   void setFrameTimeBudget(float val) { _frameTimeBudget = val; }
+
+   /** \brief Set the number of features kept for the pose optimization (0 to use all features).
+    *
+    * If enabled, the correspondences of the first iteration are ranked by their contribution along the
+    * eigen directions of the normal equations (as analyzed by the degeneracy check). The best features of
+    * every direction are taken in turn, starting with the weakest direction, and only those are searched
+    * in the remaining iterations.
+    */
+   void setFeatureSelectionNum(size_t val) { _featureSelectionNum = val; }
+   void setStackFrameNum(int val) { _stackFrameNum = val; _frameCount = val - 1; }
+   void setMapFrameNum(int val) { _mapFrameNum = val; _mapFrameCount = val - 1; }
+
+   /** \brief Set if anybody is interested in the surround map. Without demand, surround maps are skipped. */
+   void setSurroundMapDemand(bool val) { _surroundMapDemand = val; }
+   /** \brief Set the effective sensor range for building the local map (0 to disable range culling).
+    *
+    * If enabled, map cubes are selected by testing their point bounds against the range sphere and the
+    * vertical field of view, and only points within range are copied into the local map.
+    */
+   void setLocalMapRange(float val) { _localMapRange = val; }
+
+   /** \brief Set the vertical half opening angle (in degrees) of the field of view used with range culling. */
+   void setFovHalfAngle(float deg) { _fovTanHalfAngle = std::tan(deg * float(M_PI) / 180.0f); }
+
+   /** \brief Look the scan to map residuals up in per voxel statistics instead of kd-tree neighbors.
+    *
+    * Not supported together with the asynchronous map maintenance, as the statistics belong to the map cubes
+    * owned by the maintenance thread. While it's enabled, the kd-tree neighbors are used.
+    */
+   void setUseVoxelFeatures(bool val) { _useVoxelFeatures = val; }
+   void setVoxelFeatureSize(float val);
+   void setIncrementalMapFilter(bool val);
+
+   /** \brief Enable or disable the asynchronous map maintenance.
+    *
+    * If enabled, inserting into and down sizing the map cubes as well as assembling the local and
+    * surround maps run on a background thread, while process() only optimizes the pose against the
+    * most recent local map. Disabling it waits for the pending map update to finish.
+    */
+   void setAsyncMapMaintenance(bool val);
+
+   /** \brief Set the memory budget of the map cubes in bytes (0 for unlimited).
+    *
+    * If the budget is exceeded, the cubes farthest from the sensor (outside of the surround map)
+    * are spilled to the spill directory. Without a spill directory the budget is not enforced.
+    */
+   void setMapMemoryBudget(size_t bytes) { _mapMemoryBudget = bytes; }
+
+   /** \brief Set the directory for spilling map cubes to disk (empty to disable spilling).
+    *
+    * Cubes leaving the cube grid are spilled as well and reloaded when the sensor returns.
+    */
+   void setMapSpillDirectory(const std::string& directory) { _cubeSpillStore.setDirectory(directory); }
+
    auto& downSizeFilterCorner() { return _downSizeFilterCorner; }
    auto& downSizeFilterSurf() { return _downSizeFilterSurf; }
    auto& downSizeFilterMap() { return _downSizeFilterMap; }
@@ -103,16 +286,98 @@ public:
    auto maxIterations() const { return _maxIterations; }
    auto deltaTAbort()   const { return _deltaTAbort; }
    auto deltaRAbort()   const { return _deltaRAbort; }
+   auto frameTimeBudget() const { return _frameTimeBudget; }
+   auto featureSelectionNum() const { return _featureSelectionNum; }
+   auto stackFrameNum() const { return _stackFrameNum; }
+   auto mapFrameNum()   const { return _mapFrameNum; }
+   auto localMapRange() const { return _localMapRange; }
+   auto useVoxelFeatures() const { return _useVoxelFeatures; }
+   auto voxelFeatureSize() const { return _voxelFeatureSize; }
+   auto incrementalMapFilter() const { return _incrementalMapFilter; }
+   auto asyncMapMaintenance() const { return _asyncMapMaintenance; }
+   auto localizationMode() const { return _localizationMode; }
+
+   /** \brief Write a snapshot of the map cubes and the current mapping pose to the given file.
+    *
+    * Cubes spilled to disk are streamed into the snapshot as well. Fails while the asynchronous map maintenance is running, use requestMapSnapshot() instead.
+    * @return true, if the snapshot was written successfully
+    */
+   bool saveMapSnapshot(const std::string& file);
+
+   /** \brief Replace the map cubes and the mapping pose by a previously saved snapshot.
+    *
+    * The file is memory mapped and validated completely before the current map is replaced. The quantized
+    * points are copied into the cubes as they are. Cubes outside of the cube grid are moved to the spill
+    * directory, without one they are dropped. Meant to be called before the first frame is processed.
+    *
+    * @param file the snapshot file
+    * @param keepOdometryReference if true, the odometry pose at the time of the snapshot is restored as
+    *        well (for restarting the mapping alone), otherwise the odometry is expected to restart at its origin
+    * @return true, if the snapshot was loaded successfully
+    */
+   bool loadMapSnapshot(const std::string& file, bool keepOdometryReference = true);
+
+   /** \brief Switch to localization against a frozen prior map, given as map snapshot.
+    *
+    * Afterwards, process() only optimizes the pose against the prior map, starting at the given initial pose.
+    * Map insertion and maintenance are skipped entirely. The kd-tree index of the prior map is built
+    * once and cached next to the snapshot (as <file>.kdtree) for subsequent runs.
+    *
+    * @param file the map snapshot
+    * @param initialPose the sensor pose in the map at the first odometry pose (the map origin by default)
+    * @return true, if the prior map was loaded successfully
+    */
+   bool loadLocalizationMap(const std::string& file, const Twist& initialPose = Twist());
+
+   /** \brief Write a snapshot after the next map update, from the thread maintaining the map. */
+   void requestMapSnapshot(const std::string& file);
+
+   size_t mapSnapshotCount() const { return _snapshotCount; }
+   size_t mapSnapshotFailures() const { return _snapshotFailures; }
+
+   /** \brief Count the map cubes and points, in memory and spilled to disk.
+    *
+    * Not synchronized with the asynchronous map maintenance, meant for a map that is not being processed.
+    */
+   MapSize mapSize() const;
+
+   auto mapMemoryBudget() const { return _mapMemoryBudget; }
+   auto const& mapSpillDirectory() const { return _cubeSpillStore.directory(); }
+
+   /** \brief A consistent snapshot of the mapping statistics (thread safe). */
+   MappingStats stats() const;
 
    auto const& transformAftMapped()   const { return _transformAftMapped; }
    auto const& transformBefMapped()   const { return _transformBefMapped; }
-   auto const& laserCloudSurroundDS() const { return *_laserCloudSurroundDS; }
+   /** \brief The down sized cubes of the last surround map, concatenated they form the surround map cloud. */
+   auto const& surroundMapCubes()     const { return _surroundMap; }
 
    bool hasFreshMap() const { return _downsizedMapCreated; }
 
 private:
-   /** Run an optimization. */
-   void optimizeTransformTobeMapped();
+   /** \brief Run an optimization.
+    *
+    * @param timeBudget the time the optimization may take in seconds (0 = unlimited)
+    */
+   void optimizeTransformTobeMapped(double timeBudget = 0);
+
+   /** \brief Plan the iterations and the feature stride of a budgeted pose optimization.
+    *
+    * @param timeBudget the time left for the iterations in seconds
+    * @param featureNum the number of features in the down sized stacks
+    * @param iterations the resulting number of iterations
+    * @param stride the resulting stride through the feature stacks
+    */
+   void planOptimization(double timeBudget, size_t featureNum, size_t& iterations, size_t& stride) const;
+
+   /** \brief Narrow the searched stack features down to the correspondences best conditioning the normal equations.
+    *
+    * @param eigenvalues the eigenvalues of the normal equations of all correspondences (increasing)
+    * @param eigenvectors the matching eigenvectors (column-wise)
+    * @param cornerStackNum the number of corner stack features, surface features are indexed after them
+    */
+   void selectInformativeFeatures(const Eigen::Matrix<float, 1, 6>& eigenvalues,
+                                  const Eigen::Matrix<float, 6, 6>& eigenvectors, size_t cornerStackNum);
 
    void transformAssociateToMap();
    void transformUpdate();
@@ -120,7 +385,163 @@ private:
    void pointAssociateTobeMapped(const pcl::PointXYZI& pi, pcl::PointXYZI& po);
    void transformFullResToMap();
 
-   bool createDownsizedMap();
+   /** \brief Transform a point into the map using the given pose. */
+   static void pointAssociateToMap(const pcl::PointXYZI& pi, pcl::PointXYZI& po, const Twist& pose);
+
+   /** \brief Check if a new surround map is due according to the input output ratio and the demand. */
+   bool surroundMapDue();
+
+   /** \brief Collect the down sized surround cubes, down sizing only the cubes changed since the last call. */
+   void createDownsizedMap(std::vector<SurroundCube>& mapOut);
+
+   /** \brief Shift the cube grid such that the given pose stays away from its borders.
+    *
+    * @param pose the sensor pose in map coordinates
+    * @param centerCubeI, centerCubeJ, centerCubeK the resulting indices of the cube containing the pose
+    */
+   void shiftMapCubes(const Twist& pose, int& centerCubeI, int& centerCubeJ, int& centerCubeK);
+
+   /** \brief Select the cubes surrounding the given pose and the subset within the field of view. */
+   void selectMapCubes(const Twist& pose, int centerCubeI, int centerCubeJ, int centerCubeK);
+
+   /** \brief Test the bounds of a cube against the sensor range and vertical field of view.
+    *
+    * @param index the cube index
+    * @param sensor the sensor position in map coordinates
+    * @param up the sensor up direction in map coordinates
+    * @param centerX, centerY, centerZ the cube center, used as fallback for empty cubes
+    */
+   bool isCubeVisible(size_t index, const Eigen::Vector3f& sensor, const Eigen::Vector3f& up,
+                      float centerX, float centerY, float centerZ) const;
+
+   /** \brief Add the points of a cube within the local map range to a local map.
+    *
+    * Cubes completely within range are referenced in place by the view, unless copyCubes is set.
+    * Points of partially covered cubes are always copied (decoded) to the given cloud.
+    */
+   void appendCubePoints(const CompactPointCloud& cube, const Eigen::AlignedBox3f& bounds,
+                         float range, bool copyCubes, pcl::PointCloud<pcl::PointXYZI>& copied,
+                         MapPointView& view) const;
+
+   /** \brief Collect the points of the cubes in view (within range, if > 0) into the given local map views.
+    *
+    * @param copyCubes copy all points into the given clouds instead of referencing the cubes in place,
+    *   for local maps that are used while the cubes change
+    */
+   void assembleLocalMap(pcl::PointCloud<pcl::PointXYZI>& cornerMap, pcl::PointCloud<pcl::PointXYZI>& surfMap,
+                         MapPointView& cornerView, MapPointView& surfView, float range, bool copyCubes);
+
+   /** \brief Stack the last feature clouds and down size them for the pose optimization. */
+   void downsizeFeatureStack();
+
+   /** \brief Store feature points (in map coordinates) in their corresponding cubes. */
+   void insertMapPoints(const pcl::PointCloud<pcl::PointXYZI>& cornerPoints,
+                        const pcl::PointCloud<pcl::PointXYZI>& surfPoints);
+
+   /** \brief Down size all cubes within the field of view. */
+   void downsizeValidCubes();
+
+   /** \brief Mirror the corner / surface leaf sizes into the filters used for map maintenance. */
+   void syncCubeFilters();
+
+   /** \brief Start the map maintenance thread if it is not running yet. */
+   void startMapThread();
+
+   /** \brief Stop the map maintenance thread after it has processed the pending update. */
+   void stopMapThread();
+
+   /** \brief Map maintenance thread main loop. */
+   void mapMaintenanceLoop();
+
+   /** \brief Hand the current down sized feature stack over to the map maintenance thread. */
+   void queueMapUpdate();
+
+   /** \brief Take over the most recent local (and surround) map from the map maintenance thread. */
+   void fetchLocalMap();
+
+   /** \brief Add the time elapsed since start to the given stage. */
+   void recordStageTime(StageTime MappingStageTimes::*stage, SteadyClock::time_point const& start);
+
+   /** \brief Apply an update to the statistics under the statistics lock. */
+   template <typename Update>
+   void updateStats(Update const& update)
+   {
+      std::lock_guard<std::mutex> lock(_statsMutex);
+      update(_stats);
+   }
+
+   /** \brief Check if the scan to map residuals are looked up in the voxel statistics of the cubes. */
+   bool voxelFeaturesActive() const { return _useVoxelFeatures && !_asyncMapMaintenance; }
+
+   /** \brief Swap the contents of two map cubes. */
+   void swapCubes(size_t indexA, size_t indexB);
+
+   /** \brief Remove all points and voxel statistics from a map cube. */
+   void clearCube(size_t index);
+
+   /** \brief The absolute (grid offset independent) coordinates of a map cube. */
+   VoxelKey cubeKey(size_t index) const;
+
+   /** \brief The grid index of a map cube given by its absolute coordinates, if it is within the cube grid. */
+   bool toCubeIndex(const VoxelKey& key, size_t& index) const;
+
+   /** \brief Anchor the empty clouds of a map cube at its center, before points are added.
+    *
+    * Cleared cubes are reused for other parts of the map when the cube grid is shifted.
+    */
+   void anchorCube(size_t index);
+
+   /** \brief Spill a non-empty map cube to disk and clear it.
+    *
+    * @return true, if the cube was written to disk and cleared
+    */
+   bool spillCube(size_t index);
+
+   /** \brief Reload a map cube from disk if it has been spilled before. */
+   void restoreCube(size_t index);
+
+   /** \brief Rebuild the occupancy and voxel statistics of a cube after points have been appended in bulk. */
+   void rebuildCubeIndex(size_t index, size_t cornerStart, size_t surfStart);
+
+   /** \brief Write the map cubes together with the given mapping poses to a snapshot file. */
+   bool writeMapSnapshot(const std::string& file, const Twist& aftMapped, const Twist& befMapped);
+
+   /** \brief Validate and load a memory mapped snapshot. */
+   bool readMapSnapshot(const char* data, size_t size, bool keepOdometryReference);
+
+   /** \brief Load the cached kd-tree index of a localization map or build (and cache) it. */
+   void prepareMapIndex(const std::string& mapFile);
+
+   /** \brief Write a requested snapshot, if any. */
+   void writeRequestedSnapshot(const Twist& aftMapped, const Twist& befMapped);
+
+   /** \brief Estimate the memory used by a map cube. */
+   size_t cubeBytes(size_t index) const;
+
+   /** \brief Update the memory statistics and spill the farthest cubes while over budget. */
+   void enforceMapMemoryBudget(int centerCubeI, int centerCubeJ, int centerCubeK);
+
+   /** \brief Find the index of the map cube containing the given point.
+    *
+    * @param point the point in map coordinates
+    * @param cubeInd the resulting cube index
+    * @return false, if the point lies outside the cube grid
+    */
+   bool toCubeIndex(const pcl::PointXYZI& point, size_t& cubeInd) const;
+
+   /** \brief Find the statistics of the map voxel containing the given point.
+    *
+    * @param voxelArray the per cube voxel maps to search
+    * @param point the point in map coordinates
+    * @return the voxel statistics, or nullptr if the voxel is unknown
+    */
+   VoxelStats* findVoxelStats(std::vector<VoxelFeatureMap>& voxelArray, const pcl::PointXYZI& point);
+
+   /** \brief Recompute the outdated voxel statistics from the current cube points. */
+   void updateVoxelStats();
+
+   /** \brief Bring the per cube occupancy filters in line with the current corner / surface leaf sizes. */
+   void updateCubeFilters();
 
    // private:
    size_t toIndex(int i, int j, int k) const
@@ -130,8 +551,8 @@ private:
    Time _laserOdometryTime;
 
    float _scanPeriod;          ///< time per scan
-   const int _stackFrameNum;
-   const int _mapFrameNum;
+   int _stackFrameNum;         ///< number of input frames per processed frame
+   int _mapFrameNum;           ///< number of processed frames per surround map
    long _frameCount;
    long _mapFrameCount;
 
@@ -139,6 +560,41 @@ private:
    float _deltaTAbort;     ///< optimization abort threshold for deltaT
    float _deltaRAbort;     ///< optimization abort threshold for deltaR
 
+   float _frameTimeBudget;            ///< processing time target per frame in seconds (0 = unlimited)
+   double _featureIterationCost = 0;  ///< running estimate of the optimization time per feature and iteration
+   double _postOptimizationTime = 0;  ///< running estimate of the frame time after the optimization
+   size_t _lastIterations = 0;        ///< number of iterations of the last optimization
+   bool _lastConverged = false;       ///< flag if the last optimization reached the abort thresholds
+
+   OptimizationReport _report;                 ///< report of the last processed frame
+   OptimizationReportHistory _reportHistory;   ///< reports of the most recent processed frames
+
+   size_t _featureSelectionNum;                 ///< number of features kept for the optimization (0 = all)
+   std::vector<size_t> _cornerFeatureInd;       ///< corner stack features searched for correspondences
+   std::vector<size_t> _surfFeatureInd;         ///< surface stack features searched for correspondences
+   std::vector<size_t> _laserCloudOriInd;       ///< stack feature of each correspondence (surface after corner)
+   std::vector<Eigen::Matrix<float, 6, 1>> _featureJacobians;   ///< jacobian of each correspondence
+   std::vector<uint32_t> _featureOrder;         ///< correspondences ranked per eigen direction
+   std::vector<float> _featureScores;           ///< information of the correspondences per eigen direction
+   std::vector<bool> _featureTaken;             ///< flag per correspondence if it has been selected
+
+   bool _useVoxelFeatures;   ///< use per voxel statistics instead of kd-tree neighbors for scan to map residuals
+   float _voxelFeatureSize;  ///< edge length of the statistics voxels
+
+   bool _incrementalMapFilter;  ///< down size map cubes on insertion instead of re-filtering them every frame
+   float _cubeFilterLeafCorner; ///< leaf size the corner cube filters were built with (0 if invalid)
+   float _cubeFilterLeafSurf;   ///< leaf size the surface cube filters were built with (0 if invalid)
+
+   bool _asyncMapMaintenance;   ///< maintain the map cubes on a background thread
+   bool _localizationMode;      ///< localize against a frozen prior map
+   float _localMapRange;        ///< effective sensor range for building the local map (0 = unlimited)
+   float _fovTanHalfAngle;      ///< tangent of the vertical half opening angle of the field of view
+   Eigen::Vector3f _localMapCenter;   ///< sensor position the cubes were last selected for
+   bool _publishPriorMap;       ///< flag if the prior map still needs to be reported as fresh map
+
+   size_t _mapMemoryBudget;          ///< memory budget of the map cubes in bytes (0 = unlimited)
+   CubeSpillStore _cubeSpillStore;   ///< map cubes spilled to disk
+
    int _laserCloudCenWidth;
    int _laserCloudCenHeight;
    int _laserCloudCenDepth;
@@ -157,17 +613,32 @@ private:
    pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfStackDS;    ///< down sampled
 
    pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurround;
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurroundDS;     ///< down sampled
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerFromMap;
-   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfFromMap;
+   std::vector<SurroundCube> _surroundMap;                          ///< down sized cubes of the surround map
+   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerFromMap;   ///< corner points copied into the local map
+   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfFromMap;     ///< surface points copied into the local map
+   MapPointView _laserCloudCornerFromMapView;   ///< corner points of the valid map cubes
+   MapPointView _laserCloudSurfFromMapView;     ///< surface points of the valid map cubes
+   nanoflann::KdTreeFLANN<pcl::PointXYZI, MapPointView> _kdtreeCornerFromMap;   ///< index of the local map corner points
+   nanoflann::KdTreeFLANN<pcl::PointXYZI, MapPointView> _kdtreeSurfFromMap;     ///< index of the local map surface points
 
    pcl::PointCloud<pcl::PointXYZI> _laserCloudOri;
    pcl::PointCloud<pcl::PointXYZI> _coeffSel;
 
-   std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudCornerArray;
-   std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudSurfArray;
-   std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudCornerDSArray;  ///< down sampled
-   std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudSurfDSArray;    ///< down sampled
+   std::vector<CompactPointCloud> _laserCloudCornerArray;   ///< per cube corner points, relative to the cube center
+   std::vector<CompactPointCloud> _laserCloudSurfArray;     ///< per cube surface points, relative to the cube center
+   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCube;     ///< decoded cube points for down sizing
+   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCubeDS;   ///< down sampled cube points
+   std::vector<VoxelFeatureMap> _laserCloudCornerVoxelArray;  ///< per cube corner voxel statistics
+   std::vector<VoxelFeatureMap> _laserCloudSurfVoxelArray;    ///< per cube surface voxel statistics
+   std::vector<IncrementalVoxelFilter> _laserCloudCornerFilterArray;  ///< per cube corner voxel occupancy
+   std::vector<IncrementalVoxelFilter> _laserCloudSurfFilterArray;    ///< per cube surface voxel occupancy
+   std::vector<Eigen::AlignedBox3f> _laserCloudBoundsArray;           ///< per cube bounds of the corner and surface points
+   std::vector<SurroundCube> _surroundCubeArray;    ///< per cube down sized surround points (null cloud if changed)
+   uint64_t _surroundGeneration = 0;                ///< generation of the last down sized surround cube
+   float _surroundLeafSize = 0;                     ///< leaf size the surround cubes were down sized with
+   std::atomic<bool> _surroundMapDemand{true};      ///< flag if the surround map is wanted
+   size_t _laserCloudCornerFromMapNum;  ///< number of corner points in the valid map cubes
+   size_t _laserCloudSurfFromMapNum;    ///< number of surface points in the valid map cubes
 
    std::vector<size_t> _laserCloudValidInd;
    std::vector<size_t> _laserCloudSurroundInd;
@@ -179,8 +650,44 @@ private:
    pcl::VoxelGrid<pcl::PointXYZI> _downSizeFilterCorner;   ///< voxel filter for down sizing corner clouds
    pcl::VoxelGrid<pcl::PointXYZI> _downSizeFilterSurf;     ///< voxel filter for down sizing surface clouds
    pcl::VoxelGrid<pcl::PointXYZI> _downSizeFilterMap;      ///< voxel filter for down sizing accumulated map
+   pcl::VoxelGrid<pcl::PointXYZI> _cubeFilterCorner;       ///< corner filter used by the map maintenance
+   pcl::VoxelGrid<pcl::PointXYZI> _cubeFilterSurf;         ///< surface filter used by the map maintenance
 
    bool _downsizedMapCreated = false;
+
+   /** Local map clouds handed over from the map maintenance to the pose optimization. */
+   struct LocalMap
+   {
+      pcl::PointCloud<pcl::PointXYZI>::Ptr corner;       ///< corner points of the cubes in view
+      pcl::PointCloud<pcl::PointXYZI>::Ptr surf;         ///< surface points of the cubes in view
+      MapPointView cornerView;                           ///< view of the corner points
+      MapPointView surfView;                             ///< view of the surface points
+      std::vector<SurroundCube> surround;                ///< down sized surround map cubes
+      size_t cornerNum = 0;                              ///< number of corner points in the cubes in view
+      size_t surfNum = 0;                                ///< number of surface points in the cubes in view
+      bool surroundCreated = false;                      ///< flag if surround holds a new surround map
+   };
+
+   std::thread _mapThread;                   ///< map maintenance thread
+   std::mutex _mapMutex;                     ///< guards the pending update and the ready local map
+   std::condition_variable _mapCondition;    ///< signals pending updates and stop requests
+   bool _stopMapThread = false;              ///< request to stop the map maintenance thread
+   bool _mapUpdatePending = false;           ///< flag if there are feature points waiting for insertion
+   Twist _pendingPose;                       ///< latest optimized pose of the pending update
+   Twist _pendingBefPose;                    ///< odometry pose belonging to the pending pose
+   std::string _pendingSnapshotFile;         ///< requested snapshot file (empty if none)
+   std::atomic<size_t> _snapshotCount{0};    ///< number of successfully written snapshots
+   std::atomic<size_t> _snapshotFailures{0}; ///< number of failed snapshot writes
+   pcl::PointCloud<pcl::PointXYZI> _pendingCornerPoints;   ///< corner points waiting for insertion
+   pcl::PointCloud<pcl::PointXYZI> _pendingSurfPoints;     ///< surface points waiting for insertion
+   LocalMap _backLocalMap;                   ///< local map under construction (maintenance thread only)
+   LocalMap _readyLocalMap;                  ///< most recently completed local map
+   bool _localMapReady = false;              ///< flag if the ready local map has not been taken over yet
+
+   mutable std::mutex _statsMutex;           ///< guards the statistics
+   MappingStats _stats;                      ///< run time and map statistics
+   size_t _spillCount = 0;                   ///< total number of spilled cubes
+   size_t _reloadCount = 0;                  ///< total number of reloaded cubes
 };
 
 } // end namespace loam
@@ -1,4 +1,5 @@
 #pragma once
+#include "OptimizationReport.h"
 #include "Twist.h"
 #include "nanoflann_pcl.h"
 #include <pcl/point_cloud.h>
@@ -15,8 +16,12 @@ namespace loam
   public:
     explicit BasicLaserOdometry(float scanPeriod = 0.1, size_t maxIterations = 25);
 
-    /** \brief Try to process buffered data. */
-    void process();
+    /** \brief Try to process buffered data.
+     *
+     * @param sweepTime the time of the sweep, only used for the report
+     * @return the convergence and quality report of the frame, valid until the next call
+     */
+    const OptimizationReport& process(Time const& sweepTime = Time());
     void updateIMU(pcl::PointCloud<pcl::PointXYZ> const& imuTrans);
 
     auto& cornerPointsSharp()     { return _cornerPointsSharp; }
@@ -41,6 +46,9 @@ namespace loam
     auto deltaTAbort()   const { return _deltaTAbort;   }
     auto deltaRAbort()   const { return _deltaRAbort;   }
 
+    /** \brief The reports of the most recent frames, oldest first (thread safe). */
+    std::vector<OptimizationReport> recentReports() const { return _reportHistory.reports(); }
+
     /** \brief Transform the given point cloud to the end of the sweep.
      *
      * @param cloud the point cloud to transform
@@ -104,6 +112,9 @@ namespace loam
 
     Vector3 _imuShiftFromStart;
     Vector3 _imuVeloFromStart;
+
+    OptimizationReport _report;                   ///< report of the last frame
+    OptimizationReportHistory _reportHistory;     ///< reports of the most recent frames
   };
 
 } // end namespace loam
@@ -4,10 +4,13 @@
 #include <vector>
 
 #include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/filters/voxel_grid.h>
 
 #include "Angle.h"
 #include "Vector3.h"
 #include "CircularBuffer.h"
+#include "MultiScanMapper.h"
 #include "time_utils.h"
 
 namespace loam
@@ -141,11 +144,30 @@ namespace loam
     */
     void processScanlines(const Time& scanTime, std::vector<pcl::PointCloud<pcl::PointXYZI>> const& laserCloudScans);
 
+    /** \brief Process a new multi laser cloud, sorting its points into scanlines first.
+    *
+    * @param laserCloudIn the input cloud (NaN, zero and out of range points are skipped)
+    * @param scanTime the scan time
+    * @param scanMapper the mapping of vertical point angles to scan rings
+    */
+    void processCloud(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn, const Time& scanTime,
+                      const MultiScanMapper& scanMapper);
+
     bool configure(const RegistrationParams& config = RegistrationParams()); 
 
     /** \brief Update new IMU state. NOTE: MUTATES ARGS! */
     void updateIMUData(Vector3& acc, IMUState& newState);
 
+    /** \brief Update new IMU state from an IMU measurement in the lidar frame.
+    *
+    * @param stamp the measurement time
+    * @param roll the roll angle (rad)
+    * @param pitch the pitch angle (rad)
+    * @param yaw the yaw angle (rad)
+    * @param linearAcceleration the measured linear acceleration, including gravity (m/s^2)
+    */
+    void updateIMUData(const Time& stamp, double roll, double pitch, double yaw, const Vector3& linearAcceleration);
+
     /** \brief Project a point to the start of the sweep using corresponding IMU data
     *
     * @param point The point to modify
@@ -155,13 +177,15 @@ namespace loam
 
     auto const& imuTransform          () { return _imuTrans             ; }
     auto const& sweepStart            () { return _sweepStart           ; }
-    auto const& laserCloud            () { return _laserCloud           ; }
-    auto const& cornerPointsSharp     () { return _cornerPointsSharp    ; }
-    auto const& cornerPointsLessSharp () { return _cornerPointsLessSharp; }
-    auto const& surfacePointsFlat     () { return _surfacePointsFlat    ; }
-    auto const& surfacePointsLessFlat () { return _surfacePointsLessFlat; }
     auto const& config                () { return _config               ; }
 
+    // the result clouds are rebuilt for every scan, so their content may be handed on (e.g. swapped out)
+    auto& laserCloud            () { return _laserCloud           ; }
+    auto& cornerPointsSharp     () { return _cornerPointsSharp    ; }
+    auto& cornerPointsLessSharp () { return _cornerPointsLessSharp; }
+    auto& surfacePointsFlat     () { return _surfacePointsFlat    ; }
+    auto& surfacePointsLessFlat () { return _surfacePointsLessFlat; }
+
   private:
 
     /** \brief Check is IMU data is available. */
@@ -231,6 +255,7 @@ namespace loam
   private:
     RegistrationParams _config;  ///< registration parameter
 
+    std::vector<pcl::PointCloud<pcl::PointXYZI>> _laserCloudScans;   ///< scanlines of the current input cloud
     pcl::PointCloud<pcl::PointXYZI> _laserCloud;   ///< full resolution input cloud
     std::vector<IndexRange> _scanIndices;          ///< start and end indices of the individual scans withing the full resolution cloud
 
@@ -253,6 +278,10 @@ namespace loam
     std::vector<PointLabel> _regionLabel;     ///< point label buffer
     std::vector<size_t> _regionSortIndices;   ///< sorted region indices based on point curvature
     std::vector<int> _scanNeighborPicked;     ///< flag if neighboring point was already picked
+
+    pcl::PointCloud<pcl::PointXYZI>::Ptr _surfPointsLessFlatScan{ new pcl::PointCloud<pcl::PointXYZI>() };   ///< less flat surface points of the current scan
+    pcl::PointCloud<pcl::PointXYZI> _surfPointsLessFlatScanDS;      ///< down sized less flat surface points of the current scan
+    pcl::VoxelGrid<pcl::PointXYZI> _lessFlatFilter;                 ///< voxel filter for down sizing the less flat surface points
   };
 
 }
@@ -34,7 +34,7 @@ public:
    *
    * @return the buffer size
    */
-  const size_t& size() {
+  const size_t& size() const {
     return _size;
   }
 
@@ -42,7 +42,7 @@ public:
    *
    * @return the buffer capacity
    */
-  const size_t& capacity() {
+  const size_t& capacity() const {
     return _capacity;
   }
 
@@ -71,7 +71,7 @@ public:
    *
    * @return true if the buffer is empty, false otherwise
    */
-  bool empty() {
+  bool empty() const {
     return _size == 0;
   }
 
@@ -81,7 +81,7 @@ public:
    * @param i the buffer index
    * @return the element at the i-th position
    */
-  const T& operator[](const size_t& i) {
+  const T& operator[](const size_t& i) const {
     return _buffer[(_startIdx + i) % _capacity];
   }
 
@@ -89,7 +89,7 @@ public:
    *
    * @return the first element
    */
-  const T& first() {
+  const T& first() const {
     return _buffer[_startIdx];
   }
 
@@ -97,7 +97,7 @@ public:
    *
    * @return the last element
    */
-  const T& last() {
+  const T& last() const {
     size_t idx = _size == 0 ? 0 : (_startIdx + _size - 1) % _capacity;
     return _buffer[idx];
   }
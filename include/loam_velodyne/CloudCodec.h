@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+namespace loam
+{
+
+/** \brief Encoding of the clouds exchanged between the LOAM components. */
+enum class CloudEncoding
+{
+   FLOAT32,         ///< x, y, z and intensity as floats (16 bytes per point)
+   QUANTIZED,       ///< delta coded int16 coordinates and uint16 intensities (8 bytes per point)
+   QUANTIZED_LZ4    ///< QUANTIZED, compressed with LZ4 (falls back to QUANTIZED without LZ4 support)
+};
+
+/** \brief Scales and size of a quantized cloud. */
+struct QuantizedCloudInfo
+{
+   uint32_t pointNum = 0;       ///< number of encoded points
+   float scale = 0;             ///< coordinate quantization step
+   float intensityScale = 0;    ///< intensity quantization step (a power of two)
+   bool lz4 = false;            ///< flag if the encoded data is LZ4 compressed
+};
+
+/** \brief Lossy compact encoding of point clouds for transport and recording.
+ *
+ * The coordinates are quantized to int16 with a per cloud scale (the largest absolute coordinate
+ * maps to 32767, e.g. 3 mm steps for a 100 m range), the non negative intensities (scan ring and
+ * relative point time) to uint16. The intensity step is the smallest power of two covering the
+ * largest intensity (1/1024 for 64 rings) and values are rounded down, so the integral scan ring of
+ * every point survives the round trip. Each field is delta coded along the cloud order, which follows the
+ * scan rings for all registration and odometry clouds, zigzag mapped and stored as separate planes
+ * of low and high bytes. Without LZ4 this halves the float encoding; the mostly zero high byte
+ * planes make the deltas compress well with LZ4. Non finite points are skipped.
+ */
+class CloudCodec
+{
+public:
+   /** \brief Encode a cloud.
+    *
+    * @param cloud the cloud to encode
+    * @param lz4 true to compress the encoded data with LZ4 (if supported and smaller)
+    * @param info the resulting scales and size
+    * @param data the encoded data, keeping its capacity
+    */
+   void encode(const pcl::PointCloud<pcl::PointXYZI>& cloud, bool lz4,
+               QuantizedCloudInfo& info, std::vector<uint8_t>& data);
+
+   /** \brief Decode a cloud.
+    *
+    * @param info the scales and size of the encoded cloud
+    * @param data the encoded data
+    * @param cloud the decoded cloud, keeping its capacity
+    * @return true, if the data was decoded, false if it is corrupt or LZ4 compressed without LZ4 support
+    */
+   bool decode(const QuantizedCloudInfo& info, const std::vector<uint8_t>& data,
+               pcl::PointCloud<pcl::PointXYZI>& cloud);
+
+   /** \brief Check if LZ4 compression is supported by this build. */
+   static bool lz4Supported();
+
+private:
+   std::vector<uint8_t> _buffer;   ///< uncompressed planes, reused across clouds
+};
+
+} // end namespace loam
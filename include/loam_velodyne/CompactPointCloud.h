@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+namespace loam
+{
+
+/** \brief Map point quantized relative to the origin of its cloud (8 instead of 32 bytes). */
+struct CompactPoint
+{
+   int16_t x, y, z;   ///< offset from the cloud origin in units of CompactPointCloud::RESOLUTION
+   uint16_t tag;      ///< intensity (scan ring plus relative scan time) as 8.8 fixed point value
+};
+
+/** \brief Point cloud storing its points as fixed point offsets from a common origin.
+ *
+ * With a resolution of 1/1024 m, the offsets cover +-32 m around the origin, enough for a 50 m
+ * map cube anchored at its center. The intensity is kept with a resolution of 1/256 up to 255.
+ * Points are decoded on access, so the cloud can't hand out references to pcl::PointXYZI.
+ */
+class CompactPointCloud
+{
+public:
+   static constexpr float RESOLUTION = 1.0f / 1024;   ///< coordinate quantization step (in meters)
+   static constexpr float TAG_RESOLUTION = 1.0f / 256;   ///< intensity quantization step
+
+   explicit CompactPointCloud(const Eigen::Vector3f& origin = Eigen::Vector3f::Zero()) : _origin(origin) {}
+
+   /** \brief Move the origin of the cloud, re-encoding the points it already holds. */
+   void setOrigin(const Eigen::Vector3f& origin);
+
+   const Eigen::Vector3f& origin() const { return _origin; }
+
+   pcl::PointXYZI operator[](size_t i) const { return decode(_points[i]); }
+
+   /** \brief Replace the i-th point. */
+   void set(size_t i, const pcl::PointXYZI& point) { _points[i] = encode(point); }
+
+   void push_back(const pcl::PointXYZI& point) { _points.push_back(encode(point)); }
+
+   /** \brief Append all points of the given cloud. */
+   void append(const pcl::PointCloud<pcl::PointXYZI>& cloud);
+
+   /** \brief Append quantized points encoded relative to the given origin.
+    *
+    * The points are copied as they are if the origins match and re-encoded otherwise.
+    */
+   void append(const CompactPoint* points, size_t num, const Eigen::Vector3f& origin);
+
+   /** \brief Replace the points by the points of the given cloud, keeping the origin. */
+   void assign(const pcl::PointCloud<pcl::PointXYZI>& cloud) { _points.clear(); append(cloud); }
+
+   /** \brief Append the decoded points to the given cloud. */
+   void decodeTo(pcl::PointCloud<pcl::PointXYZI>& cloud) const;
+
+   size_t size() const { return _points.size(); }
+   bool empty() const { return _points.empty(); }
+   void clear() { _points.clear(); }
+   void reserve(size_t num) { _points.reserve(num); }
+   void swap(CompactPointCloud& other) { _points.swap(other._points); std::swap(_origin, other._origin); }
+
+   /** \brief Size of the stored points in bytes. */
+   size_t bytes() const { return _points.size() * sizeof(CompactPoint); }
+
+   const CompactPoint* data() const { return _points.data(); }
+
+   /** \brief Quantize a point relative to the origin, clamping offsets beyond the covered range. */
+   CompactPoint encode(const pcl::PointXYZI& point) const
+   {
+      return { int16_t(quantize(point.x - _origin.x(), 1.0f / RESOLUTION, INT16_MIN, INT16_MAX)),
+               int16_t(quantize(point.y - _origin.y(), 1.0f / RESOLUTION, INT16_MIN, INT16_MAX)),
+               int16_t(quantize(point.z - _origin.z(), 1.0f / RESOLUTION, INT16_MIN, INT16_MAX)),
+               uint16_t(quantize(point.intensity, 1.0f / TAG_RESOLUTION, 0, UINT16_MAX)) };
+   }
+
+   pcl::PointXYZI decode(const CompactPoint& point) const { return decode(point, _origin); }
+
+   static pcl::PointXYZI decode(const CompactPoint& point, const Eigen::Vector3f& origin)
+   {
+      pcl::PointXYZI pt;
+      pt.x = origin.x() + point.x * RESOLUTION;
+      pt.y = origin.y() + point.y * RESOLUTION;
+      pt.z = origin.z() + point.z * RESOLUTION;
+      pt.intensity = point.tag * TAG_RESOLUTION;
+      return pt;
+   }
+
+   /** \brief Decode a single coordinate (0 = x, 1 = y, 2 = z) of a point. */
+   static float coordinate(const CompactPoint& point, const Eigen::Vector3f& origin, int dim)
+   {
+      return origin[dim] + (dim == 0 ? point.x : dim == 1 ? point.y : point.z) * RESOLUTION;
+   }
+
+private:
+   static int32_t quantize(float value, float scale, int32_t min, int32_t max)
+   {
+      float q = std::round(value * scale);
+      return q < min ? min : q > max ? max : int32_t(q);
+   }
+
+   Eigen::Vector3f _origin;              ///< common origin of the points
+   std::vector<CompactPoint> _points;    ///< quantized points
+};
+
+
+
+/** \brief Read-only view of the local map points, indexed as if all viewed points were concatenated.
+ *
+ * Compact map cubes are referenced in place and decoded on access, plain clouds (e.g. points copied
+ * out of the cubes) are referenced as they are. The viewed clouds must outlive the view and must not
+ * be modified while it is in use. This is the point source of the local map kd-tree index.
+ */
+class MapPointView
+{
+public:
+   void clear();
+
+   /** \brief Append the points of a compact cloud (empty clouds are ignored). */
+   void append(const CompactPointCloud& cloud);
+
+   /** \brief Append the points of a plain cloud (empty clouds are ignored). */
+   void append(const pcl::PointCloud<pcl::PointXYZI>& cloud);
+
+   pcl::PointXYZI operator[](size_t idx) const
+   {
+      const Segment& segment = segmentOf(idx);
+      return segment.compact ? CompactPointCloud::decode(segment.compact[idx - segment.begin], segment.origin)
+                             : segment.points[idx - segment.begin];
+   }
+
+   /** \brief Single coordinate (0 = x, 1 = y, 2 = z) of a point, as needed by the kd-tree index. */
+   float coordinate(size_t idx, int dim) const
+   {
+      const Segment& segment = segmentOf(idx);
+      return segment.compact ? CompactPointCloud::coordinate(segment.compact[idx - segment.begin], segment.origin, dim)
+                             : segment.points[idx - segment.begin].data[dim];
+   }
+
+   size_t size() const { return _size; }
+   bool empty() const { return _size == 0; }
+   size_t segmentCount() const { return _segments.size(); }
+
+private:
+   /** Consecutive points of one viewed cloud. */
+   struct Segment
+   {
+      const CompactPoint* compact;      ///< first point of a compact segment (null for plain segments)
+      const pcl::PointXYZI* points;     ///< first point of a plain segment
+      Eigen::Vector3f origin;           ///< origin of a compact segment
+      size_t begin;                     ///< view index of the first point
+   };
+
+   void addSegment(const Segment& segment, size_t size);
+
+   /** \brief The segment holding a view index, in constant time, as the kd-tree looks up every coordinate it touches. */
+   const Segment& segmentOf(size_t idx) const { return _segments[_segmentOf[idx]]; }
+
+   std::vector<Segment> _segments;
+   std::vector<uint16_t> _segmentOf;    ///< segment of each view index
+   size_t _size = 0;
+};
+
+} // end namespace loam
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CompactPointCloud.h"
+#include "VoxelKey.h"
+
+namespace loam
+{
+
+/** \brief On-disk store for map cubes evicted from memory.
+ *
+ * Cubes are identified by their absolute grid coordinates (independent of the current cube grid
+ * offsets). Every cube is written to its own file, holding a small header followed by the quantized
+ * corner and surface points exactly as they are kept in memory (8 bytes per point).
+ */
+class CubeSpillStore
+{
+public:
+   /** \brief Set the directory for the cube files, or an empty string to disable spilling.
+    *
+    * Cubes spilled to the previous directory are forgotten. Cube files left in the new directory by an
+    * earlier run are removed, as their cubes belong to another map.
+    */
+   void setDirectory(const std::string& directory);
+
+   /** \brief Write a cube to disk.
+    *
+    * @param cube the absolute cube coordinates
+    * @param corner the corner points of the cube
+    * @param surf the surface points of the cube
+    * @return true, if the cube was written successfully
+    */
+   bool save(const VoxelKey& cube,
+             const CompactPointCloud& corner,
+             const CompactPointCloud& surf);
+
+   /** \brief Read a cube back from disk and remove it from the store.
+    *
+    * If the cube can't be read, the clouds are left unchanged and the cube is removed from the store as
+    * well. Its file is kept as <file>.unreadable, so saving the cube again doesn't overwrite the points
+    * that could not be loaded.
+    *
+    * @param cube the absolute cube coordinates
+    * @param corner the cloud to append the corner points to
+    * @param surf the cloud to append the surface points to
+    * @return true, if the cube was read successfully
+    */
+   bool load(const VoxelKey& cube,
+             CompactPointCloud& corner,
+             CompactPointCloud& surf);
+
+   /** \brief Read a cube from disk, keeping it in the store.
+    *
+    * @param cube the absolute cube coordinates
+    * @param corner the cloud to append the corner points to
+    * @param surf the cloud to append the surface points to
+    * @return true, if the cube was read successfully (the clouds are left unchanged otherwise)
+    */
+   bool read(const VoxelKey& cube,
+             CompactPointCloud& corner,
+             CompactPointCloud& surf) const;
+
+   /** \brief Remove all cube files of the store. */
+   void clear();
+
+   /** \brief The absolute coordinates of the spilled cubes. */
+   std::vector<VoxelKey> cubes() const;
+
+   bool enabled() const { return !_directory.empty(); }
+   bool contains(const VoxelKey& cube) const { return _cubes.count(cube) > 0; }
+   bool empty() const { return _cubes.empty(); }
+   size_t size() const { return _cubes.size(); }
+   size_t bytes() const { return _bytes; }
+   size_t points() const { return _points; }
+   size_t failedLoads() const { return _failedLoads; }
+   const std::string& directory() const { return _directory; }
+
+private:
+   std::string fileName(const VoxelKey& cube) const;
+
+   /** Spilled cube file. */
+   struct CubeFile
+   {
+      size_t bytes;    ///< size of the file
+      size_t points;   ///< number of corner and surface points in the file
+   };
+
+   std::string _directory;   ///< directory holding the cube files
+   std::unordered_map<VoxelKey, CubeFile, VoxelKeyHash> _cubes;   ///< spilled cubes
+   size_t _bytes = 0;        ///< total size of the spilled cube files
+   size_t _points = 0;       ///< total number of spilled points
+   size_t _failedLoads = 0;  ///< number of cubes that could not be read back
+};
+
+} // end namespace loam
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+#include <pcl/point_types.h>
+
+#include "CompactPointCloud.h"
+#include "VoxelKey.h"
+
+namespace loam
+{
+
+/** \brief Persistent voxel occupancy of a map cloud, used to keep the cloud down sized incrementally.
+ *
+ * Every occupied voxel refers to exactly one point of the associated cloud, holding the centroid
+ * of all points inserted into that voxel (as pcl::VoxelGrid would produce). Inserting a new point
+ * either merges it into the existing centroid or appends it to the cloud, both in O(1). The
+ * centroids are accumulated in float and only quantized to the resolution of the compact cloud
+ * when stored, so points keep moving a centroid however many were merged before.
+ */
+class IncrementalVoxelFilter
+{
+public:
+   explicit IncrementalVoxelFilter(const float& leafSize = 0.2f);
+
+   /** \brief Change the leaf size and re-down size the given cloud accordingly.
+    *
+    * @param leafSize the new voxel edge length
+    * @param cloud the associated cloud
+    */
+   void setLeafSize(const float& leafSize, CompactPointCloud& cloud);
+
+   /** \brief Insert a point into the associated cloud.
+    *
+    * @param point the point to insert
+    * @param cloud the associated cloud
+    * @return true, if the point was appended to the cloud, false if it was merged into an occupied voxel
+    */
+   bool insert(const pcl::PointXYZI& point, CompactPointCloud& cloud);
+
+   /** \brief Rebuild the occupancy from the given cloud, merging all points sharing a voxel.
+    *
+    * @param cloud the associated cloud, down sized in place
+    */
+   void rebuild(CompactPointCloud& cloud);
+
+   void clear() { _voxels.clear(); }
+   size_t size() const { return _voxels.size(); }
+   float leafSize() const { return _leafSize; }
+
+private:
+   /** Occupied voxel entry. */
+   struct Voxel
+   {
+      uint32_t index;      ///< index of the voxel centroid within the associated cloud
+      uint32_t count;      ///< number of points merged into the centroid
+      float centroid[4];   ///< unquantized centroid (x, y, z, intensity)
+   };
+
+   float _leafSize;      ///< voxel edge length
+   float _invLeafSize;   ///< inverse voxel edge length
+   std::unordered_map<VoxelKey, Voxel, VoxelKeyHash> _voxels;
+};
+
+} // end namespace loam
@@ -35,15 +35,22 @@
 
 
 #include "BasicLaserMapping.h"
+#include "ProfilingReporter.h"
 #include "common.h"
 
 #include <ros/ros.h>
 #include <nav_msgs/Odometry.h>
+#include <loam_velodyne/OdometryFeatures.h>
+#include <loam_velodyne/OptimizationStatus.h>
 #include <sensor_msgs/Imu.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <tf/transform_datatypes.h>
 #include <tf/transform_broadcaster.h>
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 
 
 namespace loam
@@ -56,6 +63,9 @@ class LaserMapping : public BasicLaserMapping
 public:
    explicit LaserMapping(const float& scanPeriod = 0.1, const size_t& maxIterations = 10);
 
+   /** \brief Stop the surround map publisher and write a final map snapshot, if configured. */
+   ~LaserMapping();
+
    /** \brief Setup component in active mode.
     *
     * @param node the ROS node handle
@@ -63,29 +73,13 @@ public:
     */
    virtual bool setup(ros::NodeHandle& node, ros::NodeHandle& privateNode);
 
-   /** \brief Handler method for a new last corner cloud.
-    *
-    * @param cornerPointsLastMsg the new last corner cloud message
-    */
-   void laserCloudCornerLastHandler(const sensor_msgs::PointCloud2ConstPtr& cornerPointsLastMsg);
-
-   /** \brief Handler method for a new last surface cloud.
+   /** \brief Handler method for a new laser odometry result.
     *
-    * @param surfacePointsLastMsg the new last surface cloud message
-    */
-   void laserCloudSurfLastHandler(const sensor_msgs::PointCloud2ConstPtr& surfacePointsLastMsg);
-
-   /** \brief Handler method for a new full resolution cloud.
-    *
-    * @param laserCloudFullResMsg the new full resolution cloud message
-    */
-   void laserCloudFullResHandler(const sensor_msgs::PointCloud2ConstPtr& laserCloudFullResMsg);
-
-   /** \brief Handler method for a new laser odometry.
+    * Processes the frame right away and publishes the result.
     *
-    * @param laserOdometry the new laser odometry message
+    * @param odometryFeaturesMsg the new odometry features message
     */
-   void laserOdometryHandler(const nav_msgs::Odometry::ConstPtr& laserOdometry);
+   void odometryFeaturesHandler(const loam_velodyne::OdometryFeatures::ConstPtr& odometryFeaturesMsg);
 
    /** \brief Handler method for IMU messages.
     *
@@ -93,51 +87,68 @@ public:
     */
    void imuHandler(const sensor_msgs::Imu::ConstPtr& imuIn);
 
-   /** \brief Process incoming messages in a loop until shutdown (used in active mode). */
+   /** \brief Process incoming messages until shutdown (used in active mode). */
    void spin();
 
-   /** \brief Try to process buffered data. */
+   /** \brief Process the current frame and publish the result. */
    void process();
 
 
 protected:
-   /** \brief Reset flags, etc. */
-   void reset();
-
-   /** \brief Check if all required information for a new processing step is available. */
-   bool hasNewData();
-
    /** \brief Publish the current result via the respective topics. */
    void publishResult();
 
+   /** \brief Hand the current surround map over to the surround map publisher thread. */
+   void publishSurroundMap();
+
+   /** \brief Assemble and publish the surround maps handed over by publishSurroundMap(). */
+   void surroundPublisherLoop();
+
+   /** \brief Record the latency of the last frame and log percentiles, stage means and map statistics once a report window is full. */
+   void updateLatencyReport();
+
+   /** \brief Request a periodic map snapshot and report failed snapshot writes. */
+   void updateMapSnapshot();
+
 private:
-   ros::Time _timeLaserCloudCornerLast;   ///< time of current last corner cloud
-   ros::Time _timeLaserCloudSurfLast;     ///< time of current last surface cloud
-   ros::Time _timeLaserCloudFullRes;      ///< time of current full resolution cloud
    ros::Time _timeLaserOdometry;          ///< time of current laser odometry
 
-   bool _newLaserCloudCornerLast;  ///< flag if a new last corner cloud has been received
-   bool _newLaserCloudSurfLast;    ///< flag if a new last surface cloud has been received
-   bool _newLaserCloudFullRes;     ///< flag if a new full resolution cloud has been received
-   bool _newLaserOdometry;         ///< flag if a new laser odometry has been received
    bool _outputTransforms;          //< whether or not to publish transforms to tf
 
+   int _latencyReportFrames;                 ///< number of processed frames per latency report (0 = disabled)
+   std::vector<double> _processLatencies;    ///< process() durations of the current report window (in seconds)
+   std::vector<double> _endToEndLatencies;   ///< odometry stamp to publish durations of the current report window
+   MappingStats _reportedStats;              ///< mapping statistics at the last report
+
+   std::string _mapSnapshotFile;             ///< map snapshot file (empty = disabled)
+   float _mapSnapshotInterval;               ///< time between periodic snapshots (0 = only on shutdown)
+   ros::Time _lastMapSnapshotTime;           ///< time of the last snapshot request
+   size_t _reportedSnapshotFailures = 0;     ///< number of already reported snapshot failures
+   size_t _reportedFailedReloads = 0;        ///< number of already reported failed cube reloads
+
    nav_msgs::Odometry _odomAftMapped;      ///< mapping odometry message
    tf::StampedTransform _aftMappedTrans;   ///< mapping odometry transformation
 
    ros::Publisher _pubLaserCloudSurround;    ///< map cloud message publisher
+   std::thread _surroundThread;                  ///< surround map publisher thread
+   std::mutex _surroundMutex;                    ///< guards the pending surround map
+   std::condition_variable _surroundCondition;   ///< signals pending surround maps and stop requests
+   std::vector<SurroundCube> _pendingSurround;   ///< surround map cubes waiting to be published
+   ros::Time _pendingSurroundStamp;              ///< time stamp of the pending surround map
+   bool _surroundPending = false;                ///< flag if a surround map is waiting to be published
+   bool _stopSurroundThread = false;             ///< request to stop the surround map publisher thread
    ros::Publisher _pubLaserCloudFullRes;     ///< current full resolution cloud message publisher
    ros::Publisher _pubOdomAftMapped;         ///< mapping odometry publisher
+   ros::Publisher _pubOptimizationStatus;    ///< optimization status publisher
+   bool _publishOptimizationStatus = false;  ///< flag if the optimization status of every frame is published
    tf::TransformBroadcaster _tfBroadcaster;  ///< mapping odometry transform broadcaster
 
-   ros::Subscriber _subLaserCloudCornerLast;   ///< last corner cloud message subscriber
-   ros::Subscriber _subLaserCloudSurfLast;     ///< last surface cloud message subscriber
-   ros::Subscriber _subLaserCloudFullRes;      ///< full resolution cloud message subscriber
-   ros::Subscriber _subLaserOdometry;          ///< laser odometry message subscriber
+   ros::Subscriber _subOdometryFeatures;       ///< odometry features message subscriber
+   CloudCodec _cloudCodec;                     ///< decoder of the received clouds
+   ProfilingReporter _profilingReporter;       ///< diagnostics publisher of the hot path probes
    ros::Subscriber _subImu;                    ///< IMU message subscriber
 
-   std::string _mapOdomTopic, _initFrame, _mapFrame, _loamOdomTopic,
-               _imuInputTopic;
+   std::string _mapOdomTopic, _initFrame, _mapFrame, _imuInputTopic;
 };
 
 } // end namespace loam
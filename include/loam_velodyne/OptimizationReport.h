@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <vector>
+
+#include "CircularBuffer.h"
+#include "time_utils.h"
+
+namespace loam
+{
+
+/** \brief Convergence and quality of the pose optimization of one frame.
+ *
+ * Residuals are root mean squares of the weighted point to line / plane distances of the selected
+ * correspondences (in meters), before the pose update of an iteration. The eigenvalues of the first
+ * iteration's normal equations reveal poorly constrained directions, the first degenerateDirections
+ * of them (ascending) were below the degeneracy threshold and excluded from the pose updates.
+ */
+struct OptimizationReport
+{
+   Time stamp;                          ///< time of the processed sweep
+   long frame = 0;                      ///< number of the processed frame
+   bool optimized = false;              ///< flag if the pose was optimized (too few points otherwise)
+   size_t iterations = 0;               ///< number of iterations run
+   size_t maxIterations = 0;            ///< iteration limit of the frame
+   bool converged = false;              ///< flag if the last pose update fell below the abort thresholds
+   size_t features = 0;                 ///< number of features searched for correspondences per iteration
+   size_t initialPointSelNum = 0;       ///< number of correspondences of the first iteration
+   size_t pointSelNum = 0;              ///< number of correspondences of the last iteration
+   float initialResidual = 0;           ///< residual of the first iteration
+   float finalResidual = 0;             ///< residual of the last iteration
+   std::array<float, 6> eigenvalues{};  ///< eigenvalues of the first iteration (ascending)
+   size_t degenerateDirections = 0;     ///< number of eigenvalues below the degeneracy threshold
+   float deltaR = 0;                    ///< rotation update of the last iteration (in degrees)
+   float deltaT = 0;                    ///< translation update of the last iteration (in centimeters)
+   double optimizationTime = 0;         ///< run time of the optimization (in seconds)
+   double frameTime = 0;                ///< run time of the whole frame (in seconds)
+
+   bool degenerate() const { return degenerateDirections > 0; }
+};
+
+/** \brief Thread safe history of the most recent optimization reports.
+ *
+ * Adding a report copies it into a preallocated ring buffer, so the history can be kept for every frame.
+ */
+class OptimizationReportHistory
+{
+public:
+   explicit OptimizationReportHistory(size_t capacity = 100) : _reports(capacity) {}
+
+   void push(const OptimizationReport& report)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _reports.push(report);
+   }
+
+   /** \brief The reports in the history, oldest first. */
+   std::vector<OptimizationReport> reports() const
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::vector<OptimizationReport> reports;
+      reports.reserve(_reports.size());
+      for (size_t i = 0; i < _reports.size(); i++)
+         reports.push_back(_reports[i]);
+      return reports;
+   }
+
+private:
+   mutable std::mutex _mutex;                        ///< guards the reports
+   CircularBuffer<OptimizationReport> _reports;      ///< most recent reports
+};
+
+} // end namespace loam
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "BasicLaserMapping.h"
+#include "BasicLaserOdometry.h"
+#include "BasicScanRegistration.h"
+#include "BasicTransformMaintenance.h"
+#include "MultiScanMapper.h"
+#include "SpscQueue.h"
+#include "Twist.h"
+#include "time_utils.h"
+
+namespace loam
+{
+
+/** \brief Run times of the pipeline stages, accumulated over all pushed clouds. */
+struct PipelineStageTimes
+{
+   StageTime registration;   ///< scan registration
+   StageTime odometry;       ///< laser odometry and transform maintenance
+   StageTime mapping;        ///< laser mapping (only frames handed on to the mapping)
+   StageTime frame;          ///< total time of a pushed cloud (sequential execution only)
+};
+
+/** \brief Handling of odometry frames the mapping can't keep up with (pipelined execution only). */
+enum class MappingQueuePolicy
+{
+   BLOCK,   ///< wait for the mapping, throttling odometry, registration and finally pushCloud()
+   DROP     ///< skip the mapping for the frame, the odometry keeps running at full rate
+};
+
+/** \brief Queue sizes and policies of the pipelined execution. */
+struct PipelineQueueParams
+{
+   size_t inputQueueSize = 2;      ///< sweeps waiting for the registration
+   size_t odometryQueueSize = 2;   ///< registered sweeps waiting for the odometry
+   size_t mappingQueueSize = 1;    ///< odometry frames waiting for the mapping (the mapping lag)
+   size_t imuQueueSize = 512;      ///< IMU measurements waiting for the registration and for the mapping
+   MappingQueuePolicy mappingPolicy = MappingQueuePolicy::BLOCK;
+};
+
+/** \brief Statistics of one stage queue, accumulated by its producer. */
+struct QueueStats
+{
+   size_t pushed = 0;         ///< number of queued elements
+   size_t dropped = 0;        ///< number of elements dropped as the queue was full
+   size_t maxDepth = 0;       ///< maximum number of queued elements (after a push)
+   size_t depthSum = 0;       ///< sum of the queue depths after each push
+   double blockedTime = 0;    ///< time the producer waited for a free slot (in seconds)
+
+   double meanDepth() const { return pushed > 0 ? double(depthSum) / pushed : 0; }
+};
+
+/** \brief Statistics of the stage queues of the pipelined execution. */
+struct PipelineQueueStats
+{
+   QueueStats input;      ///< pushCloud() to registration
+   QueueStats odometry;   ///< registration to odometry
+   QueueStats mapping;    ///< odometry to mapping
+   size_t droppedImu = 0;   ///< IMU measurements dropped as an IMU queue was full
+};
+
+
+
+/** \brief In-process LOAM pipeline, running all four components without ROS.
+ *
+ * By default, every pushed cloud runs through scan registration and laser odometry on the calling
+ * thread, every ioRatio-th odometry frame also through laser mapping. All resulting poses are
+ * reported through the callbacks before pushCloud() returns, so the caller can measure the end to
+ * end latency around that call.
+ *
+ * After startThreads(), the three stages run concurrently on their own threads, connected by bounded
+ * lock-free queues: registration of sweep N+1, odometry of sweep N and mapping of sweep N-k overlap,
+ * so the sustainable sweep rate is limited by the slowest stage instead of the summed latency. The
+ * callbacks are then invoked from the odometry and mapping threads.
+ *
+ * In both modes, the clouds are moved from one stage to the next in recycled frames. Only the last
+ * feature clouds of the odometry are copied, as the odometry keeps them as reference for the next
+ * sweep. The poses are given in the LOAM camera_init frame (z forward, x left, y up), as published
+ * by the respective ROS nodes.
+ */
+class Pipeline
+{
+public:
+   /** \brief Pose callback, receiving the sweep time and the pose. */
+   typedef std::function<void(const Time& stamp, const Twist& pose)> PoseCallback;
+
+   /** \brief Create a new pipeline.
+    *
+    * @param scanMapper the mapping of vertical point angles to scan rings of the lidar
+    * @param config the scan registration parameters
+    * @param ioRatio the ratio of odometry frames per mapping frame
+    */
+   explicit Pipeline(const MultiScanMapper& scanMapper = MultiScanMapper(),
+                     const RegistrationParams& config = RegistrationParams(),
+                     uint16_t ioRatio = 2);
+
+   /** \brief Stop the stage threads, if running. */
+   ~Pipeline();
+
+   /** \brief Process a new lidar sweep.
+    *
+    * In pipelined execution, the sweep is queued for the registration, waiting for a free slot if
+    * the input queue is full (back-pressure).
+    *
+    * @param points the sweep points in the lidar frame
+    * @param scanTime the sweep time
+    * @return true, if the sweep was processed by the laser mapping (sequential execution), or if the
+    * sweep was queued (pipelined execution)
+    */
+   bool pushCloud(const pcl::PointCloud<pcl::PointXYZ>& points, const Time& scanTime);
+
+   /** \brief Add a new IMU measurement, already rotated to the lidar frame.
+    *
+    * @param stamp the measurement time
+    * @param roll the roll angle (rad)
+    * @param pitch the pitch angle (rad)
+    * @param yaw the yaw angle (rad)
+    * @param linearAcceleration the measured linear acceleration, including gravity (m/s^2)
+    */
+   void pushImu(const Time& stamp, double roll, double pitch, double yaw, const Vector3& linearAcceleration);
+
+   /** \brief Run the registration, odometry and mapping stages on their own threads.
+    *
+    * pushCloud() and pushImu() must then be called from a single thread only.
+    *
+    * @param params the queue sizes and the mapping queue policy
+    */
+   void startThreads(const PipelineQueueParams& params = PipelineQueueParams());
+
+   /** \brief Process all queued sweeps, then stop the stage threads and return to sequential execution. */
+   void stopThreads();
+
+   /** \brief Wait until all queued sweeps have been processed (pipelined execution). */
+   void flush();
+
+   bool threaded() const { return _threaded; }
+
+   /** \brief Set the callback for the laser odometry pose (at sweep rate). */
+   void setOdometryCallback(PoseCallback callback) { _odometryCallback = std::move(callback); }
+
+   /** \brief Set the callback for the laser mapping pose (at mapping rate). */
+   void setMappingCallback(PoseCallback callback) { _mappingCallback = std::move(callback); }
+
+   /** \brief Set the callback for the odometry pose corrected by the last mapping result (at sweep rate). */
+   void setIntegratedCallback(PoseCallback callback) { _integratedCallback = std::move(callback); }
+
+   void setScanMapper(const MultiScanMapper& scanMapper) { _scanMapper = scanMapper; }
+   void setIoRatio(uint16_t val) { _ioRatio = val; }
+
+   auto const& scanMapper() const { return _scanMapper; }
+   auto ioRatio() const { return _ioRatio; }
+
+   /** \brief The components, e.g. for configuring them or for accessing their clouds.
+    *
+    * The components must not be accessed while the stage threads are running.
+    */
+   BasicScanRegistration& registration() { return _registration; }
+   BasicLaserOdometry& odometry() { return _odometry; }
+   BasicLaserMapping& mapping() { return _mapping; }
+   BasicTransformMaintenance& transformMaintenance() { return _transformMaintenance; }
+
+   /** \brief The accumulated stage run times. */
+   PipelineStageTimes stageTimes() const;
+
+   /** \brief The accumulated stage queue statistics of the pipelined execution. */
+   PipelineQueueStats queueStats() const;
+
+private:
+   /** Sweep waiting for the registration. */
+   struct InputFrame
+   {
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+      Time scanTime;
+      pcl::PointCloud<pcl::PointXYZ> points;
+   };
+
+   /** Registered sweep, handed from the registration to the odometry. */
+   struct SweepFrame
+   {
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+      Time sweepTime;
+      pcl::PointCloud<pcl::PointXYZI> cornerPointsSharp;
+      pcl::PointCloud<pcl::PointXYZI> cornerPointsLessSharp;
+      pcl::PointCloud<pcl::PointXYZI> surfacePointsFlat;
+      pcl::PointCloud<pcl::PointXYZI> surfacePointsLessFlat;
+      pcl::PointCloud<pcl::PointXYZI> laserCloud;
+      pcl::PointCloud<pcl::PointXYZ> imuTrans;
+   };
+
+   /** Odometry result, handed from the odometry to the mapping. */
+   struct MappingFrame
+   {
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+      Time sweepTime;
+      pcl::PointCloud<pcl::PointXYZI> cornerCloudLast;
+      pcl::PointCloud<pcl::PointXYZI> surfaceCloudLast;
+      pcl::PointCloud<pcl::PointXYZI> laserCloud;
+      Twist transformSum;
+   };
+
+   /** IMU measurement waiting for the registration or mapping thread. */
+   struct ImuMeasurement
+   {
+      Time stamp;
+      double roll, pitch, yaw;
+      float acc[3];
+   };
+
+   /** Stage queue, returning the consumed frames to the producer for reuse. */
+   template <class Frame>
+   struct FrameQueue
+   {
+      explicit FrameQueue(size_t capacity) : queue(capacity), recycled(capacity + 1) {}
+
+      /** \brief A frame to fill, reused if available (producer only). */
+      std::unique_ptr<Frame> acquire()
+      {
+         std::unique_ptr<Frame> frame;
+         if (!recycled.tryPop(frame))
+            frame.reset(new Frame());
+         return frame;
+      }
+
+      /** \brief Return a consumed frame for reuse (consumer only). */
+      void release(std::unique_ptr<Frame>& frame) { recycled.tryPush(frame); frame.reset(); }
+
+      SpscQueue<std::unique_ptr<Frame>> queue;      ///< frames waiting for the consumer
+      SpscQueue<std::unique_ptr<Frame>> recycled;   ///< consumed frames waiting for reuse
+   };
+
+   /** \brief Run the scan registration and move its result into the given frame. */
+   void registerSweep(const pcl::PointCloud<pcl::PointXYZ>& points, const Time& scanTime, SweepFrame& frame);
+
+   /** \brief Run the laser odometry and transform maintenance on a registered sweep.
+    *
+    * @param frame the registered sweep, receiving the previous odometry buffers in exchange
+    * @param mappingFrame the frame to fill for the mapping
+    * @return true, if the frame is to be handed on to the mapping
+    */
+   bool runOdometry(SweepFrame& frame, MappingFrame& mappingFrame);
+
+   /** \brief Run the laser mapping on an odometry result.
+    *
+    * @param frame the odometry result, receiving the previous mapping buffers in exchange
+    * @return true, if the mapping produced a new pose
+    */
+   bool runMapping(MappingFrame& frame);
+
+   /** \brief Queue an element, waiting for a free slot (unless dropping) and updating the queue statistics.
+    *
+    * A stop request doesn't interrupt the wait, stopThreads() lets every stage drain its queue first.
+    *
+    * @return true, if the element was queued, false if the queue was full and drop was set
+    */
+   template <class T>
+   bool pushTo(SpscQueue<T>& queue, T& element, QueueStats& stats, bool drop);
+
+   void registrationLoop();
+   void odometryLoop();
+   void mappingLoop();
+
+   /** \brief Apply the IMU measurements queued for the registration. */
+   void applyRegistrationImu();
+
+   /** \brief Apply the IMU measurements queued for the mapping. */
+   void applyMappingImu();
+
+private:
+   MultiScanMapper _scanMapper;   ///< mapping of vertical point angles to scan rings
+   uint16_t _ioRatio;             ///< ratio of odometry frames per mapping frame
+
+   BasicScanRegistration _registration;
+   BasicLaserOdometry _odometry;
+   BasicLaserMapping _mapping;
+   BasicTransformMaintenance _transformMaintenance;
+   std::mutex _transformMutex;   ///< guards the transform maintenance, updated by odometry and mapping
+
+   PoseCallback _odometryCallback;     ///< laser odometry pose callback
+   PoseCallback _mappingCallback;      ///< laser mapping pose callback
+   PoseCallback _integratedCallback;   ///< integrated pose callback
+
+   SweepFrame _sweepFrame;                                ///< sweep frame of the sequential execution
+   std::unique_ptr<MappingFrame> _mappingFrame{ new MappingFrame() };   ///< mapping frame of the sequential execution
+
+   bool _threaded = false;                            ///< flag if the stage threads are running
+   PipelineQueueParams _queueParams;                  ///< queue sizes and policies of the running threads
+   std::unique_ptr<FrameQueue<InputFrame>> _inputQueue;        ///< pushCloud() to registration
+   std::unique_ptr<FrameQueue<SweepFrame>> _odometryQueue;     ///< registration to odometry
+   std::unique_ptr<FrameQueue<MappingFrame>> _mappingQueue;    ///< odometry to mapping
+   std::unique_ptr<SpscQueue<ImuMeasurement>> _registrationImu;   ///< pushImu() to registration
+   std::unique_ptr<SpscQueue<ImuMeasurement>> _mappingImu;        ///< pushImu() to mapping
+   std::atomic<bool> _stopRequested{ false };      ///< request to finish the queued sweeps and stop
+   std::atomic<bool> _registrationDone{ false };   ///< flag if the registration thread finished
+   std::atomic<bool> _odometryDone{ false };       ///< flag if the odometry thread finished
+   std::atomic<size_t> _pendingSweeps{ 0 };        ///< pushed sweeps not yet fully processed
+   std::thread _registrationThread;
+   std::thread _odometryThread;
+   std::thread _mappingThread;
+
+   mutable std::mutex _statsMutex;     ///< guards the stage times and queue statistics
+   PipelineStageTimes _stageTimes;     ///< accumulated stage run times
+   PipelineQueueStats _queueStats;     ///< accumulated stage queue statistics
+};
+
+} // end namespace loam
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace loam
+{
+
+/** \brief Kind of an instrumentation probe. */
+enum class ProbeType
+{
+   TIMER,       ///< run times of a scope (in nanoseconds)
+   COUNTER,     ///< summed increments
+   HISTOGRAM    ///< distribution of recorded non negative integer values
+};
+
+/** \brief Aggregated values of an instrumentation probe. */
+struct ProbeStats
+{
+   /** Number of histogram buckets: bucket 0 counts zeros, bucket i > 0 the values in [2^(i-1), 2^i). */
+   static const size_t BUCKET_NUM = 65;
+
+   std::string name;
+   ProbeType type = ProbeType::TIMER;
+   uint64_t count = 0;   ///< number of recorded values (timed scopes, increments)
+   uint64_t sum = 0;     ///< sum of the recorded values
+   uint64_t min = 0;     ///< smallest recorded value
+   uint64_t max = 0;     ///< largest recorded value
+   std::array<uint64_t, BUCKET_NUM> buckets{};   ///< log2 histogram of the recorded values
+
+   double mean() const { return count > 0 ? double(sum) / count : 0; }
+
+   /** \brief Upper bound of the given percentile (0 - 100), resolved to the histogram buckets. */
+   uint64_t percentile(double p) const;
+
+   /** \brief One line summary of the values, timers in milliseconds. */
+   std::string summary() const;
+};
+
+/** \brief Lock-free aggregate of the values recorded at one instrumentation point. */
+class Probe
+{
+public:
+   Probe(const std::string& name, ProbeType type, uint32_t id);
+
+   /** \brief Add a value (thread safe). */
+   void record(uint64_t value);
+
+   ProbeStats stats() const;
+   void reset();
+
+   const std::string& name() const { return _name; }
+   ProbeType type() const { return _type; }
+   uint32_t id() const { return _id; }
+
+private:
+   const std::string _name;
+   const ProbeType _type;
+   const uint32_t _id;   ///< index of the probe in the profiler
+
+   std::atomic<uint64_t> _count{ 0 };
+   std::atomic<uint64_t> _sum{ 0 };
+   std::atomic<uint64_t> _min{ UINT64_MAX };
+   std::atomic<uint64_t> _max{ 0 };
+   std::array<std::atomic<uint64_t>, ProbeStats::BUCKET_NUM> _buckets;
+};
+
+/** \brief Process wide registry of the instrumentation probes, with an optional event trace.
+ *
+ * The probes are placed with the LOAM_SCOPED_TIMER, LOAM_COUNT and LOAM_HISTOGRAM macros, which
+ * compile to nothing unless LOAM_PROFILING is defined. Recording a value only updates a few relaxed
+ * atomics. While tracing is enabled, every value is additionally kept as event in a ring buffer,
+ * which can be written in the Chrome trace format (chrome://tracing, Perfetto) to inspect the
+ * timeline of individual frames across all threads.
+ */
+class Profiler
+{
+public:
+   static Profiler& instance();
+
+   /** \brief The probe with the given name, registered on first use. Probes live as long as the process. */
+   Probe& probe(const std::string& name, ProbeType type);
+
+   /** \brief Record a value of a counter or histogram probe. */
+   static void record(Probe& probe, uint64_t value)
+   {
+      probe.record(value);
+      Profiler& profiler = instance();
+      if (profiler.tracing())
+         profiler.traceValue(probe, value);
+   }
+
+   /** \brief The aggregated values of all probes, in registration order. */
+   std::vector<ProbeStats> snapshot() const;
+
+   /** \brief Reset the aggregated values of all probes. */
+   void reset();
+
+   /** \brief Start tracing into a ring buffer of the given number of events (0 to stop tracing).
+    *
+    * Restarting the trace drops the events recorded so far.
+    */
+   void setTraceCapacity(size_t events);
+
+   bool tracing() const { return _tracing.load(std::memory_order_relaxed); }
+
+   /** \brief Name the calling thread in the trace. */
+   void setThreadName(const std::string& name);
+
+   /** \brief Add a timed scope to the trace. */
+   void traceScope(const Probe& probe, uint64_t start, uint64_t duration);
+
+   /** \brief Add a counter or histogram value to the trace. */
+   void traceValue(const Probe& probe, uint64_t value);
+
+   /** \brief Write the traced events in the Chrome trace event format.
+    *
+    * @return true, if the file was written successfully
+    */
+   bool writeChromeTrace(const std::string& file) const;
+
+   /** \brief Monotonic time in nanoseconds, as used for the trace. */
+   static uint64_t now();
+
+private:
+   Profiler() = default;
+
+   /** Traced probe value. */
+   struct TraceEvent
+   {
+      uint32_t probe;      ///< probe id
+      uint32_t thread;     ///< trace thread id
+      uint64_t time;       ///< start of a scope or time of a value (in nanoseconds)
+      uint64_t value;      ///< duration of a scope (in nanoseconds) or the recorded value
+   };
+
+   /** \brief Small sequential id of the calling thread. */
+   static uint32_t threadId();
+
+   void addEvent(const TraceEvent& event);
+
+   mutable std::mutex _probeMutex;   ///< guards the probe registry
+   std::deque<Probe> _probes;        ///< registered probes (stable addresses)
+
+   std::atomic<bool> _tracing{ false };                  ///< flag if tracing is enabled
+   mutable std::mutex _traceMutex;                       ///< guards the trace buffer and the thread names
+   std::vector<TraceEvent> _trace;                       ///< trace ring buffer
+   size_t _traceCapacity = 0;                            ///< maximum number of traced events
+   size_t _traceNext = 0;                                ///< next trace buffer slot
+   bool _traceWrapped = false;                           ///< flag if the trace buffer was filled once
+   std::vector<std::pair<uint32_t, std::string>> _threadNames;   ///< named trace threads
+};
+
+/** \brief Timer recording the run time of its scope, or up to stop(), to a timer probe. */
+class ScopedTimer
+{
+public:
+   explicit ScopedTimer(Probe& probe) : _probe(&probe), _start(Profiler::now()) {}
+   ~ScopedTimer() { stop(); }
+
+   ScopedTimer(const ScopedTimer&) = delete;
+   ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+   /** \brief Record the time elapsed so far, only the first call counts. */
+   void stop()
+   {
+      if (!_probe)
+         return;
+
+      const uint64_t duration = Profiler::now() - _start;
+      _probe->record(duration);
+      Profiler& profiler = Profiler::instance();
+      if (profiler.tracing())
+         profiler.traceScope(*_probe, _start, duration);
+      _probe = nullptr;
+   }
+
+private:
+   Probe* _probe;     ///< the probe to record to, null once stopped
+   uint64_t _start;   ///< start time (in nanoseconds)
+};
+
+} // end namespace loam
+
+
+#ifdef LOAM_PROFILING
+
+/** The probe of the given name and type, looked up once per instrumentation point. */
+#define LOAM_PROBE(name, type) \
+   ([]() -> ::loam::Probe& { static ::loam::Probe& probe = ::loam::Profiler::instance().probe(name, type); return probe; }())
+
+/** Time the enclosing scope as variable var, LOAM_STOP_TIMER(var) ends the measurement early. */
+#define LOAM_SCOPED_TIMER(var, name) ::loam::ScopedTimer var(LOAM_PROBE(name, ::loam::ProbeType::TIMER))
+#define LOAM_STOP_TIMER(var) var.stop()
+
+/** Add n to a counter. */
+#define LOAM_COUNT(name, n) ::loam::Profiler::record(LOAM_PROBE(name, ::loam::ProbeType::COUNTER), uint64_t(n))
+
+/** Record a non negative integer value in a histogram. */
+#define LOAM_HISTOGRAM(name, value) ::loam::Profiler::record(LOAM_PROBE(name, ::loam::ProbeType::HISTOGRAM), uint64_t(value))
+
+#else
+
+#define LOAM_SCOPED_TIMER(var, name) do {} while (0)
+#define LOAM_STOP_TIMER(var) do {} while (0)
+#define LOAM_COUNT(name, n) do {} while (0)
+#define LOAM_HISTOGRAM(name, value) do {} while (0)
+
+#endif
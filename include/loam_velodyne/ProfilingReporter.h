@@ -0,0 +1,50 @@
+#ifndef LOAM_PROFILINGREPORTER_H
+#define LOAM_PROFILINGREPORTER_H
+
+
+#include <atomic>
+#include <string>
+
+#include <ros/node_handle.h>
+#include <ros/ros.h>
+
+namespace loam {
+
+/** \brief Periodic ROS diagnostics publication of the profiler probes, with an optional Chrome trace dump.
+ *
+ * Every LOAM component owns a reporter, but only the first one set up in a process reports, so nodelets
+ * sharing a process don't publish the process wide probes several times.
+ */
+class ProfilingReporter {
+public:
+  ProfilingReporter() = default;
+  ~ProfilingReporter();
+
+  ProfilingReporter(const ProfilingReporter&) = delete;
+  ProfilingReporter& operator=(const ProfilingReporter&) = delete;
+
+  /** \brief Setup the reporter from the profiling parameters.
+   *
+   * @param node the ROS node handle
+   * @param privateNode the private ROS node handle
+   * @return true, if the parameters are valid
+   */
+  bool setup(ros::NodeHandle& node, ros::NodeHandle& privateNode);
+
+private:
+  /** \brief Publish the aggregated probe values as diagnostics. */
+  void publishDiagnostics(const ros::WallTimerEvent& event);
+
+  bool _owner = false;        ///< flag if this reporter reports for the process
+  std::string _traceFile;     ///< Chrome trace file written on destruction, empty if not tracing
+
+  ros::Publisher _pubDiagnostics;   ///< diagnostics publisher
+  ros::WallTimer _timer;            ///< publication timer
+
+  static std::atomic<bool> _claimed;   ///< flag if a reporter of this process reports already
+};
+
+} // end namespace loam
+
+
+#endif //LOAM_PROFILINGREPORTER_H
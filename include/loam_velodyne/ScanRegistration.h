@@ -38,11 +38,13 @@
 #include <stdint.h>
 
 #include <geometry_msgs/TransformStamped.h>
+#include <loam_velodyne/SweepFeatures.h>
 #include <ros/node_handle.h>
 #include <sensor_msgs/Imu.h>
 #include <tf2_ros/transform_listener.h>
 
 #include "BasicScanRegistration.h"
+#include "ProfilingReporter.h"
 #include "RotateIMUData.h"
 
 namespace loam {
@@ -91,15 +93,10 @@ private:
                     ///< data
   bool _transformIMU;
   ros::Subscriber _subImu;       ///< IMU message subscriber
-  ros::Publisher _pubLaserCloud; ///< full resolution cloud message publisher
-  ros::Publisher
-      _pubCornerPointsSharp; ///< sharp corner cloud message publisher
-  ros::Publisher
-      _pubCornerPointsLessSharp; ///< less sharp corner cloud message publisher
-  ros::Publisher _pubSurfPointsFlat; ///< flat surface cloud message publisher
-  ros::Publisher
-      _pubSurfPointsLessFlat;  ///< less flat surface cloud message publisher
-  ros::Publisher _pubImuTrans; ///< IMU transformation message publisher
+  ros::Publisher _pubSweepFeatures; ///< sweep clouds and IMU transformation message publisher
+  CloudEncoding _cloudEncoding = CloudEncoding::FLOAT32; ///< encoding of the published clouds
+  CloudCodec _cloudCodec; ///< encoder of the published clouds
+  ProfilingReporter _profilingReporter; ///< diagnostics publisher of the hot path probes
   std::string _lidarFrame, _imuFrame, _imuInputTopic;
 };
 
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace loam
+{
+
+/** \brief Bounded lock-free queue for exactly one producer and one consumer thread.
+ *
+ * The elements live in a fixed ring of slots, so pushing and popping never allocates. Popped
+ * slots keep their (moved-from) element, elements with external storage (e.g. std::unique_ptr)
+ * should therefore be moved in and out instead of being copied.
+ */
+template <class T>
+class SpscQueue
+{
+public:
+   /** \brief Create a queue holding up to capacity elements. */
+   explicit SpscQueue(size_t capacity = 1) : _slots(capacity + 1), _head(0), _tail(0) {}
+
+   SpscQueue(const SpscQueue&) = delete;
+   SpscQueue& operator=(const SpscQueue&) = delete;
+
+   /** \brief Try to append an element (producer thread only).
+    *
+    * @param element the element to append, moved from on success only
+    * @return true, if the element was appended, false if the queue is full
+    */
+   bool tryPush(T& element)
+   {
+      const size_t tail = _tail.load(std::memory_order_relaxed);
+      const size_t next = increment(tail);
+      if (next == _head.load(std::memory_order_acquire))
+         return false;
+
+      _slots[tail] = std::move(element);
+      _tail.store(next, std::memory_order_release);
+      return true;
+   }
+
+   /** \brief Try to take the oldest element (consumer thread only).
+    *
+    * @param element the target for the oldest element
+    * @return true, if an element was taken, false if the queue is empty
+    */
+   bool tryPop(T& element)
+   {
+      const size_t head = _head.load(std::memory_order_relaxed);
+      if (head == _tail.load(std::memory_order_acquire))
+         return false;
+
+      element = std::move(_slots[head]);
+      _head.store(increment(head), std::memory_order_release);
+      return true;
+   }
+
+   /** \brief The number of queued elements (exact for the producer and the consumer thread, a snapshot otherwise). */
+   size_t size() const
+   {
+      const size_t head = _head.load(std::memory_order_acquire);
+      const size_t tail = _tail.load(std::memory_order_acquire);
+      return tail >= head ? tail - head : tail + _slots.size() - head;
+   }
+
+   bool empty() const { return size() == 0; }
+   size_t capacity() const { return _slots.size() - 1; }
+
+private:
+   size_t increment(size_t idx) const { return idx + 1 == _slots.size() ? 0 : idx + 1; }
+
+   /** Padding keeping head and tail on separate cache lines (explicit, as C++14 can't allocate over-aligned types). */
+   static const size_t CACHE_LINE_SIZE = 64;
+
+   std::vector<T> _slots;   ///< element ring, one slot is kept free to tell a full from an empty queue
+   char _headPadding[CACHE_LINE_SIZE];
+   std::atomic<size_t> _head;   ///< next slot to pop, written by the consumer
+   char _tailPadding[CACHE_LINE_SIZE];
+   std::atomic<size_t> _tail;   ///< next slot to push, written by the producer
+   char _endPadding[CACHE_LINE_SIZE];
+};
+
+
+
+/** \brief Progressive wait for lock-free queues: spins, yields and finally sleeps briefly between retries. */
+class Backoff
+{
+public:
+   void wait()
+   {
+      if (_count < 16)
+         ;   // busy retry, the other side is likely about to finish
+      else if (_count < 64)
+         std::this_thread::yield();
+      else
+         std::this_thread::sleep_for(std::chrono::microseconds(50));
+      _count++;
+   }
+
+   void reset() { _count = 0; }
+
+private:
+   size_t _count = 0;   ///< number of waits since the last reset
+};
+
+} // end namespace loam
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#include <Eigen/Core>
+#include <pcl/point_types.h>
+
+#include "CompactPointCloud.h"
+#include "VoxelKey.h"
+
+namespace loam
+{
+
+/** \brief Running summary statistics (mean, covariance, count) of the points within a voxel.
+ *
+ * The eigen decomposition of the covariance is computed lazily and cached until the next
+ * point is added, so repeated queries during one optimization cost a single lookup.
+ */
+class VoxelStats
+{
+public:
+   VoxelStats();
+
+   /** \brief Add a point to the running statistics. */
+   void add(const pcl::PointXYZI& point);
+
+   size_t count() const { return _count; }
+   const Eigen::Vector3f& mean() const { return _mean; }
+   Eigen::Matrix3f covariance() const;
+
+   /** \brief The covariance eigenvalues in increasing order. */
+   const Eigen::Vector3f& eigenvalues() { updateEigen(); return _eigenvalues; }
+
+   /** \brief The covariance eigenvectors (column-wise), matching the order of the eigenvalues. */
+   const Eigen::Matrix3f& eigenvectors() { updateEigen(); return _eigenvectors; }
+
+private:
+   void updateEigen();
+
+   uint32_t _count;                ///< number of accumulated points
+   Eigen::Vector3f _mean;          ///< running mean
+   Eigen::Matrix3f _scatter;       ///< running sum of squared deviations from the mean
+   bool _eigenValid;               ///< flag if the cached eigen decomposition is up to date
+   Eigen::Vector3f _eigenvalues;   ///< cached covariance eigenvalues
+   Eigen::Matrix3f _eigenvectors;  ///< cached covariance eigenvectors
+};
+
+
+
+/** \brief Hash map of voxel statistics for the feature points of one map cube.
+ *
+ * The statistics summarize the points currently stored in the cube. When the points change (insertion, down
+ * sizing, reload), the statistics are marked outdated and recomputed from the points before they are used next,
+ * so they don't depend on how the cube got its points.
+ */
+class VoxelFeatureMap
+{
+public:
+   explicit VoxelFeatureMap(const float& voxelSize = 1.0f);
+
+   /** \brief Change the voxel edge length. This discards all accumulated statistics. */
+   void setVoxelSize(const float& voxelSize);
+
+   /** \brief Mark the statistics as outdated, after the points of the cube changed. */
+   void invalidate() { _outdated = true; }
+
+   /** \brief Recompute the statistics from the points of the cube, if they are outdated. */
+   void update(const CompactPointCloud& cloud);
+
+   /** \brief Add a map point to the statistics of its voxel. */
+   void insert(const pcl::PointXYZI& point);
+
+   /** \brief Find the statistics of the voxel containing the given point.
+    *
+    * @return the voxel statistics, or nullptr if the voxel is empty
+    */
+   VoxelStats* find(const pcl::PointXYZI& point);
+
+   void clear() { _voxels.clear(); _outdated = false; }
+   size_t size() const { return _voxels.size(); }
+   float voxelSize() const { return _voxelSize; }
+
+private:
+   float _voxelSize;      ///< voxel edge length
+   float _invVoxelSize;   ///< inverse voxel edge length
+   bool _outdated;        ///< flag if the statistics lag behind the points of the cube
+   std::unordered_map<VoxelKey, VoxelStats, VoxelKeyHash> _voxels;
+};
+
+} // end namespace loam
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+namespace loam
+{
+
+/** \brief Integer coordinates of a voxel within a regular grid. */
+struct VoxelKey
+{
+   int x, y, z;
+
+   bool operator==(const VoxelKey& other) const
+   { return x == other.x && y == other.y && z == other.z; }
+};
+
+/** \brief Spatial hash for voxel keys. */
+struct VoxelKeyHash
+{
+   size_t operator()(const VoxelKey& key) const
+   {
+      return (size_t(key.x) * 73856093) ^ (size_t(key.y) * 19349663) ^ (size_t(key.z) * 83492791);
+   }
+};
+
+/** \brief Calculate the key of the voxel containing the given point.
+ *
+ * @param point the point to look up
+ * @param invVoxelSize the inverse of the voxel edge length
+ * @return the voxel key
+ */
+template <typename PointT>
+inline VoxelKey toVoxelKey(const PointT& point, const float& invVoxelSize)
+{
+   return { int(std::floor(point.x * invVoxelSize)),
+            int(std::floor(point.y * invVoxelSize)),
+            int(std::floor(point.z * invVoxelSize)) };
+}
+
+} // end namespace loam
@@ -33,10 +33,18 @@
 #ifndef LOAM_COMMON_H
 #define LOAM_COMMON_H
 
+#include <cmath>
+
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <pcl_conversions/pcl_conversions.h>
+#include <pcl_ros/point_cloud.h>
 #include <pcl/point_types.h>
+#include <loam_velodyne/CompactCloud.h>
+#include <loam_velodyne/OptimizationStatus.h>
+#include "CloudCodec.h"
+#include "OptimizationReport.h"
+#include "Profiler.h"
 #include "time_utils.h"
 
 namespace loam {
@@ -61,6 +69,144 @@ inline void publishCloudMsg(ros::Publisher& publisher,
   publisher.publish(msg);
 }
 
+/** \brief Publish a shared copy of the specified cloud via the given publisher.
+ *
+ * The publisher has to be advertised with the pcl::PointCloud<PointT> message type. Subscribers within
+ * the same process (e.g. nodelets loaded into the same manager) receive the shared cloud without any
+ * serialization, all other subscribers receive a regular sensor_msgs::PointCloud2 message.
+ *
+ * @tparam PointT the point type
+ * @param publisher the publisher instance
+ * @param cloud the cloud to publish
+ * @param stamp the time stamp of the cloud message
+ * @param frameID the message frame ID
+ */
+template <typename PointT>
+inline void publishCloud(ros::Publisher& publisher,
+                         const pcl::PointCloud<PointT>& cloud,
+                         const ros::Time& stamp,
+                         const std::string& frameID) {
+  // the published cloud is shared with the subscribers, so it must not be a buffer reused by the publishing component
+  typename pcl::PointCloud<PointT>::Ptr msg(new pcl::PointCloud<PointT>(cloud));
+  msg->header.stamp = pcl_conversions::toPCL(stamp);
+  msg->header.frame_id = frameID;
+  publisher.publish(typename pcl::PointCloud<PointT>::ConstPtr(msg));
+}
+
+/** \brief Convert a point cloud message, reusing the storage of the intermediate and the target cloud.
+ *
+ * pcl::fromROSMsg() converts through a temporary pcl::PCLPointCloud2, allocating a full copy of the
+ * message data for every message. Passing a persistent buffer keeps its capacity across messages.
+ *
+ * @tparam PointT the point type
+ * @param msg the point cloud message
+ * @param cloud the target cloud
+ * @param buffer the intermediate cloud buffer, kept across calls
+ */
+template <typename PointT>
+inline void fromROSMsg(const sensor_msgs::PointCloud2& msg,
+                       pcl::PointCloud<PointT>& cloud,
+                       pcl::PCLPointCloud2& buffer) {
+  pcl_conversions::toPCL(msg, buffer);
+  pcl::fromPCLPointCloud2(buffer, cloud);
+}
+
+
+/** \brief Parse a cloud encoding parameter value.
+ *
+ * @param name the encoding name (float32, quantized or quantized_lz4)
+ * @param encoding the parsed encoding
+ * @return true, if the name is valid
+ */
+inline bool parseCloudEncoding(const std::string& name, CloudEncoding& encoding) {
+  if (name == "float32")
+    encoding = CloudEncoding::FLOAT32;
+  else if (name == "quantized")
+    encoding = CloudEncoding::QUANTIZED;
+  else if (name == "quantized_lz4")
+    encoding = CloudEncoding::QUANTIZED_LZ4;
+  else
+    return false;
+  return true;
+}
+
+/** \brief Pack a cloud into a compact cloud message.
+ *
+ * @param cloud the cloud to pack
+ * @param msg the target message, keeping its capacity
+ * @param encoding the cloud encoding
+ * @param codec the codec for quantized encodings
+ */
+inline void toCompactCloud(const pcl::PointCloud<pcl::PointXYZI>& cloud,
+                           loam_velodyne::CompactCloud& msg,
+                           CloudEncoding encoding,
+                           CloudCodec& codec) {
+  LOAM_SCOPED_TIMER(packTimer, "cloud.pack");
+  if (encoding != CloudEncoding::FLOAT32) {
+    QuantizedCloudInfo info;
+    codec.encode(cloud, encoding == CloudEncoding::QUANTIZED_LZ4, info, msg.data);
+    msg.encoding = info.lz4 ? loam_velodyne::CompactCloud::QUANTIZED_LZ4
+                            : loam_velodyne::CompactCloud::QUANTIZED;
+    msg.pointNum = info.pointNum;
+    msg.scale = info.scale;
+    msg.intensityScale = info.intensityScale;
+    msg.points.clear();
+    return;
+  }
+
+  msg.encoding = loam_velodyne::CompactCloud::FLOAT32;
+  msg.data.clear();
+  msg.points.resize(cloud.size() * 4);
+  float* out = msg.points.data();
+  for (auto const& point : cloud) {
+    out[0] = point.x;
+    out[1] = point.y;
+    out[2] = point.z;
+    out[3] = point.intensity;
+    out += 4;
+  }
+}
+
+/** \brief Unpack a compact cloud message in any encoding, skipping non finite points.
+ *
+ * @param msg the compact cloud message
+ * @param cloud the target cloud, keeping its capacity
+ * @param codec the codec for quantized encodings
+ * @return true, if the message was unpacked, false if its encoding is unknown, unsupported or corrupt
+ */
+inline bool fromCompactCloud(const loam_velodyne::CompactCloud& msg,
+                             pcl::PointCloud<pcl::PointXYZI>& cloud,
+                             CloudCodec& codec) {
+  LOAM_SCOPED_TIMER(unpackTimer, "cloud.unpack");
+  if (msg.encoding == loam_velodyne::CompactCloud::QUANTIZED ||
+      msg.encoding == loam_velodyne::CompactCloud::QUANTIZED_LZ4) {
+    QuantizedCloudInfo info;
+    info.pointNum = msg.pointNum;
+    info.scale = msg.scale;
+    info.intensityScale = msg.intensityScale;
+    info.lz4 = msg.encoding == loam_velodyne::CompactCloud::QUANTIZED_LZ4;
+    return codec.decode(info, msg.data, cloud);
+  }
+  if (msg.encoding != loam_velodyne::CompactCloud::FLOAT32)
+    return false;
+
+  const size_t pointNum = msg.points.size() / 4;
+  cloud.resize(pointNum);
+  size_t count = 0;
+  const float* in = msg.points.data();
+  for (size_t i = 0; i < pointNum; i++, in += 4) {
+    pcl::PointXYZI& point = cloud.points[count];
+    point.x = in[0];
+    point.y = in[1];
+    point.z = in[2];
+    point.intensity = in[3];
+    count += std::isfinite(point.x) && std::isfinite(point.y) && std::isfinite(point.z);
+  }
+  cloud.resize(count);
+  cloud.is_dense = true;
+  return true;
+}
+
 
 // ROS time adapters
 inline Time fromROSTime(ros::Time const& rosTime)
@@ -75,6 +221,32 @@ inline ros::Time toROSTime(Time const& time_point)
   return ros::Time().fromNSec(std::chrono::duration_cast<std::chrono::nanoseconds>(time_point.time_since_epoch()).count());
 }
 
+/** \brief Convert an optimization report to a status message.
+ *
+ * @param report the optimization report
+ * @param msg the target message
+ */
+inline void toStatusMsg(const OptimizationReport& report, loam_velodyne::OptimizationStatus& msg) {
+  msg.header.stamp = toROSTime(report.stamp);
+  msg.frame = uint32_t(report.frame);
+  msg.optimized = report.optimized;
+  msg.iterations = uint32_t(report.iterations);
+  msg.maxIterations = uint32_t(report.maxIterations);
+  msg.converged = report.converged;
+  msg.features = uint32_t(report.features);
+  msg.initialPointSelNum = uint32_t(report.initialPointSelNum);
+  msg.pointSelNum = uint32_t(report.pointSelNum);
+  msg.initialResidual = report.initialResidual;
+  msg.finalResidual = report.finalResidual;
+  for (size_t i = 0; i < 6; i++)
+    msg.eigenvalues[i] = report.eigenvalues[i];
+  msg.degenerateDirections = uint8_t(report.degenerateDirections);
+  msg.deltaR = report.deltaR;
+  msg.deltaT = report.deltaT;
+  msg.optimizationTime = float(report.optimizationTime);
+  msg.frameTime = float(report.frameTime);
+}
+
 } // end namespace loam
 
 #endif // LOAM_COMMON_H
@@ -545,6 +545,10 @@ inline T* allocate(size_t count = 1)
      * how long to keep an object is made at the time of allocation, and there
      * is no need to track down all the objects to free them.
      *
+     * reset() releases all objects at once as well, but keeps the standard size
+     * blocks for later allocations, so an index rebuilt over and over again
+     * stops requesting memory from the system once the pool has grown large enough.
+     *
      */
 
 const size_t     WORDSIZE = 16;
@@ -561,6 +565,10 @@ class PooledAllocator
     size_t  remaining;  /* Number of bytes left in current block of storage. */
     void*   base;     /* Pointer to base of current block of storage. */
     void*   loc;      /* Current location in block to next allocate memory. */
+    void*   spare;    /* Standard size blocks kept by reset(), linked like the used blocks. */
+
+    /* Each block starts with a header of the pointer to the previous block and the block size. */
+    static const size_t HEADERSIZE = 2 * sizeof(void*);
 
     void internal_init()
     {
@@ -573,11 +581,12 @@ class PooledAllocator
 public:
     size_t  usedMemory;
     size_t  wastedMemory;
+    size_t  blockAllocations;   /* Number of blocks requested from the system over the pool lifetime. */
 
     /**
             Default constructor. Initializes a new pool.
          */
-    PooledAllocator() {
+    PooledAllocator() : spare(NULL), blockAllocations(0) {
         internal_init();
     }
 
@@ -590,10 +599,26 @@ public:
 
     /** Frees all allocated memory chunks */
     void free_all()
+    {
+        reset();
+        while (spare != NULL) {
+            void *prev = *(static_cast<void**>( spare)); /* Get pointer to prev block. */
+            ::free(spare);
+            spare = prev;
+        }
+    }
+
+    /** Releases all allocated objects, keeping the standard size blocks for reuse */
+    void reset()
     {
         while (base != NULL) {
             void *prev = *(static_cast<void**>( base)); /* Get pointer to prev block. */
-            ::free(base);
+            if (static_cast<size_t*>(base)[1] == BLOCKSIZE) {
+                static_cast<void**>(base)[0] = spare;
+                spare = base;
+            } else {
+                ::free(base);
+            }
             base = prev;
         }
         internal_init();
@@ -619,25 +644,34 @@ public:
             wastedMemory += remaining;
 
             /* Allocate new storage. */
-            const size_t blocksize = (size + sizeof(void*) + (WORDSIZE - 1) > BLOCKSIZE) ?
-                        size + sizeof(void*) + (WORDSIZE - 1) : BLOCKSIZE;
-
-            // use the standard C malloc to allocate memory
-            void* m = ::malloc(blocksize);
-            if (!m) {
-                fprintf(stderr, "Failed to allocate memory.\n");
-                return NULL;
+            const size_t blocksize = (size + HEADERSIZE + (WORDSIZE - 1) > BLOCKSIZE) ?
+                        size + HEADERSIZE + (WORDSIZE - 1) : BLOCKSIZE;
+
+            void* m;
+            if (blocksize == BLOCKSIZE && spare != NULL) {
+                /* Reuse a block kept by reset(). */
+                m = spare;
+                spare = static_cast<void**>(spare)[0];
+            } else {
+                // use the standard C malloc to allocate memory
+                m = ::malloc(blocksize);
+                if (!m) {
+                    fprintf(stderr, "Failed to allocate memory.\n");
+                    return NULL;
+                }
+                blockAllocations++;
             }
 
-            /* Fill first word of new block with pointer to previous block. */
+            /* Fill the header of the new block with the pointer to the previous block and its size. */
             static_cast<void**>(m)[0] = base;
+            static_cast<size_t*>(m)[1] = blocksize;
             base = m;
 
             size_t shift = 0;
             //int size_t = (WORDSIZE - ( (((size_t)m) + sizeof(void*)) & (WORDSIZE-1))) & (WORDSIZE-1);
 
-            remaining = blocksize - sizeof(void*) - shift;
-            loc = (static_cast<char*>(m) + sizeof(void*) + shift);
+            remaining = blocksize - HEADERSIZE - shift;
+            loc = (static_cast<char*>(m) + HEADERSIZE + shift);
         }
         void* rloc = loc;
         loc = static_cast<char*>(loc) + size;
@@ -808,7 +842,7 @@ public:
     /** Frees the previously-built index. Automatically called within buildIndex(). */
     void freeIndex(Derived &obj)
     {
-        obj.pool.free_all();
+        obj.pool.reset();
         obj.root_node = NULL;
         obj.m_size_at_index_build = 0;
     }
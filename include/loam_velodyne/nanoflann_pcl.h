@@ -49,15 +49,24 @@
 namespace nanoflann
 {
 
+// Placeholder view type of the trees only indexing clouds, setInputSegments is of no use with it.
+struct NoSegments
+{
+    size_t size () const { return 0; }
+    float coordinate (size_t, int) const { return 0; }
+};
+
 // Adapter class to give to nanoflann the same "look and fell" of pcl::KdTreeFLANN.
 // limited to squared distance between 3D points
-template <typename PointT>
+// SegmentsT is the view type accepted by setInputSegments, any type providing size()
+// and coordinate(idx, dim) (e.g. loam::MapPointView, decoding the quantized map points).
+template <typename PointT, typename SegmentsT = NoSegments>
 class KdTreeFLANN
 {
 public:
 
-    typedef boost::shared_ptr<KdTreeFLANN<PointT> > Ptr;
-    typedef boost::shared_ptr<const KdTreeFLANN<PointT> > ConstPtr;
+    typedef boost::shared_ptr<KdTreeFLANN<PointT, SegmentsT> > Ptr;
+    typedef boost::shared_ptr<const KdTreeFLANN<PointT, SegmentsT> > ConstPtr;
 
     typedef typename pcl::PointCloud<PointT> PointCloud;
     typedef typename pcl::PointCloud<PointT>::Ptr PointCloudPtr;
@@ -68,26 +77,48 @@ public:
 
     KdTreeFLANN (bool sorted = true);
 
-    KdTreeFLANN (const KdTreeFLANN<PointT> &k);
+    KdTreeFLANN (const KdTreeFLANN<PointT, SegmentsT> &k);
 
     void  setEpsilon (float eps);
 
     void  setSortedResults (bool sorted);
 
-    inline Ptr makeShared () { return Ptr (new KdTreeFLANN<PointT> (*this)); }
+    inline Ptr makeShared () { return Ptr (new KdTreeFLANN<PointT, SegmentsT> (*this)); }
 
     void setInputCloud (const PointCloudPtr &cloud, const IndicesConstPtr &indices = IndicesConstPtr ());
 
+    /** \brief Build the index over the points of a segmented view instead of a single cloud.
+      * The resulting indices refer to positions within the view, which must outlive the index.
+      */
+    void setInputSegments (const SegmentsT &segments);
+
+    /** \brief Write the index (not the points) to a binary stream. */
+    void saveIndex (FILE *stream);
+
+    /** \brief Set the input cloud and load its previously saved index instead of building it.
+      * \param[in] cloud the exact cloud the index was built for
+      * \param[in] stream the binary stream written by saveIndex
+      * \return true, if the index was loaded successfully
+      */
+    bool loadIndex (const PointCloudPtr &cloud, FILE *stream);
+
     int  nearestKSearch (const PointT &point, int k, std::vector<int> &k_indices,
                          std::vector<float> &k_sqr_distances) const;
 
     int radiusSearch (const PointT &point, double radius, std::vector<int> &k_indices,
                       std::vector<float> &k_sqr_distances) const;
 
+    /** \brief Number of memory blocks requested from the system by all index builds so far.
+      * The node storage is kept between builds, so this only grows while the indexed clouds do.
+      */
+    size_t indexAllocations () const { return _kdtree.pool.blockAllocations; }
+
 private:
 
     nanoflann::SearchParams _params;
 
+    mutable std::vector<std::pair<int, float> > _radiusResults;   // reused result storage of radiusSearch
+
     struct PointCloud_Adaptor
     {
       inline size_t kdtree_get_point_count() const;
@@ -95,6 +126,7 @@ private:
       template <class BBOX> bool kdtree_get_bbox(BBOX&) const { return false; }
       PointCloudConstPtr pcl;
       IndicesConstPtr indices;
+      const SegmentsT *segments = nullptr;
     };
 
     typedef nanoflann::KDTreeSingleIndexAdaptor<
@@ -109,36 +141,66 @@ private:
 
 //---------- Definitions ---------------------
 
-template<typename PointT> inline
-KdTreeFLANN<PointT>::KdTreeFLANN(bool sorted):
+template<typename PointT, typename SegmentsT> inline
+KdTreeFLANN<PointT, SegmentsT>::KdTreeFLANN(bool sorted):
     _kdtree(3,_adaptor)
 {
     _params.sorted = sorted;
 }
 
-template<typename PointT> inline
-void KdTreeFLANN<PointT>::setEpsilon(float eps)
+template<typename PointT, typename SegmentsT> inline
+void KdTreeFLANN<PointT, SegmentsT>::setEpsilon(float eps)
 {
     _params.eps = eps;
 }
 
-template<typename PointT> inline
-void KdTreeFLANN<PointT>::setSortedResults(bool sorted)
+template<typename PointT, typename SegmentsT> inline
+void KdTreeFLANN<PointT, SegmentsT>::setSortedResults(bool sorted)
 {
     _params.sorted = sorted;
 }
 
-template<typename PointT> inline
-void KdTreeFLANN<PointT>::setInputCloud(const KdTreeFLANN::PointCloudPtr &cloud,
+template<typename PointT, typename SegmentsT> inline
+void KdTreeFLANN<PointT, SegmentsT>::setInputCloud(const KdTreeFLANN::PointCloudPtr &cloud,
                                         const IndicesConstPtr &indices)
 {
     _adaptor.pcl = cloud;
     _adaptor.indices = indices;
+    _adaptor.segments = nullptr;
+    _kdtree.buildIndex();
+}
+
+template<typename PointT, typename SegmentsT> inline
+void KdTreeFLANN<PointT, SegmentsT>::setInputSegments(const SegmentsT &segments)
+{
+    _adaptor.pcl.reset();
+    _adaptor.indices.reset();
+    _adaptor.segments = &segments;
     _kdtree.buildIndex();
 }
 
-template<typename PointT> inline
-int KdTreeFLANN<PointT>::nearestKSearch(const PointT &point, int num_closest,
+template<typename PointT, typename SegmentsT> inline
+void KdTreeFLANN<PointT, SegmentsT>::saveIndex(FILE *stream)
+{
+    _kdtree.saveIndex(stream);
+}
+
+template<typename PointT, typename SegmentsT> inline
+bool KdTreeFLANN<PointT, SegmentsT>::loadIndex(const KdTreeFLANN::PointCloudPtr &cloud, FILE *stream)
+{
+    _adaptor.pcl = cloud;
+    _adaptor.indices = IndicesConstPtr();
+    _adaptor.segments = nullptr;
+    try {
+        _kdtree.loadIndex(stream);
+    } catch (const std::runtime_error &) {
+        return false;
+    }
+    return _kdtree.vind.size() == cloud->size();
+}
+
+template<typename PointT, typename SegmentsT> inline
+int KdTreeFLANN<PointT, SegmentsT>::nearestKSearch(const PointT &point, int num_closest,
                                 std::vector<int> &k_indices,
                                 std::vector<float> &k_sqr_distances) const
 {
@@ -151,12 +213,12 @@ int KdTreeFLANN<PointT>::nearestKSearch(const PointT &point, int num_closest,
     return resultSet.size();
 }
 
-template<typename PointT> inline
-int KdTreeFLANN<PointT>::radiusSearch(const PointT &point, double radius,
+template<typename PointT, typename SegmentsT> inline
+int KdTreeFLANN<PointT, SegmentsT>::radiusSearch(const PointT &point, double radius,
                               std::vector<int> &k_indices,
                               std::vector<float> &k_sqr_distances) const
 {
-    static std::vector<std::pair<int, float> > indices_dist;
+    std::vector<std::pair<int, float> > &indices_dist = _radiusResults;
     indices_dist.reserve( 128 );
 
     RadiusResultSet<float, int> resultSet(radius, indices_dist);
@@ -174,15 +236,17 @@ int KdTreeFLANN<PointT>::radiusSearch(const PointT &point, double radius,
     return nFound;
 }
 
-template<typename PointT> inline
-size_t KdTreeFLANN<PointT>::PointCloud_Adaptor::kdtree_get_point_count() const {
+template<typename PointT, typename SegmentsT> inline
+size_t KdTreeFLANN<PointT, SegmentsT>::PointCloud_Adaptor::kdtree_get_point_count() const {
+    if( segments ) return segments->size();
     if( indices ) return indices->size();
     if( pcl)  return pcl->points.size();
     return 0;
 }
 
-template<typename PointT> inline
-float KdTreeFLANN<PointT>::PointCloud_Adaptor::kdtree_get_pt(const size_t idx, int dim) const{
+template<typename PointT, typename SegmentsT> inline
+float KdTreeFLANN<PointT, SegmentsT>::PointCloud_Adaptor::kdtree_get_pt(const size_t idx, int dim) const{
+    if( segments ) return segments->coordinate(idx, dim);
     const PointT& p = ( indices ) ? pcl->points[(*indices)[idx]] : pcl->points[idx];
     if (dim==0) return p.x;
     else if (dim==1) return p.y;
@@ -1,15 +1,31 @@
 #pragma once
 
 #include <chrono>
+#include <cstddef>
 
 namespace loam
 { 
   /** \brief A standard non-ROS alternative to ros::Time.*/
   using Time = std::chrono::system_clock::time_point;
 
+  /** \brief Monotonic clock for measuring processing durations. */
+  using SteadyClock = std::chrono::steady_clock;
+
   // helper function
-  inline double toSec(Time::duration duration)
+  template <class Rep, class Period>
+  inline double toSec(std::chrono::duration<Rep, Period> duration)
   {
     return std::chrono::duration<double>(duration).count();
   };
+
+  /** \brief Accumulated run time of a processing stage. */
+  struct StageTime
+  {
+    size_t count = 0;    ///< number of measurements
+    double last = 0;     ///< last measured duration (in seconds)
+    double total = 0;    ///< accumulated duration (in seconds)
+
+    void add(double seconds) { count++; last = seconds; total += seconds; }
+    double mean() const { return count > 0 ? total / count : 0; }
+  };
 }
@@ -32,12 +32,26 @@
 
 
 #include "loam_velodyne/BasicLaserMapping.h"
+#include "loam_velodyne/Profiler.h"
 #include "loam_velodyne/nanoflann_pcl.h"
 #include "math_utils.h"
 
 #include <Eigen/Eigenvalues>
 #include <Eigen/QR>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace loam
 {
 
@@ -47,6 +61,169 @@ using std::asin;
 using std::atan2;
 using std::pow;
 
+namespace
+{
+
+const double CUBE_SIZE = 50.0;            ///< edge length of a map cube
+const double CUBE_HALF = CUBE_SIZE / 2;
+
+const size_t HASH_ENTRY_OVERHEAD = 2 * sizeof(void*);   ///< approximate per entry cost of a hash map node
+
+const char SNAPSHOT_MAGIC[4] = { 'L', 'M', 'A', 'P' };
+const uint32_t SNAPSHOT_VERSION = 2;   ///< 2: absolute cube coordinates and quantized points
+
+/** Map snapshot file header. */
+struct MapSnapshotHeader
+{
+   char magic[4];
+   uint32_t version;
+   int32_t gridSize[3];       ///< cube grid width, height and depth
+   int32_t gridCenter[3];     ///< cube grid center offsets
+   float cubeSize;            ///< cube edge length
+   float aftMapped[6];        ///< mapping pose (rot x, y, z, pos x, y, z)
+   float befMapped[6];        ///< odometry pose of the mapping pose (rot x, y, z, pos x, y, z)
+   uint32_t cubeCount;        ///< number of cube records following the header
+};
+
+/** Map snapshot cube record, followed by the quantized corner and surface points. */
+struct MapSnapshotCube
+{
+   int32_t key[3];            ///< absolute cube coordinates
+   uint32_t cornerNum;        ///< number of corner points
+   uint32_t surfNum;          ///< number of surface points
+   float cornerOrigin[3];     ///< origin the corner points are quantized relative to
+   float surfOrigin[3];       ///< origin the surface points are quantized relative to
+};
+
+void twistToArray(const Twist& twist, float* values)
+{
+   values[0] = twist.rot_x.rad();
+   values[1] = twist.rot_y.rad();
+   values[2] = twist.rot_z.rad();
+   values[3] = twist.pos.x();
+   values[4] = twist.pos.y();
+   values[5] = twist.pos.z();
+}
+
+void arrayToTwist(const float* values, Twist& twist)
+{
+   twist.rot_x = values[0];
+   twist.rot_y = values[1];
+   twist.rot_z = values[2];
+   twist.pos.x() = values[3];
+   twist.pos.y() = values[4];
+   twist.pos.z() = values[5];
+}
+
+void writeSnapshotCube(std::ofstream& out, const VoxelKey& key,
+                       const CompactPointCloud& corner, const CompactPointCloud& surf)
+{
+   MapSnapshotCube cube = { { key.x, key.y, key.z }, uint32_t(corner.size()), uint32_t(surf.size()) };
+   Eigen::Map<Eigen::Vector3f>(cube.cornerOrigin) = corner.origin();
+   Eigen::Map<Eigen::Vector3f>(cube.surfOrigin) = surf.origin();
+   out.write(reinterpret_cast<const char*>(&cube), sizeof(cube));
+   out.write(reinterpret_cast<const char*>(corner.data()), std::streamsize(corner.bytes()));
+   out.write(reinterpret_cast<const char*>(surf.data()), std::streamsize(surf.bytes()));
+}
+
+const char MAP_INDEX_MAGIC[4] = { 'L', 'K', 'D', 'T' };
+const uint32_t MAP_INDEX_VERSION = 2;   ///< 2: index built over the quantized map points
+
+/** Localization map index file header, identifying the snapshot the index was built for. */
+struct MapIndexHeader
+{
+   char magic[4];
+   uint32_t version;
+   uint64_t mapSize;          ///< size of the snapshot file
+   int64_t mapTime;           ///< modification time of the snapshot file
+   uint64_t cornerNum;        ///< number of indexed corner points
+   uint64_t surfNum;          ///< number of indexed surface points
+};
+
+const size_t VOXEL_MIN_POINTS = 5;        ///< minimum number of points for fitting a feature from voxel statistics
+const float VOXEL_PLANE_MAX_VAR = 0.01;   ///< maximum variance (m^2) along the normal of a planar voxel
+
+const size_t BUDGET_MIN_ITERATIONS = 2;     ///< minimum number of iterations of a budgeted optimization
+const size_t BUDGET_MIN_FEATURES = 500;     ///< minimum number of stack features used by a budgeted optimization
+const float BUDGET_SMALL_MOTION = 0.2;      ///< odometry translation (m) per frame considered well predicted
+const float BUDGET_SMALL_ROTATION = 0.02;   ///< odometry rotation (rad) per axis and frame considered well predicted
+const double BUDGET_COST_SMOOTHING = 0.2;   ///< weight of the latest sample in the running cost estimates
+
+/** \brief Calculate the scan to map coefficients of a point with respect to a map line.
+ *
+ * @param pointSel the point in map coordinates
+ * @param vc a point on the line
+ * @param direction the normalized line direction
+ * @param coeff the resulting coefficients (gradient and weighted distance)
+ * @return true, if the correspondence is close enough to be used
+ */
+bool lineCoefficients(const pcl::PointXYZI& pointSel, const Vector3& vc,
+                      const Eigen::Vector3f& direction, pcl::PointXYZI& coeff)
+{
+   float x0 = pointSel.x;
+   float y0 = pointSel.y;
+   float z0 = pointSel.z;
+   float x1 = vc.x() + 0.1 * direction(0);
+   float y1 = vc.y() + 0.1 * direction(1);
+   float z1 = vc.z() + 0.1 * direction(2);
+   float x2 = vc.x() - 0.1 * direction(0);
+   float y2 = vc.y() - 0.1 * direction(1);
+   float z2 = vc.z() - 0.1 * direction(2);
+
+   float a012 = sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                     * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                     + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                     * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                     + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))
+                     * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
+
+   float l12 = sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
+
+   float la = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+               + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
+
+   float lb = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+
+   float lc = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+
+   float ld2 = a012 / l12;
+
+   float s = 1 - 0.9f * fabs(ld2);
+
+   coeff.x = s * la;
+   coeff.y = s * lb;
+   coeff.z = s * lc;
+   coeff.intensity = s * ld2;
+
+   return s > 0.1;
+}
+
+/** \brief Calculate the scan to map coefficients of a point with respect to a map plane.
+ *
+ * @param pointSel the point in map coordinates
+ * @param pa the normalized plane parameters (pa * x + pb * y + pc * z + pd = 0)
+ * @param coeff the resulting coefficients (gradient and weighted distance)
+ * @return true, if the correspondence is close enough to be used
+ */
+bool planeCoefficients(const pcl::PointXYZI& pointSel,
+                       float pa, float pb, float pc, float pd, pcl::PointXYZI& coeff)
+{
+   float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
+
+   float s = 1 - 0.9f * fabs(pd2) / sqrt(calcPointDistance(pointSel));
+
+   coeff.x = s * pa;
+   coeff.y = s * pb;
+   coeff.z = s * pc;
+   coeff.intensity = s * pd2;
+
+   return s > 0.1;
+}
+
+} // end anonymous namespace
+
 
 BasicLaserMapping::BasicLaserMapping(const float& scanPeriod, const size_t& maxIterations) :
    _scanPeriod(scanPeriod),
@@ -57,6 +234,20 @@ BasicLaserMapping::BasicLaserMapping(const float& scanPeriod, const size_t& maxI
    _maxIterations(maxIterations),
    _deltaTAbort(0.05),
    _deltaRAbort(0.05),
+   _frameTimeBudget(0),
+   _featureSelectionNum(0),
+   _useVoxelFeatures(false),
+   _voxelFeatureSize(1.0),
+   _incrementalMapFilter(false),
+   _cubeFilterLeafCorner(0),
+   _cubeFilterLeafSurf(0),
+   _asyncMapMaintenance(false),
+   _localizationMode(false),
+   _localMapRange(0),
+   _fovTanHalfAngle(std::tan(60.0f * float(M_PI) / 180.0f)),
+   _localMapCenter(Eigen::Vector3f::Zero()),
+   _publishPriorMap(false),
+   _mapMemoryBudget(0),
    _laserCloudCenWidth(10),
    _laserCloudCenHeight(5),
    _laserCloudCenDepth(10),
@@ -72,9 +263,12 @@ BasicLaserMapping::BasicLaserMapping(const float& scanPeriod, const size_t& maxI
    _laserCloudCornerStackDS(new pcl::PointCloud<pcl::PointXYZI>()),
    _laserCloudSurfStackDS(new pcl::PointCloud<pcl::PointXYZI>()),
    _laserCloudSurround(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudSurroundDS(new pcl::PointCloud<pcl::PointXYZI>()),
    _laserCloudCornerFromMap(new pcl::PointCloud<pcl::PointXYZI>()),
-   _laserCloudSurfFromMap(new pcl::PointCloud<pcl::PointXYZI>())
+   _laserCloudSurfFromMap(new pcl::PointCloud<pcl::PointXYZI>()),
+   _laserCloudCube(new pcl::PointCloud<pcl::PointXYZI>()),
+   _laserCloudCubeDS(new pcl::PointCloud<pcl::PointXYZI>()),
+   _laserCloudCornerFromMapNum(0),
+   _laserCloudSurfFromMapNum(0)
 {
    // initialize frame counter
    _frameCount = _stackFrameNum - 1;
@@ -83,21 +277,572 @@ BasicLaserMapping::BasicLaserMapping(const float& scanPeriod, const size_t& maxI
    // setup cloud vectors
    _laserCloudCornerArray.resize(_laserCloudNum);
    _laserCloudSurfArray.resize(_laserCloudNum);
-   _laserCloudCornerDSArray.resize(_laserCloudNum);
-   _laserCloudSurfDSArray.resize(_laserCloudNum);
+   _laserCloudCornerVoxelArray.resize(_laserCloudNum, VoxelFeatureMap(_voxelFeatureSize));
+   _laserCloudSurfVoxelArray.resize(_laserCloudNum, VoxelFeatureMap(_voxelFeatureSize));
+   _laserCloudCornerFilterArray.resize(_laserCloudNum);
+   _laserCloudSurfFilterArray.resize(_laserCloudNum);
+   _laserCloudBoundsArray.resize(_laserCloudNum, Eigen::AlignedBox3f());
+   _surroundCubeArray.resize(_laserCloudNum);
+
+   // setup down size filters
+   _downSizeFilterCorner.setLeafSize(0.2, 0.2, 0.2);
+   _downSizeFilterSurf.setLeafSize(0.4, 0.4, 0.4);
+   _downSizeFilterMap.setLeafSize(0.02, 0.02, 0.02);
+
+   // setup asynchronous map buffers
+   for (LocalMap* localMap : { &_backLocalMap, &_readyLocalMap })
+   {
+      localMap->corner.reset(new pcl::PointCloud<pcl::PointXYZI>());
+      localMap->surf.reset(new pcl::PointCloud<pcl::PointXYZI>());
+   }
+}
+
+
+BasicLaserMapping::~BasicLaserMapping()
+{
+   stopMapThread();
+}
+
+
+void BasicLaserMapping::setAsyncMapMaintenance(bool val)
+{
+   // hand the map cubes back to the calling thread
+   if (!val)
+      stopMapThread();
+
+   _asyncMapMaintenance = val;
+}
+
+
+void BasicLaserMapping::setVoxelFeatureSize(float val)
+{
+   _voxelFeatureSize = val;
+
+   // statistics of the old voxel size can't be reused
+   for (size_t i = 0; i < _laserCloudNum; i++)
+   {
+      _laserCloudCornerVoxelArray[i].setVoxelSize(val);
+      _laserCloudSurfVoxelArray[i].setVoxelSize(val);
+   }
+}
+
+
+void BasicLaserMapping::setIncrementalMapFilter(bool val)
+{
+   _incrementalMapFilter = val;
+
+   // force a rebuild of the cube occupancy on the next insertion
+   _cubeFilterLeafCorner = 0;
+   _cubeFilterLeafSurf = 0;
+}
+
+
+void BasicLaserMapping::updateCubeFilters()
+{
+   float cornerLeaf = _cubeFilterCorner.getLeafSize()[0];
+   float surfLeaf = _cubeFilterSurf.getLeafSize()[0];
+
+   if (cornerLeaf != _cubeFilterLeafCorner)
+   {
+      for (size_t i = 0; i < _laserCloudNum; i++)
+      {
+         _laserCloudCornerFilterArray[i].setLeafSize(cornerLeaf, _laserCloudCornerArray[i]);
+         _surroundCubeArray[i].cloud.reset();
+      }
+      _cubeFilterLeafCorner = cornerLeaf;
+   }
+
+   if (surfLeaf != _cubeFilterLeafSurf)
+   {
+      for (size_t i = 0; i < _laserCloudNum; i++)
+      {
+         _laserCloudSurfFilterArray[i].setLeafSize(surfLeaf, _laserCloudSurfArray[i]);
+         _surroundCubeArray[i].cloud.reset();
+      }
+      _cubeFilterLeafSurf = surfLeaf;
+   }
+}
+
+
+void BasicLaserMapping::swapCubes(size_t indexA, size_t indexB)
+{
+   _laserCloudCornerArray[indexA].swap(_laserCloudCornerArray[indexB]);
+   _laserCloudSurfArray[indexA].swap(_laserCloudSurfArray[indexB]);
+   std::swap(_laserCloudCornerVoxelArray[indexA], _laserCloudCornerVoxelArray[indexB]);
+   std::swap(_laserCloudSurfVoxelArray[indexA], _laserCloudSurfVoxelArray[indexB]);
+   std::swap(_laserCloudCornerFilterArray[indexA], _laserCloudCornerFilterArray[indexB]);
+   std::swap(_laserCloudSurfFilterArray[indexA], _laserCloudSurfFilterArray[indexB]);
+   std::swap(_laserCloudBoundsArray[indexA], _laserCloudBoundsArray[indexB]);
+   std::swap(_surroundCubeArray[indexA], _surroundCubeArray[indexB]);
+}
+
+
+void BasicLaserMapping::clearCube(size_t index)
+{
+   _laserCloudCornerArray[index].clear();
+   _laserCloudSurfArray[index].clear();
+   _laserCloudCornerVoxelArray[index].clear();
+   _laserCloudSurfVoxelArray[index].clear();
+   _laserCloudCornerFilterArray[index].clear();
+   _laserCloudSurfFilterArray[index].clear();
+   _laserCloudBoundsArray[index].setEmpty();
+   _surroundCubeArray[index].cloud.reset();
+}
+
+
+bool BasicLaserMapping::toCubeIndex(const pcl::PointXYZI& point, size_t& cubeInd) const
+{
+   int cubeI = int((point.x + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenWidth;
+   int cubeJ = int((point.y + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenHeight;
+   int cubeK = int((point.z + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenDepth;
+
+   if (point.x + CUBE_HALF < 0) cubeI--;
+   if (point.y + CUBE_HALF < 0) cubeJ--;
+   if (point.z + CUBE_HALF < 0) cubeK--;
+
+   if (cubeI < 0 || cubeI >= _laserCloudWidth ||
+       cubeJ < 0 || cubeJ >= _laserCloudHeight ||
+       cubeK < 0 || cubeK >= _laserCloudDepth)
+      return false;
+
+   cubeInd = toIndex(cubeI, cubeJ, cubeK);
+   return true;
+}
+
+
+VoxelKey BasicLaserMapping::cubeKey(size_t index) const
+{
+   int i = int(index % _laserCloudWidth);
+   int j = int((index / _laserCloudWidth) % _laserCloudHeight);
+   int k = int(index / (_laserCloudWidth * _laserCloudHeight));
+   return { i - _laserCloudCenWidth, j - _laserCloudCenHeight, k - _laserCloudCenDepth };
+}
+
+
+bool BasicLaserMapping::toCubeIndex(const VoxelKey& key, size_t& index) const
+{
+   const int i = key.x + _laserCloudCenWidth;
+   const int j = key.y + _laserCloudCenHeight;
+   const int k = key.z + _laserCloudCenDepth;
+   if (i < 0 || i >= int(_laserCloudWidth) || j < 0 || j >= int(_laserCloudHeight)
+       || k < 0 || k >= int(_laserCloudDepth))
+      return false;
+
+   index = toIndex(i, j, k);
+   return true;
+}
+
+
+void BasicLaserMapping::anchorCube(size_t index)
+{
+   const VoxelKey key = cubeKey(index);
+   const Eigen::Vector3f center = Eigen::Vector3f(key.x, key.y, key.z) * float(CUBE_SIZE);
+
+   if (_laserCloudCornerArray[index].empty())
+      _laserCloudCornerArray[index].setOrigin(center);
+   if (_laserCloudSurfArray[index].empty())
+      _laserCloudSurfArray[index].setOrigin(center);
+}
+
+
+bool BasicLaserMapping::spillCube(size_t index)
+{
+   if (!_cubeSpillStore.enabled()
+       || (_laserCloudCornerArray[index].empty() && _laserCloudSurfArray[index].empty()))
+      return false;
+
+   LOAM_SCOPED_TIMER(spillTimer, "mapping.cubeSpill");
+   if (!_cubeSpillStore.save(cubeKey(index), _laserCloudCornerArray[index], _laserCloudSurfArray[index]))
+      return false;
+
+   clearCube(index);
+   _spillCount++;
+   return true;
+}
+
+
+void BasicLaserMapping::restoreCube(size_t index)
+{
+   const VoxelKey key = cubeKey(index);
+   if (!_cubeSpillStore.contains(key))
+      return;
+
+   LOAM_SCOPED_TIMER(reloadTimer, "mapping.cubeReload");
+   anchorCube(index);
+   auto& corner = _laserCloudCornerArray[index];
+   auto& surf = _laserCloudSurfArray[index];
+   const size_t cornerStart = corner.size();
+   const size_t surfStart = surf.size();
+   // a failed load drops the cube from the store, so it's not retried and its points stay in memory
+   if (!_cubeSpillStore.load(key, corner, surf))
+      return;
+
+   rebuildCubeIndex(index, cornerStart, surfStart);
+   _reloadCount++;
+}
+
+
+void BasicLaserMapping::rebuildCubeIndex(size_t index, size_t cornerStart, size_t surfStart)
+{
+   auto& corner = _laserCloudCornerArray[index];
+   auto& surf = _laserCloudSurfArray[index];
+
+   for (size_t i = cornerStart; i < corner.size(); i++)
+      _laserCloudBoundsArray[index].extend(corner[i].getVector3fMap());
+   for (size_t i = surfStart; i < surf.size(); i++)
+      _laserCloudBoundsArray[index].extend(surf[i].getVector3fMap());
+   _surroundCubeArray[index].cloud.reset();
+
+   // the occupancy and statistics are not stored, rebuild them from the points
+   if (_incrementalMapFilter)
+   {
+      _laserCloudCornerFilterArray[index].rebuild(corner);
+      _laserCloudSurfFilterArray[index].rebuild(surf);
+   }
+
+   _laserCloudCornerVoxelArray[index].invalidate();
+   _laserCloudSurfVoxelArray[index].invalidate();
+}
+
+
+bool BasicLaserMapping::saveMapSnapshot(const std::string& file)
+{
+   if (_mapThread.joinable())
+      return false;
+
+   return writeMapSnapshot(file, _transformAftMapped, _transformBefMapped);
+}
+
+
+void BasicLaserMapping::requestMapSnapshot(const std::string& file)
+{
+   std::lock_guard<std::mutex> lock(_mapMutex);
+   _pendingSnapshotFile = file;
+}
+
+
+void BasicLaserMapping::writeRequestedSnapshot(const Twist& aftMapped, const Twist& befMapped)
+{
+   std::string file;
+   {
+      std::lock_guard<std::mutex> lock(_mapMutex);
+      file.swap(_pendingSnapshotFile);
+   }
+
+   if (file.empty())
+      return;
+
+   if (writeMapSnapshot(file, aftMapped, befMapped))
+      _snapshotCount++;
+   else
+      _snapshotFailures++;
+}
+
+
+bool BasicLaserMapping::writeMapSnapshot(const std::string& file, const Twist& aftMapped, const Twist& befMapped)
+{
+   LOAM_SCOPED_TIMER(snapshotTimer, "mapping.snapshot");
+   // write to a temporary file first, so an interrupted write never replaces a valid snapshot
+   const std::string tmpFile = file + ".tmp";
+   std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+   if (!out)
+      return false;
+
+   MapSnapshotHeader header;
+   std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+   header.version = SNAPSHOT_VERSION;
+   header.gridSize[0] = int32_t(_laserCloudWidth);
+   header.gridSize[1] = int32_t(_laserCloudHeight);
+   header.gridSize[2] = int32_t(_laserCloudDepth);
+   header.gridCenter[0] = _laserCloudCenWidth;
+   header.gridCenter[1] = _laserCloudCenHeight;
+   header.gridCenter[2] = _laserCloudCenDepth;
+   header.cubeSize = float(CUBE_SIZE);
+   twistToArray(aftMapped, header.aftMapped);
+   twistToArray(befMapped, header.befMapped);
+   header.cubeCount = uint32_t(_cubeSpillStore.size());
+   for (size_t i = 0; i < _laserCloudNum; i++)
+   {
+      if (!_laserCloudCornerArray[i].empty() || !_laserCloudSurfArray[i].empty())
+         header.cubeCount++;
+   }
+   out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+   for (size_t index = 0; index < _laserCloudNum; index++)
+   {
+      auto const& corner = _laserCloudCornerArray[index];
+      auto const& surf = _laserCloudSurfArray[index];
+      if (!corner.empty() || !surf.empty())
+         writeSnapshotCube(out, cubeKey(index), corner, surf);
+   }
+
+   // spilled cubes are streamed from disk (a cube partially reloaded already ends up in two records)
+   CompactPointCloud corner, surf;
+   for (const VoxelKey& key : _cubeSpillStore.cubes())
+   {
+      const Eigen::Vector3f center = Eigen::Vector3f(key.x, key.y, key.z) * float(CUBE_SIZE);
+      corner.clear();
+      corner.setOrigin(center);
+      surf.clear();
+      surf.setOrigin(center);
+      if (!_cubeSpillStore.read(key, corner, surf))
+      {
+         out.close();
+         std::remove(tmpFile.c_str());
+         return false;
+      }
+      writeSnapshotCube(out, key, corner, surf);
+   }
+
+   out.close();
+   if (!out)
+   {
+      std::remove(tmpFile.c_str());
+      return false;
+   }
+
+   return std::rename(tmpFile.c_str(), file.c_str()) == 0;
+}
+
+
+bool BasicLaserMapping::loadMapSnapshot(const std::string& file, bool keepOdometryReference)
+{
+   if (_mapThread.joinable())
+      return false;
+
+   int fd = open(file.c_str(), O_RDONLY);
+   if (fd < 0)
+      return false;
+
+   struct stat info;
+   if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(MapSnapshotHeader))
+   {
+      close(fd);
+      return false;
+   }
+
+   const size_t size = size_t(info.st_size);
+   void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (data == MAP_FAILED)
+      return false;
+
+   madvise(data, size, MADV_SEQUENTIAL);
+   bool success = readMapSnapshot(static_cast<const char*>(data), size, keepOdometryReference);
+   munmap(data, size);
+   return success;
+}
+
+
+bool BasicLaserMapping::readMapSnapshot(const char* data, size_t size, bool keepOdometryReference)
+{
+   MapSnapshotHeader header;
+   std::memcpy(&header, data, sizeof(header));
+   if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+       || header.version != SNAPSHOT_VERSION
+       || header.gridSize[0] != int32_t(_laserCloudWidth)
+       || header.gridSize[1] != int32_t(_laserCloudHeight)
+       || header.gridSize[2] != int32_t(_laserCloudDepth)
+       || header.cubeSize != float(CUBE_SIZE))
+      return false;
+
+   // validate the cube records before touching the current map
+   MapSnapshotCube cube;
+   size_t offset = sizeof(header);
+   for (uint32_t c = 0; c < header.cubeCount; c++)
+   {
+      if (offset + sizeof(cube) > size)
+         return false;
+
+      std::memcpy(&cube, data + offset, sizeof(cube));
+      offset += sizeof(cube) + (size_t(cube.cornerNum) + cube.surfNum) * sizeof(CompactPoint);
+      if (offset > size)
+         return false;
+   }
+
+   for (size_t i = 0; i < _laserCloudNum; i++)
+      clearCube(i);
+   _cubeSpillStore.clear();
+
+   _laserCloudCenWidth = header.gridCenter[0];
+   _laserCloudCenHeight = header.gridCenter[1];
+   _laserCloudCenDepth = header.gridCenter[2];
+
+   // the points are stored as kept in memory, so they are copied without re-encoding
+   std::vector<bool> loaded(_laserCloudNum, false);
+   CompactPointCloud corner, surf;
+   bool spilled = true;
+   offset = sizeof(header);
+   for (uint32_t c = 0; c < header.cubeCount; c++)
+   {
+      std::memcpy(&cube, data + offset, sizeof(cube));
+      offset += sizeof(cube);
+      const CompactPoint* cornerPoints = reinterpret_cast<const CompactPoint*>(data + offset);
+      offset += cube.cornerNum * sizeof(CompactPoint);
+      const CompactPoint* surfPoints = reinterpret_cast<const CompactPoint*>(data + offset);
+      offset += cube.surfNum * sizeof(CompactPoint);
+
+      const VoxelKey key = { cube.key[0], cube.key[1], cube.key[2] };
+      const Eigen::Map<const Eigen::Vector3f> cornerOrigin(cube.cornerOrigin);
+      const Eigen::Map<const Eigen::Vector3f> surfOrigin(cube.surfOrigin);
+      size_t index;
+      if (toCubeIndex(key, index))
+      {
+         anchorCube(index);
+         _laserCloudCornerArray[index].append(cornerPoints, cube.cornerNum, cornerOrigin);
+         _laserCloudSurfArray[index].append(surfPoints, cube.surfNum, surfOrigin);
+         loaded[index] = true;
+         continue;
+      }
+
+      // cubes outside of the cube grid go to the spill store, without one they are dropped like
+      // cubes leaving the grid while mapping
+      if (!_cubeSpillStore.enabled())
+         continue;
+
+      corner.clear();
+      corner.setOrigin(cornerOrigin);
+      surf.clear();
+      surf.setOrigin(surfOrigin);
+      _cubeSpillStore.load(key, corner, surf);
+      corner.append(cornerPoints, cube.cornerNum, cornerOrigin);
+      surf.append(surfPoints, cube.surfNum, surfOrigin);
+      spilled = _cubeSpillStore.save(key, corner, surf) && spilled;
+   }
+
+   for (size_t index = 0; index < _laserCloudNum; index++)
+   {
+      if (loaded[index])
+         rebuildCubeIndex(index, 0, 0);
+   }
+
+   arrayToTwist(header.aftMapped, _transformAftMapped);
+   if (keepOdometryReference)
+      arrayToTwist(header.befMapped, _transformBefMapped);
+   else
+      _transformBefMapped = Twist();
+   _transformTobeMapped = _transformAftMapped;
+
+   return spilled;
+}
+
+
+MapSize BasicLaserMapping::mapSize() const
+{
+   MapSize size;
+   for (size_t i = 0; i < _laserCloudNum; i++)
+   {
+      const size_t points = _laserCloudCornerArray[i].size() + _laserCloudSurfArray[i].size();
+      if (points > 0)
+      {
+         size.cubes++;
+         size.points += points;
+      }
+   }
+
+   // partially reloaded cubes are counted once
+   size_t index;
+   for (const VoxelKey& key : _cubeSpillStore.cubes())
+   {
+      if (!toCubeIndex(key, index)
+          || (_laserCloudCornerArray[index].empty() && _laserCloudSurfArray[index].empty()))
+         size.cubes++;
+   }
+   size.points += _cubeSpillStore.points();
+   return size;
+}
+
+
+size_t BasicLaserMapping::cubeBytes(size_t index) const
+{
+   const size_t points = _laserCloudCornerArray[index].size() + _laserCloudSurfArray[index].size();
+   const size_t voxels = _laserCloudCornerVoxelArray[index].size() + _laserCloudSurfVoxelArray[index].size();
+   const size_t occupied = _laserCloudCornerFilterArray[index].size() + _laserCloudSurfFilterArray[index].size();
+
+   return points * sizeof(CompactPoint)
+      + voxels * (sizeof(VoxelKey) + sizeof(VoxelStats) + HASH_ENTRY_OVERHEAD)
+      + occupied * (sizeof(VoxelKey) + 2 * sizeof(uint32_t) + HASH_ENTRY_OVERHEAD);
+}
+
+
+void BasicLaserMapping::enforceMapMemoryBudget(int centerCubeI, int centerCubeJ, int centerCubeK)
+{
+   size_t memoryBytes = 0;
+   size_t memoryCubes = 0;
+   std::vector<std::pair<int, size_t>> candidates;   // squared cube distance and index
+
+   for (int i = 0; i < _laserCloudWidth; i++)
+   {
+      for (int j = 0; j < _laserCloudHeight; j++)
+      {
+         for (int k = 0; k < _laserCloudDepth; k++)
+         {
+            const size_t index = toIndex(i, j, k);
+            const size_t bytes = cubeBytes(index);
+            if (bytes == 0)
+               continue;
+
+            memoryBytes += bytes;
+            memoryCubes++;
+
+            // cubes of the surround map stay in memory
+            int di = i - centerCubeI;
+            int dj = j - centerCubeJ;
+            int dk = k - centerCubeK;
+            if (std::abs(di) > 2 || std::abs(dj) > 2 || std::abs(dk) > 2)
+               candidates.emplace_back(di * di + dj * dj + dk * dk, index);
+         }
+      }
+   }
+
+   // spill the farthest cubes first
+   if (_mapMemoryBudget > 0 && memoryBytes > _mapMemoryBudget && _cubeSpillStore.enabled())
+   {
+      std::sort(candidates.begin(), candidates.end(), std::greater<std::pair<int, size_t>>());
+      for (auto const& candidate : candidates)
+      {
+         if (memoryBytes <= _mapMemoryBudget)
+            break;
+
+         const size_t bytes = cubeBytes(candidate.second);
+         if (spillCube(candidate.second))
+         {
+            memoryBytes -= bytes;
+            memoryCubes--;
+         }
+      }
+   }
+
+   MappingStats::Memory memory;
+   memory.memoryBytes = memoryBytes;
+   memory.memoryCubes = memoryCubes;
+   memory.spilledBytes = _cubeSpillStore.bytes();
+   memory.spilledCubes = _cubeSpillStore.size();
+   memory.spillCount = _spillCount;
+   memory.reloadCount = _reloadCount;
+   memory.failedReloads = _cubeSpillStore.failedLoads();
+   updateStats([&](MappingStats& stats) { stats.memory = memory; });
+}
+
 
+void BasicLaserMapping::updateVoxelStats()
+{
+   LOAM_SCOPED_TIMER(voxelStatsTimer, "mapping.voxelStats");
    for (size_t i = 0; i < _laserCloudNum; i++)
    {
-      _laserCloudCornerArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-      _laserCloudSurfArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-      _laserCloudCornerDSArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-      _laserCloudSurfDSArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
+      _laserCloudCornerVoxelArray[i].update(_laserCloudCornerArray[i]);
+      _laserCloudSurfVoxelArray[i].update(_laserCloudSurfArray[i]);
    }
+}
 
-   // setup down size filters
-   _downSizeFilterCorner.setLeafSize(0.2, 0.2, 0.2);
-   _downSizeFilterSurf.setLeafSize(0.4, 0.4, 0.4);
-   _downSizeFilterMap.setLeafSize(0.02, 0.02, 0.02);
+
+VoxelStats* BasicLaserMapping::findVoxelStats(std::vector<VoxelFeatureMap>& voxelArray, const pcl::PointXYZI& point)
+{
+   size_t cubeInd;
+   if (!toCubeIndex(point, cubeInd))
+      return nullptr;
+
+   return voxelArray[cubeInd].find(point);
 }
 
 
@@ -206,17 +951,24 @@ void BasicLaserMapping::transformUpdate()
 
 
 void BasicLaserMapping::pointAssociateToMap(const pcl::PointXYZI& pi, pcl::PointXYZI& po)
+{
+   pointAssociateToMap(pi, po, _transformTobeMapped);
+}
+
+
+
+void BasicLaserMapping::pointAssociateToMap(const pcl::PointXYZI& pi, pcl::PointXYZI& po, const Twist& pose)
 {
    po.x = pi.x;
    po.y = pi.y;
    po.z = pi.z;
    po.intensity = pi.intensity;
 
-   rotateZXY(po, _transformTobeMapped.rot_z, _transformTobeMapped.rot_x, _transformTobeMapped.rot_y);
+   rotateZXY(po, pose.rot_z, pose.rot_x, pose.rot_y);
 
-   po.x += _transformTobeMapped.pos.x();
-   po.y += _transformTobeMapped.pos.y();
-   po.z += _transformTobeMapped.pos.z();
+   po.x += pose.pos.x();
+   po.y += pose.pos.y();
+   po.z += pose.pos.z();
 }
 
 
@@ -240,7 +992,7 @@ void BasicLaserMapping::transformFullResToMap()
       pointAssociateToMap(pt, pt);
 }
 
-bool BasicLaserMapping::createDownsizedMap()
+bool BasicLaserMapping::surroundMapDue()
 {
    // create new map cloud according to the input output ratio
    _mapFrameCount++;
@@ -248,66 +1000,75 @@ bool BasicLaserMapping::createDownsizedMap()
       return false;
 
    _mapFrameCount = 0;
+   if (_surroundMapDemand)
+      return true;
 
-   // accumulate map cloud
-   _laserCloudSurround->clear();
-   for (auto ind : _laserCloudSurroundInd)
-   {
-      *_laserCloudSurround += *_laserCloudCornerArray[ind];
-      *_laserCloudSurround += *_laserCloudSurfArray[ind];
-   }
-
-   // down size map cloud
-   _laserCloudSurroundDS->clear();
-   _downSizeFilterCorner.setInputCloud(_laserCloudSurround);
-   _downSizeFilterCorner.filter(*_laserCloudSurroundDS);
-   return true;
+   updateStats([](MappingStats& stats) { stats.surroundMap.skippedMaps++; });
+   return false;
 }
 
-bool BasicLaserMapping::process(Time const& laserOdometryTime)
+
+void BasicLaserMapping::createDownsizedMap(std::vector<SurroundCube>& mapOut)
 {
-   // skip some frames?!?
-   _frameCount++;
-   if (_frameCount < _stackFrameNum)
+   LOAM_SCOPED_TIMER(surroundMapTimer, "mapping.surroundMap");
+   // the cached cubes are only valid for the leaf size they were down sized with
+   const float leafSize = _cubeFilterCorner.getLeafSize()[0];
+   if (leafSize != _surroundLeafSize)
    {
-      return false;
+      for (auto& cube : _surroundCubeArray)
+         cube.cloud.reset();
+      _surroundLeafSize = leafSize;
    }
-   _frameCount = 0;
-   _laserOdometryTime = laserOdometryTime;
 
-   pcl::PointXYZI pointSel;
+   // down size the cubes changed since the last surround map
+   size_t filteredCubes = 0;
+   auto start = SteadyClock::now();
+   mapOut.clear();
+   for (auto ind : _laserCloudSurroundInd)
+   {
+      SurroundCube& cube = _surroundCubeArray[ind];
+      if (!cube.cloud)
+      {
+         _laserCloudSurround->clear();
+         _laserCloudCornerArray[ind].decodeTo(*_laserCloudSurround);
+         _laserCloudSurfArray[ind].decodeTo(*_laserCloudSurround);
 
-   // relate incoming data to map
-   transformAssociateToMap();
+         pcl::PointCloud<pcl::PointXYZI>::Ptr downsized(new pcl::PointCloud<pcl::PointXYZI>());
+         if (!_laserCloudSurround->empty())
+         {
+            _cubeFilterCorner.setInputCloud(_laserCloudSurround);
+            _cubeFilterCorner.filter(*downsized);
+         }
+         cube.cloud = downsized;
+         cube.generation = ++_surroundGeneration;
+         filteredCubes++;
+      }
 
-   for (auto const& pt : _laserCloudCornerLast->points)
-   {
-      pointAssociateToMap(pt, pointSel);
-      _laserCloudCornerStack->push_back(pointSel);
+      if (!cube.cloud->empty())
+         mapOut.push_back(cube);
    }
 
-   for (auto const& pt : _laserCloudSurfLast->points)
+   const double filterTime = toSec(SteadyClock::now() - start);
+   updateStats([&](MappingStats& stats)
    {
-      pointAssociateToMap(pt, pointSel);
-      _laserCloudSurfStack->push_back(pointSel);
-   }
-
-   pcl::PointXYZI pointOnYAxis;
-   pointOnYAxis.x = 0.0;
-   pointOnYAxis.y = 10.0;
-   pointOnYAxis.z = 0.0;
-   pointAssociateToMap(pointOnYAxis, pointOnYAxis);
+      stats.surroundMap.maps++;
+      stats.surroundMap.filteredCubes += filteredCubes;
+      stats.surroundMap.reusedCubes += _laserCloudSurroundInd.size() - filteredCubes;
+      stats.surroundMap.filterTime += filterTime;
+   });
+}
 
-   auto const CUBE_SIZE = 50.0;
-   auto const CUBE_HALF = CUBE_SIZE / 2;
 
-   int centerCubeI = int((_transformTobeMapped.pos.x() + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenWidth;
-   int centerCubeJ = int((_transformTobeMapped.pos.y() + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenHeight;
-   int centerCubeK = int((_transformTobeMapped.pos.z() + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenDepth;
+void BasicLaserMapping::shiftMapCubes(const Twist& pose, int& centerCubeI, int& centerCubeJ, int& centerCubeK)
+{
+   LOAM_SCOPED_TIMER(cubeShiftTimer, "mapping.cubeShift");
+   centerCubeI = int((pose.pos.x() + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenWidth;
+   centerCubeJ = int((pose.pos.y() + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenHeight;
+   centerCubeK = int((pose.pos.z() + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenDepth;
 
-   if (_transformTobeMapped.pos.x() + CUBE_HALF < 0) centerCubeI--;
-   if (_transformTobeMapped.pos.y() + CUBE_HALF < 0) centerCubeJ--;
-   if (_transformTobeMapped.pos.z() + CUBE_HALF < 0) centerCubeK--;
+   if (pose.pos.x() + CUBE_HALF < 0) centerCubeI--;
+   if (pose.pos.y() + CUBE_HALF < 0) centerCubeJ--;
+   if (pose.pos.z() + CUBE_HALF < 0) centerCubeK--;
 
    while (centerCubeI < 3)
    {
@@ -315,16 +1076,17 @@ bool BasicLaserMapping::process(Time const& laserOdometryTime)
       {
          for (int k = 0; k < _laserCloudDepth; k++)
          {
+            // keep the cube leaving the grid
+            spillCube(toIndex(_laserCloudWidth - 1, j, k));
+
             for (int i = _laserCloudWidth - 1; i >= 1; i--)
             {
                const size_t indexA = toIndex(i, j, k);
                const size_t indexB = toIndex(i - 1, j, k);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
+               swapCubes(indexA, indexB);
             }
             const size_t indexC = toIndex(0, j, k);
-            _laserCloudCornerArray[indexC]->clear();
-            _laserCloudSurfArray[indexC]->clear();
+            clearCube(indexC);
          }
       }
       centerCubeI++;
@@ -337,16 +1099,17 @@ bool BasicLaserMapping::process(Time const& laserOdometryTime)
       {
          for (int k = 0; k < _laserCloudDepth; k++)
          {
+            // keep the cube leaving the grid
+            spillCube(toIndex(0, j, k));
+
             for (int i = 0; i < _laserCloudWidth - 1; i++)
             {
                const size_t indexA = toIndex(i, j, k);
                const size_t indexB = toIndex(i + 1, j, k);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
+               swapCubes(indexA, indexB);
             }
             const size_t indexC = toIndex(_laserCloudWidth - 1, j, k);
-            _laserCloudCornerArray[indexC]->clear();
-            _laserCloudSurfArray[indexC]->clear();
+            clearCube(indexC);
          }
       }
       centerCubeI--;
@@ -359,16 +1122,17 @@ bool BasicLaserMapping::process(Time const& laserOdometryTime)
       {
          for (int k = 0; k < _laserCloudDepth; k++)
          {
+            // keep the cube leaving the grid
+            spillCube(toIndex(i, _laserCloudHeight - 1, k));
+
             for (int j = _laserCloudHeight - 1; j >= 1; j--)
             {
                const size_t indexA = toIndex(i, j, k);
                const size_t indexB = toIndex(i, j - 1, k);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
+               swapCubes(indexA, indexB);
             }
             const size_t indexC = toIndex(i, 0, k);
-            _laserCloudCornerArray[indexC]->clear();
-            _laserCloudSurfArray[indexC]->clear();
+            clearCube(indexC);
          }
       }
       centerCubeJ++;
@@ -381,220 +1145,688 @@ bool BasicLaserMapping::process(Time const& laserOdometryTime)
       {
          for (int k = 0; k < _laserCloudDepth; k++)
          {
+            // keep the cube leaving the grid
+            spillCube(toIndex(i, 0, k));
+
             for (int j = 0; j < _laserCloudHeight - 1; j++)
             {
                const size_t indexA = toIndex(i, j, k);
                const size_t indexB = toIndex(i, j + 1, k);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
+               swapCubes(indexA, indexB);
             }
             const size_t indexC = toIndex(i, _laserCloudHeight - 1, k);
-            _laserCloudCornerArray[indexC]->clear();
-            _laserCloudSurfArray[indexC]->clear();
+            clearCube(indexC);
          }
       }
       centerCubeJ--;
       _laserCloudCenHeight--;
    }
 
-   while (centerCubeK < 3)
+   while (centerCubeK < 3)
+   {
+      for (int i = 0; i < _laserCloudWidth; i++)
+      {
+         for (int j = 0; j < _laserCloudHeight; j++)
+         {
+            // keep the cube leaving the grid
+            spillCube(toIndex(i, j, _laserCloudDepth - 1));
+
+            for (int k = _laserCloudDepth - 1; k >= 1; k--)
+            {
+               const size_t indexA = toIndex(i, j, k);
+               const size_t indexB = toIndex(i, j, k - 1);
+               swapCubes(indexA, indexB);
+            }
+            const size_t indexC = toIndex(i, j, 0);
+            clearCube(indexC);
+         }
+      }
+      centerCubeK++;
+      _laserCloudCenDepth++;
+   }
+
+   while (centerCubeK >= _laserCloudDepth - 3)
+   {
+      for (int i = 0; i < _laserCloudWidth; i++)
+      {
+         for (int j = 0; j < _laserCloudHeight; j++)
+         {
+            // keep the cube leaving the grid
+            spillCube(toIndex(i, j, 0));
+
+            for (int k = 0; k < _laserCloudDepth - 1; k++)
+            {
+               const size_t indexA = toIndex(i, j, k);
+               const size_t indexB = toIndex(i, j, k + 1);
+               swapCubes(indexA, indexB);
+            }
+            const size_t indexC = toIndex(i, j, _laserCloudDepth - 1);
+            clearCube(indexC);
+         }
+      }
+      centerCubeK--;
+      _laserCloudCenDepth--;
+   }
+}
+
+
+void BasicLaserMapping::selectMapCubes(const Twist& pose, int centerCubeI, int centerCubeJ, int centerCubeK)
+{
+   LOAM_SCOPED_TIMER(selectTimer, "mapping.cubeSelection");
+   pcl::PointXYZI transform_pos;
+   transform_pos.x = pose.pos.x();
+   transform_pos.y = pose.pos.y();
+   transform_pos.z = pose.pos.z();
+
+   pcl::PointXYZI pointOnYAxis;
+   pointOnYAxis.x = 0.0;
+   pointOnYAxis.y = 10.0;
+   pointOnYAxis.z = 0.0;
+   pointAssociateToMap(pointOnYAxis, pointOnYAxis, pose);
+
+   const Eigen::Vector3f sensor(pose.pos.x(), pose.pos.y(), pose.pos.z());
+   const Eigen::Vector3f up = (Eigen::Vector3f(pointOnYAxis.x, pointOnYAxis.y, pointOnYAxis.z) - sensor) / 10.0f;
+   _localMapCenter = sensor;
+
+   _laserCloudValidInd.clear();
+   _laserCloudSurroundInd.clear();
+   for (int i = centerCubeI - 2; i <= centerCubeI + 2; i++)
+   {
+      for (int j = centerCubeJ - 2; j <= centerCubeJ + 2; j++)
+      {
+         for (int k = centerCubeK - 2; k <= centerCubeK + 2; k++)
+         {
+            if (i >= 0 && i < _laserCloudWidth &&
+                j >= 0 && j < _laserCloudHeight &&
+                k >= 0 && k < _laserCloudDepth)
+            {
+
+               float centerX = 50.0f * (i - _laserCloudCenWidth);
+               float centerY = 50.0f * (j - _laserCloudCenHeight);
+               float centerZ = 50.0f * (k - _laserCloudCenDepth);
+
+               bool isInLaserFOV = false;
+               if (_localMapRange > 0)
+               {
+                  isInLaserFOV = isCubeVisible(toIndex(i, j, k), sensor, up, centerX, centerY, centerZ);
+               }
+               else
+               {
+                  for (int ii = -1; ii <= 1; ii += 2)
+                  {
+                     for (int jj = -1; jj <= 1; jj += 2)
+                     {
+                        for (int kk = -1; kk <= 1; kk += 2)
+                        {
+                           pcl::PointXYZI corner;
+                           corner.x = centerX + 25.0f * ii;
+                           corner.y = centerY + 25.0f * jj;
+                           corner.z = centerZ + 25.0f * kk;
+
+                           float squaredSide1 = calcSquaredDiff(transform_pos, corner);
+                           float squaredSide2 = calcSquaredDiff(pointOnYAxis, corner);
+
+                           float check1 = 100.0f + squaredSide1 - squaredSide2
+                              - 10.0f * sqrt(3.0f) * sqrt(squaredSide1);
+
+                           float check2 = 100.0f + squaredSide1 - squaredSide2
+                              + 10.0f * sqrt(3.0f) * sqrt(squaredSide1);
+
+                           if (check1 < 0 && check2 > 0)
+                           {
+                              isInLaserFOV = true;
+                           }
+                        }
+                     }
+                  }
+               }
+
+               size_t cubeIdx = i + _laserCloudWidth * j + _laserCloudWidth * _laserCloudHeight * k;
+               if (!_cubeSpillStore.empty())
+                  restoreCube(cubeIdx);
+
+               if (isInLaserFOV)
+               {
+                  _laserCloudValidInd.push_back(cubeIdx);
+               }
+               _laserCloudSurroundInd.push_back(cubeIdx);
+            }
+         }
+      }
+   }
+}
+
+
+bool BasicLaserMapping::isCubeVisible(size_t index, const Eigen::Vector3f& sensor, const Eigen::Vector3f& up,
+                                      float centerX, float centerY, float centerZ) const
+{
+   // use the tight bounds of the cube points, or the whole cube if it is still empty
+   Eigen::AlignedBox3f bounds = _laserCloudBoundsArray[index];
+   if (bounds.isEmpty())
+   {
+      const Eigen::Vector3f center(centerX, centerY, centerZ);
+      bounds = Eigen::AlignedBox3f(center.array() - CUBE_HALF, center.array() + CUBE_HALF);
+   }
+
+   // sensor range
+   if (bounds.squaredExteriorDistance(sensor) > _localMapRange * _localMapRange)
+      return false;
+
+   // vertical field of view, boxes crossing the horizontal plane of the sensor are always visible
+   float minHeight = std::numeric_limits<float>::max();
+   float maxHeight = -std::numeric_limits<float>::max();
+   for (int c = 0; c < 8; c++)
+   {
+      const Eigen::Vector3f diff = bounds.corner(Eigen::AlignedBox3f::CornerType(c)) - sensor;
+      const float height = up.dot(diff);
+      const float horizontal = sqrt(std::max(0.0f, diff.squaredNorm() - height * height));
+      if (fabs(height) <= _fovTanHalfAngle * horizontal)
+         return true;
+
+      minHeight = std::min(minHeight, height);
+      maxHeight = std::max(maxHeight, height);
+   }
+
+   return minHeight <= 0 && maxHeight >= 0;
+}
+
+
+void BasicLaserMapping::appendCubePoints(const CompactPointCloud& cube,
+                                         const Eigen::AlignedBox3f& bounds, float range, bool copyCubes,
+                                         pcl::PointCloud<pcl::PointXYZI>& copied,
+                                         MapPointView& view) const
+{
+   const float squaredRange = range * range;
+
+   // cubes completely within range are used as a whole
+   if (range <= 0 || (bounds.max() - _localMapCenter).cwiseAbs()
+       .cwiseMax((bounds.min() - _localMapCenter).cwiseAbs()).squaredNorm() <= squaredRange)
+   {
+      if (copyCubes)
+         cube.decodeTo(copied);
+      else
+         view.append(cube);
+      return;
+   }
+
+   for (size_t i = 0; i < cube.size(); i++)
+   {
+      const pcl::PointXYZI pt = cube[i];
+      if ((pt.getVector3fMap() - _localMapCenter).squaredNorm() <= squaredRange)
+         copied.push_back(pt);
+   }
+}
+
+
+void BasicLaserMapping::assembleLocalMap(pcl::PointCloud<pcl::PointXYZI>& cornerMap,
+                                         pcl::PointCloud<pcl::PointXYZI>& surfMap,
+                                         MapPointView& cornerView, MapPointView& surfView,
+                                         float range, bool copyCubes)
+{
+   LOAM_SCOPED_TIMER(assembleTimer, "mapping.localMap");
+   // prepare valid map corner and surface points for pose optimization
+   cornerMap.clear();
+   surfMap.clear();
+   cornerView.clear();
+   surfView.clear();
+   for (auto const& ind : _laserCloudValidInd)
+   {
+      appendCubePoints(_laserCloudCornerArray[ind], _laserCloudBoundsArray[ind], range, copyCubes,
+                       cornerMap, cornerView);
+      appendCubePoints(_laserCloudSurfArray[ind], _laserCloudBoundsArray[ind], range, copyCubes,
+                       surfMap, surfView);
+   }
+
+   // the copied points go last, once the clouds do not change anymore
+   cornerView.append(cornerMap);
+   surfView.append(surfMap);
+
+   updateStats([&](MappingStats& stats)
+   {
+      stats.localMap.frames++;
+      stats.localMap.points += cornerView.size() + surfView.size();
+      stats.localMap.segments += cornerView.segmentCount() + surfView.segmentCount();
+      stats.localMap.copiedBytes += (cornerMap.size() + surfMap.size()) * sizeof(pcl::PointXYZI);
+   });
+}
+
+
+void BasicLaserMapping::downsizeFeatureStack()
+{
+   LOAM_SCOPED_TIMER(stackDownsizeTimer, "mapping.stackDownsize");
+   pcl::PointXYZI pointSel;
+
+   for (auto const& pt : _laserCloudCornerLast->points)
+   {
+      pointAssociateToMap(pt, pointSel);
+      pointAssociateTobeMapped(pointSel, pointSel);
+      _laserCloudCornerStack->push_back(pointSel);
+   }
+
+   for (auto const& pt : _laserCloudSurfLast->points)
+   {
+      pointAssociateToMap(pt, pointSel);
+      pointAssociateTobeMapped(pointSel, pointSel);
+      _laserCloudSurfStack->push_back(pointSel);
+   }
+
+   // down sample feature stack clouds
+   _laserCloudCornerStackDS->clear();
+   _downSizeFilterCorner.setInputCloud(_laserCloudCornerStack);
+   _downSizeFilterCorner.filter(*_laserCloudCornerStackDS);
+
+   _laserCloudSurfStackDS->clear();
+   _downSizeFilterSurf.setInputCloud(_laserCloudSurfStack);
+   _downSizeFilterSurf.filter(*_laserCloudSurfStackDS);
+
+   _laserCloudCornerStack->clear();
+   _laserCloudSurfStack->clear();
+}
+
+
+void BasicLaserMapping::insertMapPoints(const pcl::PointCloud<pcl::PointXYZI>& cornerPoints,
+                                        const pcl::PointCloud<pcl::PointXYZI>& surfPoints)
+{
+   LOAM_SCOPED_TIMER(insertionTimer, "mapping.insertion");
+   if (_incrementalMapFilter)
+      updateCubeFilters();
+
+   // store corner points in corresponding cube clouds
+   size_t cubeInd;
+   for (auto const& pt : cornerPoints)
+   {
+      if (toCubeIndex(pt, cubeInd))
+      {
+         if (!_cubeSpillStore.empty())
+            restoreCube(cubeInd);
+         anchorCube(cubeInd);
+
+         if (_incrementalMapFilter)
+            _laserCloudCornerFilterArray[cubeInd].insert(pt, _laserCloudCornerArray[cubeInd]);
+         else
+            _laserCloudCornerArray[cubeInd].push_back(pt);
+         _laserCloudCornerVoxelArray[cubeInd].invalidate();
+         _laserCloudBoundsArray[cubeInd].extend(pt.getVector3fMap());
+         _surroundCubeArray[cubeInd].cloud.reset();
+      }
+   }
+
+   // store surface points in corresponding cube clouds
+   for (auto const& pt : surfPoints)
+   {
+      if (toCubeIndex(pt, cubeInd))
+      {
+         if (!_cubeSpillStore.empty())
+            restoreCube(cubeInd);
+         anchorCube(cubeInd);
+
+         if (_incrementalMapFilter)
+            _laserCloudSurfFilterArray[cubeInd].insert(pt, _laserCloudSurfArray[cubeInd]);
+         else
+            _laserCloudSurfArray[cubeInd].push_back(pt);
+         _laserCloudSurfVoxelArray[cubeInd].invalidate();
+         _laserCloudBoundsArray[cubeInd].extend(pt.getVector3fMap());
+         _surroundCubeArray[cubeInd].cloud.reset();
+      }
+   }
+}
+
+
+void BasicLaserMapping::downsizeValidCubes()
+{
+   LOAM_SCOPED_TIMER(cubeDownsizeTimer, "mapping.cubeDownsize");
+   // incrementally filtered cubes are down sized on insertion
+   if (_incrementalMapFilter)
+      return;
+
+   // down size all valid (within field of view) feature cube clouds
+   for (auto const& ind : _laserCloudValidInd)
+   {
+      _laserCloudCube->clear();
+      _laserCloudCubeDS->clear();
+      _laserCloudCornerArray[ind].decodeTo(*_laserCloudCube);
+      _cubeFilterCorner.setInputCloud(_laserCloudCube);
+      _cubeFilterCorner.filter(*_laserCloudCubeDS);
+      _laserCloudCornerArray[ind].assign(*_laserCloudCubeDS);
+
+      _laserCloudCube->clear();
+      _laserCloudCubeDS->clear();
+      _laserCloudSurfArray[ind].decodeTo(*_laserCloudCube);
+      _cubeFilterSurf.setInputCloud(_laserCloudCube);
+      _cubeFilterSurf.filter(*_laserCloudCubeDS);
+      _laserCloudSurfArray[ind].assign(*_laserCloudCubeDS);
+
+      _laserCloudCornerVoxelArray[ind].invalidate();
+      _laserCloudSurfVoxelArray[ind].invalidate();
+      _surroundCubeArray[ind].cloud.reset();
+   }
+}
+
+
+void BasicLaserMapping::syncCubeFilters()
+{
+   Eigen::Vector3f cornerLeaf = _downSizeFilterCorner.getLeafSize();
+   Eigen::Vector3f surfLeaf = _downSizeFilterSurf.getLeafSize();
+   _cubeFilterCorner.setLeafSize(cornerLeaf[0], cornerLeaf[1], cornerLeaf[2]);
+   _cubeFilterSurf.setLeafSize(surfLeaf[0], surfLeaf[1], surfLeaf[2]);
+}
+
+
+void BasicLaserMapping::startMapThread()
+{
+   if (_mapThread.joinable())
+      return;
+
+   // the filters can't be changed while the thread is running
+   syncCubeFilters();
+
+   // the current local map references the cubes in place, which are about to change on the thread
+   if (!_localizationMode)
+   {
+      assembleLocalMap(*_laserCloudCornerFromMap, *_laserCloudSurfFromMap,
+                       _laserCloudCornerFromMapView, _laserCloudSurfFromMapView, _localMapRange, true);
+      _laserCloudCornerFromMapNum = _laserCloudCornerFromMapView.size();
+      _laserCloudSurfFromMapNum = _laserCloudSurfFromMapView.size();
+   }
+
+   _stopMapThread = false;
+   _mapThread = std::thread(&BasicLaserMapping::mapMaintenanceLoop, this);
+}
+
+
+void BasicLaserMapping::stopMapThread()
+{
+   if (!_mapThread.joinable())
+      return;
+
    {
-      for (int i = 0; i < _laserCloudWidth; i++)
-      {
-         for (int j = 0; j < _laserCloudHeight; j++)
-         {
-            for (int k = _laserCloudDepth - 1; k >= 1; k--)
-            {
-               const size_t indexA = toIndex(i, j, k);
-               const size_t indexB = toIndex(i, j, k - 1);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
-            }
-            const size_t indexC = toIndex(i, j, 0);
-            _laserCloudCornerArray[indexC]->clear();
-            _laserCloudSurfArray[indexC]->clear();
-         }
-      }
-      centerCubeK++;
-      _laserCloudCenDepth++;
+      std::lock_guard<std::mutex> lock(_mapMutex);
+      _stopMapThread = true;
    }
+   _mapCondition.notify_one();
+   _mapThread.join();
+}
 
-   while (centerCubeK >= _laserCloudDepth - 3)
+
+void BasicLaserMapping::mapMaintenanceLoop()
+{
+   Profiler::instance().setThreadName("map maintenance");
+   pcl::PointCloud<pcl::PointXYZI> cornerPoints, surfPoints;
+   Twist pose, befPose;
+
+   std::unique_lock<std::mutex> lock(_mapMutex);
+   while (true)
    {
-      for (int i = 0; i < _laserCloudWidth; i++)
+      _mapCondition.wait(lock, [this] { return _mapUpdatePending || _stopMapThread; });
+
+      // finish the pending update before stopping
+      if (!_mapUpdatePending)
+         break;
+
+      cornerPoints.swap(_pendingCornerPoints);
+      surfPoints.swap(_pendingSurfPoints);
+      _pendingCornerPoints.clear();
+      _pendingSurfPoints.clear();
+      pose = _pendingPose;
+      befPose = _pendingBefPose;
+      _mapUpdatePending = false;
+      lock.unlock();
+
+      auto start = SteadyClock::now();
+      int centerCubeI, centerCubeJ, centerCubeK;
+      shiftMapCubes(pose, centerCubeI, centerCubeJ, centerCubeK);
+      recordStageTime(&MappingStageTimes::cubeShift, start);
+
+      selectMapCubes(pose, centerCubeI, centerCubeJ, centerCubeK);
+
+      start = SteadyClock::now();
+      insertMapPoints(cornerPoints, surfPoints);
+      recordStageTime(&MappingStageTimes::mapInsertion, start);
+
+      start = SteadyClock::now();
+      downsizeValidCubes();
+      recordStageTime(&MappingStageTimes::cubeDownsize, start);
+
+      enforceMapMemoryBudget(centerCubeI, centerCubeJ, centerCubeK);
+
+      start = SteadyClock::now();
+      // the cubes keep changing while the local map is in use, so it has to be copied
+      assembleLocalMap(*_backLocalMap.corner, *_backLocalMap.surf,
+                       _backLocalMap.cornerView, _backLocalMap.surfView, _localMapRange, true);
+      _backLocalMap.cornerNum = _backLocalMap.cornerView.size();
+      _backLocalMap.surfNum = _backLocalMap.surfView.size();
+      recordStageTime(&MappingStageTimes::localMap, start);
+
+      _backLocalMap.surroundCreated = surroundMapDue();
+      if (_backLocalMap.surroundCreated)
       {
-         for (int j = 0; j < _laserCloudHeight; j++)
-         {
-            for (int k = 0; k < _laserCloudDepth - 1; k++)
-            {
-               const size_t indexA = toIndex(i, j, k);
-               const size_t indexB = toIndex(i, j, k + 1);
-               std::swap(_laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB]);
-               std::swap(_laserCloudSurfArray[indexA], _laserCloudSurfArray[indexB]);
-            }
-            const size_t indexC = toIndex(i, j, _laserCloudDepth - 1);
-            _laserCloudCornerArray[indexC]->clear();
-            _laserCloudSurfArray[indexC]->clear();
-         }
+         start = SteadyClock::now();
+         createDownsizedMap(_backLocalMap.surround);
+         recordStageTime(&MappingStageTimes::surroundMap, start);
       }
-      centerCubeK--;
-      _laserCloudCenDepth--;
-   }
 
-   _laserCloudValidInd.clear();
-   _laserCloudSurroundInd.clear();
-   for (int i = centerCubeI - 2; i <= centerCubeI + 2; i++)
-   {
-      for (int j = centerCubeJ - 2; j <= centerCubeJ + 2; j++)
+      writeRequestedSnapshot(pose, befPose);
+
+      lock.lock();
+
+      // keep a surround map the optimization side has not taken over yet
+      if (_localMapReady && _readyLocalMap.surroundCreated && !_backLocalMap.surroundCreated)
       {
-         for (int k = centerCubeK - 2; k <= centerCubeK + 2; k++)
-         {
-            if (i >= 0 && i < _laserCloudWidth &&
-                j >= 0 && j < _laserCloudHeight &&
-                k >= 0 && k < _laserCloudDepth)
-            {
+         _backLocalMap.surround.swap(_readyLocalMap.surround);
+         _backLocalMap.surroundCreated = true;
+      }
 
-               float centerX = 50.0f * (i - _laserCloudCenWidth);
-               float centerY = 50.0f * (j - _laserCloudCenHeight);
-               float centerZ = 50.0f * (k - _laserCloudCenDepth);
+      std::swap(_backLocalMap, _readyLocalMap);
+      _localMapReady = true;
+   }
+}
 
-               pcl::PointXYZI transform_pos = (pcl::PointXYZI) _transformTobeMapped.pos;
 
-               bool isInLaserFOV = false;
-               for (int ii = -1; ii <= 1; ii += 2)
-               {
-                  for (int jj = -1; jj <= 1; jj += 2)
-                  {
-                     for (int kk = -1; kk <= 1; kk += 2)
-                     {
-                        pcl::PointXYZI corner;
-                        corner.x = centerX + 25.0f * ii;
-                        corner.y = centerY + 25.0f * jj;
-                        corner.z = centerZ + 25.0f * kk;
+void BasicLaserMapping::queueMapUpdate()
+{
+   {
+      std::lock_guard<std::mutex> lock(_mapMutex);
+
+      // merge with a not yet processed update, so the maintenance can catch up without a queue
+      _pendingCornerPoints += *_laserCloudCornerStack;
+      _pendingSurfPoints += *_laserCloudSurfStack;
+      _pendingPose = _transformTobeMapped;
+      _pendingBefPose = _transformBefMapped;
+      _mapUpdatePending = true;
+   }
+   _mapCondition.notify_one();
 
-                        float squaredSide1 = calcSquaredDiff(transform_pos, corner);
-                        float squaredSide2 = calcSquaredDiff(pointOnYAxis, corner);
+   _laserCloudCornerStack->clear();
+   _laserCloudSurfStack->clear();
+}
 
-                        float check1 = 100.0f + squaredSide1 - squaredSide2
-                           - 10.0f * sqrt(3.0f) * sqrt(squaredSide1);
 
-                        float check2 = 100.0f + squaredSide1 - squaredSide2
-                           + 10.0f * sqrt(3.0f) * sqrt(squaredSide1);
+void BasicLaserMapping::fetchLocalMap()
+{
+   std::lock_guard<std::mutex> lock(_mapMutex);
 
-                        if (check1 < 0 && check2 > 0)
-                        {
-                           isInLaserFOV = true;
-                        }
-                     }
-                  }
-               }
+   _downsizedMapCreated = false;
+   if (!_localMapReady)
+      return;
 
-               size_t cubeIdx = i + _laserCloudWidth * j + _laserCloudWidth * _laserCloudHeight * k;
-               if (isInLaserFOV)
-               {
-                  _laserCloudValidInd.push_back(cubeIdx);
-               }
-               _laserCloudSurroundInd.push_back(cubeIdx);
-            }
-         }
-      }
-   }
+   _laserCloudCornerFromMap.swap(_readyLocalMap.corner);
+   _laserCloudSurfFromMap.swap(_readyLocalMap.surf);
+   std::swap(_laserCloudCornerFromMapView, _readyLocalMap.cornerView);
+   std::swap(_laserCloudSurfFromMapView, _readyLocalMap.surfView);
+   _laserCloudCornerFromMapNum = _readyLocalMap.cornerNum;
+   _laserCloudSurfFromMapNum = _readyLocalMap.surfNum;
 
-   // prepare valid map corner and surface cloud for pose optimization
-   _laserCloudCornerFromMap->clear();
-   _laserCloudSurfFromMap->clear();
-   for (auto const& ind : _laserCloudValidInd)
+   if (_readyLocalMap.surroundCreated)
    {
-      *_laserCloudCornerFromMap += *_laserCloudCornerArray[ind];
-      *_laserCloudSurfFromMap += *_laserCloudSurfArray[ind];
+      _surroundMap.swap(_readyLocalMap.surround);
+      _readyLocalMap.surroundCreated = false;
+      _downsizedMapCreated = true;
    }
 
-   // prepare feature stack clouds for pose optimization
-   for (auto& pt : *_laserCloudCornerStack)
-      pointAssociateTobeMapped(pt, pt);
+   _localMapReady = false;
+}
 
-   for (auto& pt : *_laserCloudSurfStack)
-      pointAssociateTobeMapped(pt, pt);
 
-   // down sample feature stack clouds
-   _laserCloudCornerStackDS->clear();
-   _downSizeFilterCorner.setInputCloud(_laserCloudCornerStack);
-   _downSizeFilterCorner.filter(*_laserCloudCornerStackDS);
-   size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->size();
+void BasicLaserMapping::recordStageTime(StageTime MappingStageTimes::*stage, SteadyClock::time_point const& start)
+{
+   double seconds = toSec(SteadyClock::now() - start);
+   updateStats([&](MappingStats& stats) { (stats.stages.*stage).add(seconds); });
+}
 
-   _laserCloudSurfStackDS->clear();
-   _downSizeFilterSurf.setInputCloud(_laserCloudSurfStack);
-   _downSizeFilterSurf.filter(*_laserCloudSurfStackDS);
-   size_t laserCloudSurfStackNum = _laserCloudSurfStackDS->size();
 
-   _laserCloudCornerStack->clear();
-   _laserCloudSurfStack->clear();
+MappingStats BasicLaserMapping::stats() const
+{
+   std::lock_guard<std::mutex> lock(_statsMutex);
+   return _stats;
+}
 
-   // run pose optimization
-   optimizeTransformTobeMapped();
 
-   // store down sized corner stack points in corresponding cube clouds
-   for (int i = 0; i < laserCloudCornerStackNum; i++)
+bool BasicLaserMapping::process(Time const& laserOdometryTime)
+{
+   // skip some frames?!?
+   _frameCount++;
+   if (_frameCount < _stackFrameNum)
    {
-      pointAssociateToMap(_laserCloudCornerStackDS->points[i], pointSel);
+      return false;
+   }
+   _frameCount = 0;
+   _laserOdometryTime = laserOdometryTime;
+   LOAM_SCOPED_TIMER(frameTimer, "mapping.frame");
 
-      int cubeI = int((pointSel.x + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenWidth;
-      int cubeJ = int((pointSel.y + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenHeight;
-      int cubeK = int((pointSel.z + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenDepth;
+   const long reportFrame = _report.frame + 1;
+   _report = OptimizationReport();
+   _report.stamp = laserOdometryTime;
+   _report.frame = reportFrame;
 
-      if (pointSel.x + CUBE_HALF < 0) cubeI--;
-      if (pointSel.y + CUBE_HALF < 0) cubeJ--;
-      if (pointSel.z + CUBE_HALF < 0) cubeK--;
+   auto frameStart = SteadyClock::now();
+   auto start = frameStart;
+   int centerCubeI, centerCubeJ, centerCubeK;
 
-      if (cubeI >= 0 && cubeI < _laserCloudWidth &&
-          cubeJ >= 0 && cubeJ < _laserCloudHeight &&
-          cubeK >= 0 && cubeK < _laserCloudDepth)
+   // relate incoming data to map
+   transformAssociateToMap();
+
+   // the prior map of the localization mode is frozen and indexed once on load
+   if (!_localizationMode)
+   {
+      if (_asyncMapMaintenance)
       {
-         size_t cubeInd = cubeI + _laserCloudWidth * cubeJ + _laserCloudWidth * _laserCloudHeight * cubeK;
-         _laserCloudCornerArray[cubeInd]->push_back(pointSel);
+         // optimize against the most recent local map, never wait for the map maintenance
+         startMapThread();
+         fetchLocalMap();
+      }
+      else
+      {
+         syncCubeFilters();
+
+         shiftMapCubes(_transformTobeMapped, centerCubeI, centerCubeJ, centerCubeK);
+         recordStageTime(&MappingStageTimes::cubeShift, start);
+
+         start = SteadyClock::now();
+         selectMapCubes(_transformTobeMapped, centerCubeI, centerCubeJ, centerCubeK);
+         assembleLocalMap(*_laserCloudCornerFromMap, *_laserCloudSurfFromMap,
+                          _laserCloudCornerFromMapView, _laserCloudSurfFromMapView, _localMapRange, false);
+         _laserCloudCornerFromMapNum = _laserCloudCornerFromMapView.size();
+         _laserCloudSurfFromMapNum = _laserCloudSurfFromMapView.size();
+         recordStageTime(&MappingStageTimes::localMap, start);
       }
    }
 
-   // store down sized surface stack points in corresponding cube clouds
-   for (int i = 0; i < laserCloudSurfStackNum; i++)
+   start = SteadyClock::now();
+   downsizeFeatureStack();
+   recordStageTime(&MappingStageTimes::stackDownsize, start);
+
+   // run pose optimization, within the time left for this frame if budgeted
+   start = SteadyClock::now();
+   double optimizationBudget = 0;
+   if (_frameTimeBudget > 0)
    {
-      pointAssociateToMap(_laserCloudSurfStackDS->points[i], pointSel);
+      // a late frame still gets the minimum iterations, so never pass 0 (= unlimited)
+      optimizationBudget = std::max(1e-4, _frameTimeBudget - toSec(start - frameStart) - _postOptimizationTime);
+   }
+   optimizeTransformTobeMapped(optimizationBudget);
+   recordStageTime(&MappingStageTimes::optimization, start);
+   auto optimizationEnd = SteadyClock::now();
 
-      int cubeI = int((pointSel.x + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenWidth;
-      int cubeJ = int((pointSel.y + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenHeight;
-      int cubeK = int((pointSel.z + CUBE_HALF) / CUBE_SIZE) + _laserCloudCenDepth;
+   if (_localizationMode)
+   {
+      // the prior map does not change, it is reported once somebody is interested
+      _downsizedMapCreated = _publishPriorMap && _surroundMapDemand;
+      if (_downsizedMapCreated)
+         _publishPriorMap = false;
+   }
+   else
+   {
+      // transform down sized feature stack to map for insertion
+      pcl::PointXYZI pointSel;
+      for (auto const& pt : *_laserCloudCornerStackDS)
+      {
+         pointAssociateToMap(pt, pointSel);
+         _laserCloudCornerStack->push_back(pointSel);
+      }
 
-      if (pointSel.x + CUBE_HALF < 0) cubeI--;
-      if (pointSel.y + CUBE_HALF < 0) cubeJ--;
-      if (pointSel.z + CUBE_HALF < 0) cubeK--;
+      for (auto const& pt : *_laserCloudSurfStackDS)
+      {
+         pointAssociateToMap(pt, pointSel);
+         _laserCloudSurfStack->push_back(pointSel);
+      }
 
-      if (cubeI >= 0 && cubeI < _laserCloudWidth &&
-          cubeJ >= 0 && cubeJ < _laserCloudHeight &&
-          cubeK >= 0 && cubeK < _laserCloudDepth)
+      if (_asyncMapMaintenance)
       {
-         size_t cubeInd = cubeI + _laserCloudWidth * cubeJ + _laserCloudWidth * _laserCloudHeight * cubeK;
-         _laserCloudSurfArray[cubeInd]->push_back(pointSel);
+         queueMapUpdate();
+      }
+      else
+      {
+         start = SteadyClock::now();
+         insertMapPoints(*_laserCloudCornerStack, *_laserCloudSurfStack);
+         _laserCloudCornerStack->clear();
+         _laserCloudSurfStack->clear();
+         recordStageTime(&MappingStageTimes::mapInsertion, start);
+
+         start = SteadyClock::now();
+         downsizeValidCubes();
+         recordStageTime(&MappingStageTimes::cubeDownsize, start);
+
+         enforceMapMemoryBudget(centerCubeI, centerCubeJ, centerCubeK);
       }
    }
 
-   // down size all valid (within field of view) feature cube clouds
-   for (auto const& ind : _laserCloudValidInd)
-   {
-      _laserCloudCornerDSArray[ind]->clear();
-      _downSizeFilterCorner.setInputCloud(_laserCloudCornerArray[ind]);
-      _downSizeFilterCorner.filter(*_laserCloudCornerDSArray[ind]);
+   start = SteadyClock::now();
+   transformFullResToMap();
+   recordStageTime(&MappingStageTimes::fullResTransform, start);
 
-      _laserCloudSurfDSArray[ind]->clear();
-      _downSizeFilterSurf.setInputCloud(_laserCloudSurfArray[ind]);
-      _downSizeFilterSurf.filter(*_laserCloudSurfDSArray[ind]);
+   if (!_asyncMapMaintenance && !_localizationMode)
+   {
+      _downsizedMapCreated = surroundMapDue();
+      if (_downsizedMapCreated)
+      {
+         start = SteadyClock::now();
+         createDownsizedMap(_surroundMap);
+         recordStageTime(&MappingStageTimes::surroundMap, start);
+      }
 
-      // swap cube clouds for next processing
-      _laserCloudCornerArray[ind].swap(_laserCloudCornerDSArray[ind]);
-      _laserCloudSurfArray[ind].swap(_laserCloudSurfDSArray[ind]);
+      writeRequestedSnapshot(_transformAftMapped, _transformBefMapped);
    }
 
-   transformFullResToMap();
-   _downsizedMapCreated = createDownsizedMap();
+   recordStageTime(&MappingStageTimes::frame, frameStart);
+   _report.frameTime = toSec(SteadyClock::now() - frameStart);
+   _reportHistory.push(_report);
+
+   if (_frameTimeBudget > 0)
+   {
+      auto frameEnd = SteadyClock::now();
+      const double postOptimizationTime = toSec(frameEnd - optimizationEnd);
+      _postOptimizationTime += (postOptimizationTime - _postOptimizationTime) * BUDGET_COST_SMOOTHING;
+
+      const double frameTime = toSec(frameEnd - frameStart);
+      updateStats([&](MappingStats& stats)
+      {
+         stats.frameBudget.frames++;
+         stats.frameBudget.frameBudget += _frameTimeBudget;
+         stats.frameBudget.frameTime += frameTime;
+         if (frameTime > _frameTimeBudget)
+            stats.frameBudget.overruns++;
+      });
+   }
 
    return true;
 }
@@ -621,21 +1853,140 @@ void BasicLaserMapping::updateOdometry(Twist const& twist)
    _transformSum = twist;
 }
 
-nanoflann::KdTreeFLANN<pcl::PointXYZI> kdtreeCornerFromMap;
-nanoflann::KdTreeFLANN<pcl::PointXYZI> kdtreeSurfFromMap;
+void BasicLaserMapping::planOptimization(double timeBudget, size_t featureNum,
+                                         size_t& iterations, size_t& stride) const
+{
+   iterations = _maxIterations;
+   stride = 1;
+
+   // a small odometry increment after a converged frame leaves little to correct
+   auto increment = [](const Angle& now, const Angle& before)
+   {
+      return float(fabs(std::remainder(now.rad() - before.rad(), 2 * M_PI)));
+   };
+   const float rotation = std::max({ increment(_transformSum.rot_x, _transformBefMapped.rot_x),
+                                     increment(_transformSum.rot_y, _transformBefMapped.rot_y),
+                                     increment(_transformSum.rot_z, _transformBefMapped.rot_z) });
+   if (_lastConverged && _transformIncre.pos.norm() < BUDGET_SMALL_MOTION && rotation < BUDGET_SMALL_ROTATION)
+      iterations = std::min(_maxIterations, std::max(BUDGET_MIN_ITERATIONS, _lastIterations + 1));
+
+   // no cost estimate before the first optimization
+   if (_featureIterationCost <= 0 || featureNum == 0)
+      return;
+
+   // trade iterations for features down to the minimum, then sample the feature stacks
+   size_t affordable = size_t(timeBudget / (_featureIterationCost * iterations));
+   if (affordable < BUDGET_MIN_FEATURES && iterations > BUDGET_MIN_ITERATIONS)
+   {
+      iterations = std::max(BUDGET_MIN_ITERATIONS,
+                            std::min(iterations, size_t(timeBudget / (_featureIterationCost * BUDGET_MIN_FEATURES))));
+      affordable = size_t(timeBudget / (_featureIterationCost * iterations));
+   }
+
+   affordable = std::max(affordable, BUDGET_MIN_FEATURES);
+   if (affordable < featureNum)
+      stride = (featureNum + affordable - 1) / affordable;
+}
+
+
+void BasicLaserMapping::selectInformativeFeatures(const Eigen::Matrix<float, 1, 6>& eigenvalues,
+                                                  const Eigen::Matrix<float, 6, 6>& eigenvectors,
+                                                  size_t cornerStackNum)
+{
+   const size_t num = _featureJacobians.size();
+   const size_t selectNum = std::min(_featureSelectionNum, num);
+
+   // rank the correspondences by their information along each eigen direction
+   _featureOrder.resize(6 * num);
+   _featureScores.resize(6 * num);
+   for (size_t k = 0; k < 6; k++)
+   {
+      uint32_t* order = &_featureOrder[k * num];
+      float* scores = &_featureScores[k * num];
+      for (size_t i = 0; i < num; i++)
+      {
+         const float projection = eigenvectors.col(k).dot(_featureJacobians[i]);
+         scores[i] = projection * projection;
+         order[i] = uint32_t(i);
+      }
+      std::partial_sort(order, order + selectNum, order + num,
+                        [scores](uint32_t a, uint32_t b) { return scores[a] > scores[b]; });
+   }
+
+   // take the best remaining correspondence of every direction in turn, starting with the weakest direction
+   _featureTaken.assign(num, false);
+   size_t next[6] = { 0, 0, 0, 0, 0, 0 };
+   size_t selected = 0;
+   Eigen::Matrix<float, 6, 6> selectedAtA = Eigen::Matrix<float, 6, 6>::Zero();
+   _cornerFeatureInd.clear();
+   _surfFeatureInd.clear();
+   while (selected < selectNum)
+   {
+      for (size_t k = 0; k < 6 && selected < selectNum; k++)
+      {
+         const uint32_t* order = &_featureOrder[k * num];
+         while (next[k] < selectNum && _featureTaken[order[next[k]]])
+            next[k]++;
+         if (next[k] == selectNum)
+            continue;
+
+         const uint32_t i = order[next[k]];
+         _featureTaken[i] = true;
+         selectedAtA.noalias() += _featureJacobians[i] * _featureJacobians[i].transpose();
+         selected++;
+
+         const size_t stackInd = _laserCloudOriInd[i];
+         if (stackInd < cornerStackNum)
+            _cornerFeatureInd.push_back(stackInd);
+         else
+            _surfFeatureInd.push_back(stackInd - cornerStackNum);
+      }
+   }
+
+   // search the stacks in memory order
+   std::sort(_cornerFeatureInd.begin(), _cornerFeatureInd.end());
+   std::sort(_surfFeatureInd.begin(), _surfFeatureInd.end());
+
+   Eigen::SelfAdjointEigenSolver<Eigen::Matrix<float, 6, 6>> esolver(selectedAtA, Eigen::EigenvaluesOnly);
+   updateStats([&](MappingStats& stats)
+   {
+      stats.featureSelection.frames++;
+      stats.featureSelection.correspondences += num;
+      stats.featureSelection.selected += selected;
+      if (eigenvalues(0, 0) > 0)
+         stats.featureSelection.weakestInformation += esolver.eigenvalues()(0) / eigenvalues(0, 0);
+   });
+}
+
 
-void BasicLaserMapping::optimizeTransformTobeMapped()
+void BasicLaserMapping::optimizeTransformTobeMapped(double timeBudget)
 {
-   if (_laserCloudCornerFromMap->size() <= 10 || _laserCloudSurfFromMap->size() <= 100)
+   _report.maxIterations = _maxIterations;
+   if (_laserCloudCornerFromMapNum <= 10 || _laserCloudSurfFromMapNum <= 100)
       return;
 
+   auto optimizationStart = SteadyClock::now();
+   LOAM_SCOPED_TIMER(optimizationTimer, "mapping.optimization");
+
    pcl::PointXYZI pointSel, pointOri, /*pointProj, */coeff;
 
    std::vector<int> pointSearchInd(5, 0);
    std::vector<float> pointSearchSqDis(5, 0);
 
-   kdtreeCornerFromMap.setInputCloud(_laserCloudCornerFromMap);
-   kdtreeSurfFromMap.setInputCloud(_laserCloudSurfFromMap);
+   if (voxelFeaturesActive())
+      updateVoxelStats();
+
+   // the localization map is indexed once on load
+   if (!voxelFeaturesActive() && !_localizationMode)
+   {
+      LOAM_SCOPED_TIMER(kdtreeTimer, "mapping.kdtree");
+      _kdtreeCornerFromMap.setInputSegments(_laserCloudCornerFromMapView);
+      _kdtreeSurfFromMap.setInputSegments(_laserCloudSurfFromMapView);
+      LOAM_STOP_TIMER(kdtreeTimer);
+
+      const size_t indexAllocations = _kdtreeCornerFromMap.indexAllocations() + _kdtreeSurfFromMap.indexAllocations();
+      updateStats([&](MappingStats& stats) { stats.localMap.indexAllocations = indexAllocations; });
+   }
 
    Eigen::Matrix<float, 5, 3> matA0;
    Eigen::Matrix<float, 5, 1> matB0;
@@ -658,23 +2009,69 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
    size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->size();
    size_t laserCloudSurfStackNum = _laserCloudSurfStackDS->size();
 
-   for (size_t iterCount = 0; iterCount < _maxIterations; iterCount++)
+   // the index build counts against the budget as well
+   size_t maxIterations = _maxIterations;
+   size_t stride = 1;
+   auto iterationStart = SteadyClock::now();
+   double iterationBudget = timeBudget - toSec(iterationStart - optimizationStart);
+   if (timeBudget > 0)
+      planOptimization(iterationBudget, laserCloudCornerStackNum + laserCloudSurfStackNum, maxIterations, stride);
+   _report.maxIterations = maxIterations;
+
+   // stack features searched for correspondences, narrowed down after the first iteration if selecting
+   _cornerFeatureInd.clear();
+   _surfFeatureInd.clear();
+   for (size_t i = 0; i < laserCloudCornerStackNum; i += stride)
+      _cornerFeatureInd.push_back(i);
+   for (size_t i = 0; i < laserCloudSurfStackNum; i += stride)
+      _surfFeatureInd.push_back(i);
+
+   size_t iterations = 0;
+   size_t searchedFeatures = 0;
+   bool converged = false;
+   for (size_t iterCount = 0; iterCount < maxIterations; iterCount++)
    {
+      // stop early if another iteration would exceed the budget
+      if (timeBudget > 0 && iterCount >= BUDGET_MIN_ITERATIONS
+          && toSec(SteadyClock::now() - iterationStart) / iterCount * (iterCount + 1) > iterationBudget)
+         break;
+
+      iterations++;
+      searchedFeatures += _cornerFeatureInd.size() + _surfFeatureInd.size();
+      LOAM_SCOPED_TIMER(correspondenceTimer, "mapping.correspondences");
       _laserCloudOri.clear();
       _coeffSel.clear();
+      _laserCloudOriInd.clear();
 
-      for (int i = 0; i < laserCloudCornerStackNum; i++)
+      for (size_t i : _cornerFeatureInd)
       {
          pointOri = _laserCloudCornerStackDS->points[i];
          pointAssociateToMap(pointOri, pointSel);
-         kdtreeCornerFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+
+         if (voxelFeaturesActive())
+         {
+            // use the line fitted to the statistics of the corresponding map voxel
+            VoxelStats* voxel = findVoxelStats(_laserCloudCornerVoxelArray, pointSel);
+            if (voxel && voxel->count() >= VOXEL_MIN_POINTS &&
+                voxel->eigenvalues()(2) > 3 * voxel->eigenvalues()(1) &&
+                lineCoefficients(pointSel, Vector3(voxel->mean()(0), voxel->mean()(1), voxel->mean()(2)),
+                                 voxel->eigenvectors().col(2), coeff))
+            {
+               _laserCloudOri.push_back(pointOri);
+               _laserCloudOriInd.push_back(i);
+               _coeffSel.push_back(coeff);
+            }
+            continue;
+         }
+
+         _kdtreeCornerFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
 
          if (pointSearchSqDis[4] < 1.0)
          {
             Vector3 vc(0, 0, 0);
 
             for (int j = 0; j < 5; j++)
-               vc += Vector3(_laserCloudCornerFromMap->points[pointSearchInd[j]]);
+               vc += Vector3(_laserCloudCornerFromMapView[pointSearchInd[j]]);
             vc /= 5.0;
 
             Eigen::Matrix3f mat_a;
@@ -682,7 +2079,7 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
 
             for (int j = 0; j < 5; j++)
             {
-               Vector3 a = Vector3(_laserCloudCornerFromMap->points[pointSearchInd[j]]) - vc;
+               Vector3 a = Vector3(_laserCloudCornerFromMapView[pointSearchInd[j]]) - vc;
 
                mat_a(0, 0) += a.x() * a.x();
                mat_a(1, 0) += a.x() * a.y();
@@ -697,74 +2094,52 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
             matD1 = esolver.eigenvalues().real();
             matV1 = esolver.eigenvectors().real();
 
-            if (matD1(0, 2) > 3 * matD1(0, 1))
+            if (matD1(0, 2) > 3 * matD1(0, 1) &&
+                lineCoefficients(pointSel, vc, matV1.col(2), coeff))
             {
+               _laserCloudOri.push_back(pointOri);
+               _laserCloudOriInd.push_back(i);
+               _coeffSel.push_back(coeff);
+            }
+         }
+      }
 
-               float x0 = pointSel.x;
-               float y0 = pointSel.y;
-               float z0 = pointSel.z;
-               float x1 = vc.x() + 0.1 * matV1(0, 2);
-               float y1 = vc.y() + 0.1 * matV1(1, 2);
-               float z1 = vc.z() + 0.1 * matV1(2, 2);
-               float x2 = vc.x() - 0.1 * matV1(0, 2);
-               float y2 = vc.y() - 0.1 * matV1(1, 2);
-               float z2 = vc.z() - 0.1 * matV1(2, 2);
-
-               float a012 = sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                                 * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                                 + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                                 * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                                 + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))
-                                 * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
-
-               float l12 = sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
-
-               float la = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                           + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
-
-               float lb = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                            - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
-
-               float lc = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                            + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
-
-               float ld2 = a012 / l12;
-
-//                // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
-//                pointProj = pointSel;
-//                pointProj.x -= la * ld2;
-//                pointProj.y -= lb * ld2;
-//                pointProj.z -= lc * ld2;
-
-               float s = 1 - 0.9f * fabs(ld2);
+      for (size_t i : _surfFeatureInd)
+      {
+         pointOri = _laserCloudSurfStackDS->points[i];
+         pointAssociateToMap(pointOri, pointSel);
 
-               coeff.x = s * la;
-               coeff.y = s * lb;
-               coeff.z = s * lc;
-               coeff.intensity = s * ld2;
+         if (voxelFeaturesActive())
+         {
+            // use the plane fitted to the statistics of the corresponding map voxel
+            VoxelStats* voxel = findVoxelStats(_laserCloudSurfVoxelArray, pointSel);
+            if (voxel && voxel->count() >= VOXEL_MIN_POINTS &&
+                voxel->eigenvalues()(0) < VOXEL_PLANE_MAX_VAR &&
+                voxel->eigenvalues()(1) > 3 * voxel->eigenvalues()(0))
+            {
+               Eigen::Vector3f normal = voxel->eigenvectors().col(0);
+               float pd = -normal.dot(voxel->mean());
 
-               if (s > 0.1)
+               if (planeCoefficients(pointSel, normal(0), normal(1), normal(2), pd, coeff))
                {
                   _laserCloudOri.push_back(pointOri);
+                  _laserCloudOriInd.push_back(laserCloudCornerStackNum + i);
                   _coeffSel.push_back(coeff);
                }
             }
+            continue;
          }
-      }
 
-      for (int i = 0; i < laserCloudSurfStackNum; i++)
-      {
-         pointOri = _laserCloudSurfStackDS->points[i];
-         pointAssociateToMap(pointOri, pointSel);
-         kdtreeSurfFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
+         _kdtreeSurfFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis);
 
          if (pointSearchSqDis[4] < 1.0)
          {
             for (int j = 0; j < 5; j++)
             {
-               matA0(j, 0) = _laserCloudSurfFromMap->points[pointSearchInd[j]].x;
-               matA0(j, 1) = _laserCloudSurfFromMap->points[pointSearchInd[j]].y;
-               matA0(j, 2) = _laserCloudSurfFromMap->points[pointSearchInd[j]].z;
+               const pcl::PointXYZI pt = _laserCloudSurfFromMapView[pointSearchInd[j]];
+               matA0(j, 0) = pt.x;
+               matA0(j, 1) = pt.y;
+               matA0(j, 2) = pt.z;
             }
             matX0 = matA0.colPivHouseholderQr().solve(matB0);
 
@@ -782,37 +2157,18 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
             bool planeValid = true;
             for (int j = 0; j < 5; j++)
             {
-               if (fabs(pa * _laserCloudSurfFromMap->points[pointSearchInd[j]].x +
-                        pb * _laserCloudSurfFromMap->points[pointSearchInd[j]].y +
-                        pc * _laserCloudSurfFromMap->points[pointSearchInd[j]].z + pd) > 0.2)
+               if (fabs(pa * matA0(j, 0) + pb * matA0(j, 1) + pc * matA0(j, 2) + pd) > 0.2)
                {
                   planeValid = false;
                   break;
                }
             }
 
-            if (planeValid)
+            if (planeValid && planeCoefficients(pointSel, pa, pb, pc, pd, coeff))
             {
-               float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
-
-               //                // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
-               //                pointProj = pointSel;
-               //                pointProj.x -= pa * pd2;
-               //                pointProj.y -= pb * pd2;
-               //                pointProj.z -= pc * pd2;
-
-               float s = 1 - 0.9f * fabs(pd2) / sqrt(calcPointDistance(pointSel));
-
-               coeff.x = s * pa;
-               coeff.y = s * pb;
-               coeff.z = s * pc;
-               coeff.intensity = s * pd2;
-
-               if (s > 0.1)
-               {
-                  _laserCloudOri.push_back(pointOri);
-                  _coeffSel.push_back(coeff);
-               }
+               _laserCloudOri.push_back(pointOri);
+               _laserCloudOriInd.push_back(laserCloudCornerStackNum + i);
+               _coeffSel.push_back(coeff);
             }
          }
       }
@@ -825,15 +2181,27 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
       float crz = _transformTobeMapped.rot_z.cos();
 
       size_t laserCloudSelNum = _laserCloudOri.size();
+      LOAM_STOP_TIMER(correspondenceTimer);
+      LOAM_HISTOGRAM("mapping.pointSelNum", laserCloudSelNum);
+      if (iterCount == 0)
+         _report.initialPointSelNum = laserCloudSelNum;
+      _report.pointSelNum = laserCloudSelNum;
       if (laserCloudSelNum < 50)
          continue;
 
-      Eigen::Matrix<float, Eigen::Dynamic, 6> matA(laserCloudSelNum, 6);
-      Eigen::Matrix<float, 6, Eigen::Dynamic> matAt(6, laserCloudSelNum);
-      Eigen::Matrix<float, 6, 6> matAtA;
-      Eigen::VectorXf matB(laserCloudSelNum);
-      Eigen::VectorXf matAtB;
-      Eigen::VectorXf matX;
+      LOAM_SCOPED_TIMER(jacobianTimer, "mapping.jacobian");
+
+      // the jacobians of the first iteration rank the features for the selection
+      const bool selectFeatures = iterCount == 0 && _featureSelectionNum > 0 && laserCloudSelNum > _featureSelectionNum;
+      if (selectFeatures)
+         _featureJacobians.resize(laserCloudSelNum);
+
+      // accumulate the normal equations directly, so no per point matrices are allocated
+      Eigen::Matrix<float, 6, 6> matAtA = Eigen::Matrix<float, 6, 6>::Zero();
+      Eigen::Matrix<float, 6, 1> matAtB = Eigen::Matrix<float, 6, 1>::Zero();
+      Eigen::Matrix<float, 6, 1> matA;
+      Eigen::Matrix<float, 6, 1> matX;
+      float squaredResiduals = 0;
 
       for (int i = 0; i < laserCloudSelNum; i++)
       {
@@ -853,18 +2221,21 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
             + (crx*crz*pointOri.x - crx * srz*pointOri.y) * coeff.y
             + ((sry*srz + cry * crz*srx)*pointOri.x + (crz*sry - cry * srx*srz)*pointOri.y)*coeff.z;
 
-         matA(i, 0) = arx;
-         matA(i, 1) = ary;
-         matA(i, 2) = arz;
-         matA(i, 3) = coeff.x;
-         matA(i, 4) = coeff.y;
-         matA(i, 5) = coeff.z;
-         matB(i, 0) = -coeff.intensity;
+         matA << arx, ary, arz, coeff.x, coeff.y, coeff.z;
+         matAtA.noalias() += matA * matA.transpose();
+         matAtB -= matA * coeff.intensity;
+         squaredResiduals += coeff.intensity * coeff.intensity;
+         if (selectFeatures)
+            _featureJacobians[i] = matA;
       }
+      LOAM_STOP_TIMER(jacobianTimer);
+
+      _report.optimized = true;
+      _report.finalResidual = sqrt(squaredResiduals / laserCloudSelNum);
+      if (iterCount == 0)
+         _report.initialResidual = _report.finalResidual;
 
-      matAt = matA.transpose();
-      matAtA = matAt * matA;
-      matAtB = matAt * matB;
+      LOAM_SCOPED_TIMER(solveTimer, "mapping.solve");
       matX = matAtA.colPivHouseholderQr().solve(matAtB);
 
       if (iterCount == 0)
@@ -881,6 +2252,8 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
 
          isDegenerate = false;
          float eignThre[6] = { 100, 100, 100, 100, 100, 100 };
+         for (int i = 0; i < 6; i++)
+            _report.eigenvalues[i] = matE(0, i);
          for (int i = 0; i < 6; i++)
          {
             if (matE(0, i) < eignThre[i])
@@ -890,6 +2263,7 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
                   matV2(i, j) = 0;
                }
                isDegenerate = true;
+               _report.degenerateDirections++;
             }
             else
             {
@@ -897,6 +2271,9 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
             }
          }
          matP = matV.inverse() * matV2;
+
+         if (selectFeatures)
+            selectInformativeFeatures(matE, matV, laserCloudCornerStackNum);
       }
 
       if (isDegenerate)
@@ -904,6 +2281,7 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
          Eigen::Matrix<float, 6, 1> matX2(matX);
          matX = matP * matX2;
       }
+      LOAM_STOP_TIMER(solveTimer);
 
       _transformTobeMapped.rot_x += matX(0, 0);
       _transformTobeMapped.rot_y += matX(1, 0);
@@ -918,12 +2296,127 @@ void BasicLaserMapping::optimizeTransformTobeMapped()
       float deltaT = sqrt(pow(matX(3, 0) * 100, 2) +
                           pow(matX(4, 0) * 100, 2) +
                           pow(matX(5, 0) * 100, 2));
+      _report.deltaR = deltaR;
+      _report.deltaT = deltaT;
 
       if (deltaR < _deltaRAbort && deltaT < _deltaTAbort)
+      {
+         converged = true;
          break;
+      }
    }
 
    transformUpdate();
+   LOAM_HISTOGRAM("mapping.iterations", iterations);
+
+   _report.iterations = iterations;
+   _report.converged = converged;
+   _report.features = iterations > 0 ? searchedFeatures / iterations : 0;
+   _report.optimizationTime = toSec(SteadyClock::now() - optimizationStart);
+
+   if (timeBudget <= 0)
+      return;
+
+   // update the cost estimate from the features actually searched
+   auto end = SteadyClock::now();
+   if (searchedFeatures > 0)
+   {
+      const double cost = toSec(end - iterationStart) / searchedFeatures;
+      _featureIterationCost = _featureIterationCost > 0
+                              ? _featureIterationCost + (cost - _featureIterationCost) * BUDGET_COST_SMOOTHING
+                              : cost;
+   }
+   _lastIterations = iterations;
+   _lastConverged = converged;
+
+   updateStats([&](MappingStats& stats)
+   {
+      stats.frameBudget.optimizationBudget += timeBudget;
+      stats.frameBudget.optimizationTime += toSec(end - optimizationStart);
+      stats.frameBudget.plannedIterations += maxIterations;
+      stats.frameBudget.iterations += iterations;
+      stats.frameBudget.features += iterations > 0 ? searchedFeatures / iterations : 0;
+      stats.frameBudget.stackFeatures += laserCloudCornerStackNum + laserCloudSurfStackNum;
+   });
+}
+
+
+bool BasicLaserMapping::loadLocalizationMap(const std::string& file, const Twist& initialPose)
+{
+   if (_mapThread.joinable() || !loadMapSnapshot(file, false))
+      return false;
+
+   // the odometry starts at its origin, which corresponds to the initial pose in the map
+   _transformAftMapped = initialPose;
+   _transformTobeMapped = initialPose;
+
+   // the whole prior map serves as local map
+   _laserCloudValidInd.clear();
+   _laserCloudSurroundInd.clear();
+   for (size_t i = 0; i < _laserCloudNum; i++)
+   {
+      _laserCloudValidInd.push_back(i);
+      _laserCloudSurroundInd.push_back(i);
+   }
+   // the kd-tree index cache refers to a flat copy of the prior map
+   assembleLocalMap(*_laserCloudCornerFromMap, *_laserCloudSurfFromMap,
+                    _laserCloudCornerFromMapView, _laserCloudSurfFromMapView, 0, true);
+   _laserCloudCornerFromMapNum = _laserCloudCornerFromMapView.size();
+   _laserCloudSurfFromMapNum = _laserCloudSurfFromMapView.size();
+
+   if (!voxelFeaturesActive())
+      prepareMapIndex(file);
+
+   syncCubeFilters();
+   createDownsizedMap(_surroundMap);
+
+   _localizationMode = true;
+   _publishPriorMap = true;
+   return true;
+}
+
+
+void BasicLaserMapping::prepareMapIndex(const std::string& mapFile)
+{
+   MapIndexHeader expected;
+   std::memset(&expected, 0, sizeof(expected));
+   std::memcpy(expected.magic, MAP_INDEX_MAGIC, sizeof(expected.magic));
+   expected.version = MAP_INDEX_VERSION;
+   expected.cornerNum = _laserCloudCornerFromMap->size();
+   expected.surfNum = _laserCloudSurfFromMap->size();
+
+   struct stat info;
+   if (stat(mapFile.c_str(), &info) == 0)
+   {
+      expected.mapSize = uint64_t(info.st_size);
+      expected.mapTime = int64_t(info.st_mtime);
+   }
+
+   // reuse the index of a previous run if it belongs to the same snapshot
+   const std::string indexFile = mapFile + ".kdtree";
+   if (FILE* in = std::fopen(indexFile.c_str(), "rb"))
+   {
+      MapIndexHeader header;
+      bool loaded = std::fread(&header, sizeof(header), 1, in) == 1
+         && std::memcmp(&header, &expected, sizeof(header)) == 0
+         && _kdtreeCornerFromMap.loadIndex(_laserCloudCornerFromMap, in)
+         && _kdtreeSurfFromMap.loadIndex(_laserCloudSurfFromMap, in);
+      std::fclose(in);
+
+      if (loaded)
+         return;
+   }
+
+   _kdtreeCornerFromMap.setInputCloud(_laserCloudCornerFromMap);
+   _kdtreeSurfFromMap.setInputCloud(_laserCloudSurfFromMap);
+
+   if (FILE* out = std::fopen(indexFile.c_str(), "wb"))
+   {
+      std::fwrite(&expected, sizeof(expected), 1, out);
+      _kdtreeCornerFromMap.saveIndex(out);
+      _kdtreeSurfFromMap.saveIndex(out);
+      std::fclose(out);
+   }
 }
 
 
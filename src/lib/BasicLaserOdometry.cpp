@@ -1,4 +1,5 @@
 #include "loam_velodyne/BasicLaserOdometry.h"
+#include "loam_velodyne/Profiler.h"
 
 #include "math_utils.h"
 #include <pcl/filters/filter.h>
@@ -193,21 +194,30 @@ void BasicLaserOdometry::updateIMU(pcl::PointCloud<pcl::PointXYZ> const& imuTran
    _imuVeloFromStart = imuTrans.points[3];
 }
 
-void BasicLaserOdometry::process()
+const OptimizationReport& BasicLaserOdometry::process(Time const& sweepTime)
 {
+   LOAM_SCOPED_TIMER(frameTimer, "odometry.frame");
+   auto frameStart = SteadyClock::now();
+   _report = OptimizationReport();
+   _report.stamp = sweepTime;
+   _report.frame = _frameCount;
+
    if (!_systemInited)
    {
       _cornerPointsLessSharp.swap(_lastCornerCloud);
       _surfPointsLessFlat.swap(_lastSurfaceCloud);
 
+      LOAM_SCOPED_TIMER(kdtreeTimer, "odometry.kdtree");
       _lastCornerKDTree.setInputCloud(_lastCornerCloud);
       _lastSurfaceKDTree.setInputCloud(_lastSurfaceCloud);
+      LOAM_STOP_TIMER(kdtreeTimer);
 
       _transformSum.rot_x += _imuPitchStart;
       _transformSum.rot_z += _imuRollStart;
 
       _systemInited = true;
-      return;
+      _reportHistory.push(_report);
+      return _report;
    }
 
    pcl::PointXYZI coeff;
@@ -215,6 +225,8 @@ void BasicLaserOdometry::process()
    Eigen::Matrix<float, 6, 6> matP;
 
    _frameCount++;
+   _report.frame = _frameCount;
+   _report.maxIterations = _maxIterations;
    _transform.pos -= _imuVeloFromStart * _scanPeriod;
 
 
@@ -236,9 +248,14 @@ void BasicLaserOdometry::process()
       _pointSearchSurfInd1.resize(surfPointsFlatNum);
       _pointSearchSurfInd2.resize(surfPointsFlatNum);
       _pointSearchSurfInd3.resize(surfPointsFlatNum);
+      _report.features = cornerPointsSharpNum + surfPointsFlatNum;
 
+      auto optimizationStart = SteadyClock::now();
       for (size_t iterCount = 0; iterCount < _maxIterations; iterCount++)
       {
+         LOAM_COUNT("odometry.iterations", 1);
+         _report.iterations++;
+         LOAM_SCOPED_TIMER(correspondenceTimer, "odometry.correspondences");
          pcl::PointXYZI pointSel, pointProj, tripod1, tripod2, tripod3;
          _laserCloudOri->clear();
          _coeffSel->clear();
@@ -259,7 +276,7 @@ void BasicLaserOdometry::process()
                   int closestPointScan = int(_lastCornerCloud->points[closestPointInd].intensity);
 
                   float pointSqDis, minPointSqDis2 = 25;
-                  for (int j = closestPointInd + 1; j < cornerPointsSharpNum; j++)
+                  for (int j = closestPointInd + 1; j < int(_lastCornerCloud->points.size()); j++)
                   {
                      if (int(_lastCornerCloud->points[j].intensity) > closestPointScan + 2.5)
                      {
@@ -375,7 +392,7 @@ void BasicLaserOdometry::process()
                   int closestPointScan = int(_lastSurfaceCloud->points[closestPointInd].intensity);
 
                   float pointSqDis, minPointSqDis2 = 25, minPointSqDis3 = 25;
-                  for (int j = closestPointInd + 1; j < surfPointsFlatNum; j++)
+                  for (int j = closestPointInd + 1; j < int(_lastSurfaceCloud->points.size()); j++)
                   {
                      if (int(_lastSurfaceCloud->points[j].intensity) > closestPointScan + 2.5)
                      {
@@ -481,18 +498,26 @@ void BasicLaserOdometry::process()
             }
          }
 
+         LOAM_STOP_TIMER(correspondenceTimer);
+
          int pointSelNum = _laserCloudOri->points.size();
+         LOAM_HISTOGRAM("odometry.pointSelNum", pointSelNum);
+         if (iterCount == 0)
+            _report.initialPointSelNum = pointSelNum;
+         _report.pointSelNum = pointSelNum;
          if (pointSelNum < 10)
          {
             continue;
          }
 
-         Eigen::Matrix<float, Eigen::Dynamic, 6> matA(pointSelNum, 6);
-         Eigen::Matrix<float, 6, Eigen::Dynamic> matAt(6, pointSelNum);
-         Eigen::Matrix<float, 6, 6> matAtA;
-         Eigen::VectorXf matB(pointSelNum);
-         Eigen::Matrix<float, 6, 1> matAtB;
+         LOAM_SCOPED_TIMER(jacobianTimer, "odometry.jacobian");
+
+         // accumulate the normal equations directly, so no per point matrices are allocated
+         Eigen::Matrix<float, 6, 6> matAtA = Eigen::Matrix<float, 6, 6>::Zero();
+         Eigen::Matrix<float, 6, 1> matAtB = Eigen::Matrix<float, 6, 1>::Zero();
+         Eigen::Matrix<float, 6, 1> matA;
          Eigen::Matrix<float, 6, 1> matX;
+         float squaredResiduals = 0;
 
          for (int i = 0; i < pointSelNum; i++)
          {
@@ -543,19 +568,20 @@ void BasicLaserOdometry::process()
             float atz = s * crx*sry * coeff.x - s * srx * coeff.y - s * crx*cry * coeff.z;
 
             float d2 = coeff.intensity;
+            squaredResiduals += d2 * d2;
 
-            matA(i, 0) = arx;
-            matA(i, 1) = ary;
-            matA(i, 2) = arz;
-            matA(i, 3) = atx;
-            matA(i, 4) = aty;
-            matA(i, 5) = atz;
-            matB(i, 0) = -0.05 * d2;
+            matA << arx, ary, arz, atx, aty, atz;
+            matAtA.noalias() += matA * matA.transpose();
+            matAtB += matA * float(-0.05 * d2);
          }
-         matAt = matA.transpose();
-         matAtA = matAt * matA;
-         matAtB = matAt * matB;
+         LOAM_STOP_TIMER(jacobianTimer);
 
+         _report.optimized = true;
+         _report.finalResidual = sqrt(squaredResiduals / pointSelNum);
+         if (iterCount == 0)
+            _report.initialResidual = _report.finalResidual;
+
+         LOAM_SCOPED_TIMER(solveTimer, "odometry.solve");
          matX = matAtA.colPivHouseholderQr().solve(matAtB);
 
          if (iterCount == 0)
@@ -572,6 +598,8 @@ void BasicLaserOdometry::process()
 
             isDegenerate = false;
             float eignThre[6] = { 10, 10, 10, 10, 10, 10 };
+            for (int i = 0; i < 6; i++)
+               _report.eigenvalues[i] = matE(0, i);
             for (int i = 0; i < 6; i++)
             {
                if (matE(0, i) < eignThre[i])
@@ -581,6 +609,7 @@ void BasicLaserOdometry::process()
                      matV2(i, j) = 0;
                   }
                   isDegenerate = true;
+                  _report.degenerateDirections++;
                }
                else
                {
@@ -595,6 +624,7 @@ void BasicLaserOdometry::process()
             Eigen::Matrix<float, 6, 1> matX2(matX);
             matX = matP * matX2;
          }
+         LOAM_STOP_TIMER(solveTimer);
 
          _transform.rot_x = _transform.rot_x.rad() + matX(0, 0);
          _transform.rot_y = _transform.rot_y.rad() + matX(1, 0);
@@ -617,10 +647,16 @@ void BasicLaserOdometry::process()
          float deltaT = sqrt(pow(matX(3, 0) * 100, 2) +
                              pow(matX(4, 0) * 100, 2) +
                              pow(matX(5, 0) * 100, 2));
+         _report.deltaR = deltaR;
+         _report.deltaT = deltaT;
 
          if (deltaR < _deltaRAbort && deltaT < _deltaTAbort)
+         {
+            _report.converged = true;
             break;
+         }
       }
+      _report.optimizationTime = toSec(SteadyClock::now() - optimizationStart);
    }
 
    Angle rx, ry, rz;
@@ -659,10 +695,14 @@ void BasicLaserOdometry::process()
 
    if (lastCornerCloudSize > 10 && lastSurfaceCloudSize > 100)
    {
+      LOAM_SCOPED_TIMER(kdtreeTimer, "odometry.kdtree");
       _lastCornerKDTree.setInputCloud(_lastCornerCloud);
       _lastSurfaceKDTree.setInputCloud(_lastSurfaceCloud);
    }
 
+   _report.frameTime = toSec(SteadyClock::now() - frameStart);
+   _reportHistory.push(_report);
+   return _report;
 }
 
 
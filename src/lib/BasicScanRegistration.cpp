@@ -1,8 +1,9 @@
-#include <pcl/filters/voxel_grid.h>
-
 #include "loam_velodyne/BasicScanRegistration.h"
+#include "loam_velodyne/Profiler.h"
 #include "math_utils.h"
 
+#include <algorithm>
+
 namespace loam
 {
 
@@ -45,6 +46,91 @@ void BasicScanRegistration::processScanlines(const Time& scanTime, std::vector<p
   updateIMUTransform();
 }
 
+void BasicScanRegistration::processCloud(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn, const Time& scanTime,
+                                         const MultiScanMapper& scanMapper)
+{
+  LOAM_SCOPED_TIMER(frameTimer, "registration.frame");
+  LOAM_SCOPED_TIMER(binningTimer, "registration.binning");
+  size_t cloudSize = laserCloudIn.size();
+  LOAM_HISTOGRAM("registration.points", cloudSize);
+
+  // determine scan start and end orientations
+  float startOri = -std::atan2(laserCloudIn[0].y, laserCloudIn[0].x);
+  float endOri = -std::atan2(laserCloudIn[cloudSize - 1].y,
+                             laserCloudIn[cloudSize - 1].x) + 2 * float(M_PI);
+  if (endOri - startOri > 3 * M_PI) {
+    endOri -= 2 * M_PI;
+  } else if (endOri - startOri < M_PI) {
+    endOri += 2 * M_PI;
+  }
+
+  bool halfPassed = false;
+  pcl::PointXYZI point;
+  _laserCloudScans.resize(scanMapper.getNumberOfScanRings());
+  // clear all scanline points
+  std::for_each(_laserCloudScans.begin(), _laserCloudScans.end(), [](auto&&v) {v.clear(); });
+
+  // extract valid points from input cloud
+  for (int i = 0; i < cloudSize; i++) {
+    point.x = laserCloudIn[i].x;
+    point.y = laserCloudIn[i].y;
+    point.z = laserCloudIn[i].z;
+
+    // skip NaN and INF valued points
+    if (!pcl_isfinite(point.x) ||
+        !pcl_isfinite(point.y) ||
+        !pcl_isfinite(point.z)) {
+      continue;
+    }
+
+    // skip zero valued points
+    if (point.x * point.x + point.y * point.y + point.z * point.z < 0.0001) {
+      continue;
+    }
+
+    // calculate vertical point angle and scan ID
+    float angle = std::atan(point.z / std::sqrt(point.y * point.y + point.x * point.x));
+    int scanID = scanMapper.getRingForAngle(angle);
+    if (scanID >= scanMapper.getNumberOfScanRings() || scanID < 0 ){
+      continue;
+    }
+
+    // calculate horizontal point angle
+    float ori = -std::atan2(point.y, point.x);
+    if (!halfPassed) {
+      if (ori < startOri - M_PI / 2) {
+        ori += 2 * M_PI;
+      } else if (ori > startOri + M_PI * 3 / 2) {
+        ori -= 2 * M_PI;
+      }
+
+      if (ori - startOri > M_PI) {
+        halfPassed = true;
+      }
+    } else {
+      ori += 2 * M_PI;
+
+      if (ori < endOri - M_PI * 3 / 2) {
+        ori += 2 * M_PI;
+      } else if (ori > endOri + M_PI / 2) {
+        ori -= 2 * M_PI;
+      }
+    }
+
+    // calculate relative scan time based on point orientation
+    float relTime = _config.scanPeriod * (ori - startOri) / (endOri - startOri);
+    point.intensity = scanID + relTime;
+
+    projectPointToStartOfSweep(point, relTime);
+
+    _laserCloudScans[scanID].push_back(point);
+  }
+  LOAM_STOP_TIMER(binningTimer);
+
+  processScanlines(scanTime, _laserCloudScans);
+}
+
+
 bool BasicScanRegistration::configure(const RegistrationParams& config)
 {
   _config = config;
@@ -98,6 +184,26 @@ void BasicScanRegistration::updateIMUData(Vector3& acc, IMUState& newState)
 }
 
 
+void BasicScanRegistration::updateIMUData(const Time& stamp, double roll, double pitch, double yaw,
+                                          const Vector3& linearAcceleration)
+{
+  // remove gravity and swap the axes to the camera frame convention
+  Vector3 acc;
+  acc.x() = float(linearAcceleration.y() - std::sin(roll) * std::cos(pitch) * 9.81);
+  acc.y() = float(linearAcceleration.z() - std::cos(roll) * std::cos(pitch) * 9.81);
+  acc.z() = float(linearAcceleration.x() + std::sin(pitch) * 9.81);
+
+  IMUState newState;
+  newState.stamp = stamp;
+  newState.roll = roll;
+  newState.pitch = pitch;
+  newState.yaw = yaw;
+  newState.acceleration = acc;
+
+  updateIMUData(acc, newState);
+}
+
+
 void BasicScanRegistration::projectPointToStartOfSweep(pcl::PointXYZI& point, float relTime)
 {
   // project point to the start of the sweep using corresponding IMU data
@@ -157,7 +263,7 @@ void BasicScanRegistration::extractFeatures(const uint16_t& beginIdx)
   // extract features from individual scans
   size_t nScans = _scanIndices.size();
   for (size_t i = beginIdx; i < nScans; i++) {
-    pcl::PointCloud<pcl::PointXYZI>::Ptr surfPointsLessFlatScan(new pcl::PointCloud<pcl::PointXYZI>);
+    _surfPointsLessFlatScan->clear();
     size_t scanStartIdx = _scanIndices[i].first;
     size_t scanEndIdx = _scanIndices[i].second;
 
@@ -194,6 +300,7 @@ void BasicScanRegistration::extractFeatures(const uint16_t& beginIdx)
 
 
       // extract corner features
+      LOAM_SCOPED_TIMER(selectionTimer, "registration.selection");
       int largestPickedNum = 0;
       for (size_t k = regionSize; k > 0 && largestPickedNum < _config.maxCornerLessSharp;) {
         size_t idx = _regionSortIndices[--k];
@@ -237,19 +344,18 @@ void BasicScanRegistration::extractFeatures(const uint16_t& beginIdx)
       // extract less flat surface features
       for (int k = 0; k < regionSize; k++) {
         if (_regionLabel[k] <= SURFACE_LESS_FLAT) {
-          surfPointsLessFlatScan->push_back(_laserCloud[sp + k]);
+          _surfPointsLessFlatScan->push_back(_laserCloud[sp + k]);
         }
       }
     }
 
     // down size less flat surface point cloud of current scan
-    pcl::PointCloud<pcl::PointXYZI> surfPointsLessFlatScanDS;
-    pcl::VoxelGrid<pcl::PointXYZI> downSizeFilter;
-    downSizeFilter.setInputCloud(surfPointsLessFlatScan);
-    downSizeFilter.setLeafSize(_config.lessFlatFilterSize, _config.lessFlatFilterSize, _config.lessFlatFilterSize);
-    downSizeFilter.filter(surfPointsLessFlatScanDS);
+    LOAM_SCOPED_TIMER(filterTimer, "registration.lessFlatFilter");
+    _lessFlatFilter.setInputCloud(_surfPointsLessFlatScan);
+    _lessFlatFilter.setLeafSize(_config.lessFlatFilterSize, _config.lessFlatFilterSize, _config.lessFlatFilterSize);
+    _lessFlatFilter.filter(_surfPointsLessFlatScanDS);
 
-    _surfacePointsLessFlat += surfPointsLessFlatScanDS;
+    _surfacePointsLessFlat += _surfPointsLessFlatScanDS;
   }
 }
 
@@ -283,6 +389,7 @@ void BasicScanRegistration::updateIMUTransform()
 
 void BasicScanRegistration::setRegionBuffersFor(const size_t& startIdx, const size_t& endIdx)
 {
+  LOAM_SCOPED_TIMER(curvatureTimer, "registration.curvature");
   // resize buffers
   size_t regionSize = endIdx - startIdx + 1;
   _regionCurvature.resize(regionSize);
@@ -0,0 +1,174 @@
+#include "loam_velodyne/CloudCodec.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef LOAM_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+namespace loam
+{
+
+/** Number of quantized fields per point (x, y, z, intensity). */
+static const size_t FIELD_NUM = 4;
+
+/** Map a delta to an unsigned value, small magnitudes of either sign to small values. */
+static inline uint16_t zigzag(uint16_t delta)
+{
+   const int16_t value = int16_t(delta);
+   return uint16_t((value << 1) ^ (value >> 15));
+}
+
+static inline uint16_t unzigzag(uint16_t value)
+{
+   return uint16_t((value >> 1) ^ -(value & 1));
+}
+
+static inline bool isFinite(const pcl::PointXYZI& point)
+{
+   return std::isfinite(point.x) && std::isfinite(point.y) && std::isfinite(point.z);
+}
+
+/** Smallest power of two intensity step covering the given maximum intensity with 16 bits. */
+static inline float intensityStep(float maxIntensity)
+{
+   if (!(maxIntensity > 0))
+      return 1;
+   return float(std::ldexp(1.0, int(std::ceil(std::log2(double(maxIntensity) / 65535)))));
+}
+
+void CloudCodec::encode(const pcl::PointCloud<pcl::PointXYZI>& cloud, bool lz4,
+                        QuantizedCloudInfo& info, std::vector<uint8_t>& data)
+{
+   size_t pointNum = 0;
+   float maxAbs = 0, maxIntensity = 0;
+   for (auto const& point : cloud)
+   {
+      if (!isFinite(point))
+         continue;
+      pointNum++;
+      maxAbs = std::max({ maxAbs, std::fabs(point.x), std::fabs(point.y), std::fabs(point.z) });
+      maxIntensity = std::max(maxIntensity, point.intensity);
+   }
+
+   info.pointNum = uint32_t(pointNum);
+   info.scale = maxAbs > 0 ? maxAbs / 32767 : 1;
+   info.intensityScale = intensityStep(maxIntensity);
+   info.lz4 = false;
+
+#ifdef LOAM_HAVE_LZ4
+   lz4 = lz4 && pointNum > 0;
+#else
+   lz4 = false;
+#endif
+
+   // the planes go to the data directly, unless they are compressed afterwards
+   std::vector<uint8_t>& planes = lz4 ? _buffer : data;
+   planes.resize(pointNum * FIELD_NUM * 2);
+
+   const float invScale = 1 / info.scale;
+   const float invIntensityScale = 1 / info.intensityScale;
+   uint16_t previous[FIELD_NUM] = { 0, 0, 0, 0 };
+   size_t i = 0;
+   for (auto const& point : cloud)
+   {
+      if (!isFinite(point))
+         continue;
+
+      const uint16_t values[FIELD_NUM] = {
+         uint16_t(int16_t(std::lround(point.x * invScale))),
+         uint16_t(int16_t(std::lround(point.y * invScale))),
+         uint16_t(int16_t(std::lround(point.z * invScale))),
+         uint16_t(std::min(std::floor(std::min(std::max(point.intensity, 0.0f), maxIntensity) * invIntensityScale),
+                           65535.0f)) };
+
+      for (size_t field = 0; field < FIELD_NUM; field++)
+      {
+         const uint16_t value = zigzag(uint16_t(values[field] - previous[field]));
+         previous[field] = values[field];
+
+         uint8_t* plane = planes.data() + field * 2 * pointNum;
+         plane[i] = uint8_t(value & 0xff);
+         plane[pointNum + i] = uint8_t(value >> 8);
+      }
+      i++;
+   }
+
+#ifdef LOAM_HAVE_LZ4
+   if (lz4)
+   {
+      const int rawSize = int(_buffer.size());
+      data.resize(LZ4_compressBound(rawSize));
+      const int size = LZ4_compress_default(reinterpret_cast<const char*>(_buffer.data()),
+                                            reinterpret_cast<char*>(data.data()), rawSize, int(data.size()));
+      if (size > 0 && size < rawSize)
+      {
+         data.resize(size);
+         info.lz4 = true;
+      }
+      else
+      {
+         // incompressible, send the planes as they are
+         data.swap(_buffer);
+      }
+   }
+#endif
+}
+
+bool CloudCodec::decode(const QuantizedCloudInfo& info, const std::vector<uint8_t>& data,
+                        pcl::PointCloud<pcl::PointXYZI>& cloud)
+{
+   const size_t pointNum = info.pointNum;
+   const size_t rawSize = pointNum * FIELD_NUM * 2;
+   const uint8_t* planes = data.data();
+
+   if (info.lz4)
+   {
+#ifdef LOAM_HAVE_LZ4
+      _buffer.resize(rawSize);
+      const int size = LZ4_decompress_safe(reinterpret_cast<const char*>(data.data()),
+                                           reinterpret_cast<char*>(_buffer.data()), int(data.size()), int(rawSize));
+      if (size < 0 || size_t(size) != rawSize)
+         return false;
+      planes = _buffer.data();
+#else
+      return false;
+#endif
+   }
+   else if (data.size() != rawSize)
+   {
+      return false;
+   }
+
+   cloud.resize(pointNum);
+   uint16_t previous[FIELD_NUM] = { 0, 0, 0, 0 };
+   for (size_t i = 0; i < pointNum; i++)
+   {
+      for (size_t field = 0; field < FIELD_NUM; field++)
+      {
+         const uint8_t* plane = planes + field * 2 * pointNum;
+         previous[field] += unzigzag(uint16_t(plane[i] | (plane[pointNum + i] << 8)));
+      }
+
+      pcl::PointXYZI& point = cloud.points[i];
+      point.x = int16_t(previous[0]) * info.scale;
+      point.y = int16_t(previous[1]) * info.scale;
+      point.z = int16_t(previous[2]) * info.scale;
+      point.intensity = previous[3] * info.intensityScale;
+   }
+   cloud.is_dense = true;
+
+   return true;
+}
+
+bool CloudCodec::lz4Supported()
+{
+#ifdef LOAM_HAVE_LZ4
+   return true;
+#else
+   return false;
+#endif
+}
+
+} // end namespace loam
@@ -0,0 +1,76 @@
+#include "loam_velodyne/CompactPointCloud.h"
+
+#include <cassert>
+
+namespace loam
+{
+
+constexpr float CompactPointCloud::RESOLUTION;
+constexpr float CompactPointCloud::TAG_RESOLUTION;
+
+void CompactPointCloud::setOrigin(const Eigen::Vector3f& origin)
+{
+   const Eigen::Vector3f oldOrigin = _origin;
+   _origin = origin;
+   for (auto& pt : _points)
+      pt = encode(decode(pt, oldOrigin));
+}
+
+void CompactPointCloud::append(const pcl::PointCloud<pcl::PointXYZI>& cloud)
+{
+   _points.reserve(_points.size() + cloud.size());
+   for (auto const& pt : cloud)
+      _points.push_back(encode(pt));
+}
+
+void CompactPointCloud::append(const CompactPoint* points, size_t num, const Eigen::Vector3f& origin)
+{
+   if (origin == _origin)
+   {
+      _points.insert(_points.end(), points, points + num);
+      return;
+   }
+
+   _points.reserve(_points.size() + num);
+   for (size_t i = 0; i < num; i++)
+      _points.push_back(encode(decode(points[i], origin)));
+}
+
+void CompactPointCloud::decodeTo(pcl::PointCloud<pcl::PointXYZI>& cloud) const
+{
+   cloud.reserve(cloud.size() + _points.size());
+   for (auto const& pt : _points)
+      cloud.push_back(decode(pt));
+}
+
+
+
+void MapPointView::clear()
+{
+   _segments.clear();
+   _segmentOf.clear();
+   _size = 0;
+}
+
+void MapPointView::append(const CompactPointCloud& cloud)
+{
+   addSegment(Segment{ cloud.data(), nullptr, cloud.origin(), _size }, cloud.size());
+}
+
+void MapPointView::append(const pcl::PointCloud<pcl::PointXYZI>& cloud)
+{
+   addSegment(Segment{ nullptr, cloud.points.data(), Eigen::Vector3f::Zero(), _size }, cloud.size());
+}
+
+void MapPointView::addSegment(const Segment& segment, size_t size)
+{
+   if (size == 0)
+      return;
+
+   assert(_segments.size() <= UINT16_MAX);
+   _segmentOf.insert(_segmentOf.end(), size, uint16_t(_segments.size()));
+   _segments.push_back(segment);
+   _size += size;
+}
+
+} // end namespace loam
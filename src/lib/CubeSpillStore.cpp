@@ -0,0 +1,192 @@
+#include "loam_velodyne/CubeSpillStore.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <dirent.h>
+
+namespace loam
+{
+
+namespace
+{
+
+const char CUBE_FILE_MAGIC[4] = { 'L', 'C', 'U', 'B' };
+const uint32_t CUBE_FILE_VERSION = 2;
+
+/** Cube file header. */
+struct CubeFileHeader
+{
+   char magic[4];
+   uint32_t version;
+   uint32_t cornerNum;      ///< number of corner points following the header
+   uint32_t surfNum;        ///< number of surface points following the corner points
+   float cornerOrigin[3];   ///< origin the corner points are quantized relative to
+   float surfOrigin[3];     ///< origin the surface points are quantized relative to
+};
+
+void writePoints(std::ofstream& out, const CompactPointCloud& cloud)
+{
+   out.write(reinterpret_cast<const char*>(cloud.data()), std::streamsize(cloud.bytes()));
+}
+
+bool readPoints(std::ifstream& in, size_t num, std::vector<CompactPoint>& points)
+{
+   points.resize(num);
+   return bool(in.read(reinterpret_cast<char*>(points.data()), std::streamsize(num * sizeof(CompactPoint))));
+}
+
+/** Remove the cube files (cube_*.bin) of a directory. */
+void removeCubeFiles(const std::string& directory)
+{
+   DIR* dir = opendir(directory.c_str());
+   if (!dir)
+      return;
+
+   while (const dirent* entry = readdir(dir))
+   {
+      const size_t length = std::strlen(entry->d_name);
+      if (length > 9 && std::strncmp(entry->d_name, "cube_", 5) == 0
+          && std::strcmp(entry->d_name + length - 4, ".bin") == 0)
+         std::remove((directory + "/" + entry->d_name).c_str());
+   }
+   closedir(dir);
+}
+
+} // end anonymous namespace
+
+
+void CubeSpillStore::setDirectory(const std::string& directory)
+{
+   _directory = directory;
+   _cubes.clear();
+   _bytes = 0;
+   _points = 0;
+
+   if (enabled())
+      removeCubeFiles(_directory);
+}
+
+
+void CubeSpillStore::clear()
+{
+   for (auto const& entry : _cubes)
+      std::remove(fileName(entry.first).c_str());
+
+   _cubes.clear();
+   _bytes = 0;
+   _points = 0;
+}
+
+
+std::vector<VoxelKey> CubeSpillStore::cubes() const
+{
+   std::vector<VoxelKey> keys;
+   keys.reserve(_cubes.size());
+   for (auto const& entry : _cubes)
+      keys.push_back(entry.first);
+   return keys;
+}
+
+
+std::string CubeSpillStore::fileName(const VoxelKey& cube) const
+{
+   return _directory + "/cube_" + std::to_string(cube.x) + "_" + std::to_string(cube.y) + "_"
+      + std::to_string(cube.z) + ".bin";
+}
+
+
+bool CubeSpillStore::save(const VoxelKey& cube,
+                          const CompactPointCloud& corner,
+                          const CompactPointCloud& surf)
+{
+   if (!enabled())
+      return false;
+
+   std::ofstream out(fileName(cube), std::ios::binary | std::ios::trunc);
+   if (!out)
+      return false;
+
+   CubeFileHeader header;
+   std::copy(CUBE_FILE_MAGIC, CUBE_FILE_MAGIC + 4, header.magic);
+   header.version = CUBE_FILE_VERSION;
+   header.cornerNum = uint32_t(corner.size());
+   header.surfNum = uint32_t(surf.size());
+   Eigen::Map<Eigen::Vector3f>(header.cornerOrigin) = corner.origin();
+   Eigen::Map<Eigen::Vector3f>(header.surfOrigin) = surf.origin();
+   out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+   writePoints(out, corner);
+   writePoints(out, surf);
+   if (!out)
+      return false;
+
+   const CubeFile file = { sizeof(header) + corner.bytes() + surf.bytes(), corner.size() + surf.size() };
+   auto it = _cubes.find(cube);
+   if (it != _cubes.end())
+   {
+      _bytes -= it->second.bytes;
+      _points -= it->second.points;
+   }
+   _cubes[cube] = file;
+   _bytes += file.bytes;
+   _points += file.points;
+   return true;
+}
+
+
+bool CubeSpillStore::load(const VoxelKey& cube,
+                          CompactPointCloud& corner,
+                          CompactPointCloud& surf)
+{
+   auto it = _cubes.find(cube);
+   if (it == _cubes.end())
+      return false;
+
+   const bool loaded = read(cube, corner, surf);
+   _bytes -= it->second.bytes;
+   _points -= it->second.points;
+   _cubes.erase(it);
+   if (loaded)
+   {
+      std::remove(fileName(cube).c_str());
+   }
+   else
+   {
+      // keep the points for inspection, but out of the way of the next save of the cube
+      std::rename(fileName(cube).c_str(), (fileName(cube) + ".unreadable").c_str());
+      _failedLoads++;
+   }
+   return loaded;
+}
+
+
+bool CubeSpillStore::read(const VoxelKey& cube,
+                          CompactPointCloud& corner,
+                          CompactPointCloud& surf) const
+{
+   if (_cubes.count(cube) == 0)
+      return false;
+
+   // read into temporaries, so a failed read leaves the clouds untouched
+   std::vector<CompactPoint> cornerPoints, surfPoints;
+   CubeFileHeader header;
+   {
+      std::ifstream in(fileName(cube), std::ios::binary);
+      if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+          || !std::equal(CUBE_FILE_MAGIC, CUBE_FILE_MAGIC + 4, header.magic)
+          || header.version != CUBE_FILE_VERSION
+          || !readPoints(in, header.cornerNum, cornerPoints)
+          || !readPoints(in, header.surfNum, surfPoints))
+         return false;
+   }
+
+   corner.append(cornerPoints.data(), cornerPoints.size(), Eigen::Map<const Eigen::Vector3f>(header.cornerOrigin));
+   surf.append(surfPoints.data(), surfPoints.size(), Eigen::Map<const Eigen::Vector3f>(header.surfOrigin));
+   return true;
+}
+
+} // end namespace loam
@@ -0,0 +1,58 @@
+#include "loam_velodyne/IncrementalVoxelFilter.h"
+
+namespace loam
+{
+
+IncrementalVoxelFilter::IncrementalVoxelFilter(const float& leafSize) :
+   _leafSize(leafSize),
+   _invLeafSize(1.0f / leafSize)
+{}
+
+void IncrementalVoxelFilter::setLeafSize(const float& leafSize, CompactPointCloud& cloud)
+{
+   _leafSize = leafSize;
+   _invLeafSize = 1.0f / leafSize;
+   rebuild(cloud);
+}
+
+bool IncrementalVoxelFilter::insert(const pcl::PointXYZI& point, CompactPointCloud& cloud)
+{
+   const Voxel entry = { uint32_t(cloud.size()), 1, { point.x, point.y, point.z, point.intensity } };
+   auto result = _voxels.insert({ toVoxelKey(point, _invLeafSize), entry });
+   if (result.second)
+   {
+      cloud.push_back(point);
+      return true;
+   }
+
+   // merge into running centroid, a quantized one would stop moving once the increments drop below one step
+   Voxel& voxel = result.first->second;
+   voxel.count++;
+   float w = 1.0f / voxel.count;
+   voxel.centroid[0] += (point.x - voxel.centroid[0]) * w;
+   voxel.centroid[1] += (point.y - voxel.centroid[1]) * w;
+   voxel.centroid[2] += (point.z - voxel.centroid[2]) * w;
+   voxel.centroid[3] += (point.intensity - voxel.centroid[3]) * w;
+
+   pcl::PointXYZI centroid;
+   centroid.x = voxel.centroid[0];
+   centroid.y = voxel.centroid[1];
+   centroid.z = voxel.centroid[2];
+   centroid.intensity = voxel.centroid[3];
+   cloud.set(voxel.index, centroid);
+   return false;
+}
+
+void IncrementalVoxelFilter::rebuild(CompactPointCloud& cloud)
+{
+   _voxels.clear();
+
+   CompactPointCloud compacted(cloud.origin());
+   compacted.reserve(cloud.size());
+   for (size_t i = 0; i < cloud.size(); i++)
+      insert(cloud[i], compacted);
+
+   cloud.swap(compacted);
+}
+
+} // end namespace loam
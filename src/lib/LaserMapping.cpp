@@ -33,16 +33,36 @@
 #include "loam_velodyne/LaserMapping.h"
 #include "loam_velodyne/common.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
 namespace loam {
 
+namespace {
+
+/** \brief Nearest rank percentile of the given (unsorted) samples. */
+double percentile(std::vector<double> samples, double p) {
+  if (samples.empty())
+    return 0;
+
+  size_t rank = std::min(samples.size() - 1, size_t(p * samples.size()));
+  std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+  return samples[rank];
+}
+
+} // end anonymous namespace
+
 LaserMapping::LaserMapping(const float &scanPeriod,
                            const size_t &maxIterations) {
   _mapOdomTopic = "/aft_mapped_to_init";
   _initFrame = "/camera_init";
   _mapFrame = "/aft_mapped";
-  _loamOdomTopic = "/laser_odom_to_init";
   _imuInputTopic = "/imu/data";
   _outputTransforms = true;
+  _latencyReportFrames = 0;
+  _mapSnapshotInterval = 0;
 
   // initialize mapping odometry and odometry tf messages
   _odomAftMapped.header.frame_id = _initFrame;
@@ -52,6 +72,27 @@ LaserMapping::LaserMapping(const float &scanPeriod,
   _aftMappedTrans.child_frame_id_ = _mapFrame;
 }
 
+LaserMapping::~LaserMapping() {
+  if (_surroundThread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(_surroundMutex);
+      _stopSurroundThread = true;
+    }
+    _surroundCondition.notify_one();
+    _surroundThread.join();
+  }
+
+  if (_mapSnapshotFile.empty())
+    return;
+
+  // finish the pending map update and write a final snapshot
+  setAsyncMapMaintenance(false);
+  if (saveMapSnapshot(_mapSnapshotFile))
+    ROS_INFO("Wrote map snapshot %s", _mapSnapshotFile.c_str());
+  else
+    ROS_ERROR("Failed to write map snapshot %s", _mapSnapshotFile.c_str());
+}
+
 bool LaserMapping::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
   // fetch laser mapping params
   float fParam;
@@ -99,6 +140,26 @@ bool LaserMapping::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
     }
   }
 
+  if (privateNode.getParam("frameTimeBudget", fParam)) {
+    if (fParam < 0) {
+      ROS_ERROR("Invalid frameTimeBudget parameter: %f (expected >= 0)", fParam);
+      return false;
+    } else {
+      setFrameTimeBudget(fParam / 1000);
+      ROS_DEBUG("Set frameTimeBudget: %g ms", fParam);
+    }
+  }
+
+  if (privateNode.getParam("featureSelectionNum", iParam)) {
+    if (iParam < 0) {
+      ROS_ERROR("Invalid featureSelectionNum parameter: %d (expected >= 0)", iParam);
+      return false;
+    } else {
+      setFeatureSelectionNum(iParam);
+      ROS_DEBUG("Set featureSelectionNum: %d", iParam);
+    }
+  }
+
   if (privateNode.getParam("cornerFilterSize", fParam)) {
     if (fParam < 0.001) {
       ROS_ERROR("Invalid cornerFilterSize parameter: %f (expected >= 0.001)",
@@ -132,6 +193,123 @@ bool LaserMapping::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
     }
   }
 
+  if (privateNode.getParam("stackFrameNum", iParam)) {
+    if (iParam < 1) {
+      ROS_ERROR("Invalid stackFrameNum parameter: %d (expected >= 1)", iParam);
+      return false;
+    } else {
+      setStackFrameNum(iParam);
+      ROS_DEBUG("Set stackFrameNum: %d", iParam);
+    }
+  }
+
+  if (privateNode.getParam("mapFrameNum", iParam)) {
+    if (iParam < 1) {
+      ROS_ERROR("Invalid mapFrameNum parameter: %d (expected >= 1)", iParam);
+      return false;
+    } else {
+      setMapFrameNum(iParam);
+      ROS_DEBUG("Set mapFrameNum: %d", iParam);
+    }
+  }
+
+  if (privateNode.getParam("latencyReportFrames", iParam)) {
+    if (iParam < 0) {
+      ROS_ERROR("Invalid latencyReportFrames parameter: %d (expected >= 0)", iParam);
+      return false;
+    } else {
+      _latencyReportFrames = iParam;
+      ROS_DEBUG("Set latencyReportFrames: %d", iParam);
+    }
+  }
+
+  if (privateNode.getParam("localMapRange", fParam)) {
+    if (fParam < 0) {
+      ROS_ERROR("Invalid localMapRange parameter: %f (expected >= 0)", fParam);
+      return false;
+    } else {
+      setLocalMapRange(fParam);
+      ROS_DEBUG("Set localMapRange: %g", fParam);
+    }
+  }
+
+  if (privateNode.getParam("fovHalfAngle", fParam)) {
+    if (fParam <= 0 || fParam > 90) {
+      ROS_ERROR("Invalid fovHalfAngle parameter: %f (expected > 0 and <= 90)", fParam);
+      return false;
+    } else {
+      setFovHalfAngle(fParam);
+      ROS_DEBUG("Set fovHalfAngle: %g", fParam);
+    }
+  }
+
+  if (privateNode.getParam("mapMemoryBudget", fParam)) {
+    if (fParam < 0) {
+      ROS_ERROR("Invalid mapMemoryBudget parameter: %f (expected >= 0)", fParam);
+      return false;
+    } else {
+      setMapMemoryBudget(size_t(fParam * 1024 * 1024));
+      ROS_DEBUG("Set mapMemoryBudget: %g MB", fParam);
+    }
+  }
+
+  if (privateNode.getParam("mapSpillDirectory", sParam) && !sParam.empty()) {
+    struct stat info;
+    if (stat(sParam.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+      ROS_ERROR("Invalid mapSpillDirectory parameter: %s (expected an existing directory)", sParam.c_str());
+      return false;
+    } else {
+      setMapSpillDirectory(sParam);
+      ROS_DEBUG("Set mapSpillDirectory: %s", sParam.c_str());
+    }
+  }
+
+  if (privateNode.getParam("mapSnapshotInterval", fParam)) {
+    if (fParam < 0) {
+      ROS_ERROR("Invalid mapSnapshotInterval parameter: %f (expected >= 0)", fParam);
+      return false;
+    } else {
+      _mapSnapshotInterval = fParam;
+      ROS_DEBUG("Set mapSnapshotInterval: %g", fParam);
+    }
+  }
+
+  bool keepOdometryReference = true;
+  if (privateNode.getParam("mapSnapshotKeepOdometry", bParam)) {
+    keepOdometryReference = bParam;
+    ROS_DEBUG("Set mapSnapshotKeepOdometry: %d", bParam);
+  }
+
+  if (privateNode.getParam("incrementalMapFilter", bParam)) {
+    setIncrementalMapFilter(bParam);
+    ROS_DEBUG("Set incrementalMapFilter: %d", bParam);
+  }
+
+  if (privateNode.getParam("asyncMapMaintenance", bParam)) {
+    setAsyncMapMaintenance(bParam);
+    ROS_DEBUG("Set asyncMapMaintenance: %d", bParam);
+  }
+
+  if (privateNode.getParam("useVoxelFeatures", bParam)) {
+    if (bParam && asyncMapMaintenance()) {
+      ROS_ERROR("Invalid useVoxelFeatures parameter: %d (not supported with asyncMapMaintenance)", bParam);
+      return false;
+    }
+    setUseVoxelFeatures(bParam);
+    ROS_DEBUG("Set useVoxelFeatures: %d", bParam);
+  }
+
+  if (privateNode.getParam("voxelFeatureSize", fParam)) {
+    if (fParam < 0.1) {
+      ROS_ERROR("Invalid voxelFeatureSize parameter: %f (expected >= 0.1)",
+                fParam);
+      return false;
+    } else {
+      setVoxelFeatureSize(fParam);
+      ROS_DEBUG("Set voxel feature size: %g", fParam);
+    }
+  }
+
   if (node.getParam("mapOdomTopic", sParam)) {
     _mapOdomTopic = sParam;
     ROS_DEBUG("Set map odometry topic to: %s", sParam.c_str());
@@ -151,11 +329,6 @@ bool LaserMapping::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
     ROS_DEBUG("Set map frame name to: %s", sParam.c_str());
   }
 
-  if (node.getParam("loamOdomTopic", sParam)) {
-    _loamOdomTopic = sParam;
-    ROS_DEBUG("Set loam odometry topic name to: %s", sParam.c_str());
-  }
-
   if (node.getParam("imuInputTopic", sParam)) {
     _imuInputTopic = sParam;
     ROS_DEBUG("Set IMU input topic name to: %s", sParam.c_str());
@@ -166,27 +339,67 @@ bool LaserMapping::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
     ROS_DEBUG("Set outputTransforms to: %d", bParam);
   }
 
+  if (node.getParam("publishOptimizationStatus", bParam)) {
+    _publishOptimizationStatus = bParam;
+    ROS_DEBUG("Set publishOptimizationStatus: %d", bParam);
+  }
+
+  if (!_profilingReporter.setup(node, privateNode))
+    return false;
+
+  Twist initialPose;
+  std::vector<double> vParam;
+  if (privateNode.getParam("localizationInitialPose", vParam)) {
+    if (vParam.size() != 6) {
+      ROS_ERROR("Invalid localizationInitialPose parameter: %zu values (expected [x, y, z, rotX, rotY, rotZ])",
+                vParam.size());
+      return false;
+    }
+    initialPose.pos = Vector3(float(vParam[0]), float(vParam[1]), float(vParam[2]));
+    initialPose.rot_x = float(vParam[3]);
+    initialPose.rot_y = float(vParam[4]);
+    initialPose.rot_z = float(vParam[5]);
+    ROS_DEBUG("Set localizationInitialPose: [%g, %g, %g, %g, %g, %g]",
+              vParam[0], vParam[1], vParam[2], vParam[3], vParam[4], vParam[5]);
+  }
+
+  if (privateNode.getParam("localizationMap", sParam) && !sParam.empty()) {
+    auto start = SteadyClock::now();
+    if (!loadLocalizationMap(sParam, initialPose)) {
+      ROS_ERROR("Invalid localizationMap parameter: %s (expected a valid map snapshot)", sParam.c_str());
+      return false;
+    }
+    ROS_INFO("Localizing against map %s (loaded in %.1f ms)", sParam.c_str(),
+             toSec(SteadyClock::now() - start) * 1000);
+  } else if (privateNode.getParam("mapSnapshotFile", sParam) && !sParam.empty()) {
+    _mapSnapshotFile = sParam;
+    ROS_DEBUG("Set mapSnapshotFile: %s", sParam.c_str());
+
+    struct stat info;
+    if (stat(_mapSnapshotFile.c_str(), &info) == 0) {
+      auto start = SteadyClock::now();
+      if (loadMapSnapshot(_mapSnapshotFile, keepOdometryReference))
+        ROS_INFO("Loaded map snapshot %s in %.1f ms", _mapSnapshotFile.c_str(),
+                 toSec(SteadyClock::now() - start) * 1000);
+      else
+        ROS_ERROR("Failed to load map snapshot %s, starting with an empty map",
+                  _mapSnapshotFile.c_str());
+    }
+  }
+
   // advertise laser mapping topics
   _pubLaserCloudSurround =
       node.advertise<sensor_msgs::PointCloud2>("laser_cloud_surround", 1);
+  _surroundThread = std::thread(&LaserMapping::surroundPublisherLoop, this);
   _pubLaserCloudFullRes =
-      node.advertise<sensor_msgs::PointCloud2>("velodyne_cloud_registered", 2);
+      node.advertise<pcl::PointCloud<pcl::PointXYZI>>("velodyne_cloud_registered", 2);
   _pubOdomAftMapped = node.advertise<nav_msgs::Odometry>(_mapOdomTopic, 5);
+  if (_publishOptimizationStatus)
+    _pubOptimizationStatus = node.advertise<loam_velodyne::OptimizationStatus>("laser_mapping_status", 5);
 
-  // subscribe to laser odometry topics
-  _subLaserCloudCornerLast = node.subscribe<sensor_msgs::PointCloud2>(
-      "laser_cloud_corner_last", 2, &LaserMapping::laserCloudCornerLastHandler,
-      this);
-
-  _subLaserCloudSurfLast = node.subscribe<sensor_msgs::PointCloud2>(
-      "laser_cloud_surf_last", 2, &LaserMapping::laserCloudSurfLastHandler,
-      this);
-
-  _subLaserOdometry = node.subscribe<nav_msgs::Odometry>(
-      _loamOdomTopic, 5, &LaserMapping::laserOdometryHandler, this);
-
-  _subLaserCloudFullRes = node.subscribe<sensor_msgs::PointCloud2>(
-      "velodyne_cloud_3", 2, &LaserMapping::laserCloudFullResHandler, this);
+  // subscribe to the laser odometry result
+  _subOdometryFeatures = node.subscribe<loam_velodyne::OdometryFeatures>(
+      "odometry_features", 2, &LaserMapping::odometryFeaturesHandler, this);
 
   // subscribe to IMU topic
   _subImu = node.subscribe<sensor_msgs::Imu>(_imuInputTopic, 50,
@@ -195,44 +408,27 @@ bool LaserMapping::setup(ros::NodeHandle &node, ros::NodeHandle &privateNode) {
   return true;
 }
 
-void LaserMapping::laserCloudCornerLastHandler(
-    const sensor_msgs::PointCloud2ConstPtr &cornerPointsLastMsg) {
-  _timeLaserCloudCornerLast = cornerPointsLastMsg->header.stamp;
-  laserCloudCornerLast().clear();
-  pcl::fromROSMsg(*cornerPointsLastMsg, laserCloudCornerLast());
-  _newLaserCloudCornerLast = true;
-}
-
-void LaserMapping::laserCloudSurfLastHandler(
-    const sensor_msgs::PointCloud2ConstPtr &surfacePointsLastMsg) {
-  _timeLaserCloudSurfLast = surfacePointsLastMsg->header.stamp;
-  laserCloudSurfLast().clear();
-  pcl::fromROSMsg(*surfacePointsLastMsg, laserCloudSurfLast());
-  _newLaserCloudSurfLast = true;
-}
-
-void LaserMapping::laserCloudFullResHandler(
-    const sensor_msgs::PointCloud2ConstPtr &laserCloudFullResMsg) {
-  _timeLaserCloudFullRes = laserCloudFullResMsg->header.stamp;
-  laserCloud().clear();
-  pcl::fromROSMsg(*laserCloudFullResMsg, laserCloud());
-  _newLaserCloudFullRes = true;
-}
-
-void LaserMapping::laserOdometryHandler(
-    const nav_msgs::Odometry::ConstPtr &laserOdometry) {
-  _timeLaserOdometry = laserOdometry->header.stamp;
+void LaserMapping::odometryFeaturesHandler(
+    const loam_velodyne::OdometryFeatures::ConstPtr &odometryFeaturesMsg) {
+  _timeLaserOdometry = odometryFeaturesMsg->header.stamp;
 
-  double roll, pitch, yaw;
-  geometry_msgs::Quaternion geoQuat = laserOdometry->pose.pose.orientation;
-  tf::Matrix3x3(tf::Quaternion(geoQuat.z, -geoQuat.x, -geoQuat.y, geoQuat.w))
-      .getRPY(roll, pitch, yaw);
+  if (!fromCompactCloud(odometryFeaturesMsg->cornerCloudLast, laserCloudCornerLast(), _cloudCodec) ||
+      !fromCompactCloud(odometryFeaturesMsg->surfaceCloudLast, laserCloudSurfLast(), _cloudCodec) ||
+      !fromCompactCloud(odometryFeaturesMsg->laserCloud, laserCloud(), _cloudCodec)) {
+    ROS_WARN("Dropping odometry frame with unsupported or corrupt cloud encoding");
+    return;
+  }
 
-  updateOdometry(-pitch, -yaw, roll, laserOdometry->pose.pose.position.x,
-                 laserOdometry->pose.pose.position.y,
-                 laserOdometry->pose.pose.position.z);
+  Twist transformSum;
+  transformSum.rot_x = odometryFeaturesMsg->transformSum[0];
+  transformSum.rot_y = odometryFeaturesMsg->transformSum[1];
+  transformSum.rot_z = odometryFeaturesMsg->transformSum[2];
+  transformSum.pos = Vector3(odometryFeaturesMsg->transformSum[3],
+                             odometryFeaturesMsg->transformSum[4],
+                             odometryFeaturesMsg->transformSum[5]);
+  updateOdometry(transformSum);
 
-  _newLaserOdometry = true;
+  process();
 }
 
 void LaserMapping::imuHandler(const sensor_msgs::Imu::ConstPtr &imuIn) {
@@ -244,58 +440,237 @@ void LaserMapping::imuHandler(const sensor_msgs::Imu::ConstPtr &imuIn) {
 }
 
 void LaserMapping::spin() {
-  ros::Rate rate(100);
-  bool status = ros::ok();
+  // the odometry features handler processes every frame as soon as it arrives
+  ros::spin();
+}
+
+void LaserMapping::process() {
+  // skip the surround map as long as nobody listens
+  setSurroundMapDemand(_pubLaserCloudSurround.getNumSubscribers() > 0);
+
+  if (!BasicLaserMapping::process(fromROSTime(_timeLaserOdometry)))
+    return;
+
+  publishResult();
+
+  if (_publishOptimizationStatus) {
+    loam_velodyne::OptimizationStatus statusMsg;
+    toStatusMsg(lastReport(), statusMsg);
+    _pubOptimizationStatus.publish(statusMsg);
+  }
 
-  while (status) {
-    ros::spinOnce();
+  if (_latencyReportFrames > 0)
+    updateLatencyReport();
 
-    // try processing buffered data
-    process();
+  if (!_mapSnapshotFile.empty() && _mapSnapshotInterval > 0)
+    updateMapSnapshot();
 
-    status = ros::ok();
-    rate.sleep();
+  if (!mapSpillDirectory().empty()) {
+    const size_t failedReloads = stats().memory.failedReloads;
+    if (failedReloads > _reportedFailedReloads) {
+      ROS_WARN("Failed to reload %zu spilled map cubes from %s, their files were renamed to *.unreadable",
+               failedReloads - _reportedFailedReloads, mapSpillDirectory().c_str());
+      _reportedFailedReloads = failedReloads;
+    }
   }
 }
 
-void LaserMapping::reset() {
-  _newLaserCloudCornerLast = false;
-  _newLaserCloudSurfLast = false;
-  _newLaserCloudFullRes = false;
-  _newLaserOdometry = false;
+void LaserMapping::publishSurroundMap() {
+  {
+    std::lock_guard<std::mutex> lock(_surroundMutex);
+    _pendingSurround = surroundMapCubes();
+    _pendingSurroundStamp = _timeLaserOdometry;
+    _surroundPending = true;
+  }
+  _surroundCondition.notify_one();
 }
 
-bool LaserMapping::hasNewData() {
-  return _newLaserCloudCornerLast && _newLaserCloudSurfLast &&
-         _newLaserCloudFullRes && _newLaserOdometry &&
-         fabs((_timeLaserCloudCornerLast - _timeLaserOdometry).toSec()) <
-             0.005 &&
-         fabs((_timeLaserCloudSurfLast - _timeLaserOdometry).toSec()) < 0.005 &&
-         fabs((_timeLaserCloudFullRes - _timeLaserOdometry).toSec()) < 0.005;
+void LaserMapping::surroundPublisherLoop() {
+  // the field layout of the message matches the memory layout of the point type,
+  // so the (immutable) cube clouds are copied into the message as they are
+  sensor_msgs::PointCloud2 msg;
+  pcl::toROSMsg(pcl::PointCloud<pcl::PointXYZI>(), msg);
+  msg.header.frame_id = _odomAftMapped.header.frame_id;
+
+  std::vector<SurroundCube> cubes;
+  std::unique_lock<std::mutex> lock(_surroundMutex);
+  while (true) {
+    _surroundCondition.wait(lock, [&] { return _surroundPending || _stopSurroundThread; });
+    if (_stopSurroundThread)
+      return;
+
+    cubes.swap(_pendingSurround);
+    msg.header.stamp = _pendingSurroundStamp;
+    _surroundPending = false;
+    lock.unlock();
+
+    size_t pointNum = 0;
+    for (auto const &cube : cubes)
+      pointNum += cube.cloud->size();
+
+    msg.data.resize(pointNum * msg.point_step);
+    uint8_t *out = msg.data.data();
+    for (auto const &cube : cubes) {
+      std::memcpy(out, cube.cloud->points.data(), cube.cloud->size() * msg.point_step);
+      out += cube.cloud->size() * msg.point_step;
+    }
+    msg.width = uint32_t(pointNum);
+    msg.height = 1;
+    msg.row_step = msg.width * msg.point_step;
+    _pubLaserCloudSurround.publish(msg);
+
+    cubes.clear();
+    lock.lock();
+  }
 }
 
-void LaserMapping::process() {
-  if (!hasNewData()) // waiting for new data to arrive...
-    return;
+void LaserMapping::updateMapSnapshot() {
+  if (mapSnapshotFailures() > _reportedSnapshotFailures) {
+    _reportedSnapshotFailures = mapSnapshotFailures();
+    ROS_WARN("Failed to write map snapshot %s", _mapSnapshotFile.c_str());
+  }
 
-  reset(); // reset flags, etc.
+  if (_lastMapSnapshotTime.isZero()) {
+    _lastMapSnapshotTime = _timeLaserOdometry;
+  } else if ((_timeLaserOdometry - _lastMapSnapshotTime).toSec() >= _mapSnapshotInterval) {
+    requestMapSnapshot(_mapSnapshotFile);
+    _lastMapSnapshotTime = _timeLaserOdometry;
+  }
+}
 
-  if (!BasicLaserMapping::process(fromROSTime(_timeLaserOdometry)))
+void LaserMapping::updateLatencyReport() {
+  _processLatencies.push_back(stats().stages.frame.last);
+  _endToEndLatencies.push_back((ros::Time::now() - _timeLaserOdometry).toSec());
+  if (_processLatencies.size() < size_t(_latencyReportFrames))
     return;
 
-  publishResult();
+  // per stage means over the report window
+  const MappingStats now = stats();
+  const MappingStats &before = _reportedStats;
+  auto windowMean = [&](StageTime MappingStageTimes::*stage) {
+    const StageTime &end = now.stages.*stage, &start = before.stages.*stage;
+    size_t count = end.count - start.count;
+    return count > 0 ? (end.total - start.total) / count * 1000 : 0.0;
+  };
+
+  struct Stage { const char *name; StageTime MappingStageTimes::*time; bool criticalPath; };
+  const bool async = asyncMapMaintenance();
+  const Stage stages[] = {
+      {"cubeShift", &MappingStageTimes::cubeShift, !async},
+      {"localMap", &MappingStageTimes::localMap, !async},
+      {"stackDownsize", &MappingStageTimes::stackDownsize, true},
+      {"optimization", &MappingStageTimes::optimization, true},
+      {"mapInsertion", &MappingStageTimes::mapInsertion, !async},
+      {"cubeDownsize", &MappingStageTimes::cubeDownsize, !async},
+      {"fullResTransform", &MappingStageTimes::fullResTransform, true},
+      {"surroundMap", &MappingStageTimes::surroundMap, !async}};
+
+  // the critical path stage with the highest mean blocks the frame rate
+  const Stage *blocking = nullptr;
+  std::string breakdown;
+  for (auto const &stage : stages) {
+    double mean = windowMean(stage.time);
+    if (stage.criticalPath && (!blocking || mean > windowMean(blocking->time)))
+      blocking = &stage;
+    char entry[64];
+    snprintf(entry, sizeof(entry), " %s=%.2f", stage.name, mean);
+    breakdown += entry;
+  }
+
+  ROS_INFO("laserMapping latency over %zu frames (ms): process p50=%.2f p95=%.2f p99=%.2f, "
+           "end-to-end p50=%.2f p95=%.2f p99=%.2f, budget %.1f, blocking stage: %s",
+           _processLatencies.size(),
+           percentile(_processLatencies, 0.5) * 1000, percentile(_processLatencies, 0.95) * 1000,
+           percentile(_processLatencies, 0.99) * 1000,
+           percentile(_endToEndLatencies, 0.5) * 1000, percentile(_endToEndLatencies, 0.95) * 1000,
+           percentile(_endToEndLatencies, 0.99) * 1000,
+           scanPeriod() * stackFrameNum() * 1000, blocking->name);
+  ROS_INFO("laserMapping stage means (ms%s):%s",
+           async ? ", map maintenance on background thread" : "", breakdown.c_str());
+
+  // map statistics of the report window, sections of inactive features are left out
+  char section[256];
+  std::string summary;
+  auto append = [&](int length) { summary.append(section, std::min<size_t>(length, sizeof(section) - 1)); };
+
+  append(snprintf(section, sizeof(section), " memory %.1f MB in %zu cubes, %.1f MB in %zu spilled cubes "
+                  "(%zu spills, %zu reloads);",
+                  now.memory.memoryBytes / 1048576.0, now.memory.memoryCubes, now.memory.spilledBytes / 1048576.0,
+                  now.memory.spilledCubes, now.memory.spillCount, now.memory.reloadCount));
+
+  const size_t localMapFrames = now.localMap.frames - before.localMap.frames;
+  if (localMapFrames > 0) {
+    append(snprintf(section, sizeof(section), " local map per frame %zu points in %zu segments, %.1f kB copied, "
+                    "%zu kd-tree block allocations;",
+                    (now.localMap.points - before.localMap.points) / localMapFrames,
+                    (now.localMap.segments - before.localMap.segments) / localMapFrames,
+                    (now.localMap.copiedBytes - before.localMap.copiedBytes) / localMapFrames / 1024.0,
+                    now.localMap.indexAllocations - before.localMap.indexAllocations));
+  }
+
+  // time saved by skipped surround maps and reused cubes, estimated from the mean cube down size time
+  const MappingStats::SurroundMap &surround = now.surroundMap;
+  const size_t maps = surround.maps - before.surroundMap.maps;
+  const size_t filteredCubes = surround.filteredCubes - before.surroundMap.filteredCubes;
+  const size_t reusedCubes = surround.reusedCubes - before.surroundMap.reusedCubes;
+  const size_t skippedMaps = surround.skippedMaps - before.surroundMap.skippedMaps;
+  if (maps > 0 || skippedMaps > 0) {
+    const double cubeTime = surround.filteredCubes > 0 ? surround.filterTime / surround.filteredCubes : 0;
+    const double cubesPerMap = surround.maps > 0
+        ? double(surround.filteredCubes + surround.reusedCubes) / surround.maps : 0;
+    const double saved = (reusedCubes + skippedMaps * cubesPerMap) * cubeTime / _processLatencies.size();
+    append(snprintf(section, sizeof(section), " surround map %zu maps, %zu skipped, %zu of %zu cubes reused, "
+                    "saved %.2f ms per frame;", maps, skippedMaps, reusedCubes, filteredCubes + reusedCubes, saved * 1000));
+  }
+
+  // planned against actual optimization effort under the frame time budget
+  const MappingStats::FrameBudget &budget = now.frameBudget, &budgetBefore = before.frameBudget;
+  const size_t budgetFrames = budget.frames - budgetBefore.frames;
+  if (budgetFrames > 0) {
+    append(snprintf(section, sizeof(section), " frame budget %.1f ms, %zu frames over budget, frame mean %.2f ms, "
+                    "optimization mean %.2f of %.2f ms, %.1f of %.1f iterations, %.0f%% of the stack features;",
+                    (budget.frameBudget - budgetBefore.frameBudget) / budgetFrames * 1000,
+                    budget.overruns - budgetBefore.overruns,
+                    (budget.frameTime - budgetBefore.frameTime) / budgetFrames * 1000,
+                    (budget.optimizationTime - budgetBefore.optimizationTime) / budgetFrames * 1000,
+                    (budget.optimizationBudget - budgetBefore.optimizationBudget) / budgetFrames * 1000,
+                    double(budget.iterations - budgetBefore.iterations) / budgetFrames,
+                    double(budget.plannedIterations - budgetBefore.plannedIterations) / budgetFrames,
+                    budget.stackFeatures > budgetBefore.stackFeatures
+                        ? 100.0 * (budget.features - budgetBefore.features)
+                              / (budget.stackFeatures - budgetBefore.stackFeatures)
+                        : 100.0));
+  }
+
+  // information kept by the feature selection
+  const MappingStats::FeatureSelection &selection = now.featureSelection, &selectionBefore = before.featureSelection;
+  const size_t selectionFrames = selection.frames - selectionBefore.frames;
+  if (selectionFrames > 0) {
+    append(snprintf(section, sizeof(section), " feature selection kept %.0f%% of %zu correspondences per frame, "
+                    "%.0f%% of the weakest direction information;",
+                    100.0 * (selection.selected - selectionBefore.selected)
+                        / std::max<size_t>(selection.correspondences - selectionBefore.correspondences, 1),
+                    (selection.correspondences - selectionBefore.correspondences) / selectionFrames,
+                    100.0 * (selection.weakestInformation - selectionBefore.weakestInformation) / selectionFrames));
+  }
+
+  summary.pop_back();
+  ROS_INFO("laserMapping map statistics:%s", summary.c_str());
+
+  _reportedStats = now;
+  _processLatencies.clear();
+  _endToEndLatencies.clear();
 }
 
 void LaserMapping::publishResult() {
 
   // publish new map cloud according to the input output ratio
   if (hasFreshMap()) // publish new map cloud
-    publishCloudMsg(_pubLaserCloudSurround, laserCloudSurroundDS(),
-                    _timeLaserOdometry, _odomAftMapped.header.frame_id);
+    publishSurroundMap();
 
   // publish transformed full resolution input cloud
-  publishCloudMsg(_pubLaserCloudFullRes, laserCloud(), _timeLaserOdometry,
-                  _odomAftMapped.header.frame_id);
+  publishCloud(_pubLaserCloudFullRes, laserCloud(), _timeLaserOdometry,
+               _odomAftMapped.header.frame_id);
 
   // publish odometry after mapped transformations
   geometry_msgs::Quaternion geoQuat = tf::createQuaternionMsgFromRollPitchYaw(
@@ -30,8 +30,6 @@
 //   J. Zhang and S. Singh. LOAM: Lidar Odometry and Mapping in Real-time.
 //     Robotics: Science and Systems Conference (RSS). Berkeley, CA, July 2014.
 
-#include <pcl/filters/filter.h>
-
 #include "loam_velodyne/LaserOdometry.h"
 #include "loam_velodyne/common.h"
 #include "math_utils.h"
@@ -174,146 +172,79 @@ namespace loam
       ROS_DEBUG("Set outputTransforms param to: %d", bParam);
     }
 
-    // advertise laser odometry topics
-    _pubLaserCloudCornerLast = node.advertise<sensor_msgs::PointCloud2>("laser_cloud_corner_last", 2);
-    _pubLaserCloudSurfLast = node.advertise<sensor_msgs::PointCloud2>("laser_cloud_surf_last", 2);
-    _pubLaserCloudFullRes = node.advertise<sensor_msgs::PointCloud2>("velodyne_cloud_3", 2);
-    _pubLaserOdometry = node.advertise<nav_msgs::Odometry>(_loamOdomTopic, 5);
-
-    // subscribe to scan registration topics
-    _subCornerPointsSharp = node.subscribe<sensor_msgs::PointCloud2>
-      ("laser_cloud_sharp", 2, &LaserOdometry::laserCloudSharpHandler, this);
-
-    _subCornerPointsLessSharp = node.subscribe<sensor_msgs::PointCloud2>
-      ("laser_cloud_less_sharp", 2, &LaserOdometry::laserCloudLessSharpHandler, this);
+    if (node.getParam("cloudEncoding", sParam))
+    {
+      if (!parseCloudEncoding(sParam, _cloudEncoding))
+      {
+        ROS_ERROR("Invalid cloudEncoding parameter: %s (expected float32, quantized or quantized_lz4)", sParam.c_str());
+        return false;
+      }
+      else
+      {
+        ROS_DEBUG("Set cloudEncoding: %s", sParam.c_str());
+      }
+    }
 
-    _subSurfPointsFlat = node.subscribe<sensor_msgs::PointCloud2>
-      ("laser_cloud_flat", 2, &LaserOdometry::laserCloudFlatHandler, this);
+    if (node.getParam("publishOptimizationStatus", bParam))
+    {
+      _publishOptimizationStatus = bParam;
+      ROS_DEBUG("Set publishOptimizationStatus: %d", bParam);
+    }
 
-    _subSurfPointsLessFlat = node.subscribe<sensor_msgs::PointCloud2>
-      ("laser_cloud_less_flat", 2, &LaserOdometry::laserCloudLessFlatHandler, this);
+    if (!_profilingReporter.setup(node, privateNode))
+      return false;
 
-    _subLaserCloudFullRes = node.subscribe<sensor_msgs::PointCloud2>
-      ("velodyne_cloud_2", 2, &LaserOdometry::laserCloudFullResHandler, this);
+    // advertise laser odometry topics
+    _pubOdometryFeatures = node.advertise<loam_velodyne::OdometryFeatures>("odometry_features", 2);
+    _pubLaserOdometry = node.advertise<nav_msgs::Odometry>(_loamOdomTopic, 5);
+    if (_publishOptimizationStatus)
+      _pubOptimizationStatus = node.advertise<loam_velodyne::OptimizationStatus>("laser_odometry_status", 5);
 
-    _subImuTrans = node.subscribe<sensor_msgs::PointCloud2>
-      ("imu_trans", 5, &LaserOdometry::imuTransHandler, this);
+    // subscribe to the scan registration result
+    _subSweepFeatures = node.subscribe<loam_velodyne::SweepFeatures>
+      ("sweep_features", 2, &LaserOdometry::sweepFeaturesHandler, this);
 
     return true;
   }
 
-  void LaserOdometry::reset()
-  {
-    _newCornerPointsSharp = false;
-    _newCornerPointsLessSharp = false;
-    _newSurfPointsFlat = false;
-    _newSurfPointsLessFlat = false;
-    _newLaserCloudFullRes = false;
-    _newImuTrans = false;
-  }
-
-  void LaserOdometry::laserCloudSharpHandler(const sensor_msgs::PointCloud2ConstPtr& cornerPointsSharpMsg)
-  {
-    _timeCornerPointsSharp = cornerPointsSharpMsg->header.stamp;
-
-    cornerPointsSharp()->clear();
-    pcl::fromROSMsg(*cornerPointsSharpMsg, *cornerPointsSharp());
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(*cornerPointsSharp(), *cornerPointsSharp(), indices);
-    _newCornerPointsSharp = true;
-  }
-
-  void LaserOdometry::laserCloudLessSharpHandler(const sensor_msgs::PointCloud2ConstPtr& cornerPointsLessSharpMsg)
-  {
-    _timeCornerPointsLessSharp = cornerPointsLessSharpMsg->header.stamp;
-
-    cornerPointsLessSharp()->clear();
-    pcl::fromROSMsg(*cornerPointsLessSharpMsg, *cornerPointsLessSharp());
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(*cornerPointsLessSharp(), *cornerPointsLessSharp(), indices);
-    _newCornerPointsLessSharp = true;
-  }
-
-  void LaserOdometry::laserCloudFlatHandler(const sensor_msgs::PointCloud2ConstPtr& surfPointsFlatMsg)
+  void LaserOdometry::sweepFeaturesHandler(const loam_velodyne::SweepFeatures::ConstPtr& sweepFeaturesMsg)
   {
-    _timeSurfPointsFlat = surfPointsFlatMsg->header.stamp;
+    _timeSweep = sweepFeaturesMsg->header.stamp;
 
-    surfPointsFlat()->clear();
-    pcl::fromROSMsg(*surfPointsFlatMsg, *surfPointsFlat());
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(*surfPointsFlat(), *surfPointsFlat(), indices);
-    _newSurfPointsFlat = true;
-  }
-
-  void LaserOdometry::laserCloudLessFlatHandler(const sensor_msgs::PointCloud2ConstPtr& surfPointsLessFlatMsg)
-  {
-    _timeSurfPointsLessFlat = surfPointsLessFlatMsg->header.stamp;
-
-    surfPointsLessFlat()->clear();
-    pcl::fromROSMsg(*surfPointsLessFlatMsg, *surfPointsLessFlat());
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(*surfPointsLessFlat(), *surfPointsLessFlat(), indices);
-    _newSurfPointsLessFlat = true;
-  }
-
-  void LaserOdometry::laserCloudFullResHandler(const sensor_msgs::PointCloud2ConstPtr& laserCloudFullResMsg)
-  {
-    _timeLaserCloudFullRes = laserCloudFullResMsg->header.stamp;
-
-    laserCloud()->clear();
-    pcl::fromROSMsg(*laserCloudFullResMsg, *laserCloud());
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(*laserCloud(), *laserCloud(), indices);
-    _newLaserCloudFullRes = true;
-  }
-
-  void LaserOdometry::imuTransHandler(const sensor_msgs::PointCloud2ConstPtr& imuTransMsg)
-  {
-    _timeImuTrans = imuTransMsg->header.stamp;
-
-    pcl::PointCloud<pcl::PointXYZ> imuTrans;
-    pcl::fromROSMsg(*imuTransMsg, imuTrans);
-    updateIMU(imuTrans);
-    _newImuTrans = true;
-  }
-
-  void LaserOdometry::spin()
-  {
-    ros::Rate rate(100);
-    bool status = ros::ok();
+    if (!fromCompactCloud(sweepFeaturesMsg->cornerPointsSharp, *cornerPointsSharp(), _cloudCodec) ||
+        !fromCompactCloud(sweepFeaturesMsg->cornerPointsLessSharp, *cornerPointsLessSharp(), _cloudCodec) ||
+        !fromCompactCloud(sweepFeaturesMsg->surfacePointsFlat, *surfPointsFlat(), _cloudCodec) ||
+        !fromCompactCloud(sweepFeaturesMsg->surfacePointsLessFlat, *surfPointsLessFlat(), _cloudCodec) ||
+        !fromCompactCloud(sweepFeaturesMsg->laserCloud, *laserCloud(), _cloudCodec))
+    {
+      ROS_WARN("Dropping sweep with unsupported or corrupt cloud encoding");
+      return;
+    }
 
-    // loop until shutdown
-    while (status)
+    _imuTrans.resize(4);
+    for (size_t i = 0; i < 4; i++)
     {
-      ros::spinOnce();
+      _imuTrans[i].x = sweepFeaturesMsg->imuTrans[3 * i];
+      _imuTrans[i].y = sweepFeaturesMsg->imuTrans[3 * i + 1];
+      _imuTrans[i].z = sweepFeaturesMsg->imuTrans[3 * i + 2];
+    }
+    updateIMU(_imuTrans);
 
-      // try processing new data
-      process();
+    const OptimizationReport& report = BasicLaserOdometry::process(fromROSTime(_timeSweep));
+    publishResult();
 
-      status = ros::ok();
-      rate.sleep();
+    if (_publishOptimizationStatus)
+    {
+      loam_velodyne::OptimizationStatus statusMsg;
+      toStatusMsg(report, statusMsg);
+      _pubOptimizationStatus.publish(statusMsg);
     }
   }
 
-  bool LaserOdometry::hasNewData()
-  {
-    return _newCornerPointsSharp && _newCornerPointsLessSharp && _newSurfPointsFlat &&
-      _newSurfPointsLessFlat && _newLaserCloudFullRes && _newImuTrans &&
-      fabs((_timeCornerPointsSharp - _timeSurfPointsLessFlat).toSec()) < 0.005 &&
-      fabs((_timeCornerPointsLessSharp - _timeSurfPointsLessFlat).toSec()) < 0.005 &&
-      fabs((_timeSurfPointsFlat - _timeSurfPointsLessFlat).toSec()) < 0.005 &&
-      fabs((_timeLaserCloudFullRes - _timeSurfPointsLessFlat).toSec()) < 0.005 &&
-      fabs((_timeImuTrans - _timeSurfPointsLessFlat).toSec()) < 0.005;
-  }
-
-  void LaserOdometry::process()
+  void LaserOdometry::spin()
   {
-    if (!hasNewData())
-      return;// waiting for new data to arrive...
-
-    reset();// reset flags, etc.
-    BasicLaserOdometry::process();
-    publishResult();
+    // the sweep features handler processes every sweep as soon as it arrives
+    ros::spin();
   }
 
   void LaserOdometry::publishResult()
@@ -323,7 +254,7 @@ namespace loam
                                                                                -transformSum().rot_x.rad(),
                                                                                -transformSum().rot_y.rad());
 
-    _laserOdometryMsg.header.stamp            = _timeSurfPointsLessFlat;
+    _laserOdometryMsg.header.stamp            = _timeSweep;
     _laserOdometryMsg.pose.pose.orientation.x = -geoQuat.y;
     _laserOdometryMsg.pose.pose.orientation.y = -geoQuat.z;
     _laserOdometryMsg.pose.pose.orientation.z = geoQuat.x;
@@ -334,7 +265,7 @@ namespace loam
     _pubLaserOdometry.publish(_laserOdometryMsg);
 
     if(_outputTransforms){
-    _laserOdometryTrans.stamp_ = _timeSurfPointsLessFlat;
+    _laserOdometryTrans.stamp_ = _timeSweep;
     _laserOdometryTrans.setRotation(tf::Quaternion(-geoQuat.y, -geoQuat.z, geoQuat.x, geoQuat.w));
     _laserOdometryTrans.setOrigin(tf::Vector3(transformSum().pos.x(), transformSum().pos.y(), transformSum().pos.z()));
     _tfBroadcaster.sendTransform(_laserOdometryTrans);
@@ -343,12 +274,22 @@ namespace loam
     // publish cloud results according to the input output ratio
     if (_ioRatio < 2 || frameCount() % _ioRatio == 1)
     {
-      ros::Time sweepTime = _timeSurfPointsLessFlat;
-      publishCloudMsg(_pubLaserCloudCornerLast, *lastCornerCloud(), sweepTime, _lidarFrame);
-      publishCloudMsg(_pubLaserCloudSurfLast, *lastSurfaceCloud(), sweepTime, _lidarFrame);
+      loam_velodyne::OdometryFeatures::Ptr msg(new loam_velodyne::OdometryFeatures());
+      msg->header.stamp = _timeSweep;
+      msg->header.frame_id = _lidarFrame;
+      toCompactCloud(*lastCornerCloud(), msg->cornerCloudLast, _cloudEncoding, _cloudCodec);
+      toCompactCloud(*lastSurfaceCloud(), msg->surfaceCloudLast, _cloudEncoding, _cloudCodec);
 
       transformToEnd(laserCloud());  // transform full resolution cloud to sweep end before sending it
-      publishCloudMsg(_pubLaserCloudFullRes, *laserCloud(), sweepTime, _lidarFrame);
+      toCompactCloud(*laserCloud(), msg->laserCloud, _cloudEncoding, _cloudCodec);
+
+      msg->transformSum[0] = transformSum().rot_x.rad();
+      msg->transformSum[1] = transformSum().rot_y.rad();
+      msg->transformSum[2] = transformSum().rot_z.rad();
+      msg->transformSum[3] = transformSum().pos.x();
+      msg->transformSum[4] = transformSum().pos.y();
+      msg->transformSum[5] = transformSum().pos.z();
+      _pubOdometryFeatures.publish(loam_velodyne::OdometryFeatures::ConstPtr(msg));
     }
   }
 
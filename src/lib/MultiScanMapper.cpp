@@ -0,0 +1,34 @@
+#include "loam_velodyne/MultiScanMapper.h"
+
+#include <cmath>
+
+namespace loam {
+
+MultiScanMapper::MultiScanMapper(const float& lowerBound,
+                                 const float& upperBound,
+                                 const uint16_t& nScanRings)
+    : _lowerBound(lowerBound),
+      _upperBound(upperBound),
+      _nScanRings(nScanRings),
+      _factor((nScanRings - 1) / (upperBound - lowerBound))
+{
+
+}
+
+void MultiScanMapper::set(const float &lowerBound,
+                          const float &upperBound,
+                          const uint16_t &nScanRings)
+{
+  _lowerBound = lowerBound;
+  _upperBound = upperBound;
+  _nScanRings = nScanRings;
+  _factor = (nScanRings - 1) / (upperBound - lowerBound);
+}
+
+
+
+int MultiScanMapper::getRingForAngle(const float& angle) const {
+  return int(((angle * 180 / M_PI) - _lowerBound) * _factor + 0.5);
+}
+
+} // end namespace loam
@@ -38,38 +38,6 @@
 
 namespace loam {
 
-MultiScanMapper::MultiScanMapper(const float& lowerBound,
-                                 const float& upperBound,
-                                 const uint16_t& nScanRings)
-    : _lowerBound(lowerBound),
-      _upperBound(upperBound),
-      _nScanRings(nScanRings),
-      _factor((nScanRings - 1) / (upperBound - lowerBound))
-{
-
-}
-
-void MultiScanMapper::set(const float &lowerBound,
-                          const float &upperBound,
-                          const uint16_t &nScanRings)
-{
-  _lowerBound = lowerBound;
-  _upperBound = upperBound;
-  _nScanRings = nScanRings;
-  _factor = (nScanRings - 1) / (upperBound - lowerBound);
-}
-
-
-
-int MultiScanMapper::getRingForAngle(const float& angle) {
-  return int(((angle * 180 / M_PI) - _lowerBound) * _factor + 0.5);
-}
-
-
-
-
-
-
 MultiScanRegistration::MultiScanRegistration(const MultiScanMapper& scanMapper)
     : _scanMapper(scanMapper)
 {};
@@ -158,91 +126,16 @@ void MultiScanRegistration::handleCloudMessage(const sensor_msgs::PointCloud2Con
   }
 
   // fetch new input cloud
-  pcl::PointCloud<pcl::PointXYZ> laserCloudIn;
-  pcl::fromROSMsg(*laserCloudMsg, laserCloudIn);
+  fromROSMsg(*laserCloudMsg, _laserCloudIn, _cloudMsgBuffer);
 
-  process(laserCloudIn, fromROSTime(laserCloudMsg->header.stamp));
+  process(_laserCloudIn, fromROSTime(laserCloudMsg->header.stamp));
 }
 
 
 
 void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn, const Time& scanTime)
 {
-  size_t cloudSize = laserCloudIn.size();
-
-  // determine scan start and end orientations
-  float startOri = -std::atan2(laserCloudIn[0].y, laserCloudIn[0].x);
-  float endOri = -std::atan2(laserCloudIn[cloudSize - 1].y,
-                             laserCloudIn[cloudSize - 1].x) + 2 * float(M_PI);
-  if (endOri - startOri > 3 * M_PI) {
-    endOri -= 2 * M_PI;
-  } else if (endOri - startOri < M_PI) {
-    endOri += 2 * M_PI;
-  }
-
-  bool halfPassed = false;
-  pcl::PointXYZI point;
-  _laserCloudScans.resize(_scanMapper.getNumberOfScanRings());
-  // clear all scanline points
-  std::for_each(_laserCloudScans.begin(), _laserCloudScans.end(), [](auto&&v) {v.clear(); });
-
-  // extract valid points from input cloud
-  for (int i = 0; i < cloudSize; i++) {
-    point.x = laserCloudIn[i].x;
-    point.y = laserCloudIn[i].y;
-    point.z = laserCloudIn[i].z;
-
-    // skip NaN and INF valued points
-    if (!pcl_isfinite(point.x) ||
-        !pcl_isfinite(point.y) ||
-        !pcl_isfinite(point.z)) {
-      continue;
-    }
-
-    // skip zero valued points
-    if (point.x * point.x + point.y * point.y + point.z * point.z < 0.0001) {
-      continue;
-    }
-
-    // calculate vertical point angle and scan ID
-    float angle = std::atan(point.z / std::sqrt(point.y * point.y + point.x * point.x));
-    int scanID = _scanMapper.getRingForAngle(angle);
-    if (scanID >= _scanMapper.getNumberOfScanRings() || scanID < 0 ){
-      continue;
-    }
-
-    // calculate horizontal point angle
-    float ori = -std::atan2(point.y, point.x);
-    if (!halfPassed) {
-      if (ori < startOri - M_PI / 2) {
-        ori += 2 * M_PI;
-      } else if (ori > startOri + M_PI * 3 / 2) {
-        ori -= 2 * M_PI;
-      }
-
-      if (ori - startOri > M_PI) {
-        halfPassed = true;
-      }
-    } else {
-      ori += 2 * M_PI;
-
-      if (ori < endOri - M_PI * 3 / 2) {
-        ori += 2 * M_PI;
-      } else if (ori > endOri + M_PI / 2) {
-        ori -= 2 * M_PI;
-      }
-    }
-
-    // calculate relative scan time based on point orientation
-    float relTime = config().scanPeriod * (ori - startOri) / (endOri - startOri);
-    point.intensity = scanID + relTime;
-
-    projectPointToStartOfSweep(point, relTime);
-
-    _laserCloudScans[scanID].push_back(point);
-  }
-
-  processScanlines(scanTime, _laserCloudScans);
+  processCloud(laserCloudIn, scanTime, _scanMapper);
   publishResult();
 }
 
@@ -0,0 +1,347 @@
+#include "loam_velodyne/Pipeline.h"
+#include "loam_velodyne/Profiler.h"
+
+namespace loam
+{
+
+Pipeline::Pipeline(const MultiScanMapper& scanMapper, const RegistrationParams& config, uint16_t ioRatio) :
+   _scanMapper(scanMapper),
+   _ioRatio(ioRatio),
+   _odometry(config.scanPeriod),
+   _mapping(config.scanPeriod)
+{
+   _registration.configure(config);
+}
+
+Pipeline::~Pipeline()
+{
+   stopThreads();
+}
+
+bool Pipeline::pushCloud(const pcl::PointCloud<pcl::PointXYZ>& points, const Time& scanTime)
+{
+   if (points.empty())
+      return false;
+
+   if (_threaded)
+   {
+      std::unique_ptr<InputFrame> input = _inputQueue->acquire();
+      input->scanTime = scanTime;
+      input->points = points;
+
+      _pendingSweeps++;
+      return pushTo(_inputQueue->queue, input, _queueStats.input, false);
+   }
+
+   auto start = SteadyClock::now();
+   registerSweep(points, scanTime, _sweepFrame);
+
+   // hand on every ioRatio-th frame to the mapping (as the odometry node publishes its clouds)
+   bool mapped = runOdometry(_sweepFrame, *_mappingFrame) && runMapping(*_mappingFrame);
+
+   std::lock_guard<std::mutex> lock(_statsMutex);
+   _stageTimes.frame.add(toSec(SteadyClock::now() - start));
+   return mapped;
+}
+
+void Pipeline::registerSweep(const pcl::PointCloud<pcl::PointXYZ>& points, const Time& scanTime, SweepFrame& frame)
+{
+   auto start = SteadyClock::now();
+   _registration.processCloud(points, scanTime, _scanMapper);
+
+   // move the registration result into the frame, the registration rebuilds its clouds for every scan
+   frame.sweepTime = _registration.sweepStart();
+   frame.cornerPointsSharp.swap(_registration.cornerPointsSharp());
+   frame.cornerPointsLessSharp.swap(_registration.cornerPointsLessSharp());
+   frame.surfacePointsFlat.swap(_registration.surfacePointsFlat());
+   frame.surfacePointsLessFlat.swap(_registration.surfacePointsLessFlat());
+   frame.laserCloud.swap(_registration.laserCloud());
+   frame.imuTrans = _registration.imuTransform();
+
+   std::lock_guard<std::mutex> lock(_statsMutex);
+   _stageTimes.registration.add(toSec(SteadyClock::now() - start));
+}
+
+bool Pipeline::runOdometry(SweepFrame& frame, MappingFrame& mappingFrame)
+{
+   auto start = SteadyClock::now();
+   _odometry.cornerPointsSharp()->swap(frame.cornerPointsSharp);
+   _odometry.cornerPointsLessSharp()->swap(frame.cornerPointsLessSharp);
+   _odometry.surfPointsFlat()->swap(frame.surfacePointsFlat);
+   _odometry.surfPointsLessFlat()->swap(frame.surfacePointsLessFlat);
+   _odometry.laserCloud()->swap(frame.laserCloud);
+   _odometry.updateIMU(frame.imuTrans);
+   _odometry.process(frame.sweepTime);
+
+   const Twist& odometryPose = _odometry.transformSum();
+   Twist integratedPose;
+   {
+      std::lock_guard<std::mutex> lock(_transformMutex);
+      _transformMaintenance.updateOdometry(odometryPose.rot_x.rad(), odometryPose.rot_y.rad(), odometryPose.rot_z.rad(),
+                                           odometryPose.pos.x(), odometryPose.pos.y(), odometryPose.pos.z());
+      _transformMaintenance.transformAssociateToMap();
+
+      const float* mapped = _transformMaintenance.transformMapped();
+      integratedPose.rot_x = mapped[0];
+      integratedPose.rot_y = mapped[1];
+      integratedPose.rot_z = mapped[2];
+      integratedPose.pos = Vector3(mapped[3], mapped[4], mapped[5]);
+   }
+
+   const bool handOn = _ioRatio < 2 || _odometry.frameCount() % _ioRatio == 1;
+   if (handOn)
+   {
+      // the odometry keeps its last feature clouds as reference for the next sweep, so these are copied
+      mappingFrame.sweepTime = frame.sweepTime;
+      mappingFrame.cornerCloudLast = *_odometry.lastCornerCloud();
+      mappingFrame.surfaceCloudLast = *_odometry.lastSurfaceCloud();
+
+      // the full resolution cloud is refilled by the next sweep
+      _odometry.transformToEnd(_odometry.laserCloud());
+      mappingFrame.laserCloud.swap(*_odometry.laserCloud());
+      mappingFrame.transformSum = odometryPose;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(_statsMutex);
+      _stageTimes.odometry.add(toSec(SteadyClock::now() - start));
+   }
+
+   if (_odometryCallback)
+      _odometryCallback(frame.sweepTime, odometryPose);
+
+   if (_integratedCallback)
+      _integratedCallback(frame.sweepTime, integratedPose);
+
+   return handOn;
+}
+
+bool Pipeline::runMapping(MappingFrame& frame)
+{
+   auto start = SteadyClock::now();
+   _mapping.laserCloudCornerLast().swap(frame.cornerCloudLast);
+   _mapping.laserCloudSurfLast().swap(frame.surfaceCloudLast);
+   _mapping.laserCloud().swap(frame.laserCloud);
+   _mapping.updateOdometry(frame.transformSum);
+   const bool mapped = _mapping.process(frame.sweepTime);
+
+   if (mapped)
+   {
+      std::lock_guard<std::mutex> lock(_transformMutex);
+      _transformMaintenance.updateMappingTransform(_mapping.transformAftMapped(), _mapping.transformBefMapped());
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(_statsMutex);
+      _stageTimes.mapping.add(toSec(SteadyClock::now() - start));
+   }
+
+   if (mapped && _mappingCallback)
+      _mappingCallback(frame.sweepTime, _mapping.transformAftMapped());
+
+   return mapped;
+}
+
+void Pipeline::pushImu(const Time& stamp, double roll, double pitch, double yaw, const Vector3& linearAcceleration)
+{
+   if (!_threaded)
+   {
+      _registration.updateIMUData(stamp, roll, pitch, yaw, linearAcceleration);
+      _mapping.updateIMU({ stamp, roll, pitch });
+      return;
+   }
+
+   ImuMeasurement registrationImu{ stamp, roll, pitch, yaw,
+                                   { linearAcceleration.x(), linearAcceleration.y(), linearAcceleration.z() } };
+   ImuMeasurement mappingImu = registrationImu;
+   size_t dropped = !_registrationImu->tryPush(registrationImu) + !_mappingImu->tryPush(mappingImu);
+   if (dropped > 0)
+   {
+      std::lock_guard<std::mutex> lock(_statsMutex);
+      _queueStats.droppedImu += dropped;
+   }
+}
+
+void Pipeline::applyRegistrationImu()
+{
+   ImuMeasurement imu;
+   while (_registrationImu->tryPop(imu))
+      _registration.updateIMUData(imu.stamp, imu.roll, imu.pitch, imu.yaw, Vector3(imu.acc[0], imu.acc[1], imu.acc[2]));
+}
+
+void Pipeline::applyMappingImu()
+{
+   ImuMeasurement imu;
+   while (_mappingImu->tryPop(imu))
+      _mapping.updateIMU({ imu.stamp, imu.roll, imu.pitch });
+}
+
+template <class T>
+bool Pipeline::pushTo(SpscQueue<T>& queue, T& element, QueueStats& stats, bool drop)
+{
+   bool blocked = false;
+   auto start = SteadyClock::now();
+   Backoff backoff;
+   while (!queue.tryPush(element))
+   {
+      if (drop)
+      {
+         std::lock_guard<std::mutex> lock(_statsMutex);
+         stats.dropped++;
+         return false;
+      }
+      blocked = true;
+      backoff.wait();
+   }
+
+   const size_t depth = queue.size();
+   std::lock_guard<std::mutex> lock(_statsMutex);
+   stats.pushed++;
+   stats.depthSum += depth;
+   stats.maxDepth = std::max(stats.maxDepth, depth);
+   if (blocked)
+      stats.blockedTime += toSec(SteadyClock::now() - start);
+   return true;
+}
+
+void Pipeline::startThreads(const PipelineQueueParams& params)
+{
+   if (_threaded)
+      return;
+
+   _queueParams = params;
+   _inputQueue.reset(new FrameQueue<InputFrame>(std::max<size_t>(params.inputQueueSize, 1)));
+   _odometryQueue.reset(new FrameQueue<SweepFrame>(std::max<size_t>(params.odometryQueueSize, 1)));
+   _mappingQueue.reset(new FrameQueue<MappingFrame>(std::max<size_t>(params.mappingQueueSize, 1)));
+   _registrationImu.reset(new SpscQueue<ImuMeasurement>(std::max<size_t>(params.imuQueueSize, 1)));
+   _mappingImu.reset(new SpscQueue<ImuMeasurement>(std::max<size_t>(params.imuQueueSize, 1)));
+
+   _stopRequested = false;
+   _registrationDone = false;
+   _odometryDone = false;
+   _pendingSweeps = 0;
+   _threaded = true;
+
+   _registrationThread = std::thread(&Pipeline::registrationLoop, this);
+   _odometryThread = std::thread(&Pipeline::odometryLoop, this);
+   _mappingThread = std::thread(&Pipeline::mappingLoop, this);
+}
+
+void Pipeline::stopThreads()
+{
+   if (!_threaded)
+      return;
+
+   // every stage finishes its queue once its producer is done, so all pushed sweeps are processed
+   _stopRequested.store(true, std::memory_order_release);
+   _registrationThread.join();
+   _odometryThread.join();
+   _mappingThread.join();
+
+   // IMU measurements received after the last sweep are still relevant for the next one
+   applyRegistrationImu();
+   applyMappingImu();
+   _threaded = false;
+}
+
+void Pipeline::flush()
+{
+   Backoff backoff;
+   while (_pendingSweeps.load(std::memory_order_acquire) > 0)
+      backoff.wait();
+}
+
+void Pipeline::registrationLoop()
+{
+   Profiler::instance().setThreadName("registration");
+   std::unique_ptr<InputFrame> input;
+   Backoff backoff;
+   while (true)
+   {
+      if (!_inputQueue->queue.tryPop(input))
+      {
+         if (_stopRequested.load(std::memory_order_acquire) && _inputQueue->queue.empty())
+            break;
+         backoff.wait();
+         continue;
+      }
+      backoff.reset();
+
+      applyRegistrationImu();
+      std::unique_ptr<SweepFrame> frame = _odometryQueue->acquire();
+      registerSweep(input->points, input->scanTime, *frame);
+      _inputQueue->release(input);
+
+      pushTo(_odometryQueue->queue, frame, _queueStats.odometry, false);
+   }
+
+   _registrationDone.store(true, std::memory_order_release);
+}
+
+void Pipeline::odometryLoop()
+{
+   Profiler::instance().setThreadName("odometry");
+   std::unique_ptr<SweepFrame> frame;
+   std::unique_ptr<MappingFrame> mappingFrame = _mappingQueue->acquire();
+   const bool dropMapping = _queueParams.mappingPolicy == MappingQueuePolicy::DROP;
+   Backoff backoff;
+   while (true)
+   {
+      if (!_odometryQueue->queue.tryPop(frame))
+      {
+         if (_registrationDone.load(std::memory_order_acquire) && _odometryQueue->queue.empty())
+            break;
+         backoff.wait();
+         continue;
+      }
+      backoff.reset();
+
+      const bool handOn = runOdometry(*frame, *mappingFrame);
+      _odometryQueue->release(frame);
+
+      // a dropped mapping frame is simply refilled by the next handed on sweep
+      if (handOn && pushTo(_mappingQueue->queue, mappingFrame, _queueStats.mapping, dropMapping))
+         mappingFrame = _mappingQueue->acquire();
+      else
+         _pendingSweeps.fetch_sub(1, std::memory_order_release);
+   }
+
+   _odometryDone.store(true, std::memory_order_release);
+}
+
+void Pipeline::mappingLoop()
+{
+   Profiler::instance().setThreadName("mapping");
+   std::unique_ptr<MappingFrame> frame;
+   Backoff backoff;
+   while (true)
+   {
+      if (!_mappingQueue->queue.tryPop(frame))
+      {
+         if (_odometryDone.load(std::memory_order_acquire) && _mappingQueue->queue.empty())
+            break;
+         backoff.wait();
+         continue;
+      }
+      backoff.reset();
+
+      applyMappingImu();
+      runMapping(*frame);
+      _mappingQueue->release(frame);
+      _pendingSweeps.fetch_sub(1, std::memory_order_release);
+   }
+}
+
+PipelineStageTimes Pipeline::stageTimes() const
+{
+   std::lock_guard<std::mutex> lock(_statsMutex);
+   return _stageTimes;
+}
+
+PipelineQueueStats Pipeline::queueStats() const
+{
+   std::lock_guard<std::mutex> lock(_statsMutex);
+   return _queueStats;
+}
+
+} // end namespace loam
@@ -0,0 +1,286 @@
+#include "loam_velodyne/Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include <unistd.h>
+
+namespace loam
+{
+
+/** \brief Histogram bucket of a value: 0 for zero, otherwise the number of significant bits. */
+static inline size_t bucketOf(uint64_t value)
+{
+   return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
+uint64_t ProbeStats::percentile(double p) const
+{
+   if (count == 0)
+      return 0;
+
+   const uint64_t rank = std::max<uint64_t>(uint64_t(p / 100 * count + 0.5), 1);
+   uint64_t seen = 0;
+   for (size_t i = 0; i < BUCKET_NUM; i++)
+   {
+      seen += buckets[i];
+      if (seen >= rank)
+      {
+         const uint64_t upper = i == 0 ? 0 : i == 64 ? UINT64_MAX : (uint64_t(1) << i) - 1;
+         return std::min(upper, max);
+      }
+   }
+   return max;
+}
+
+std::string ProbeStats::summary() const
+{
+   char buffer[160];
+   if (type == ProbeType::COUNTER)
+   {
+      std::snprintf(buffer, sizeof(buffer), "sum %llu", (unsigned long long)sum);
+   }
+   else
+   {
+      // percentiles are bucket upper bounds, hence the "<="
+      const double scale = type == ProbeType::TIMER ? 1e-6 : 1;
+      std::snprintf(buffer, sizeof(buffer), "n %llu, mean %.3f, p50 <= %.3f, p99 <= %.3f, max %.3f%s",
+                    (unsigned long long)count, mean() * scale, percentile(50) * scale, percentile(99) * scale,
+                    max * scale, type == ProbeType::TIMER ? " ms" : "");
+   }
+   return buffer;
+}
+
+Probe::Probe(const std::string& name, ProbeType type, uint32_t id) : _name(name), _type(type), _id(id)
+{
+   for (auto& bucket : _buckets)
+      bucket.store(0, std::memory_order_relaxed);
+}
+
+void Probe::record(uint64_t value)
+{
+   _count.fetch_add(1, std::memory_order_relaxed);
+   _sum.fetch_add(value, std::memory_order_relaxed);
+   _buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+
+   uint64_t current = _min.load(std::memory_order_relaxed);
+   while (value < current && !_min.compare_exchange_weak(current, value, std::memory_order_relaxed))
+      ;
+   current = _max.load(std::memory_order_relaxed);
+   while (value > current && !_max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+      ;
+}
+
+ProbeStats Probe::stats() const
+{
+   ProbeStats stats;
+   stats.name = _name;
+   stats.type = _type;
+   stats.count = _count.load(std::memory_order_relaxed);
+   stats.sum = _sum.load(std::memory_order_relaxed);
+   stats.min = stats.count > 0 ? _min.load(std::memory_order_relaxed) : 0;
+   stats.max = _max.load(std::memory_order_relaxed);
+   for (size_t i = 0; i < ProbeStats::BUCKET_NUM; i++)
+      stats.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+   return stats;
+}
+
+void Probe::reset()
+{
+   _count.store(0, std::memory_order_relaxed);
+   _sum.store(0, std::memory_order_relaxed);
+   _min.store(UINT64_MAX, std::memory_order_relaxed);
+   _max.store(0, std::memory_order_relaxed);
+   for (auto& bucket : _buckets)
+      bucket.store(0, std::memory_order_relaxed);
+}
+
+
+Profiler& Profiler::instance()
+{
+   static Profiler profiler;
+   return profiler;
+}
+
+Probe& Profiler::probe(const std::string& name, ProbeType type)
+{
+   std::lock_guard<std::mutex> lock(_probeMutex);
+   for (Probe& probe : _probes)
+   {
+      if (probe.name() == name)
+         return probe;
+   }
+   _probes.emplace_back(name, type, uint32_t(_probes.size()));
+   return _probes.back();
+}
+
+std::vector<ProbeStats> Profiler::snapshot() const
+{
+   std::lock_guard<std::mutex> lock(_probeMutex);
+   std::vector<ProbeStats> stats;
+   stats.reserve(_probes.size());
+   for (const Probe& probe : _probes)
+      stats.push_back(probe.stats());
+   return stats;
+}
+
+void Profiler::reset()
+{
+   std::lock_guard<std::mutex> lock(_probeMutex);
+   for (Probe& probe : _probes)
+      probe.reset();
+}
+
+uint64_t Profiler::now()
+{
+   return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint32_t Profiler::threadId()
+{
+   static std::atomic<uint32_t> nextId{ 1 };
+   thread_local uint32_t id = nextId.fetch_add(1, std::memory_order_relaxed);
+   return id;
+}
+
+void Profiler::setTraceCapacity(size_t events)
+{
+   std::lock_guard<std::mutex> lock(_traceMutex);
+   _trace.clear();
+   _trace.shrink_to_fit();
+   _trace.reserve(events);
+   _traceCapacity = events;
+   _traceNext = 0;
+   _traceWrapped = false;
+   _tracing.store(events > 0, std::memory_order_relaxed);
+}
+
+void Profiler::setThreadName(const std::string& name)
+{
+   const uint32_t id = threadId();
+   std::lock_guard<std::mutex> lock(_traceMutex);
+   for (auto& threadName : _threadNames)
+   {
+      if (threadName.first == id)
+      {
+         threadName.second = name;
+         return;
+      }
+   }
+   _threadNames.emplace_back(id, name);
+}
+
+void Profiler::traceScope(const Probe& probe, uint64_t start, uint64_t duration)
+{
+   addEvent({ probe.id(), threadId(), start, duration });
+}
+
+void Profiler::traceValue(const Probe& probe, uint64_t value)
+{
+   addEvent({ probe.id(), threadId(), now(), value });
+}
+
+void Profiler::addEvent(const TraceEvent& event)
+{
+   std::lock_guard<std::mutex> lock(_traceMutex);
+   if (_traceCapacity == 0)
+      return;
+
+   if (_trace.size() < _traceCapacity)
+      _trace.push_back(event);
+   else
+      _trace[_traceNext] = event;
+
+   if (++_traceNext == _traceCapacity)
+   {
+      _traceNext = 0;
+      _traceWrapped = true;
+   }
+}
+
+/** \brief Write a string as JSON string, escaping quotes and backslashes. */
+static void writeJsonString(FILE* file, const std::string& str)
+{
+   std::fputc('"', file);
+   for (char c : str)
+   {
+      if (c == '"' || c == '\\')
+         std::fputc('\\', file);
+      std::fputc(c, file);
+   }
+   std::fputc('"', file);
+}
+
+bool Profiler::writeChromeTrace(const std::string& file) const
+{
+   std::vector<std::string> probeNames;
+   std::vector<ProbeType> probeTypes;
+   {
+      std::lock_guard<std::mutex> lock(_probeMutex);
+      for (const Probe& probe : _probes)
+      {
+         probeNames.push_back(probe.name());
+         probeTypes.push_back(probe.type());
+      }
+   }
+
+   // copy the events oldest first, so the trace isn't blocked while writing
+   std::vector<TraceEvent> events;
+   std::vector<std::pair<uint32_t, std::string>> threadNames;
+   {
+      std::lock_guard<std::mutex> lock(_traceMutex);
+      if (_traceWrapped)
+         events.insert(events.end(), _trace.begin() + _traceNext, _trace.end());
+      events.insert(events.end(), _trace.begin(), _trace.begin() + (_traceWrapped ? _traceNext : _trace.size()));
+      threadNames = _threadNames;
+   }
+
+   FILE* out = std::fopen(file.c_str(), "w");
+   if (!out)
+      return false;
+
+   const int pid = int(getpid());
+   // scopes are recorded when they end, so an enclosing scope starts before the first recorded event
+   uint64_t origin = events.empty() ? 0 : events.front().time;
+   for (const TraceEvent& event : events)
+      origin = std::min(origin, event.time);
+   std::fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+   bool first = true;
+   for (auto const& threadName : threadNames)
+   {
+      std::fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":",
+                   first ? "" : ",\n", pid, threadName.first);
+      writeJsonString(out, threadName.second);
+      std::fprintf(out, "}}");
+      first = false;
+   }
+
+   for (const TraceEvent& event : events)
+   {
+      if (event.probe >= probeNames.size())
+         continue;
+
+      // scopes as complete events, counter and histogram values as counter tracks (in microseconds)
+      std::fprintf(out, "%s{\"name\":", first ? "" : ",\n");
+      writeJsonString(out, probeNames[event.probe]);
+      const double time = (event.time - origin) * 1e-3;
+      if (probeTypes[event.probe] == ProbeType::TIMER)
+      {
+         std::fprintf(out, ",\"cat\":\"loam\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                      pid, event.thread, time, event.value * 1e-3);
+      }
+      else
+      {
+         std::fprintf(out, ",\"cat\":\"loam\",\"ph\":\"C\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%llu}}",
+                      pid, event.thread, time, (unsigned long long)event.value);
+      }
+      first = false;
+   }
+   std::fprintf(out, "\n]}\n");
+
+   return std::fclose(out) == 0;
+}
+
+} // end namespace loam
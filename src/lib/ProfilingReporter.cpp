@@ -0,0 +1,119 @@
+#include "loam_velodyne/ProfilingReporter.h"
+#include "loam_velodyne/Profiler.h"
+
+#include <algorithm>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+namespace loam {
+
+namespace {
+
+/** \brief Insert the node name before the extension of the trace file, so the nodes of a launch don't share one file. */
+std::string nodeTraceFile(const std::string& file) {
+  std::string node = ros::this_node::getName();
+  std::replace(node.begin(), node.end(), '/', '_');
+  node.erase(0, node.find_first_not_of('_'));
+
+  const size_t dot = file.find_last_of('.');
+  const size_t slash = file.find_last_of('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    return file + "_" + node;
+  return file.substr(0, dot) + "_" + node + file.substr(dot);
+}
+
+} // end anonymous namespace
+
+std::atomic<bool> ProfilingReporter::_claimed{ false };
+
+ProfilingReporter::~ProfilingReporter() {
+  if (!_owner)
+    return;
+
+  _timer.stop();
+  if (!_traceFile.empty()) {
+    if (Profiler::instance().writeChromeTrace(_traceFile))
+      ROS_INFO("Wrote profiling trace %s", _traceFile.c_str());
+    else
+      ROS_ERROR("Failed to write profiling trace %s", _traceFile.c_str());
+  }
+  _claimed = false;
+}
+
+bool ProfilingReporter::setup(ros::NodeHandle& node, ros::NodeHandle& privateNode) {
+  float fParam;
+  int iParam;
+  std::string sParam;
+
+  double period = 5;
+  if (node.getParam("profilingPeriod", fParam)) {
+    if (fParam < 0) {
+      ROS_ERROR("Invalid profilingPeriod parameter: %f (expected >= 0)", fParam);
+      return false;
+    }
+    period = fParam;
+    ROS_DEBUG("Set profilingPeriod: %g", fParam);
+  }
+
+  size_t traceEvents = 100000;
+  if (node.getParam("profilingTraceEvents", iParam)) {
+    if (iParam < 1) {
+      ROS_ERROR("Invalid profilingTraceEvents parameter: %d (expected >= 1)", iParam);
+      return false;
+    }
+    traceEvents = size_t(iParam);
+    ROS_DEBUG("Set profilingTraceEvents: %d", iParam);
+  }
+
+  std::string traceFile;
+  if (node.getParam("profilingTraceFile", sParam)) {
+    traceFile = sParam;
+    ROS_DEBUG("Set profilingTraceFile: %s", sParam.c_str());
+  }
+
+#ifdef LOAM_PROFILING
+  if (_claimed.exchange(true))
+    return true;
+  _owner = true;
+
+  if (!traceFile.empty()) {
+    _traceFile = nodeTraceFile(traceFile);
+    Profiler::instance().setTraceCapacity(traceEvents);
+  }
+
+  if (period > 0) {
+    _pubDiagnostics = node.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+    _timer = node.createWallTimer(ros::WallDuration(period), &ProfilingReporter::publishDiagnostics, this);
+  }
+#else
+  // the parameters are still validated, so a configuration is valid for either build
+  (void)period;
+  (void)traceEvents;
+  if (!traceFile.empty())
+    ROS_WARN("Ignoring profilingTraceFile, built without LOAM_PROFILING");
+#endif
+
+  return true;
+}
+
+void ProfilingReporter::publishDiagnostics(const ros::WallTimerEvent& event) {
+  // the values are aggregated since the start of the process
+  diagnostic_msgs::DiagnosticStatus status;
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  status.name = "loam_velodyne: profiling";
+  status.hardware_id = ros::this_node::getName();
+  status.message = "hot path timers (ms), counters and histograms";
+  for (const ProbeStats& stats : Profiler::instance().snapshot()) {
+    diagnostic_msgs::KeyValue value;
+    value.key = stats.name;
+    value.value = stats.summary();
+    status.values.push_back(value);
+  }
+
+  diagnostic_msgs::DiagnosticArray msg;
+  msg.header.stamp = ros::Time::now();
+  msg.status.push_back(status);
+  _pubDiagnostics.publish(msg);
+}
+
+} // end namespace loam
@@ -163,6 +163,15 @@ bool ScanRegistration::parseParams(const ros::NodeHandle &node,
     ROS_DEBUG("Set IMU input topic name to: %s", sParam.c_str());
   }
 
+  if (node.getParam("cloudEncoding", sParam)) {
+    if (!parseCloudEncoding(sParam, _cloudEncoding)) {
+      ROS_ERROR("Invalid cloudEncoding parameter: %s (expected float32, quantized or quantized_lz4)", sParam.c_str());
+      success = false;
+    } else {
+      ROS_DEBUG("Set cloudEncoding: %s", sParam.c_str());
+    }
+  }
+
   // Get transformation to apply to IMU
   if (_transformIMU) {
     tf2_ros::Buffer tfBuffer;
@@ -203,25 +212,17 @@ bool ScanRegistration::setupROS(ros::NodeHandle &node,
   _lidarFrame = "/camera";
   _imuInputTopic = "/imu/data";
 
-  if (!parseParams(node, privateNode, config_out))
+  if (!parseParams(node, privateNode, config_out) ||
+      !_profilingReporter.setup(node, privateNode))
     return false;
 
   // subscribe to IMU topic
   _subImu = node.subscribe<sensor_msgs::Imu>(
       _imuInputTopic, 50, &ScanRegistration::handleIMUMessage, this);
 
-  // advertise scan registration topics
-  _pubLaserCloud =
-      node.advertise<sensor_msgs::PointCloud2>("velodyne_cloud_2", 2);
-  _pubCornerPointsSharp =
-      node.advertise<sensor_msgs::PointCloud2>("laser_cloud_sharp", 2);
-  _pubCornerPointsLessSharp =
-      node.advertise<sensor_msgs::PointCloud2>("laser_cloud_less_sharp", 2);
-  _pubSurfPointsFlat =
-      node.advertise<sensor_msgs::PointCloud2>("laser_cloud_flat", 2);
-  _pubSurfPointsLessFlat =
-      node.advertise<sensor_msgs::PointCloud2>("laser_cloud_less_flat", 2);
-  _pubImuTrans = node.advertise<sensor_msgs::PointCloud2>("imu_trans", 5);
+  // advertise the scan registration result (shared without serialization within the same process)
+  _pubSweepFeatures =
+      node.advertise<loam_velodyne::SweepFeatures>("sweep_features", 2);
 
   return true;
 }
@@ -245,39 +246,32 @@ void ScanRegistration::handleIMUMessage(
   double roll, pitch, yaw;
   tf::Matrix3x3(orientation).getRPY(roll, pitch, yaw);
 
-  Vector3 acc;
-  acc.x() = float(imuInRotated->linear_acceleration.y -
-                  sin(roll) * cos(pitch) * 9.81);
-  acc.y() = float(imuInRotated->linear_acceleration.z -
-                  cos(roll) * cos(pitch) * 9.81);
-  acc.z() = float(imuInRotated->linear_acceleration.x + sin(pitch) * 9.81);
-
-  IMUState newState;
-  newState.stamp = fromROSTime(imuInRotated->header.stamp);
-  newState.roll = roll;
-  newState.pitch = pitch;
-  newState.yaw = yaw;
-  newState.acceleration = acc;
-
-  updateIMUData(acc, newState);
+  updateIMUData(fromROSTime(imuInRotated->header.stamp), roll, pitch, yaw,
+                Vector3(imuInRotated->linear_acceleration.x,
+                        imuInRotated->linear_acceleration.y,
+                        imuInRotated->linear_acceleration.z));
 }
 
 void ScanRegistration::publishResult() {
+  // publish full resolution and feature point clouds together with the
+  // corresponding IMU transformation information in a single message
+  loam_velodyne::SweepFeatures::Ptr msg(new loam_velodyne::SweepFeatures());
+  msg->header.stamp = toROSTime(sweepStart());
+  msg->header.frame_id = _lidarFrame;
+  toCompactCloud(laserCloud(), msg->laserCloud, _cloudEncoding, _cloudCodec);
+  toCompactCloud(cornerPointsSharp(), msg->cornerPointsSharp, _cloudEncoding, _cloudCodec);
+  toCompactCloud(cornerPointsLessSharp(), msg->cornerPointsLessSharp, _cloudEncoding, _cloudCodec);
+  toCompactCloud(surfacePointsFlat(), msg->surfacePointsFlat, _cloudEncoding, _cloudCodec);
+  toCompactCloud(surfacePointsLessFlat(), msg->surfacePointsLessFlat, _cloudEncoding, _cloudCodec);
+
+  auto const &imuTrans = imuTransform();
+  for (size_t i = 0; i < 4; i++) {
+    msg->imuTrans[3 * i] = imuTrans[i].x;
+    msg->imuTrans[3 * i + 1] = imuTrans[i].y;
+    msg->imuTrans[3 * i + 2] = imuTrans[i].z;
+  }
 
-  auto sweepStartTime = toROSTime(sweepStart());
-  // publish full resolution and feature point clouds
-  publishCloudMsg(_pubLaserCloud, laserCloud(), sweepStartTime, _lidarFrame);
-  publishCloudMsg(_pubCornerPointsSharp, cornerPointsSharp(), sweepStartTime,
-                  _lidarFrame);
-  publishCloudMsg(_pubCornerPointsLessSharp, cornerPointsLessSharp(),
-                  sweepStartTime, _lidarFrame);
-  publishCloudMsg(_pubSurfPointsFlat, surfacePointsFlat(), sweepStartTime,
-                  _lidarFrame);
-  publishCloudMsg(_pubSurfPointsLessFlat, surfacePointsLessFlat(),
-                  sweepStartTime, _lidarFrame);
-
-  // publish corresponding IMU transformation information
-  publishCloudMsg(_pubImuTrans, imuTransform(), sweepStartTime, _lidarFrame);
+  _pubSweepFeatures.publish(loam_velodyne::SweepFeatures::ConstPtr(msg));
 }
 
 } // end namespace loam
@@ -0,0 +1,85 @@
+#include "loam_velodyne/VoxelFeatureMap.h"
+
+#include <Eigen/Eigenvalues>
+
+namespace loam
+{
+
+VoxelStats::VoxelStats() :
+   _count(0),
+   _mean(Eigen::Vector3f::Zero()),
+   _scatter(Eigen::Matrix3f::Zero()),
+   _eigenValid(false),
+   _eigenvalues(Eigen::Vector3f::Zero()),
+   _eigenvectors(Eigen::Matrix3f::Identity())
+{}
+
+void VoxelStats::add(const pcl::PointXYZI& point)
+{
+   // Welford update of mean and scatter matrix
+   Eigen::Vector3f p(point.x, point.y, point.z);
+   Eigen::Vector3f delta = p - _mean;
+   _count++;
+   _mean += delta / float(_count);
+   _scatter += delta * (p - _mean).transpose();
+   _eigenValid = false;
+}
+
+Eigen::Matrix3f VoxelStats::covariance() const
+{
+   if (_count == 0)
+      return Eigen::Matrix3f::Zero();
+
+   return _scatter / float(_count);
+}
+
+void VoxelStats::updateEigen()
+{
+   if (_eigenValid)
+      return;
+
+   // This solver only looks at the lower-triangular part of the covariance.
+   Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> esolver(covariance());
+   _eigenvalues = esolver.eigenvalues().real();
+   _eigenvectors = esolver.eigenvectors().real();
+   _eigenValid = true;
+}
+
+
+
+VoxelFeatureMap::VoxelFeatureMap(const float& voxelSize)
+{
+   setVoxelSize(voxelSize);
+}
+
+void VoxelFeatureMap::setVoxelSize(const float& voxelSize)
+{
+   _voxelSize = voxelSize;
+   _invVoxelSize = 1.0f / voxelSize;
+   _voxels.clear();
+   _outdated = true;
+}
+
+void VoxelFeatureMap::update(const CompactPointCloud& cloud)
+{
+   if (!_outdated)
+      return;
+
+   _voxels.clear();
+   for (size_t i = 0; i < cloud.size(); i++)
+      insert(cloud[i]);
+   _outdated = false;
+}
+
+void VoxelFeatureMap::insert(const pcl::PointXYZI& point)
+{
+   _voxels[toVoxelKey(point, _invVoxelSize)].add(point);
+}
+
+VoxelStats* VoxelFeatureMap::find(const pcl::PointXYZI& point)
+{
+   auto it = _voxels.find(toVoxelKey(point, _invVoxelSize));
+   return it == _voxels.end() ? nullptr : &it->second;
+}
+
+} // end namespace loam
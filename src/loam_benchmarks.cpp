@@ -0,0 +1,1322 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include "loam_velodyne/CompactPointCloud.h"
+#include "loam_velodyne/Pipeline.h"
+#include "loam_velodyne/Profiler.h"
+#include "loam_velodyne/VoxelKey.h"
+#include "loam_velodyne/common.h"
+
+
+// Count all heap allocations of the process. PCL clouds allocate through Eigen, which calls malloc()
+// directly, so replacing operator new alone would miss most of the point storage. The replacements
+// forward to the glibc implementation.
+static std::atomic<size_t> allocationCount{ 0 };   ///< number of allocations so far
+static std::atomic<size_t> allocatedBytes{ 0 };    ///< number of requested bytes so far
+
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+
+static inline void countAllocation(size_t size)
+{
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void* malloc(size_t size) noexcept
+{
+  countAllocation(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size) noexcept
+{
+  countAllocation(num * size);
+  return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, size_t size) noexcept
+{
+  countAllocation(size);
+  return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept
+{
+  countAllocation(size);
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept
+{
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept
+{
+  void* result = memalign(alignment, size);
+  if (!result)
+    return ENOMEM;
+  *ptr = result;
+  return 0;
+}
+
+void free(void* ptr) noexcept
+{
+  __libc_free(ptr);
+}
+}
+
+
+namespace
+{
+
+using namespace loam;
+
+/** Number of initial calls of a stage excluded from the steady state allocation counts. */
+const size_t WARMUP_CALLS = 10;
+
+/** Number of loads of the snapshot suite. */
+const size_t SNAPSHOT_LOADS = 3;
+
+/** Feature selection sizes of the selection suite (0 = all features). */
+const size_t SELECTION_SIZES[] = { 0, 200, 500, 1000, 1500, 2000 };
+
+/** \brief Peak resident set size of the process in kB. */
+long peakRssKb()
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+/** Recorded sweep, preloaded so that reading the bag is not measured. */
+struct Sweep
+{
+  Time stamp;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr points;
+};
+
+/** Per call measurements of one stage. */
+struct StageSamples
+{
+  std::vector<double> durations;     ///< run time of every call (in seconds)
+  std::vector<size_t> allocations;   ///< heap allocations of every call
+  size_t bytes = 0;                  ///< total number of allocated bytes
+  long rssGrowthKb = 0;              ///< total growth of the peak RSS during the calls
+
+  void reserve(size_t num) { durations.reserve(num); allocations.reserve(num); }
+
+  /** \brief Run the given function once and record its run time, allocations and peak RSS growth. */
+  template <class Function>
+  void measure(Function&& function)
+  {
+    const long rss = peakRssKb();
+    const size_t count = allocationCount.load(std::memory_order_relaxed);
+    const size_t size = allocatedBytes.load(std::memory_order_relaxed);
+    auto start = SteadyClock::now();
+    function();
+    const double duration = toSec(SteadyClock::now() - start);
+    const size_t callAllocations = allocationCount.load(std::memory_order_relaxed) - count;
+    bytes += allocatedBytes.load(std::memory_order_relaxed) - size;
+
+    durations.push_back(duration);
+    allocations.push_back(callAllocations);
+    rssGrowthKb += peakRssKb() - rss;
+  }
+};
+
+/** \brief Nearest rank percentile of the given sorted values. */
+double percentile(const std::vector<double>& sorted, double p)
+{
+  if (sorted.empty())
+    return 0;
+  size_t rank = size_t(std::ceil(p / 100 * sorted.size()));
+  return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+/** \brief Minimal streaming JSON writer with indentation. */
+class JsonWriter
+{
+public:
+  explicit JsonWriter(FILE* file) : _file(file) {}
+
+  void beginObject(const char* key = nullptr) { open(key, '{'); }
+  void endObject() { close('}'); }
+  void beginArray(const char* key = nullptr) { open(key, '['); }
+  void endArray() { close(']'); }
+
+  void value(const char* key, double value)
+  {
+    prefix(key);
+    // JSON has no representation of infinity or NaN
+    if (std::isfinite(value))
+      std::fprintf(_file, "%.6g", value);
+    else
+      std::fprintf(_file, "null");
+  }
+
+  void value(const char* key, size_t value) { prefix(key); std::fprintf(_file, "%zu", value); }
+  void value(const char* key, long value) { prefix(key); std::fprintf(_file, "%ld", value); }
+  void value(const char* key, bool value) { prefix(key); std::fprintf(_file, value ? "true" : "false"); }
+
+  void value(const char* key, const std::string& value)
+  {
+    prefix(key);
+    std::fputc('"', _file);
+    for (char c : value)
+    {
+      if (c == '"' || c == '\\')
+        std::fputc('\\', _file);
+      std::fputc(c, _file);
+    }
+    std::fputc('"', _file);
+  }
+
+  void finish() { std::fputc('\n', _file); }
+
+private:
+  void prefix(const char* key)
+  {
+    if (!_first.empty())
+    {
+      std::fprintf(_file, _first.back() ? "\n" : ",\n");
+      _first.back() = false;
+    }
+    std::fprintf(_file, "%*s", int(2 * _first.size()), "");
+    if (key)
+      std::fprintf(_file, "\"%s\": ", key);
+  }
+
+  void open(const char* key, char bracket)
+  {
+    prefix(key);
+    std::fputc(bracket, _file);
+    _first.push_back(true);
+  }
+
+  void close(char bracket)
+  {
+    const bool empty = _first.back();
+    _first.pop_back();
+    if (!empty)
+      std::fprintf(_file, "\n%*s", int(2 * _first.size()), "");
+    std::fputc(bracket, _file);
+  }
+
+  FILE* _file;
+  std::vector<bool> _first;   ///< flag per open object / array if no element was written yet
+};
+
+/** \brief Write the latency percentiles, throughput, allocations and RSS growth of a stage. */
+void writeStage(JsonWriter& json, const char* name, const StageSamples& samples)
+{
+  std::vector<double> sorted = samples.durations;
+  std::sort(sorted.begin(), sorted.end());
+  double total = 0;
+  for (double duration : sorted)
+    total += duration;
+
+  size_t allocations = 0, steadyAllocations = 0, steadyCalls = 0, maxAllocations = 0;
+  for (size_t i = 0; i < samples.allocations.size(); i++)
+  {
+    allocations += samples.allocations[i];
+    maxAllocations = std::max(maxAllocations, samples.allocations[i]);
+    if (i >= WARMUP_CALLS)
+    {
+      steadyAllocations += samples.allocations[i];
+      steadyCalls++;
+    }
+  }
+
+  const size_t count = sorted.size();
+  json.beginObject(name);
+  json.value("calls", count);
+  json.value("meanMs", count > 0 ? total / count * 1000 : 0.0);
+  json.value("p50Ms", percentile(sorted, 50) * 1000);
+  json.value("p95Ms", percentile(sorted, 95) * 1000);
+  json.value("p99Ms", percentile(sorted, 99) * 1000);
+  json.value("maxMs", count > 0 ? sorted.back() * 1000 : 0.0);
+  json.value("throughputHz", total > 0 ? count / total : 0.0);
+  json.value("allocationsPerCall", count > 0 ? double(allocations) / count : 0.0);
+  json.value("steadyAllocationsPerCall", steadyCalls > 0 ? double(steadyAllocations) / steadyCalls : 0.0);
+  json.value("maxAllocationsPerCall", maxAllocations);
+  json.value("allocatedBytesPerCall", count > 0 ? double(samples.bytes) / count : 0.0);
+  json.value("peakRssGrowthKb", samples.rssGrowthKb);
+  json.endObject();
+}
+
+/** \brief Write a pose as position and rotation angles. */
+void writePose(JsonWriter& json, const char* name, const Twist& pose)
+{
+  json.beginObject(name);
+  json.value("x", double(pose.pos.x()));
+  json.value("y", double(pose.pos.y()));
+  json.value("z", double(pose.pos.z()));
+  json.value("rotX", double(pose.rot_x.rad()));
+  json.value("rotY", double(pose.rot_y.rad()));
+  json.value("rotZ", double(pose.rot_z.rad()));
+  json.endObject();
+}
+
+/** \brief Write the profiler probes (empty unless built with LOAM_PROFILING), timers in milliseconds. */
+void writeProbes(JsonWriter& json, const char* name)
+{
+  json.beginObject(name);
+  for (const ProbeStats& stats : Profiler::instance().snapshot())
+  {
+    json.beginObject(stats.name.c_str());
+    if (stats.type == ProbeType::COUNTER)
+    {
+      json.value("sum", size_t(stats.sum));
+    }
+    else
+    {
+      // percentiles are the upper bounds of the log2 histogram buckets
+      const double scale = stats.type == ProbeType::TIMER ? 1e-6 : 1;
+      json.value("count", size_t(stats.count));
+      json.value("mean", stats.mean() * scale);
+      json.value("p50", stats.percentile(50) * scale);
+      json.value("p99", stats.percentile(99) * scale);
+      json.value("max", stats.max * scale);
+    }
+    json.endObject();
+  }
+  json.endObject();
+}
+
+bool samePose(const Twist& a, const Twist& b)
+{
+  return a.pos.x() == b.pos.x() && a.pos.y() == b.pos.y() && a.pos.z() == b.pos.z() &&
+         a.rot_x.rad() == b.rot_x.rad() && a.rot_y.rad() == b.rot_y.rad() && a.rot_z.rad() == b.rot_z.rad();
+}
+
+double translationDifference(const Twist& a, const Twist& b)
+{
+  const double dx = a.pos.x() - b.pos.x(), dy = a.pos.y() - b.pos.y(), dz = a.pos.z() - b.pos.z();
+  return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+double rotationDifference(const Twist& a, const Twist& b)
+{
+  return std::max({ std::fabs(a.rot_x.rad() - b.rot_x.rad()),
+              std::fabs(a.rot_y.rad() - b.rot_y.rad()),
+              std::fabs(a.rot_z.rad() - b.rot_z.rad()) });
+}
+
+
+/** \brief The four LOAM components, driven like the sequential loam::Pipeline with every stage call measured.
+ *
+ * Only the stage calls themselves are measured, handing the clouds from one stage to the next is not.
+ */
+struct StageRun
+{
+  StageRun(const MultiScanMapper& scanMapper, uint16_t ioRatio) : scanMapper(scanMapper), ioRatio(ioRatio)
+  {
+    registration.configure(RegistrationParams());
+  }
+
+  void run(const std::vector<Sweep>& sweeps)
+  {
+    registrationSamples.reserve(sweeps.size());
+    odometrySamples.reserve(sweeps.size());
+    transformSamples.reserve(sweeps.size());
+    mappingSamples.reserve(sweeps.size());
+    const SteadyClock::time_point runStart = SteadyClock::now();
+
+    for (size_t i = 0; i < sweeps.size(); i++)
+    {
+      const Sweep& sweep = sweeps[i];
+      const SteadyClock::time_point arrival = SteadyClock::now();
+      registrationSamples.measure([&] { registration.processCloud(*sweep.points, sweep.stamp, scanMapper); });
+
+      odometry.cornerPointsSharp()->swap(registration.cornerPointsSharp());
+      odometry.cornerPointsLessSharp()->swap(registration.cornerPointsLessSharp());
+      odometry.surfPointsFlat()->swap(registration.surfacePointsFlat());
+      odometry.surfPointsLessFlat()->swap(registration.surfacePointsLessFlat());
+      odometry.laserCloud()->swap(registration.laserCloud());
+      odometry.updateIMU(registration.imuTransform());
+      waitForPoll(runStart);
+      odometrySamples.measure([&] { odometry.process(); });
+
+      const Twist& odometryPose = odometry.transformSum();
+      transformMaintenance.updateOdometry(odometryPose.rot_x.rad(), odometryPose.rot_y.rad(), odometryPose.rot_z.rad(),
+                              odometryPose.pos.x(), odometryPose.pos.y(), odometryPose.pos.z());
+      transformSamples.measure([&] { transformMaintenance.transformAssociateToMap(); });
+
+      if (ioRatio >= 2 && odometry.frameCount() % ioRatio != 1)
+        continue;
+
+      mapping.laserCloudCornerLast() = *odometry.lastCornerCloud();
+      mapping.laserCloudSurfLast() = *odometry.lastSurfaceCloud();
+      odometry.transformToEnd(odometry.laserCloud());
+      mapping.laserCloud().swap(*odometry.laserCloud());
+      mapping.updateOdometry(odometryPose);
+
+      bool mapped = false;
+      waitForPoll(runStart);
+      mappingSamples.measure([&] { mapped = mapping.process(sweep.stamp); });
+      if (mapped)
+      {
+        endToEndLatencies.push_back(toSec(SteadyClock::now() - arrival));
+        transformMaintenance.updateMappingTransform(mapping.transformAftMapped(), mapping.transformBefMapped());
+        mappedFrames++;
+        mappedSweeps.push_back(i);
+        mappedPoses.push_back(mapping.transformAftMapped());
+
+        // the maintenance stages are accumulated by the mapping itself
+        const MappingStageTimes times = mapping.stats().stages;
+        const double maintenance = times.cubeShift.total + times.mapInsertion.total + times.cubeDownsize.total;
+        maintenanceDurations.push_back(maintenance - maintenanceTotal);
+        maintenanceTotal = maintenance;
+      }
+    }
+  }
+
+  /** \brief With a poll period, wait for the next tick of a polling loop started at the given time. */
+  void waitForPoll(SteadyClock::time_point loopStart)
+  {
+    if (pollPeriod == SteadyClock::duration::zero())
+      return;
+
+    const SteadyClock::time_point now = SteadyClock::now();
+    const SteadyClock::time_point tick = loopStart + ((now - loopStart) / pollPeriod + 1) * pollPeriod;
+    std::this_thread::sleep_until(tick);
+    pollWaitTotal += toSec(SteadyClock::now() - now);
+  }
+
+  MultiScanMapper scanMapper;
+  uint16_t ioRatio;
+
+  BasicScanRegistration registration;
+  BasicLaserOdometry odometry;
+  BasicLaserMapping mapping;
+  BasicTransformMaintenance transformMaintenance;
+
+  StageSamples registrationSamples;
+  StageSamples odometrySamples;
+  StageSamples transformSamples;
+  StageSamples mappingSamples;
+  size_t mappedFrames = 0;
+  std::vector<size_t> mappedSweeps;   ///< index of the sweep of every mapped frame
+  std::vector<Twist> mappedPoses;     ///< mapping pose of every mapped frame
+  std::vector<double> maintenanceDurations;   ///< cube shift, map insertion and cube down sizing time of every mapped frame
+  double maintenanceTotal = 0;
+  std::vector<double> endToEndLatencies;   ///< registration start to mapping end of every mapped frame
+  SteadyClock::duration pollPeriod = SteadyClock::duration::zero();   ///< polling period of odometry and mapping (0 = none)
+  double pollWaitTotal = 0;   ///< total time spent waiting for polling ticks
+};
+
+
+/** Benchmark settings and the preloaded dataset. */
+struct Benchmark
+{
+  std::vector<Sweep> sweeps;
+  size_t datasetPoints = 0;
+  MultiScanMapper scanMapper;
+  uint16_t ioRatio = 2;
+  std::string snapshotFile;
+  std::string loadSnapshotFile;   ///< existing map snapshot for the snapshot suite
+  Twist sequentialPose;   ///< final mapping pose of the sequential pipeline, reference for the other runs
+  bool hasSequentialPose = false;
+  const char* suite = "";   ///< name of the running suite
+  std::vector<std::string> failedChecks;   ///< correctness checks that failed, as <suite>.<check>
+};
+
+/** \brief Write a correctness check, remembering a failure for the exit code. */
+void writeCheck(Benchmark& bench, JsonWriter& json, const char* name, bool passed)
+{
+  json.value(name, passed);
+  if (!passed)
+    bench.failedChecks.push_back(std::string(bench.suite) + "." + name);
+}
+
+/** \brief Stage latencies, allocations and RSS growth of all four components, plus the map snapshot round trip. */
+void runStagesSuite(Benchmark& bench, JsonWriter& json)
+{
+  std::unique_ptr<StageRun> run(new StageRun(bench.scanMapper, bench.ioRatio));
+  Profiler::instance().reset();
+  auto start = SteadyClock::now();
+  run->run(bench.sweeps);
+  const double elapsed = toSec(SteadyClock::now() - start);
+
+  json.beginObject("stages");
+  json.value("sweeps", bench.sweeps.size());
+  json.value("mappedFrames", run->mappedFrames);
+  json.value("sweepsPerSecond", elapsed > 0 ? bench.sweeps.size() / elapsed : 0.0);
+  writeStage(json, "registration", run->registrationSamples);
+  writeStage(json, "odometry", run->odometrySamples);
+  writeStage(json, "transformMaintenance", run->transformSamples);
+  writeStage(json, "mapping", run->mappingSamples);
+  writePose(json, "finalPose", run->mapping.transformAftMapped());
+  writeProbes(json, "probes");
+  json.endObject();
+
+  // map snapshot round trip of the resulting map
+  start = SteadyClock::now();
+  const bool saved = run->mapping.saveMapSnapshot(bench.snapshotFile);
+  const double saveTime = toSec(SteadyClock::now() - start);
+
+  struct stat fileStat;
+  const size_t snapshotBytes = saved && stat(bench.snapshotFile.c_str(), &fileStat) == 0 ? size_t(fileStat.st_size) : 0;
+  const size_t mapBytes = run->mapping.stats().memory.memoryBytes;
+  const MapSize mapSize = run->mapping.mapSize();
+  const Twist mapPose = run->mapping.transformAftMapped();
+  run.reset();
+
+  BasicLaserMapping restored;
+  start = SteadyClock::now();
+  const bool loaded = saved && restored.loadMapSnapshot(bench.snapshotFile);
+  const double loadTime = toSec(SteadyClock::now() - start);
+  std::remove(bench.snapshotFile.c_str());
+  const MapSize restoredSize = restored.mapSize();
+
+  json.beginObject("mapSnapshot");
+  writeCheck(bench, json, "saved", saved);
+  writeCheck(bench, json, "loaded", loaded);
+  json.value("cubes", mapSize.cubes);
+  json.value("points", mapSize.points);
+  json.value("restoredCubes", restoredSize.cubes);
+  json.value("restoredPoints", restoredSize.points);
+  writeCheck(bench, json, "sameSize", restoredSize.cubes == mapSize.cubes && restoredSize.points == mapSize.points);
+  writeCheck(bench, json, "samePose", samePose(mapPose, restored.transformAftMapped()));
+  json.value("mapBytes", mapBytes);
+  json.value("fileBytes", snapshotBytes);
+  json.value("saveMs", saveTime * 1000);
+  json.value("loadMs", loadTime * 1000);
+  json.endObject();
+}
+
+/** \brief Mapping latency of a run and the deviation of its poses from those of a reference run for the same sweeps.
+ *
+ * @param firstSweep the index of the first sweep of the run in the sweeps of the reference run
+ */
+void writePoseDeviation(JsonWriter& json, const char* name, const StageRun& reference,
+                        const StageRun& run, size_t firstSweep)
+{
+  double sumTranslation = 0, maxTranslation = 0, maxRotation = 0;
+  size_t frames = 0;
+  for (size_t f = 0; f < run.mappedSweeps.size(); f++)
+  {
+    auto it = std::lower_bound(reference.mappedSweeps.begin(), reference.mappedSweeps.end(),
+                               firstSweep + run.mappedSweeps[f]);
+    if (it == reference.mappedSweeps.end() || *it != firstSweep + run.mappedSweeps[f])
+      continue;
+
+    const Twist& pose = reference.mappedPoses[it - reference.mappedSweeps.begin()];
+    const double translation = translationDifference(pose, run.mappedPoses[f]);
+    sumTranslation += translation;
+    maxTranslation = std::max(maxTranslation, translation);
+    maxRotation = std::max(maxRotation, rotationDifference(pose, run.mappedPoses[f]));
+    frames++;
+  }
+
+  json.beginObject(name);
+  json.value("firstSweep", firstSweep);
+  json.value("comparedFrames", frames);
+  json.value("meanTranslationDeviationM", frames > 0 ? sumTranslation / frames : 0.0);
+  json.value("maxTranslationDeviationM", maxTranslation);
+  json.value("maxRotationDeviationRad", maxRotation);
+  writeStage(json, "mapping", run.mappingSamples);
+  json.endObject();
+}
+
+/** \brief Localization against the map built from the same sweeps, replayed from the start and from halfway.
+ *
+ * The mapping poses of the sweeps serve as ground truth. The second replay starts at the first mapped sweep of
+ * the second half, with its mapping pose passed as initial pose.
+ */
+void runLocalizationSuite(Benchmark& bench, JsonWriter& json)
+{
+  std::unique_ptr<StageRun> mapped(new StageRun(bench.scanMapper, bench.ioRatio));
+  mapped->run(bench.sweeps);
+  const bool saved = mapped->mapping.saveMapSnapshot(bench.snapshotFile);
+  if (!saved || mapped->mappedSweeps.empty())
+  {
+    std::fprintf(stderr, "Skipping localization suite, no map to localize against\n");
+    std::remove(bench.snapshotFile.c_str());
+    return;
+  }
+
+  json.beginObject("localization");
+  json.value("mappedFrames", mapped->mappedFrames);
+  writeStage(json, "mapping", mapped->mappingSamples);
+
+  {
+    std::unique_ptr<StageRun> localized(new StageRun(bench.scanMapper, bench.ioRatio));
+    const auto start = SteadyClock::now();
+    const bool loaded = localized->mapping.loadLocalizationMap(bench.snapshotFile);
+    json.value("loadMs", toSec(SteadyClock::now() - start) * 1000);
+    writeCheck(bench, json, "loaded", loaded);
+    if (loaded)
+    {
+      localized->run(bench.sweeps);
+      writePoseDeviation(json, "fromStart", *mapped, *localized, 0);
+    }
+  }
+
+  const auto half = std::lower_bound(mapped->mappedSweeps.begin(), mapped->mappedSweeps.end(), bench.sweeps.size() / 2);
+  if (half != mapped->mappedSweeps.end())
+  {
+    const size_t firstSweep = *half;
+    // every sweep is localized, so the frames line up with the mapped sweeps whatever their parity
+    std::unique_ptr<StageRun> localized(new StageRun(bench.scanMapper, 1));
+    if (localized->mapping.loadLocalizationMap(bench.snapshotFile,
+                                              mapped->mappedPoses[half - mapped->mappedSweeps.begin()]))
+    {
+      localized->run(std::vector<Sweep>(bench.sweeps.begin() + firstSweep, bench.sweeps.end()));
+      writePoseDeviation(json, "fromHalfway", *mapped, *localized, firstSweep);
+    }
+  }
+  json.endObject();
+
+  // the cached kd-tree index is written next to the snapshot
+  std::remove(bench.snapshotFile.c_str());
+  std::remove((bench.snapshotFile + ".kdtree").c_str());
+}
+
+/** \brief Load time and throughput of an existing (e.g. multi-gigabyte) map snapshot given with --snapshot. */
+void runSnapshotSuite(Benchmark& bench, JsonWriter& json)
+{
+  if (bench.loadSnapshotFile.empty())
+  {
+    std::fprintf(stderr, "Skipping snapshot suite, no --snapshot file given\n");
+    return;
+  }
+
+  struct stat fileStat;
+  const size_t fileBytes = stat(bench.loadSnapshotFile.c_str(), &fileStat) == 0 ? size_t(fileStat.st_size) : 0;
+
+  // the first load reads the file from disk, the following ones mostly from the page cache
+  StageSamples loadSamples;
+  MapSize size;
+  bool loaded = true;
+  for (size_t i = 0; i < SNAPSHOT_LOADS && loaded; i++)
+  {
+    std::unique_ptr<BasicLaserMapping> mapping(new BasicLaserMapping());
+    loadSamples.measure([&] { loaded = mapping->loadMapSnapshot(bench.loadSnapshotFile); });
+    size = mapping->mapSize();
+  }
+
+  json.beginObject("snapshotLoad");
+  json.value("file", bench.loadSnapshotFile);
+  writeCheck(bench, json, "loaded", loaded);
+  json.value("fileBytes", fileBytes);
+  json.value("cubes", size.cubes);
+  json.value("points", size.points);
+  json.value("firstLoadMs", loadSamples.durations.front() * 1000);
+  json.value("firstLoadMBps", fileBytes / 1e6 / loadSamples.durations.front());
+  writeStage(json, "load", loadSamples);
+  json.endObject();
+}
+
+/** \brief End to end frame rate of the sequential and the pipelined loam::Pipeline. */
+void runPipelineSuite(Benchmark& bench, JsonWriter& json)
+{
+  json.beginObject("pipeline");
+
+  {
+    Pipeline pipeline(bench.scanMapper, RegistrationParams(), bench.ioRatio);
+    pipeline.setMappingCallback([&](const Time&, const Twist& pose) {
+      bench.sequentialPose = pose;
+      bench.hasSequentialPose = true;
+    });
+
+    StageSamples frames;
+    frames.reserve(bench.sweeps.size());
+    for (const Sweep& sweep : bench.sweeps)
+      frames.measure([&] { pipeline.pushCloud(*sweep.points, sweep.stamp); });
+
+    json.beginObject("sequential");
+    double total = 0;
+    for (double duration : frames.durations)
+      total += duration;
+    json.value("fps", total > 0 ? frames.durations.size() / total : 0.0);
+    writeStage(json, "frame", frames);
+    json.endObject();
+  }
+
+  {
+    Pipeline pipeline(bench.scanMapper, RegistrationParams(), bench.ioRatio);
+    Twist lastPose;
+    pipeline.setMappingCallback([&](const Time&, const Twist& pose) { lastPose = pose; });
+
+    pipeline.startThreads();
+    const size_t allocations = allocationCount.load(std::memory_order_relaxed);
+    auto start = SteadyClock::now();
+    for (const Sweep& sweep : bench.sweeps)
+      pipeline.pushCloud(*sweep.points, sweep.stamp);
+    pipeline.stopThreads();
+    const double elapsed = toSec(SteadyClock::now() - start);
+    const size_t sweepAllocations = allocationCount.load(std::memory_order_relaxed) - allocations;
+
+    const PipelineStageTimes times = pipeline.stageTimes();
+    const PipelineQueueStats queues = pipeline.queueStats();
+    json.beginObject("pipelined");
+    json.value("fps", elapsed > 0 ? bench.sweeps.size() / elapsed : 0.0);
+    json.value("allocationsPerSweep", bench.sweeps.empty() ? 0.0 : double(sweepAllocations) / bench.sweeps.size());
+    json.value("registrationMeanMs", times.registration.mean() * 1000);
+    json.value("odometryMeanMs", times.odometry.mean() * 1000);
+    json.value("mappingMeanMs", times.mapping.mean() * 1000);
+    json.value("inputBlockedS", queues.input.blockedTime);
+    json.value("odometryBlockedS", queues.odometry.blockedTime);
+    json.value("mappingBlockedS", queues.mapping.blockedTime);
+    json.value("mappingDropped", queues.mapping.dropped);
+    writeCheck(bench, json, "matchesSequential", bench.hasSequentialPose && samePose(lastPose, bench.sequentialPose));
+    json.endObject();
+  }
+
+  json.endObject();
+}
+
+/** \brief Two sequential pipelines processing the dataset concurrently, checking that they don't interfere. */
+void runConcurrentSuite(Benchmark& bench, JsonWriter& json)
+{
+  const size_t instances = 2;
+  std::vector<Twist> poses(instances);
+  std::vector<std::thread> threads;
+
+  auto start = SteadyClock::now();
+  for (size_t i = 0; i < instances; i++)
+  {
+    threads.emplace_back([&, i] {
+      Pipeline pipeline(bench.scanMapper, RegistrationParams(), bench.ioRatio);
+      pipeline.setMappingCallback([&](const Time&, const Twist& pose) { poses[i] = pose; });
+      for (const Sweep& sweep : bench.sweeps)
+        pipeline.pushCloud(*sweep.points, sweep.stamp);
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  const double elapsed = toSec(SteadyClock::now() - start);
+
+  bool identical = true;
+  for (const Twist& pose : poses)
+    identical = identical && samePose(pose, poses.front());
+
+  json.beginObject("concurrent");
+  json.value("instances", instances);
+  json.value("fpsPerInstance", elapsed > 0 ? bench.sweeps.size() / elapsed : 0.0);
+  writeCheck(bench, json, "identicalResults", identical);
+  if (bench.hasSequentialPose)
+    writeCheck(bench, json, "matchesSequential", identical && samePose(poses.front(), bench.sequentialPose));
+  json.endObject();
+}
+
+/** \brief End to end latency of handler driven processing against the former 100 Hz polling loops.
+ *
+ * The sweeps are replayed back to back. With polling, the odometry and the mapping wait for the next tick of a
+ * 10 ms loop before processing their input, like the ros::Rate(100) spin loops of the nodes did. Handler driven,
+ * they start as soon as their input is ready. The latency runs from the start of the registration of a sweep to
+ * the end of its mapping.
+ */
+void runDispatchSuite(Benchmark& bench, JsonWriter& json)
+{
+  json.beginObject("dispatch");
+  for (bool polling : { false, true })
+  {
+    std::unique_ptr<StageRun> run(new StageRun(bench.scanMapper, bench.ioRatio));
+    if (polling)
+      run->pollPeriod = std::chrono::milliseconds(10);
+    run->run(bench.sweeps);
+
+    std::vector<double> sorted = run->endToEndLatencies;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (double latency : sorted)
+      total += latency;
+
+    json.beginObject(polling ? "polling100Hz" : "handler");
+    json.value("frames", sorted.size());
+    json.value("meanMs", sorted.empty() ? 0.0 : total / sorted.size() * 1000);
+    json.value("p50Ms", percentile(sorted, 50) * 1000);
+    json.value("p95Ms", percentile(sorted, 95) * 1000);
+    json.value("p99Ms", percentile(sorted, 99) * 1000);
+    json.value("pollWaitPerSweepMs", bench.sweeps.empty() ? 0.0 : run->pollWaitTotal / bench.sweeps.size() * 1000);
+    json.endObject();
+  }
+  json.endObject();
+}
+
+/** \brief Mapping latency and final pose deviation over the number of selected mapping features. */
+void runSelectionSuite(Benchmark& bench, JsonWriter& json)
+{
+  Twist referencePose;
+  json.beginArray("featureSelection");
+  for (size_t selectionNum : SELECTION_SIZES)
+  {
+    std::unique_ptr<StageRun> run(new StageRun(bench.scanMapper, bench.ioRatio));
+    run->mapping.setFeatureSelectionNum(selectionNum);
+    run->run(bench.sweeps);
+
+    const Twist& pose = run->mapping.transformAftMapped();
+    if (selectionNum == 0)
+      referencePose = pose;
+
+    const MappingStats::FeatureSelection stats = run->mapping.stats().featureSelection;
+    json.beginObject();
+    json.value("features", selectionNum);
+    writeStage(json, "mapping", run->mappingSamples);
+    json.value("meanCorrespondences", stats.frames > 0 ? double(stats.correspondences) / stats.frames : 0.0);
+    json.value("meanSelected", stats.frames > 0 ? double(stats.selected) / stats.frames : 0.0);
+    json.value("meanWeakestInformation", stats.frames > 0 ? stats.weakestInformation / stats.frames : 0.0);
+    json.value("translationDeviationM", translationDifference(pose, referencePose));
+    json.value("rotationDeviationRad", rotationDifference(pose, referencePose));
+    json.endObject();
+  }
+  json.endArray();
+}
+
+/** \brief Mapping latency and pose deviation with per voxel line / plane statistics against kd-tree neighbors. */
+void runVoxelFeaturesSuite(Benchmark& bench, JsonWriter& json)
+{
+  std::unique_ptr<StageRun> reference(new StageRun(bench.scanMapper, bench.ioRatio));
+  reference->run(bench.sweeps);
+  std::unique_ptr<StageRun> voxels(new StageRun(bench.scanMapper, bench.ioRatio));
+  voxels->mapping.setUseVoxelFeatures(true);
+  voxels->run(bench.sweeps);
+
+  json.beginObject("voxelFeatures");
+  json.value("voxelFeatureSize", double(voxels->mapping.voxelFeatureSize()));
+  writeStage(json, "kdtreeMapping", reference->mappingSamples);
+  writePoseDeviation(json, "voxelFeatures", *reference, *voxels, 0);
+  json.value("finalTranslationDeviationM",
+             translationDifference(reference->mapping.transformAftMapped(), voxels->mapping.transformAftMapped()));
+  json.value("finalRotationDeviationRad",
+             rotationDifference(reference->mapping.transformAftMapped(), voxels->mapping.transformAftMapped()));
+  json.endObject();
+}
+
+/** \brief Per-frame map maintenance time over the run, re-filtering the cubes in view against the incremental filter. */
+void runMapFilterSuite(Benchmark& bench, JsonWriter& json)
+{
+  json.beginObject("mapFilter");
+  std::unique_ptr<StageRun> reference;
+  for (bool incremental : { false, true })
+  {
+    std::unique_ptr<StageRun> run(new StageRun(bench.scanMapper, bench.ioRatio));
+    run->mapping.setIncrementalMapFilter(incremental);
+    run->run(bench.sweeps);
+
+    // only the run times are known, the allocation and RSS figures stay zero
+    StageSamples maintenance;
+    maintenance.durations = run->maintenanceDurations;
+
+    json.beginObject(incremental ? "incremental" : "refilter");
+    writeStage(json, "maintenance", maintenance);
+
+    // the maintenance time grows with the map unless the filter is incremental
+    const size_t frames = run->maintenanceDurations.size();
+    json.beginArray("quarterMeanMs");
+    for (size_t q = 0; q < 4; q++)
+    {
+      const size_t begin = frames * q / 4, end = frames * (q + 1) / 4;
+      double total = 0;
+      for (size_t f = begin; f < end; f++)
+        total += run->maintenanceDurations[f];
+      json.value(nullptr, end > begin ? total / (end - begin) * 1000 : 0.0);
+    }
+    json.endArray();
+
+    if (reference)
+      writePoseDeviation(json, "poseDeviation", *reference, *run, 0);
+    else
+      writeStage(json, "mapping", run->mappingSamples);
+    json.endObject();
+
+    if (!incremental)
+      reference = std::move(run);
+  }
+  json.endObject();
+}
+
+/** \brief Local map size, bytes copied out of the map cubes and assembly time per frame.
+ *
+ * The synchronous mapping references the cubes in place, the asynchronous map maintenance copies them.
+ */
+void runLocalMapSuite(Benchmark& bench, JsonWriter& json)
+{
+  json.beginObject("localMap");
+  for (bool async : { false, true })
+  {
+    std::unique_ptr<StageRun> run(new StageRun(bench.scanMapper, bench.ioRatio));
+    run->mapping.setAsyncMapMaintenance(async);
+    run->run(bench.sweeps);
+    run->mapping.setAsyncMapMaintenance(false);
+
+    const MappingStats stats = run->mapping.stats();
+    const double frames = std::max<double>(stats.localMap.frames, 1);
+    json.beginObject(async ? "copied" : "referenced");
+    json.value("frames", stats.localMap.frames);
+    json.value("pointsPerFrame", stats.localMap.points / frames);
+    json.value("segmentsPerFrame", stats.localMap.segments / frames);
+    json.value("copiedBytesPerFrame", stats.localMap.copiedBytes / frames);
+    json.value("assemblyMeanMs", stats.stages.localMap.mean() * 1000);
+    json.value("optimizationMeanMs", stats.stages.optimization.mean() * 1000);
+    writeStage(json, "mapping", run->mappingSamples);
+    json.endObject();
+  }
+  json.endObject();
+}
+
+/** \brief Size and run time of the cloud encodings on the registered sweeps (all five clouds of a sweep). */
+void runCodecSuite(Benchmark& bench, JsonWriter& json)
+{
+  BasicScanRegistration registration;
+  registration.configure(RegistrationParams());
+
+  const CloudEncoding encodings[] = { CloudEncoding::FLOAT32, CloudEncoding::QUANTIZED, CloudEncoding::QUANTIZED_LZ4 };
+  const char* names[] = { "float32", "quantized", "quantized_lz4" };
+  const size_t encodingNum = 3;
+
+  std::vector<StageSamples> encodeSamples(encodingNum), decodeSamples(encodingNum);
+  std::vector<size_t> encodedBytes(encodingNum, 0);
+  std::vector<double> maxError(encodingNum, 0);
+  std::vector<double> maxIntensityError(encodingNum, 0);
+  std::vector<size_t> ringErrors(encodingNum, 0);
+  std::vector<size_t> sizeErrors(encodingNum, 0);
+  size_t points = 0;
+
+  CloudCodec codec;
+  loam_velodyne::CompactCloud msgs[5];
+  pcl::PointCloud<pcl::PointXYZI> decoded;
+  for (const Sweep& sweep : bench.sweeps)
+  {
+    registration.processCloud(*sweep.points, sweep.stamp, bench.scanMapper);
+    const pcl::PointCloud<pcl::PointXYZI>* clouds[5] = {
+      &registration.laserCloud(), &registration.cornerPointsSharp(), &registration.cornerPointsLessSharp(),
+      &registration.surfacePointsFlat(), &registration.surfacePointsLessFlat() };
+    for (auto cloud : clouds)
+      points += cloud->size();
+
+    for (size_t e = 0; e < encodingNum; e++)
+    {
+      encodeSamples[e].measure([&] {
+        for (size_t c = 0; c < 5; c++)
+          toCompactCloud(*clouds[c], msgs[c], encodings[e], codec);
+      });
+      for (size_t c = 0; c < 5; c++)
+        encodedBytes[e] += msgs[c].data.size() + msgs[c].points.size() * sizeof(float);
+
+      // decode the sweep cloud last, to compare it with the original
+      decodeSamples[e].measure([&] {
+        for (size_t c = 5; c-- > 0;)
+          fromCompactCloud(msgs[c], decoded, codec);
+      });
+      sizeErrors[e] += decoded.size() != clouds[0]->size();
+      if (decoded.size() == clouds[0]->size())
+      {
+        for (size_t i = 0; i < decoded.size(); i++)
+        {
+          const pcl::PointXYZI& a = decoded.points[i];
+          const pcl::PointXYZI& b = clouds[0]->points[i];
+          maxError[e] = std::max({ maxError[e], double(std::fabs(a.x - b.x)), double(std::fabs(a.y - b.y)),
+                                   double(std::fabs(a.z - b.z)) });
+          maxIntensityError[e] = std::max(maxIntensityError[e], double(std::fabs(a.intensity - b.intensity)));
+
+          // the odometry takes the scan ring from the integral part of the intensity
+          ringErrors[e] += int(a.intensity) != int(b.intensity);
+        }
+      }
+    }
+  }
+
+  json.beginObject("codec");
+  json.value("lz4Supported", CloudCodec::lz4Supported());
+  json.value("pointsPerSweep", bench.sweeps.empty() ? 0.0 : double(points) / bench.sweeps.size());
+  for (size_t e = 0; e < encodingNum; e++)
+  {
+    json.beginObject(names[e]);
+    json.value("bytesPerPoint", points > 0 ? double(encodedBytes[e]) / points : 0.0);
+    json.value("bytesPerSweep", bench.sweeps.empty() ? 0.0 : double(encodedBytes[e]) / bench.sweeps.size());
+    json.value("maxErrorM", maxError[e]);
+    json.value("maxIntensityError", maxIntensityError[e]);
+    json.value("ringErrors", ringErrors[e]);
+    json.value("sizeErrors", sizeErrors[e]);
+    // float32 is lossless, the quantized encodings have to keep the point counts and scan rings
+    writeCheck(bench, json, "decoded", sizeErrors[e] == 0 && ringErrors[e] == 0
+               && (encodings[e] != CloudEncoding::FLOAT32 || (maxError[e] == 0 && maxIntensityError[e] == 0)));
+    writeStage(json, "encode", encodeSamples[e]);
+    writeStage(json, "decode", decodeSamples[e]);
+    json.endObject();
+  }
+  json.endObject();
+}
+
+/** \brief Memory and kd-tree query time of plain against compact (quantized) map clouds.
+ *
+ * The compact cloud is indexed once as a single view segment and once split into cells like the cubes of a
+ * local map, so that the per coordinate segment lookup of the view is measured with a realistic segment count.
+ */
+void runCompactSuite(Benchmark& bench, JsonWriter& json)
+{
+  if (bench.sweeps.empty())
+    return;
+
+  // the first registered sweeps, within the +-32 m covered by a compact cloud, serve as map sample
+  const size_t mapSweeps = std::min<size_t>(bench.sweeps.size(), 10);
+  const float range = 30;
+  BasicScanRegistration registration;
+  registration.configure(RegistrationParams());
+  pcl::PointCloud<pcl::PointXYZI>::Ptr plain(new pcl::PointCloud<pcl::PointXYZI>());
+  pcl::PointCloud<pcl::PointXYZI> queries;
+  for (size_t i = 0; i < mapSweeps; i++)
+  {
+    registration.processCloud(*bench.sweeps[i].points, bench.sweeps[i].stamp, bench.scanMapper);
+    for (auto const& point : registration.laserCloud())
+    {
+      if (std::fabs(point.x) < range && std::fabs(point.y) < range && std::fabs(point.z) < range)
+        plain->push_back(point);
+    }
+    if (i == 0)
+      queries = registration.laserCloud();
+  }
+
+  CompactPointCloud compact;
+  compact.assign(*plain);
+  MapPointView view;
+  view.append(compact);
+
+  nanoflann::KdTreeFLANN<pcl::PointXYZI> plainTree;
+  nanoflann::KdTreeFLANN<pcl::PointXYZI, MapPointView> compactTree;
+  StageSamples plainBuild, compactBuild, plainQuery, compactQuery;
+  plainBuild.measure([&] { plainTree.setInputCloud(plain); });
+  compactBuild.measure([&] { compactTree.setInputSegments(view); });
+
+  const float cellSize = 2;
+  std::unordered_map<VoxelKey, pcl::PointCloud<pcl::PointXYZI>, VoxelKeyHash> cells;
+  for (auto const& point : *plain)
+    cells[toVoxelKey(point, 1 / cellSize)].push_back(point);
+  std::vector<CompactPointCloud> cellClouds(cells.size());
+  MapPointView segmentedView;
+  size_t cell = 0;
+  for (auto const& entry : cells)
+  {
+    cellClouds[cell].assign(entry.second);
+    segmentedView.append(cellClouds[cell++]);
+  }
+  nanoflann::KdTreeFLANN<pcl::PointXYZI, MapPointView> segmentedTree;
+  StageSamples segmentedBuild, segmentedQuery;
+  segmentedBuild.measure([&] { segmentedTree.setInputSegments(segmentedView); });
+
+  std::vector<int> indices;
+  std::vector<float> distances;
+  plainQuery.measure([&] {
+    for (auto const& point : queries)
+      plainTree.nearestKSearch(point, 5, indices, distances);
+  });
+  compactQuery.measure([&] {
+    for (auto const& point : queries)
+      compactTree.nearestKSearch(point, 5, indices, distances);
+  });
+  segmentedQuery.measure([&] {
+    for (auto const& point : queries)
+      segmentedTree.nearestKSearch(point, 5, indices, distances);
+  });
+
+  const double queryNum = std::max<double>(queries.size(), 1);
+  json.beginObject("compactCloud");
+  json.value("points", plain->size());
+  json.value("plainBytes", plain->size() * sizeof(pcl::PointXYZI));
+  json.value("compactBytes", compact.bytes());
+  json.value("plainBuildMs", plainBuild.durations.front() * 1000);
+  json.value("compactBuildMs", compactBuild.durations.front() * 1000);
+  json.value("queries", queries.size());
+  json.value("plainQueryUs", plainQuery.durations.front() / queryNum * 1e6);
+  json.value("compactQueryUs", compactQuery.durations.front() / queryNum * 1e6);
+  json.value("segments", segmentedView.segmentCount());
+  json.value("segmentedBuildMs", segmentedBuild.durations.front() * 1000);
+  json.value("segmentedQueryUs", segmentedQuery.durations.front() / queryNum * 1e6);
+  json.endObject();
+}
+
+
+/** \brief The sweeps played forward and then backward, restamped to a monotonic time line. */
+std::vector<Sweep> outAndBack(const std::vector<Sweep>& sweeps)
+{
+  std::vector<Sweep> route(sweeps);
+  route.insert(route.end(), sweeps.rbegin(), sweeps.rend());
+  Time::duration period = std::chrono::milliseconds(100);
+  if (sweeps.size() > 1)
+    period = (sweeps.back().stamp - sweeps.front().stamp) / long(sweeps.size() - 1);
+  for (size_t i = 0; i < route.size(); i++)
+    route[i].stamp = sweeps.front().stamp + period * long(i);
+  return route;
+}
+
+/** \brief Remove a directory of spilled cube files. */
+void removeSpillDirectory(const std::string& directory)
+{
+  if (DIR* dir = opendir(directory.c_str()))
+  {
+    while (dirent* entry = readdir(dir))
+    {
+      if (std::strncmp(entry->d_name, "cube_", 5) == 0)
+        std::remove((directory + "/" + entry->d_name).c_str());
+    }
+    closedir(dir);
+  }
+  rmdir(directory.c_str());
+}
+
+/** \brief Spilling and reloading of map cubes when driving out and back, against keeping the whole map in memory.
+ *
+ * With a budget of a single byte, every cube outside the surround map is spilled, so every cube revisited on the
+ * way back is reloaded from disk. Reloaded cubes hold the same quantized points, so the poses should agree.
+ */
+void runRevisitSuite(Benchmark& bench, JsonWriter& json)
+{
+  const std::vector<Sweep> route = outAndBack(bench.sweeps);
+  const std::string spillDirectory = bench.snapshotFile + ".cubes";
+  if (mkdir(spillDirectory.c_str(), 0755) != 0 && errno != EEXIST)
+  {
+    std::fprintf(stderr, "Failed to create spill directory %s\n", spillDirectory.c_str());
+    return;
+  }
+
+  std::unique_ptr<StageRun> reference(new StageRun(bench.scanMapper, bench.ioRatio));
+  reference->run(route);
+
+  std::unique_ptr<StageRun> spilling(new StageRun(bench.scanMapper, bench.ioRatio));
+  spilling->mapping.setMapMemoryBudget(1);
+  spilling->mapping.setMapSpillDirectory(spillDirectory);
+  Profiler::instance().reset();
+  spilling->run(route);
+  const MappingStats::Memory stats = spilling->mapping.stats().memory;
+  const MappingStats::Memory referenceStats = reference->mapping.stats().memory;
+
+  json.beginObject("revisit");
+  json.value("sweeps", route.size());
+  json.value("spillCount", stats.spillCount);
+  json.value("reloadCount", stats.reloadCount);
+  json.value("failedReloads", stats.failedReloads);
+  json.value("spilledCubes", stats.spilledCubes);
+  json.value("spilledBytes", stats.spilledBytes);
+  json.value("memoryBytes", stats.memoryBytes);
+  json.value("referenceMemoryBytes", referenceStats.memoryBytes);
+  writeStage(json, "referenceMapping", reference->mappingSamples);
+  writeStage(json, "spillingMapping", spilling->mappingSamples);
+  writeCheck(bench, json, "samePose",
+             samePose(reference->mapping.transformAftMapped(), spilling->mapping.transformAftMapped()));
+  json.value("translationDeviationM",
+             translationDifference(reference->mapping.transformAftMapped(), spilling->mapping.transformAftMapped()));
+  json.value("rotationDeviationRad",
+             rotationDifference(reference->mapping.transformAftMapped(), spilling->mapping.transformAftMapped()));
+  writeProbes(json, "probes");
+  json.endObject();
+
+  spilling.reset();
+  removeSpillDirectory(spillDirectory);
+}
+
+/** Benchmark suite, run in the listed order. */
+struct Suite
+{
+  const char* name;
+  void (*run)(Benchmark& bench, JsonWriter& json);
+};
+
+// the pipeline suite runs before the concurrent one, which compares against its sequential pose
+const Suite SUITES[] = {
+  { "stages", runStagesSuite },
+  { "pipeline", runPipelineSuite },
+  { "dispatch", runDispatchSuite },
+  { "concurrent", runConcurrentSuite },
+  { "selection", runSelectionSuite },
+  { "voxels", runVoxelFeaturesSuite },
+  { "filter", runMapFilterSuite },
+  { "localmap", runLocalMapSuite },
+  { "codec", runCodecSuite },
+  { "compact", runCompactSuite },
+  { "revisit", runRevisitSuite },
+  { "localization", runLocalizationSuite },
+  { "snapshot", runSnapshotSuite },
+};
+
+void printUsage(const char* name)
+{
+  std::fprintf(stderr,
+               "Usage: %s <bag> [options]\n"
+               "Benchmark the LOAM stages on a recorded bag, writing the results as JSON.\n\n"
+               "  --cloud-topic <topic>   point cloud topic (default /velodyne_points)\n"
+               "  --lidar <model>         VLP-16, HDL-32 or HDL-64E (default VLP-16)\n"
+               "  --io-ratio <n>          odometry frames per mapping frame (default 2)\n"
+               "  --max-sweeps <n>        only use the first n sweeps (default all)\n"
+               "  --suites <list>         comma separated suites (default stages,pipeline,dispatch,concurrent,selection,voxels,filter,localmap,codec,compact,revisit,localization,snapshot)\n"
+               "  --snapshot <file>       map snapshot loaded by the snapshot suite\n"
+               "  --output <file>         JSON output file (default stdout)\n\n"
+               "Exits with 2 if a correctness check of a suite failed.\n",
+               name);
+}
+
+} // end namespace
+
+
+/** Benchmark entry point. */
+int main(int argc, char **argv)
+{
+  if (argc < 2 || argv[1][0] == '-')
+  {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  Benchmark bench;
+  std::string bagFile = argv[1];
+  std::string cloudTopic = "/velodyne_points";
+  std::string lidarName = "VLP-16";
+  std::string suites = "stages,pipeline,dispatch,concurrent,selection,voxels,filter,localmap,codec,compact,revisit,localization,snapshot";
+  std::string outputFile;
+  size_t maxSweeps = 0;
+  int ioRatio = 2;
+
+  for (int i = 2; i < argc; i++)
+  {
+    const bool hasValue = i + 1 < argc;
+    if (std::strcmp(argv[i], "--cloud-topic") == 0 && hasValue)
+      cloudTopic = argv[++i];
+    else if (std::strcmp(argv[i], "--lidar") == 0 && hasValue)
+      lidarName = argv[++i];
+    else if (std::strcmp(argv[i], "--io-ratio") == 0 && hasValue)
+      ioRatio = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--max-sweeps") == 0 && hasValue)
+      maxSweeps = std::strtoul(argv[++i], nullptr, 10);
+    else if (std::strcmp(argv[i], "--suites") == 0 && hasValue)
+      suites = argv[++i];
+    else if (std::strcmp(argv[i], "--snapshot") == 0 && hasValue)
+      bench.loadSnapshotFile = argv[++i];
+    else if (std::strcmp(argv[i], "--output") == 0 && hasValue)
+      outputFile = argv[++i];
+    else
+    {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  suites = "," + suites + ",";
+
+  if (lidarName == "VLP-16")
+    bench.scanMapper = MultiScanMapper::Velodyne_VLP_16();
+  else if (lidarName == "HDL-32")
+    bench.scanMapper = MultiScanMapper::Velodyne_HDL_32();
+  else if (lidarName == "HDL-64E")
+    bench.scanMapper = MultiScanMapper::Velodyne_HDL_64E();
+  else
+  {
+    std::fprintf(stderr, "Invalid lidar: %s (only \"VLP-16\", \"HDL-32\" and \"HDL-64E\" are supported)\n",
+                 lidarName.c_str());
+    return 1;
+  }
+
+  if (ioRatio < 1)
+  {
+    std::fprintf(stderr, "Invalid io ratio: %d (expected >= 1)\n", ioRatio);
+    return 1;
+  }
+  bench.ioRatio = uint16_t(ioRatio);
+  bench.snapshotFile = (outputFile.empty() ? std::string("loam_benchmarks") : outputFile) + ".snapshot";
+
+  // bag time stamps don't need a running clock
+  ros::Time::init();
+
+  // preload all sweeps, so that the suites only measure the processing
+  const long rssBeforeDataset = peakRssKb();
+  try
+  {
+    rosbag::Bag bag;
+    bag.open(bagFile, rosbag::bagmode::Read);
+    rosbag::View view(bag, rosbag::TopicQuery(std::vector<std::string>{ cloudTopic }));
+    pcl::PCLPointCloud2 cloudBuffer;
+    for (const rosbag::MessageInstance& msg : view)
+    {
+      sensor_msgs::PointCloud2::ConstPtr cloudMsg = msg.instantiate<sensor_msgs::PointCloud2>();
+      if (!cloudMsg)
+        continue;
+
+      Sweep sweep;
+      sweep.stamp = fromROSTime(cloudMsg->header.stamp);
+      sweep.points.reset(new pcl::PointCloud<pcl::PointXYZ>());
+      fromROSMsg(*cloudMsg, *sweep.points, cloudBuffer);
+      bench.datasetPoints += sweep.points->size();
+      bench.sweeps.push_back(sweep);
+      if (maxSweeps > 0 && bench.sweeps.size() >= maxSweeps)
+        break;
+    }
+  }
+  catch (const rosbag::BagException& e)
+  {
+    std::fprintf(stderr, "Failed to read bag %s: %s\n", bagFile.c_str(), e.what());
+    return 1;
+  }
+
+  if (bench.sweeps.empty())
+  {
+    std::fprintf(stderr, "No point clouds on topic %s in bag %s\n", cloudTopic.c_str(), bagFile.c_str());
+    return 1;
+  }
+
+  FILE* output = stdout;
+  if (!outputFile.empty() && !(output = std::fopen(outputFile.c_str(), "w")))
+  {
+    std::fprintf(stderr, "Failed to open output file %s\n", outputFile.c_str());
+    return 1;
+  }
+
+  JsonWriter json(output);
+  json.beginObject();
+  json.beginObject("dataset");
+  json.value("bag", bagFile);
+  json.value("lidar", lidarName);
+  json.value("ioRatio", size_t(bench.ioRatio));
+  json.value("sweeps", bench.sweeps.size());
+  json.value("pointsPerSweep", double(bench.datasetPoints) / bench.sweeps.size());
+  json.value("recordedS", toSec(bench.sweeps.back().stamp - bench.sweeps.front().stamp));
+  json.value("datasetRssKb", peakRssKb() - rssBeforeDataset);
+  json.endObject();
+
+  for (const Suite& suite : SUITES)
+  {
+    if (suites.find(std::string(",") + suite.name + ",") == std::string::npos)
+      continue;
+
+    std::fprintf(stderr, "Running %s suite...\n", suite.name);
+    bench.suite = suite.name;
+    suite.run(bench, json);
+    std::fflush(output);
+  }
+
+  json.value("peakRssKb", peakRssKb());
+  json.endObject();
+  json.finish();
+
+  if (output != stdout)
+    std::fclose(output);
+
+  for (const std::string& check : bench.failedChecks)
+    std::fprintf(stderr, "Failed check: %s\n", check.c_str());
+  return bench.failedChecks.empty() ? 0 : 2;
+}
@@ -0,0 +1,89 @@
+#include <memory>
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include "loam_velodyne/LaserMapping.h"
+#include "loam_velodyne/LaserOdometry.h"
+#include "loam_velodyne/MultiScanRegistration.h"
+#include "loam_velodyne/TransformMaintenance.h"
+
+
+namespace loam
+{
+
+/** \brief Scan registration nodelet.
+ *
+ * The LOAM nodelets exchange the clouds of a sweep in a single message, which nodelets loaded into the same
+ * manager pass on as a shared pointer instead of serializing it. The clouds are still copied into and out of
+ * the message (toCompactCloud() / fromCompactCloud()) at every hop, in the configured cloudEncoding.
+ *
+ * Every nodelet uses the single threaded node handles, so the callbacks of one component never run
+ * concurrently (as in the respective node). The odometry and mapping process a sweep from the handler of
+ * its message, so no processing timer is needed.
+ */
+class MultiScanRegistrationNodelet : public nodelet::Nodelet
+{
+private:
+  void onInit() override
+  {
+    _multiScan.reset(new MultiScanRegistration());
+    if (!_multiScan->setup(getNodeHandle(), getPrivateNodeHandle()))
+      NODELET_ERROR("Failed to set up scan registration");
+  }
+
+  std::unique_ptr<MultiScanRegistration> _multiScan;
+};
+
+
+/** \brief Laser odometry nodelet. */
+class LaserOdometryNodelet : public nodelet::Nodelet
+{
+private:
+  void onInit() override
+  {
+    _laserOdom.reset(new LaserOdometry(0.1));
+    if (!_laserOdom->setup(getNodeHandle(), getPrivateNodeHandle()))
+      NODELET_ERROR("Failed to set up laser odometry");
+  }
+
+  std::unique_ptr<LaserOdometry> _laserOdom;
+};
+
+
+/** \brief Laser mapping nodelet. */
+class LaserMappingNodelet : public nodelet::Nodelet
+{
+private:
+  void onInit() override
+  {
+    _laserMapping.reset(new LaserMapping(0.1));
+    if (!_laserMapping->setup(getNodeHandle(), getPrivateNodeHandle()))
+      NODELET_ERROR("Failed to set up laser mapping");
+  }
+
+  std::unique_ptr<LaserMapping> _laserMapping;
+};
+
+
+/** \brief Transform maintenance nodelet. */
+class TransformMaintenanceNodelet : public nodelet::Nodelet
+{
+private:
+  void onInit() override
+  {
+    _transMaintenance.reset(new TransformMaintenance());
+    if (!_transMaintenance->setup(getNodeHandle(), getPrivateNodeHandle()))
+      NODELET_ERROR("Failed to set up transform maintenance");
+  }
+
+  std::unique_ptr<TransformMaintenance> _transMaintenance;
+};
+
+} // end namespace loam
+
+
+PLUGINLIB_EXPORT_CLASS(loam::MultiScanRegistrationNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(loam::LaserOdometryNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(loam::LaserMappingNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(loam::TransformMaintenanceNodelet, nodelet::Nodelet)
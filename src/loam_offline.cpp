@@ -0,0 +1,220 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/Imu.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <tf/transform_datatypes.h>
+
+#include "loam_velodyne/Pipeline.h"
+#include "loam_velodyne/Profiler.h"
+#include "loam_velodyne/common.h"
+
+
+static void printUsage(const char* name)
+{
+  std::fprintf(stderr,
+               "Usage: %s <bag> [options]\n"
+               "Run LOAM on a recorded bag as fast as possible, without ROS master.\n\n"
+               "  --cloud-topic <topic>   point cloud topic (default /velodyne_points)\n"
+               "  --imu-topic <topic>     IMU topic, already in the lidar frame (default none)\n"
+               "  --lidar <model>         VLP-16, HDL-32 or HDL-64E (default VLP-16)\n"
+               "  --io-ratio <n>          odometry frames per mapping frame (default 2)\n"
+               "  --poses <file>          write the mapping poses (TUM format: stamp x y z qx qy qz qw)\n"
+               "  --map <file>            write a map snapshot after the last sweep\n"
+               "  --trace <file>          write the profiler events in the Chrome trace format\n"
+               "  --pipelined             run registration, odometry and mapping on their own threads\n",
+               name);
+}
+
+/** \brief Write a LOAM camera_init frame pose as TUM trajectory line, oriented as the published odometry. */
+static void writePose(FILE* file, const loam::Time& stamp, const loam::Twist& pose)
+{
+  geometry_msgs::Quaternion geoQuat = tf::createQuaternionMsgFromRollPitchYaw(pose.rot_z.rad(),
+                                                                             -pose.rot_x.rad(),
+                                                                             -pose.rot_y.rad());
+  std::fprintf(file, "%.9f %.6f %.6f %.6f %.9f %.9f %.9f %.9f\n",
+               loam::toROSTime(stamp).toSec(), pose.pos.x(), pose.pos.y(), pose.pos.z(),
+               -geoQuat.y, -geoQuat.z, geoQuat.x, geoQuat.w);
+}
+
+/** \brief Print the convergence summary of the given optimization reports. */
+static void printReportSummary(const char* name, const std::vector<loam::OptimizationReport>& reports)
+{
+  size_t optimized = 0, converged = 0, degenerate = 0, iterations = 0;
+  double residual = 0;
+  for (const loam::OptimizationReport& report : reports) {
+    if (!report.optimized)
+      continue;
+    optimized++;
+    converged += report.converged;
+    degenerate += report.degenerate();
+    iterations += report.iterations;
+    residual += report.finalResidual;
+  }
+  if (optimized == 0)
+    return;
+
+  std::printf("%s (last %zu frames): %.1f iterations, %.0f%% converged, %zu degenerate, residual %.4f m\n",
+              name, optimized, double(iterations) / optimized, 100.0 * converged / optimized, degenerate,
+              residual / optimized);
+}
+
+
+/** Offline runner entry point. */
+int main(int argc, char **argv)
+{
+  if (argc < 2 || argv[1][0] == '-') {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  std::string bagFile = argv[1];
+  std::string cloudTopic = "/velodyne_points";
+  std::string imuTopic;
+  std::string lidarName = "VLP-16";
+  std::string posesFile, mapFile, traceFile;
+  int ioRatio = 2;
+  bool pipelined = false;
+
+  for (int i = 2; i < argc; i++) {
+    const bool hasValue = i + 1 < argc;
+    if (std::strcmp(argv[i], "--cloud-topic") == 0 && hasValue) {
+      cloudTopic = argv[++i];
+    } else if (std::strcmp(argv[i], "--imu-topic") == 0 && hasValue) {
+      imuTopic = argv[++i];
+    } else if (std::strcmp(argv[i], "--lidar") == 0 && hasValue) {
+      lidarName = argv[++i];
+    } else if (std::strcmp(argv[i], "--io-ratio") == 0 && hasValue) {
+      ioRatio = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--poses") == 0 && hasValue) {
+      posesFile = argv[++i];
+    } else if (std::strcmp(argv[i], "--map") == 0 && hasValue) {
+      mapFile = argv[++i];
+    } else if (std::strcmp(argv[i], "--trace") == 0 && hasValue) {
+      traceFile = argv[++i];
+    } else if (std::strcmp(argv[i], "--pipelined") == 0) {
+      pipelined = true;
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  loam::MultiScanMapper scanMapper;
+  if (lidarName == "VLP-16") {
+    scanMapper = loam::MultiScanMapper::Velodyne_VLP_16();
+  } else if (lidarName == "HDL-32") {
+    scanMapper = loam::MultiScanMapper::Velodyne_HDL_32();
+  } else if (lidarName == "HDL-64E") {
+    scanMapper = loam::MultiScanMapper::Velodyne_HDL_64E();
+  } else {
+    std::fprintf(stderr, "Invalid lidar: %s (only \"VLP-16\", \"HDL-32\" and \"HDL-64E\" are supported)\n",
+                 lidarName.c_str());
+    return 1;
+  }
+
+  if (ioRatio < 1) {
+    std::fprintf(stderr, "Invalid io ratio: %d (expected >= 1)\n", ioRatio);
+    return 1;
+  }
+
+  FILE* poses = nullptr;
+  if (!posesFile.empty() && !(poses = std::fopen(posesFile.c_str(), "w"))) {
+    std::fprintf(stderr, "Failed to open pose file %s\n", posesFile.c_str());
+    return 1;
+  }
+
+  // bag time stamps don't need a running clock
+  ros::Time::init();
+
+  rosbag::Bag bag;
+  try {
+    bag.open(bagFile, rosbag::bagmode::Read);
+  } catch (const rosbag::BagException& e) {
+    std::fprintf(stderr, "Failed to open bag %s: %s\n", bagFile.c_str(), e.what());
+    return 1;
+  }
+
+  std::vector<std::string> topics{ cloudTopic };
+  if (!imuTopic.empty())
+    topics.push_back(imuTopic);
+  rosbag::View view(bag, rosbag::TopicQuery(topics));
+
+  // keep the most recent events of a few minutes of sweeps
+  if (!traceFile.empty())
+    loam::Profiler::instance().setTraceCapacity(1000000);
+
+  loam::Pipeline pipeline(scanMapper, loam::RegistrationParams(), uint16_t(ioRatio));
+  size_t mappedFrames = 0;
+  pipeline.setMappingCallback([&](const loam::Time& stamp, const loam::Twist& pose) {
+    mappedFrames++;
+    if (poses)
+      writePose(poses, stamp, pose);
+  });
+  if (pipelined)
+    pipeline.startThreads();
+
+  // messages are replayed in bag order, so every sweep sees all IMU measurements recorded before it
+  pcl::PointCloud<pcl::PointXYZ> cloud;
+  pcl::PCLPointCloud2 cloudBuffer;
+  size_t sweeps = 0;
+  ros::Time firstStamp, lastStamp;
+  auto start = loam::SteadyClock::now();
+  for (const rosbag::MessageInstance& msg : view) {
+    if (sensor_msgs::PointCloud2::ConstPtr cloudMsg = msg.instantiate<sensor_msgs::PointCloud2>()) {
+      loam::fromROSMsg(*cloudMsg, cloud, cloudBuffer);
+      pipeline.pushCloud(cloud, loam::fromROSTime(cloudMsg->header.stamp));
+
+      if (sweeps++ == 0)
+        firstStamp = cloudMsg->header.stamp;
+      lastStamp = cloudMsg->header.stamp;
+    } else if (sensor_msgs::Imu::ConstPtr imuMsg = msg.instantiate<sensor_msgs::Imu>()) {
+      double roll, pitch, yaw;
+      tf::Quaternion orientation;
+      tf::quaternionMsgToTF(imuMsg->orientation, orientation);
+      tf::Matrix3x3(orientation).getRPY(roll, pitch, yaw);
+      pipeline.pushImu(loam::fromROSTime(imuMsg->header.stamp), roll, pitch, yaw,
+                       loam::Vector3(imuMsg->linear_acceleration.x, imuMsg->linear_acceleration.y,
+                                     imuMsg->linear_acceleration.z));
+    }
+  }
+  pipeline.stopThreads();
+  const double elapsed = loam::toSec(loam::SteadyClock::now() - start);
+  bag.close();
+
+  if (poses)
+    std::fclose(poses);
+
+  if (!mapFile.empty() && !pipeline.mapping().saveMapSnapshot(mapFile)) {
+    std::fprintf(stderr, "Failed to write map snapshot %s\n", mapFile.c_str());
+    return 1;
+  }
+
+  // the fps line keeps a fixed format for regression tracking scripts
+  const double recorded = sweeps > 1 ? (lastStamp - firstStamp).toSec() : 0;
+  loam::PipelineStageTimes times = pipeline.stageTimes();
+  std::printf("fps: %.2f (%zu sweeps, %zu mapped in %.2f s, %.1fx real time)\n",
+              elapsed > 0 ? sweeps / elapsed : 0, sweeps, mappedFrames, elapsed,
+              elapsed > 0 ? recorded / elapsed : 0);
+  std::printf("stage means (ms): registration %.2f, odometry %.2f, mapping %.2f\n",
+              times.registration.mean() * 1000, times.odometry.mean() * 1000, times.mapping.mean() * 1000);
+
+  printReportSummary("odometry", pipeline.odometry().recentReports());
+  printReportSummary("mapping", pipeline.mapping().recentReports());
+
+  // empty unless built with LOAM_PROFILING
+  for (const loam::ProbeStats& stats : loam::Profiler::instance().snapshot())
+    std::printf("  %-28s %s\n", stats.name.c_str(), stats.summary().c_str());
+
+  if (!traceFile.empty() && !loam::Profiler::instance().writeChromeTrace(traceFile)) {
+    std::fprintf(stderr, "Failed to write trace %s\n", traceFile.c_str());
+    return 1;
+  }
+
+  return 0;
+}
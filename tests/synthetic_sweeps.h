@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "loam_velodyne/time_utils.h"
+
+namespace loam_test
+{
+
+/** \brief A simulated lidar sweep and the sensor pose at its start. */
+struct SyntheticSweep
+{
+  loam::Time stamp;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr points;
+  float x, y, yaw;   ///< sensor position (in meters) and heading (in radians) in the world
+};
+
+/** \brief Axis aligned box of the simulated scene. */
+struct Box
+{
+  float min[3], max[3];
+};
+
+/** \brief Distance along a ray to the entry of a solid box, or infinity if the ray misses it. */
+inline float hitSolid(const Box& box, const float origin[3], const float dir[3])
+{
+  float near = 0, far = std::numeric_limits<float>::infinity();
+  for (int i = 0; i < 3; i++) {
+    if (std::fabs(dir[i]) < 1e-9f) {
+      if (origin[i] < box.min[i] || origin[i] > box.max[i])
+        return std::numeric_limits<float>::infinity();
+      continue;
+    }
+    float t0 = (box.min[i] - origin[i]) / dir[i];
+    float t1 = (box.max[i] - origin[i]) / dir[i];
+    if (t0 > t1)
+      std::swap(t0, t1);
+    near = std::max(near, t0);
+    far = std::min(far, t1);
+  }
+  return near <= far && near > 0 ? near : std::numeric_limits<float>::infinity();
+}
+
+/** \brief Distance along a ray from inside a box to its walls. */
+inline float hitInterior(const Box& box, const float origin[3], const float dir[3])
+{
+  float t = std::numeric_limits<float>::infinity();
+  for (int i = 0; i < 3; i++) {
+    if (dir[i] > 1e-9f)
+      t = std::min(t, (box.max[i] - origin[i]) / dir[i]);
+    else if (dir[i] < -1e-9f)
+      t = std::min(t, (box.min[i] - origin[i]) / dir[i]);
+  }
+  return t;
+}
+
+/** \brief Sweeps of a 16 ring lidar (like a VLP-16) driving through a hall with pillars and crates.
+ *
+ * The sensor moves forward at speed (in m/s) while slowly turning, sweeping at 10 Hz. Every point is
+ * measured from the sensor pose at its firing time, so the sweeps carry the same motion distortion as
+ * real ones. The sweeps are deterministic.
+ */
+inline std::vector<SyntheticSweep> syntheticSweeps(size_t count, float speed = 2.0f)
+{
+  const Box hall = {{-20, -12, -1.8f}, {40, 12, 4}};
+  std::vector<Box> obstacles = {
+      {{8, -9, -1.8f}, {10, -7, -0.6f}}, {{16, 8, -1.8f}, {17.5f, 10, -0.9f}},
+      {{-10, 6, -1.8f}, {-8, 8, 0.2f}},  {{24, -11, -1.8f}, {26, -8, 1}}};
+
+  // rows of pillars along both sides, irregularly spaced so no two positions look alike
+  for (int i = 0; i < 12; i++) {
+    const float x = -16 + 5 * i + 1.3f * (i % 3);
+    const float y = 4 + 0.7f * (i % 4);
+    obstacles.push_back({{x, y, -1.8f}, {x + 0.5f, y + 0.5f, 4}});
+    obstacles.push_back({{x + 2, -y - 1, -1.8f}, {x + 2.5f, -y - 0.5f, 4}});
+  }
+
+  const float scanPeriod = 0.1f;
+  const float yawRate = 0.05f;   // rad/s
+  const int columns = 720;
+  const int rings = 16;
+  const auto start = loam::Time() + std::chrono::hours(24 * 365 * 40);
+
+  std::vector<SyntheticSweep> sweeps;
+  for (size_t s = 0; s < count; s++) {
+    SyntheticSweep sweep;
+    sweep.stamp = start + std::chrono::milliseconds(100 * s);
+    sweep.points.reset(new pcl::PointCloud<pcl::PointXYZ>());
+    sweep.points->reserve(columns * rings);
+
+    for (int c = 0; c < columns; c++) {
+      // sensor pose at the firing time of the column, integrated along the curved path
+      const float t = (s + float(c) / columns) * scanPeriod;
+      const float yaw = yawRate * t;
+      const float px = yawRate > 0 ? speed / yawRate * std::sin(yaw) : speed * t;
+      const float py = yawRate > 0 ? speed / yawRate * (1 - std::cos(yaw)) : 0;
+      if (c == 0) {
+        sweep.x = px;
+        sweep.y = py;
+        sweep.yaw = yaw;
+      }
+
+      // clockwise rotation, starting straight ahead
+      const float azimuth = -2 * float(M_PI) * c / columns;
+      for (int r = 0; r < rings; r++) {
+        const float elevation = float(-15 + 2 * r) * float(M_PI) / 180;
+        const float local[3] = {std::cos(elevation) * std::cos(azimuth), std::cos(elevation) * std::sin(azimuth),
+                                std::sin(elevation)};
+        const float dir[3] = {std::cos(yaw) * local[0] - std::sin(yaw) * local[1],
+                              std::sin(yaw) * local[0] + std::cos(yaw) * local[1], local[2]};
+        const float origin[3] = {px, py, 0};
+
+        float range = hitInterior(hall, origin, dir);
+        for (const Box& box : obstacles)
+          range = std::min(range, hitSolid(box, origin, dir));
+        if (range < 0.5f || range > 100)
+          continue;
+
+        sweep.points->push_back(pcl::PointXYZ(local[0] * range, local[1] * range, local[2] * range));
+      }
+    }
+    sweeps.push_back(sweep);
+  }
+  return sweeps;
+}
+
+/** \brief A temporary file name, unique per test process. */
+inline std::string temporaryFile(const std::string& name)
+{
+  const char* dir = std::getenv("TMPDIR");
+  return std::string(dir ? dir : "/tmp") + "/loam_test_" + std::to_string(::getpid()) + "_" + name;
+}
+
+} // end namespace loam_test
@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "loam_velodyne/Pipeline.h"
+#include "synthetic_sweeps.h"
+
+using namespace loam;
+
+namespace
+{
+
+typedef std::vector<Twist> PoseTrack;
+
+PoseTrack run(const std::vector<loam_test::SyntheticSweep>& sweeps)
+{
+  PoseTrack poses;
+  Pipeline pipeline;
+  pipeline.setMappingCallback([&](const Time&, const Twist& pose) { poses.push_back(pose); });
+  for (const loam_test::SyntheticSweep& sweep : sweeps)
+    pipeline.pushCloud(*sweep.points, sweep.stamp);
+  return poses;
+}
+
+void expectSamePoses(const PoseTrack& a, const PoseTrack& b)
+{
+  ASSERT_EQ(a.size(), b.size());
+  for (size_t i = 0; i < a.size(); i++) {
+    EXPECT_EQ(a[i].pos.x(), b[i].pos.x()) << "frame " << i;
+    EXPECT_EQ(a[i].pos.y(), b[i].pos.y()) << "frame " << i;
+    EXPECT_EQ(a[i].pos.z(), b[i].pos.z()) << "frame " << i;
+    EXPECT_EQ(a[i].rot_x.rad(), b[i].rot_x.rad()) << "frame " << i;
+    EXPECT_EQ(a[i].rot_y.rad(), b[i].rot_y.rad()) << "frame " << i;
+    EXPECT_EQ(a[i].rot_z.rad(), b[i].rot_z.rad()) << "frame " << i;
+  }
+}
+
+} // end anonymous namespace
+
+
+TEST(ConcurrentPipelines, GiveTheSamePosesAsASingleOne)
+{
+  const std::vector<loam_test::SyntheticSweep> sweeps = loam_test::syntheticSweeps(30);
+  const PoseTrack reference = run(sweeps);
+  ASSERT_GT(reference.size(), 10u);
+
+  // the pipelines share no state, e.g. the kd-trees of the local map
+  std::vector<PoseTrack> poses(2);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < poses.size(); i++)
+    threads.emplace_back([&, i] { poses[i] = run(sweeps); });
+  for (std::thread& thread : threads)
+    thread.join();
+
+  for (const PoseTrack& instance : poses)
+    expectSamePoses(instance, reference);
+}
@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "loam_velodyne/CubeSpillStore.h"
+#include "synthetic_sweeps.h"
+
+using namespace loam;
+
+namespace
+{
+
+bool fileExists(const std::string& file)
+{
+  struct stat fileStat;
+  return stat(file.c_str(), &fileStat) == 0;
+}
+
+CompactPointCloud makeCloud(const Eigen::Vector3f& origin, size_t num, float offset)
+{
+  CompactPointCloud cloud(origin);
+  for (size_t i = 0; i < num; i++) {
+    pcl::PointXYZI point;
+    point.x = origin.x() + 0.37f * i + offset;
+    point.y = origin.y() - 0.11f * i;
+    point.z = origin.z() + 0.05f * (i % 7);
+    point.intensity = float(i % 16) + 0.01f * i;
+    cloud.push_back(point);
+  }
+  return cloud;
+}
+
+bool sameCloud(const CompactPointCloud& a, const CompactPointCloud& b)
+{
+  return a.origin() == b.origin() && a.size() == b.size() && std::memcmp(a.data(), b.data(), a.bytes()) == 0;
+}
+
+/** Spill store in its own directory, removed with all files the store leaves behind. */
+class CubeSpillStoreTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    directory = loam_test::temporaryFile("spill");
+    ASSERT_EQ(mkdir(directory.c_str(), 0755), 0);
+    store.setDirectory(directory);
+  }
+
+  void TearDown() override
+  {
+    store.clear();
+    std::remove(cubeFile(cube).c_str());
+    std::remove((cubeFile(cube) + ".unreadable").c_str());
+    std::remove((directory + "/notes.txt").c_str());
+    rmdir(directory.c_str());
+  }
+
+  std::string cubeFile(const VoxelKey& key) const
+  {
+    return directory + "/cube_" + std::to_string(key.x) + "_" + std::to_string(key.y) + "_"
+           + std::to_string(key.z) + ".bin";
+  }
+
+  std::string directory;
+  CubeSpillStore store;
+  const VoxelKey cube = {3, -2, 1};
+  const CompactPointCloud corner = makeCloud(Eigen::Vector3f(150, -100, 50), 200, 0);
+  const CompactPointCloud surf = makeCloud(Eigen::Vector3f(160, -90, 60), 500, 0.5f);
+};
+
+} // end anonymous namespace
+
+
+TEST_F(CubeSpillStoreTest, ReloadRestoresTheSpilledPoints)
+{
+  ASSERT_TRUE(store.save(cube, corner, surf));
+  EXPECT_TRUE(store.contains(cube));
+  EXPECT_EQ(store.size(), 1u);
+  EXPECT_EQ(store.points(), corner.size() + surf.size());
+
+  CompactPointCloud loadedCorner(corner.origin()), loadedSurf(surf.origin());
+  ASSERT_TRUE(store.load(cube, loadedCorner, loadedSurf));
+  EXPECT_TRUE(sameCloud(loadedCorner, corner));
+  EXPECT_TRUE(sameCloud(loadedSurf, surf));
+
+  // a reloaded cube is in memory only
+  EXPECT_FALSE(store.contains(cube));
+  EXPECT_EQ(store.bytes(), 0u);
+  EXPECT_EQ(store.points(), 0u);
+  EXPECT_FALSE(fileExists(cubeFile(cube)));
+  EXPECT_EQ(store.failedLoads(), 0u);
+}
+
+TEST_F(CubeSpillStoreTest, ReloadIntoAnotherOriginKeepsThePoints)
+{
+  ASSERT_TRUE(store.save(cube, corner, surf));
+
+  CompactPointCloud loadedCorner(corner.origin() + Eigen::Vector3f(1, 2, 3)), loadedSurf(surf.origin());
+  ASSERT_TRUE(store.load(cube, loadedCorner, loadedSurf));
+  ASSERT_EQ(loadedCorner.size(), corner.size());
+  for (size_t i = 0; i < corner.size(); i++) {
+    EXPECT_NEAR(loadedCorner[i].x, corner[i].x, CompactPointCloud::RESOLUTION);
+    EXPECT_NEAR(loadedCorner[i].y, corner[i].y, CompactPointCloud::RESOLUTION);
+    EXPECT_NEAR(loadedCorner[i].z, corner[i].z, CompactPointCloud::RESOLUTION);
+    EXPECT_EQ(loadedCorner[i].intensity, corner[i].intensity);
+  }
+}
+
+TEST_F(CubeSpillStoreTest, ReadKeepsTheCube)
+{
+  ASSERT_TRUE(store.save(cube, corner, surf));
+
+  CompactPointCloud readCorner(corner.origin()), readSurf(surf.origin());
+  ASSERT_TRUE(store.read(cube, readCorner, readSurf));
+  EXPECT_TRUE(sameCloud(readCorner, corner));
+  EXPECT_TRUE(sameCloud(readSurf, surf));
+  EXPECT_TRUE(store.contains(cube));
+  EXPECT_TRUE(fileExists(cubeFile(cube)));
+}
+
+TEST_F(CubeSpillStoreTest, UnreadableCubeIsDroppedOnce)
+{
+  ASSERT_TRUE(store.save(cube, corner, surf));
+  const size_t fileBytes = store.bytes();
+
+  // cut the surface points short
+  ASSERT_EQ(truncate(cubeFile(cube).c_str(), off_t(fileBytes / 2)), 0);
+
+  CompactPointCloud loadedCorner(corner.origin()), loadedSurf(surf.origin());
+  EXPECT_FALSE(store.load(cube, loadedCorner, loadedSurf));
+  EXPECT_TRUE(loadedCorner.empty());
+  EXPECT_TRUE(loadedSurf.empty());
+  EXPECT_EQ(store.failedLoads(), 1u);
+
+  // the cube is not retried, and its remaining points are kept aside
+  EXPECT_FALSE(store.contains(cube));
+  EXPECT_EQ(store.bytes(), 0u);
+  EXPECT_FALSE(store.load(cube, loadedCorner, loadedSurf));
+  EXPECT_EQ(store.failedLoads(), 1u);
+  EXPECT_FALSE(fileExists(cubeFile(cube)));
+  ASSERT_TRUE(fileExists(cubeFile(cube) + ".unreadable"));
+
+  // spilling the cube again doesn't touch the unreadable file
+  ASSERT_TRUE(store.save(cube, corner, surf));
+  struct stat fileStat;
+  ASSERT_EQ(stat((cubeFile(cube) + ".unreadable").c_str(), &fileStat), 0);
+  EXPECT_EQ(size_t(fileStat.st_size), fileBytes / 2);
+}
+
+TEST_F(CubeSpillStoreTest, StaleCubeFilesAreRemoved)
+{
+  ASSERT_TRUE(store.save(cube, corner, surf));
+  std::ofstream(directory + "/notes.txt") << "not a cube";
+
+  // a new store in the same directory starts without the cubes of the previous map
+  CubeSpillStore restarted;
+  restarted.setDirectory(directory);
+  EXPECT_TRUE(restarted.empty());
+  EXPECT_FALSE(fileExists(cubeFile(cube)));
+  EXPECT_TRUE(fileExists(directory + "/notes.txt"));
+
+  CompactPointCloud loadedCorner, loadedSurf;
+  EXPECT_FALSE(restarted.load(cube, loadedCorner, loadedSurf));
+}
@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "loam_velodyne/Pipeline.h"
+#include "synthetic_sweeps.h"
+
+using namespace loam;
+
+namespace
+{
+
+const size_t SWEEPS = 50;
+const double MAX_TRANSLATION_ERROR = 0.02;   // in meters
+const double MAX_ROTATION_ERROR = 0.003;     // in radians
+
+// the first frame converges from the initial pose without a motion estimate from the odometry
+const double MAX_FIRST_TRANSLATION_ERROR = 0.2;
+const double MAX_FIRST_ROTATION_ERROR = 0.01;
+
+typedef std::map<Time, Twist> PoseTrack;
+
+/** Run a pipeline mapping every sweep, collecting the mapping poses by sweep time. */
+PoseTrack run(Pipeline& pipeline, std::vector<loam_test::SyntheticSweep>::const_iterator begin,
+              std::vector<loam_test::SyntheticSweep>::const_iterator end)
+{
+  PoseTrack poses;
+  pipeline.setMappingCallback([&](const Time& stamp, const Twist& pose) { poses[stamp] = pose; });
+  for (auto sweep = begin; sweep != end; ++sweep)
+    pipeline.pushCloud(*sweep->points, sweep->stamp);
+  return poses;
+}
+
+/** Check the deviations of the localized poses from the mapped ones at the same sweeps. */
+void expectWithinBounds(const PoseTrack& mapped, const PoseTrack& localized)
+{
+  size_t frame = 0;
+  for (auto const& entry : localized) {
+    auto reference = mapped.find(entry.first);
+    ASSERT_NE(reference, mapped.end());
+
+    const Twist &a = entry.second, &b = reference->second;
+    const double dx = a.pos.x() - b.pos.x(), dy = a.pos.y() - b.pos.y(), dz = a.pos.z() - b.pos.z();
+    const double translationError = std::sqrt(dx * dx + dy * dy + dz * dz);
+    const double rotationError = std::max<double>({std::fabs(a.rot_x.rad() - b.rot_x.rad()),
+                                                   std::fabs(a.rot_y.rad() - b.rot_y.rad()),
+                                                   std::fabs(a.rot_z.rad() - b.rot_z.rad())});
+    EXPECT_LT(translationError, frame == 0 ? MAX_FIRST_TRANSLATION_ERROR : MAX_TRANSLATION_ERROR) << "frame " << frame;
+    EXPECT_LT(rotationError, frame == 0 ? MAX_FIRST_ROTATION_ERROR : MAX_ROTATION_ERROR) << "frame " << frame;
+    frame++;
+  }
+}
+
+/** Map built from the synthetic sweeps, shared by all tests. */
+class LocalizationTest : public ::testing::Test
+{
+protected:
+  static void SetUpTestCase()
+  {
+    sweeps = loam_test::syntheticSweeps(SWEEPS);
+    mapFile = loam_test::temporaryFile("prior.snapshot");
+
+    Pipeline pipeline(MultiScanMapper(), RegistrationParams(), 1);
+    mapped = run(pipeline, sweeps.begin(), sweeps.end());
+    mapSize = pipeline.mapping().mapSize();
+    saved = pipeline.mapping().saveMapSnapshot(mapFile);
+  }
+
+  static void TearDownTestCase()
+  {
+    std::remove(mapFile.c_str());
+    std::remove((mapFile + ".kdtree").c_str());
+  }
+
+  static std::vector<loam_test::SyntheticSweep> sweeps;
+  static std::string mapFile;
+  static PoseTrack mapped;
+  static MapSize mapSize;
+  static bool saved;
+};
+
+std::vector<loam_test::SyntheticSweep> LocalizationTest::sweeps;
+std::string LocalizationTest::mapFile;
+PoseTrack LocalizationTest::mapped;
+MapSize LocalizationTest::mapSize;
+bool LocalizationTest::saved = false;
+
+} // end anonymous namespace
+
+
+TEST_F(LocalizationTest, FollowsTheMappedPosesFromTheStart)
+{
+  ASSERT_TRUE(saved);
+  ASSERT_EQ(mapped.size(), SWEEPS);
+
+  Pipeline pipeline(MultiScanMapper(), RegistrationParams(), 1);
+  ASSERT_TRUE(pipeline.mapping().loadLocalizationMap(mapFile));
+  const PoseTrack localized = run(pipeline, sweeps.begin(), sweeps.end());
+  EXPECT_EQ(localized.size(), SWEEPS);
+  expectWithinBounds(mapped, localized);
+
+  // the prior map stays frozen
+  EXPECT_EQ(pipeline.mapping().mapSize().cubes, mapSize.cubes);
+  EXPECT_EQ(pipeline.mapping().mapSize().points, mapSize.points);
+}
+
+TEST_F(LocalizationTest, FollowsTheMappedPosesFromAnInitialPose)
+{
+  ASSERT_TRUE(saved);
+  const size_t first = SWEEPS / 2;
+  auto initialPose = mapped.find(sweeps[first].stamp);
+  ASSERT_NE(initialPose, mapped.end());
+
+  Pipeline pipeline(MultiScanMapper(), RegistrationParams(), 1);
+  ASSERT_TRUE(pipeline.mapping().loadLocalizationMap(mapFile, initialPose->second));
+  const PoseTrack localized = run(pipeline, sweeps.begin() + first, sweeps.end());
+  EXPECT_EQ(localized.size(), SWEEPS - first);
+  expectWithinBounds(mapped, localized);
+}
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "loam_velodyne/Pipeline.h"
+#include "synthetic_sweeps.h"
+
+using namespace loam;
+
+namespace
+{
+
+std::string readFile(const std::string& file)
+{
+  std::ifstream in(file, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+bool samePose(const Twist& a, const Twist& b)
+{
+  return a.pos.x() == b.pos.x() && a.pos.y() == b.pos.y() && a.pos.z() == b.pos.z() &&
+         a.rot_x.rad() == b.rot_x.rad() && a.rot_y.rad() == b.rot_y.rad() && a.rot_z.rad() == b.rot_z.rad();
+}
+
+/** Snapshot of the map built from the synthetic sweeps, shared by all tests. */
+class MapSnapshotTest : public ::testing::Test
+{
+protected:
+  static void SetUpTestCase()
+  {
+    snapshotFile = loam_test::temporaryFile("map.snapshot");
+    Pipeline pipeline;
+    for (const loam_test::SyntheticSweep& sweep : loam_test::syntheticSweeps(30))
+      pipeline.pushCloud(*sweep.points, sweep.stamp);
+
+    mapSize = pipeline.mapping().mapSize();
+    mappingPose = pipeline.mapping().transformAftMapped();
+    saved = pipeline.mapping().saveMapSnapshot(snapshotFile);
+  }
+
+  static void TearDownTestCase()
+  {
+    std::remove(snapshotFile.c_str());
+  }
+
+  void TearDown() override
+  {
+    std::remove(copyFile.c_str());
+  }
+
+  static std::string snapshotFile;
+  static MapSize mapSize;
+  static Twist mappingPose;
+  static bool saved;
+  const std::string copyFile = loam_test::temporaryFile("copy.snapshot");
+};
+
+std::string MapSnapshotTest::snapshotFile;
+MapSize MapSnapshotTest::mapSize;
+Twist MapSnapshotTest::mappingPose;
+bool MapSnapshotTest::saved = false;
+
+} // end anonymous namespace
+
+
+TEST_F(MapSnapshotTest, RoundTripIsByteExact)
+{
+  ASSERT_TRUE(saved);
+  ASSERT_GT(mapSize.points, 0u);
+
+  BasicLaserMapping restored;
+  ASSERT_TRUE(restored.loadMapSnapshot(snapshotFile));
+  EXPECT_EQ(restored.mapSize().cubes, mapSize.cubes);
+  EXPECT_EQ(restored.mapSize().points, mapSize.points);
+  EXPECT_TRUE(samePose(restored.transformAftMapped(), mappingPose));
+
+  ASSERT_TRUE(restored.saveMapSnapshot(copyFile));
+  const std::string original = readFile(snapshotFile), copy = readFile(copyFile);
+  EXPECT_FALSE(original.empty());
+  EXPECT_TRUE(original == copy) << "snapshot sizes " << original.size() << " and " << copy.size();
+}
+
+TEST_F(MapSnapshotTest, TruncatedSnapshotLeavesTheMapUnchanged)
+{
+  ASSERT_TRUE(saved);
+  const std::string original = readFile(snapshotFile);
+  std::ofstream(copyFile, std::ios::binary).write(original.data(), std::streamsize(original.size() - 100));
+
+  BasicLaserMapping restored;
+  ASSERT_TRUE(restored.loadMapSnapshot(snapshotFile));
+  EXPECT_FALSE(restored.loadMapSnapshot(copyFile));
+  EXPECT_EQ(restored.mapSize().cubes, mapSize.cubes);
+  EXPECT_EQ(restored.mapSize().points, mapSize.points);
+  EXPECT_TRUE(samePose(restored.transformAftMapped(), mappingPose));
+}